@@ -0,0 +1,68 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "packet.h"
+#include "probe_train.h"
+#include "util.h"
+
+using std::cout;
+using std::string;
+
+using namespace Netrounds;
+
+// Probes per second one core gets out with a sendto() per probe against GSO trains of growing length, over
+// loopback. The receiving socket is never read; its drops do not slow the sender.
+
+namespace
+{
+const uint32_t NR_PROBES = 1000000;
+const size_t PROBE_LEN = 1000;
+
+double probes_per_second(std::chrono::steady_clock::duration elapsed)
+{
+    return NR_PROBES / std::chrono::duration<double>(elapsed).count();
+}
+}
+
+int main()
+{
+    sockaddr_storage addr;
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5052, &addr);
+    do_bind(rx, &addr);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    std::vector<char> buf(TRAIN_MAX_BYTES);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t seq = 0; seq < NR_PROBES; seq++)
+    {
+        prepare_packet(buf.data(), PROBE_LEN, seq);
+        while (!try_sendpacket(&addr, tx, buf.data(), PROBE_LEN))
+        {
+        }
+    }
+    cout << "sendto: " << probes_per_second(std::chrono::steady_clock::now() - start) << " probes/s\n";
+
+    for (size_t train : { 1, 8, 16, 32, 64 })
+    {
+        size_t n = train_segments(PROBE_LEN, train);
+        start = std::chrono::steady_clock::now();
+        for (uint32_t seq = 0; seq < NR_PROBES; seq += n)
+        {
+            build_train(buf.data(), PROBE_LEN, seq, n);
+            while (!send_train(tx, &addr, buf.data(), PROBE_LEN, n))
+            {
+            }
+        }
+        cout << "GSO trains of " << n << ": " << probes_per_second(std::chrono::steady_clock::now() - start)
+             << " probes/s\n";
+    }
+    close(rx);
+    close(tx);
+    return 0;
+}
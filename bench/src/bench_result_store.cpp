@@ -0,0 +1,63 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+#include "result_store.h"
+
+using std::cout;
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+const size_t NR_RECORDS = 4000000;
+const int ROUNDS = 10;
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void run(const ResultStore& store, SimdLevel level, const char *name)
+{
+    size_t n = store.size();
+    vector<int64_t> rtt(n), fwd(n), rev(n), ipdv(n - 1);
+    int64_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        compute_rtt(store, rtt.data(), level);
+        compute_one_way(store, fwd.data(), rev.data(), level);
+        compute_ipdv(rtt.data(), n, ipdv.data(), level);
+        sink += compute_stats(rtt.data(), n, level).sum;
+        sink += compute_stats(ipdv.data(), n - 1, level).abs_sum;
+    }
+    double elapsed = seconds_since(start);
+
+    cout << name << ": " << (n * ROUNDS) / elapsed / 1e6 << " M records/s (rtt + one-way + ipdv + stats)"
+         << " [" << sink % 10 << "]\n";
+}
+}
+
+int main()
+{
+    ResultStore store(NR_RECORDS);
+    int64_t t1 = 0;
+    for (size_t i = 0; i < NR_RECORDS; i++)
+    {
+        int64_t t2 = t1 + 40000 + (i * 7919) % 3000;
+        int64_t t3 = t2 + 2500;
+        int64_t t4 = t3 + 40000 + (i * 104729) % 3000;
+        store.append(i, t1, t2, t3, t4, i % 1000 ? RESULT_COMPLETE : RESULT_HAS_T1);
+        t1 += 1000;
+    }
+
+    run(store, SIMD_SCALAR, "scalar");
+    if (simd_level() == SIMD_AVX2)
+    {
+        run(store, SIMD_AVX2, "avx2");
+    }
+    return 0;
+}
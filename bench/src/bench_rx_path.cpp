@@ -0,0 +1,123 @@
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "rx_path.h"
+#include "util.h"
+
+using std::cout;
+using std::string;
+
+using namespace Netrounds;
+
+// Per-packet cost of the receive paths over loopback: the legacy recvpacket(), the runtime-generic try_recvpacket()
+// and the RxPath specialized for the socket's timestamp mode. Only the receive side is timed; datagrams are queued
+// in batches beforehand so every call finds one.
+
+namespace
+{
+const int NR_PACKETS = 400000;
+const int BATCH = 64;
+const size_t PACKET_LEN = 64;
+
+struct Pair
+{
+    int rx;
+    int tx;
+    sockaddr_storage addr;
+};
+
+Pair make_pair(int so_flags, in_port_t port)
+{
+    Pair p;
+    p.rx = setup_socket(AF_INET, SOCK_DGRAM, so_flags);
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), port, &p.addr);
+    do_bind(p.rx, &p.addr);
+    p.tx = socket(AF_INET, SOCK_DGRAM, 0);
+    return p;
+}
+
+template <typename Receive>
+double run(const Pair& p, Receive receive)
+{
+    char buf[1500] = {};
+    std::chrono::steady_clock::duration busy(0);
+    for (int sent = 0; sent < NR_PACKETS; sent += BATCH)
+    {
+        for (int i = 0; i < BATCH; i++)
+        {
+            sendto(p.tx, buf, PACKET_LEN, 0, reinterpret_cast<const sockaddr *>(&p.addr), sizeof(sockaddr_in));
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < BATCH; i++)
+        {
+            receive(buf);
+        }
+        busy += std::chrono::steady_clock::now() - start;
+    }
+    return std::chrono::duration<double, std::nano>(busy).count() / NR_PACKETS;
+}
+
+template <typename Path>
+void compare(const char *mode, in_port_t port)
+{
+    Pair p = make_pair(Path::SO_FLAGS, port);
+    int64_t sink = 0;
+
+    // recvpacket() logs every packet; keep that out of the terminal but in the measurement.
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    double legacy = run(p, [&](char *)
+                        {
+                            std::shared_ptr<char> data;
+                            int len;
+                            sockaddr_storage from;
+                            timespec hwts;
+                            std::tie(data, len, from, hwts) = recvpacket(p.rx, 0);
+                            sink += len;
+                        });
+    cout.flush();
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(devnull);
+    close(saved_stdout);
+
+    double generic = run(p, [&](char *buf)
+                         {
+                             sockaddr_storage from;
+                             int64_t hw_ns;
+                             uint32_t dropped;
+                             sink += try_recvpacket(p.rx, 0, buf, 1500, &from, &hw_ns, &dropped);
+                         });
+    double specialized = run(p, [&](char *buf)
+                             {
+                                 typename Path::Address from;
+                                 int64_t sw_ns;
+                                 int64_t hw_ns;
+                                 uint32_t dropped;
+                                 sink += Path::receive(p.rx, buf, 1500, &from, &sw_ns, &hw_ns, &dropped);
+                             });
+
+    cout << mode << ": recvpacket " << legacy << " ns/packet, try_recvpacket " << generic << ", RxPath "
+         << specialized << " (control buffer " << Path::CONTROL_LEN << " bytes) [" << sink % 10 << "]\n";
+    close(p.rx);
+    close(p.tx);
+}
+}
+
+int main()
+{
+    compare<RxPath<TS_NONE, AF_INET>>("none", 5031);
+    compare<RxPath<TS_SOFTWARE, AF_INET>>("sw", 5032);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <cstring>
+
+#include <sys/socket.h>
+
+#include "admission.h"
+
+namespace Netrounds
+{
+namespace
+{
+// Address bytes of source (the port left out), returns their length.
+size_t source_key(const sockaddr_storage& source, uint8_t *key)
+{
+    if (source.ss_family == AF_INET)
+    {
+        const sockaddr_in *sin = reinterpret_cast<const sockaddr_in *>(&source);
+        memcpy(key, &sin->sin_addr, sizeof(sin->sin_addr));
+        return sizeof(sin->sin_addr);
+    }
+    const sockaddr_in6 *sin6 = reinterpret_cast<const sockaddr_in6 *>(&source);
+    memcpy(key, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+    return sizeof(sin6->sin6_addr);
+}
+
+uint64_t hash_key(const uint8_t *key)
+{
+    uint64_t lo;
+    uint64_t hi;
+    memcpy(&lo, key, sizeof(lo));
+    memcpy(&hi, key + sizeof(lo), sizeof(hi));
+    uint64_t h = lo ^ (hi * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ULL;
+    h ^= h >> 32;
+    return h;
+}
+}
+
+const size_t AdmissionControl::MAX_PROBE;
+
+AdmissionControl::AdmissionControl(double rate_pps, double burst, size_t max_sources) :
+    rate_per_ns(rate_pps / 1e9), burst(burst), nr_sources(0), nr_shed(0), nr_overflowed(0)
+{
+    if (rate_pps <= 0 || burst < 1)
+    {
+        throw std::runtime_error("Admission control needs a positive rate and a burst of at least one probe");
+    }
+    refill_ns = static_cast<int64_t>(burst / rate_per_ns);
+    size_t slots = MAX_PROBE;
+    while (slots < max_sources)
+    {
+        slots *= 2;
+    }
+    Bucket free_slot;
+    memset(&free_slot, 0, sizeof(free_slot));
+    free_slot.family = AF_UNSPEC;
+    table.assign(slots, free_slot);
+    set_mask = slots / MAX_PROBE - 1;
+    overflow = free_slot;
+    overflow.tokens = burst;
+}
+
+bool AdmissionControl::take(Bucket& b, int64_t now_ns, uint32_t *shed)
+{
+    // A clock stepped back adds nothing, rather than taking the tokens away; the bucket goes on from now_ns.
+    b.tokens = std::min(burst, b.tokens + std::max<int64_t>(0, now_ns - b.last_ns) * rate_per_ns);
+    b.last_ns = now_ns;
+    if (b.tokens >= 1)
+    {
+        b.tokens -= 1;
+        *shed = b.shed;
+        return true;
+    }
+    b.shed++;
+    nr_shed++;
+    *shed = b.shed;
+    return false;
+}
+
+bool AdmissionControl::idle(const Bucket& b, int64_t now_ns) const
+{
+    // A slot last used "in the future" is stale after a backward step; it would otherwise stay taken until the clock
+    // caught up.
+    return now_ns - b.last_ns >= refill_ns || now_ns < b.last_ns;
+}
+
+bool AdmissionControl::admit(const sockaddr_storage& source, int64_t now_ns, uint32_t *shed)
+{
+    uint8_t key[16] = {};
+    size_t key_len = source_key(source, key);
+    Bucket *set = &table[(hash_key(key) & set_mask) * MAX_PROBE];
+    Bucket *vacant = nullptr;
+    for (size_t way = 0; way < MAX_PROBE; way++)
+    {
+        Bucket& b = set[way];
+        if (b.family == source.ss_family && !memcmp(b.addr, key, key_len))
+        {
+            return take(b, now_ns, shed);
+        }
+        if (!vacant && b.family == AF_UNSPEC)
+        {
+            vacant = &b;
+        }
+    }
+    if (vacant)
+    {
+        nr_sources++;
+    }
+    else
+    {
+        for (size_t way = 0; way < MAX_PROBE && !vacant; way++)
+        {
+            if (idle(set[way], now_ns))
+            {
+                vacant = &set[way];
+            }
+        }
+    }
+    if (!vacant)
+    {
+        nr_overflowed++;
+        return take(overflow, now_ns, shed);
+    }
+    vacant->family = source.ss_family;
+    memcpy(vacant->addr, key, sizeof(key));
+    vacant->tokens = burst;
+    vacant->last_ns = now_ns;
+    vacant->shed = 0;
+    return take(*vacant, now_ns, shed);
+}
+};
@@ -0,0 +1,82 @@
+#ifndef _ADMISSION_H_
+#define _ADMISSION_H_
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+namespace Netrounds
+{
+// Per-source token buckets in front of the reflector, so that one sender flooding it cannot push up the residence
+// time of everybody else's probes. A source is an IP address, whatever its ports: every source may reflect rate_pps
+// probes per second on average and burst probes at once, and the rest are dropped before any work is done on them.
+// Replies to the probes that do get through carry the number shed so far (ReflectorPacket::shed), so the offending
+// sender learns about it.
+//
+// State is a fixed table of MAX_PROBE-way sets, one hash and at most MAX_PROBE compares per probe. A new source
+// takes a free slot of its set or, failing that, one whose bucket has refilled completely, which then starts over
+// (shed count included) if its source comes back.
+// When every slot of the set is in use, the newcomer shares one overflow bucket with all other such sources: a flood
+// of spoofed addresses can then only crowd out other sources without a slot of their own, not the tracked ones.
+//
+// Single threaded, like the reflector loops that use it.
+class AdmissionControl
+{
+public:
+    static const size_t MAX_PROBE = 8;
+
+    // max_sources is rounded up to a power of two, at least MAX_PROBE.
+    AdmissionControl(double rate_pps, double burst, size_t max_sources = 4096);
+
+    // Takes a token of source's bucket at now_ns, best on a monotonic time line; a step back is taken as no time
+    // having passed. False if there was none and the probe is to be dropped. *shed gets the source's count of
+    // dropped probes either way.
+    bool admit(const sockaddr_storage& source, int64_t now_ns, uint32_t *shed);
+
+    // Probes dropped over all sources.
+    uint64_t shed() const
+    {
+        return nr_shed;
+    }
+
+    // Sources with a slot of their own.
+    size_t sources() const
+    {
+        return nr_sources;
+    }
+
+    // Probes of sources that had to use the overflow bucket.
+    uint64_t overflowed() const
+    {
+        return nr_overflowed;
+    }
+
+private:
+    struct Bucket
+    {
+        uint8_t family;      // AF_UNSPEC for a free slot
+        uint8_t addr[16];
+        double tokens;
+        int64_t last_ns;
+        uint32_t shed;
+    };
+
+    bool take(Bucket& b, int64_t now_ns, uint32_t *shed);
+    bool idle(const Bucket& b, int64_t now_ns) const;
+
+    double rate_per_ns;
+    double burst;
+    int64_t refill_ns;      // from empty to full
+    std::vector<Bucket> table;
+    size_t set_mask;        // sets of MAX_PROBE slots
+    Bucket overflow;
+    size_t nr_sources;
+    uint64_t nr_shed;
+    uint64_t nr_overflowed;
+};
+};
+
+#endif
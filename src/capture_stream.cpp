@@ -0,0 +1,107 @@
+#include <cstring>
+#include <cstddef>
+
+#include <arpa/inet.h>
+
+#include "capture_stream.h"
+
+using std::string;
+
+namespace Netrounds
+{
+namespace
+{
+int udp_port(const sockaddr_storage& ss)
+{
+    if (ss.ss_family == AF_INET)
+    {
+        return ntohs(reinterpret_cast<const sockaddr_in *>(&ss)->sin_port);
+    }
+    return ntohs(reinterpret_cast<const sockaddr_in6 *>(&ss)->sin6_port);
+}
+}
+
+CaptureStream::CaptureStream(const string& path, bool sender_side, int port) :
+    reader(path), sender_side(sender_side), port(port), have_event(false)
+{
+    advance();
+}
+
+ProbeTimestamp CaptureStream::which() const
+{
+    if (current.type == FROM_SENDER)
+    {
+        return sender_side ? PROBE_T1 : PROBE_T2;
+    }
+    return sender_side ? PROBE_T4 : PROBE_T3;
+}
+
+void CaptureStream::advance()
+{
+    CapturedPacket pkt;
+    UdpDatagram udp;
+    have_event = false;
+
+    while (reader.next(&pkt))
+    {
+        if (!extract_udp(pkt, &udp))
+        {
+            continue;
+        }
+        if (port && udp_port(udp.src) != port && udp_port(udp.dst) != port)
+        {
+            continue;
+        }
+        PacketType type;
+        const char *payload = reinterpret_cast<const char *>(udp.payload);
+        if (!peek_packet_type(payload, udp.len, &type) || type == FROM_REFLECTOR_ONLY_TIMESTAMPS)
+        {
+            continue;
+        }
+        uint32_t seq;
+        memcpy(&seq, payload + offsetof(SenderPacket, sender_seq), sizeof(seq));
+        current.ts_ns = pkt.ts_ns;
+        current.seq = ntohl(seq);
+        current.type = type;
+        current.t2 = 0;
+        current.t3 = 0;
+        ReflectorPacket reply;
+        if (type == FROM_REFLECTOR && decode_reflector_packet(payload, udp.len, &reply))
+        {
+            current.t2 = reply.t2;
+            current.t3 = reply.t3;
+        }
+        have_event = true;
+        return;
+    }
+}
+
+void match_captures(CaptureStream& sender_side, CaptureStream *reflector_side, ProbeMatcher *matcher)
+{
+    for (;;)
+    {
+        CaptureStream *stream = sender_side.has_event() ? &sender_side : nullptr;
+        if (reflector_side && reflector_side->has_event() &&
+            (!stream || reflector_side->event().seq < stream->event().seq))
+        {
+            stream = reflector_side;
+        }
+        if (!stream)
+        {
+            break;
+        }
+        const ProbeEvent& event = stream->event();
+        matcher->add(event.seq, stream->which(), event.ts_ns);
+        // A reflector side capture has them from the wire, the replies are all there is otherwise.
+        if (!reflector_side && event.t2)
+        {
+            matcher->add(event.seq, PROBE_T2, event.t2);
+        }
+        if (!reflector_side && event.t3)
+        {
+            matcher->add(event.seq, PROBE_T3, event.t3);
+        }
+        stream->advance();
+    }
+}
+};
@@ -0,0 +1,62 @@
+#ifndef _CAPTURE_STREAM_H_
+#define _CAPTURE_STREAM_H_
+
+#include <string>
+
+#include <cstdint>
+
+#include <netinet/in.h>
+
+#include "packet.h"
+#include "pcap_reader.h"
+#include "probe_matcher.h"
+
+namespace Netrounds
+{
+// A probe or reply found in a capture.
+struct ProbeEvent
+{
+    int64_t ts_ns;
+    uint32_t seq;
+    PacketType type;
+    int64_t t2;     // as carried in a FROM_REFLECTOR reply, 0 if not
+    int64_t t3;
+};
+
+// The probes and replies of a capture taken on the sender or the reflector side, in capture order, for pcap_analyze.
+// Other traffic, and with a port that of other ports, is skipped, and so are timestamp reports.
+class CaptureStream
+{
+public:
+    // port 0 for any.
+    CaptureStream(const std::string& path, bool sender_side, int port);
+
+    bool has_event() const
+    {
+        return have_event;
+    }
+
+    const ProbeEvent& event() const
+    {
+        return current;
+    }
+
+    // Which of the probe's timestamps the capture time of the event is.
+    ProbeTimestamp which() const;
+
+    void advance();
+
+private:
+    PcapReader reader;
+    bool sender_side;
+    int port;
+    bool have_event;
+    ProbeEvent current;
+};
+
+// Merges the captures into matcher by sequence number rather than time, so clock offsets between the hosts do not
+// matter. Without reflector_side, t2 and t3 are those the reflector put in its replies. Does not flush matcher.
+void match_captures(CaptureStream& sender_side, CaptureStream *reflector_side, ProbeMatcher *matcher);
+};
+
+#endif
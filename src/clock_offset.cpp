@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "clock_offset.h"
+
+namespace Netrounds
+{
+namespace
+{
+void print_stats(std::ostream& os, const char *name, const DelayStats& stats)
+{
+    os << ' ' << name << ' ';
+    if (!stats.count)
+    {
+        os << "-";
+        return;
+    }
+    os << stats.min / 1000.0 << '/' << static_cast<double>(stats.sum) / stats.count / 1000.0 << '/'
+       << stats.max / 1000.0;
+}
+
+void add_delay(DelayStats *stats, int64_t delay)
+{
+    if (!stats->count)
+    {
+        stats->min = stats->max = delay;
+    }
+    stats->min = std::min(stats->min, delay);
+    stats->max = std::max(stats->max, delay);
+    stats->sum += delay;
+    stats->abs_sum += delay < 0 ? -delay : delay;
+    stats->count++;
+}
+}
+
+ClockOffsetEstimator::ClockOffsetEstimator(size_t segment_probes, size_t window_segments) :
+    segment_probes(segment_probes), ring(window_segments), head(0), count(0), nr_segments(0), best(), open_probes(0),
+    ref_ts_ns(0), ref_offset_ns(0), sx(0), sy(0), sxx(0), sxy(0), syy(0), max_half_rtt_ns(0)
+{
+    if (!segment_probes || !window_segments)
+    {
+        throw std::runtime_error("Clock offset segment and window must not be empty");
+    }
+}
+
+void ClockOffsetEstimator::add_to_sums(const Point& p, double sign)
+{
+    double x = (p.ts_ns - ref_ts_ns) / 1e9;
+    double y = static_cast<double>(p.offset_ns - ref_offset_ns);
+    sx += sign * x;
+    sy += sign * y;
+    sxx += sign * x * x;
+    sxy += sign * x * y;
+    syy += sign * y * y;
+}
+
+// Sums relative to the newest point, so that neither x nor y grow with the length of the session.
+void ClockOffsetEstimator::recenter()
+{
+    const Point& newest = ring[(head + ring.size() - 1) % ring.size()];
+    ref_ts_ns = newest.ts_ns;
+    ref_offset_ns = newest.offset_ns;
+    sx = sy = sxx = sxy = syy = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        add_to_sums(ring[i], 1);
+    }
+}
+
+void ClockOffsetEstimator::close_segment()
+{
+    if (!count)
+    {
+        ref_ts_ns = best.ts_ns;
+        ref_offset_ns = best.offset_ns;
+    }
+    if (count == ring.size())
+    {
+        add_to_sums(ring[head], -1);
+    }
+    ring[head] = best;
+    add_to_sums(best, 1);
+    head = (head + 1) % ring.size();
+    count = std::min(count + 1, ring.size());
+    nr_segments++;
+    open_probes = 0;
+    if (!head)
+    {
+        recenter();
+    }
+    max_half_rtt_ns = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        max_half_rtt_ns = std::max(max_half_rtt_ns, ring[i].half_rtt_ns);
+    }
+}
+
+OneWayDelay ClockOffsetEstimator::update(const ProbeRecord& rec)
+{
+    OneWayDelay delay = { false, 0, 0, 0 };
+    if (rec.flags != RESULT_COMPLETE)
+    {
+        return delay;
+    }
+    int64_t forward = rec.t2 - rec.t1;
+    int64_t reverse = rec.t4 - rec.t3;
+    // Negative when the timestamps are broken, such a probe says nothing about the clocks.
+    if (forward + reverse < 0)
+    {
+        return delay;
+    }
+    Point p = { rec.t1, (forward - reverse) / 2, (forward + reverse) / 2 };
+    if (!open_probes || p.half_rtt_ns < best.half_rtt_ns)
+    {
+        best = p;
+    }
+    if (++open_probes == segment_probes)
+    {
+        close_segment();
+    }
+
+    ClockEstimate at_t1 = estimate(rec.t1);
+    ClockEstimate at_t4 = estimate(rec.t4);
+    delay.valid = true;
+    delay.forward_ns = forward - std::llround(at_t1.offset_ns);
+    delay.reverse_ns = reverse + std::llround(at_t4.offset_ns);
+    delay.bound_ns = std::llround(std::max(at_t1.bound_ns, at_t4.bound_ns));
+    return delay;
+}
+
+ClockEstimate ClockOffsetEstimator::estimate(int64_t ts_ns) const
+{
+    ClockEstimate clock = { false, 0, 0, 0 };
+    if (!count)
+    {
+        // Until the first segment closes, the best probe of the open one.
+        if (open_probes)
+        {
+            clock.valid = true;
+            clock.offset_ns = best.offset_ns;
+            clock.bound_ns = best.half_rtt_ns;
+        }
+        return clock;
+    }
+    double n = count;
+    double x = (ts_ns - ref_ts_ns) / 1e9;
+    double mean_x = sx / n;
+    double mean_y = sy / n;
+    double cxx = sxx - sx * mean_x;
+    double cxy = sxy - sx * mean_y;
+    double cyy = syy - sy * mean_y;
+    double slope = count >= 2 && cxx > 0 ? cxy / cxx : 0;
+    double se = 0;
+    if (count > 2 && cxx > 0)
+    {
+        double residual = std::max(0.0, (cyy - slope * cxy) / (n - 2));
+        se = std::sqrt(residual * (1 / n + (x - mean_x) * (x - mean_x) / cxx));
+    }
+    clock.valid = true;
+    clock.offset_ns = ref_offset_ns + mean_y + slope * (x - mean_x);
+    clock.drift_ppm = slope / 1000;    // ns per s
+    clock.bound_ns = max_half_rtt_ns + 2 * se;
+    return clock;
+}
+
+void clear_one_way(OneWaySummary *summary)
+{
+    *summary = OneWaySummary();
+}
+
+void add_one_way(OneWaySummary *summary, const OneWayDelay& delay)
+{
+    if (!delay.valid)
+    {
+        return;
+    }
+    add_delay(&summary->forward, delay.forward_ns);
+    add_delay(&summary->reverse, delay.reverse_ns);
+    summary->max_bound_ns = std::max(summary->max_bound_ns, delay.bound_ns);
+}
+
+void print_one_way(std::ostream& os, const OneWaySummary& summary, const ClockEstimate& clock)
+{
+    os << "one-way: clock offset ";
+    if (clock.valid)
+    {
+        os << clock.offset_ns / 1000.0 << " +-" << clock.bound_ns / 1000.0 << " us drift " << clock.drift_ppm
+           << " ppm";
+    }
+    else
+    {
+        os << "-";
+    }
+    os << " (min/mean/max us, each +-" << summary.max_bound_ns / 1000.0 << ")";
+    print_stats(os, "fwd", summary.forward);
+    print_stats(os, "rev", summary.reverse);
+    os << '\n';
+}
+};
@@ -0,0 +1,112 @@
+#ifndef _CLOCK_OFFSET_H_
+#define _CLOCK_OFFSET_H_
+
+#include <ostream>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "probe_matcher.h"
+#include "result_store.h"
+
+namespace Netrounds
+{
+// The reflector clock (t2, t3) against the sender clock (t1, t4) at some sender time.
+struct ClockEstimate
+{
+    bool valid;          // false until a complete probe has been seen
+    double offset_ns;    // reflector minus sender
+    double drift_ppm;    // how fast the offset grows, 0 until a fit has two points
+    double bound_ns;     // the offset is within +- this, see ClockOffsetEstimator
+};
+
+// One-way delays of a probe with the clock offset taken out.
+struct OneWayDelay
+{
+    bool valid;
+    int64_t forward_ns;  // t2 - t1 - offset
+    int64_t reverse_ns;  // t4 - t3 + offset
+    int64_t bound_ns;    // each of them is within +- this
+};
+
+// Offset and drift between the sender and reflector clocks from the four timestamps of each probe, in fixed memory.
+//
+// A probe confines the offset to [-(t4 - t3), t2 - t1], since neither one-way delay can be negative: the midpoint,
+// give or take half the RTT. Of every segment_probes complete probes the one with the smallest RTT, and so the
+// tightest interval, is kept (minimum-delay filter), and a line is fitted through the midpoints of the last
+// window_segments of them (sliding-window least squares). Each probe costs one comparison and one evaluation of the
+// line. Closing a segment updates the fit's sums in O(1) and looks for the widest interval of the window, one pass
+// over window_segments points per segment_probes probes; every window_segments segments the sums are re-centered on
+// the newest point, so they keep their precision however long the session runs. No probe is stored.
+//
+// The bound is that widest half RTT plus two standard errors of the fit. The half RTT holds whatever the path, as
+// the true offset is inside every probe's interval; with the same minimum delay both ways the midpoints are close to
+// exact and it is mostly slack. An asymmetric path shifts the midpoints by half the difference, which no estimate
+// from round trips can tell from an offset.
+class ClockOffsetEstimator
+{
+public:
+    explicit ClockOffsetEstimator(size_t segment_probes = 32, size_t window_segments = 32);
+
+    // Takes a probe and returns its one-way delays under the estimate that includes it. Probes without all four
+    // timestamps are not used, and come back not valid.
+    OneWayDelay update(const ProbeRecord& rec);
+
+    // At sender time ts_ns.
+    ClockEstimate estimate(int64_t ts_ns) const;
+
+    // Segments that went into the fit so far.
+    uint64_t segments() const
+    {
+        return nr_segments;
+    }
+
+private:
+    struct Point
+    {
+        int64_t ts_ns;       // t1 of the probe
+        int64_t offset_ns;   // midpoint of its interval
+        int64_t half_rtt_ns;
+    };
+
+    void close_segment();
+    void add_to_sums(const Point& p, double sign);
+    void recenter();
+
+    size_t segment_probes;
+    std::vector<Point> ring;
+    size_t head;            // next slot to write
+    size_t count;
+    uint64_t nr_segments;
+
+    Point best;             // of the open segment
+    size_t open_probes;
+
+    // Sums over the ring of x (s since ref_ts_ns) and y (ns from ref_offset_ns).
+    int64_t ref_ts_ns;
+    int64_t ref_offset_ns;
+    double sx;
+    double sy;
+    double sxx;
+    double sxy;
+    double syy;
+    int64_t max_half_rtt_ns;
+};
+
+// Statistics of a window of one-way delays.
+struct OneWaySummary
+{
+    DelayStats forward;
+    DelayStats reverse;
+    int64_t max_bound_ns;
+};
+
+void clear_one_way(OneWaySummary *summary);
+void add_one_way(OneWaySummary *summary, const OneWayDelay& delay);
+
+// "one-way: clock offset 5012.3 +-12.5 us drift 20.01 ppm (min/mean/max us) fwd 100.2/103.4/150.1 rev ..."
+void print_one_way(std::ostream& os, const OneWaySummary& summary, const ClockEstimate& clock);
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <sys/socket.h>
+
+#include "dispersion.h"
+
+namespace Netrounds
+{
+namespace
+{
+const double MIN_RATE_BPS = 1e5;
+
+bool has(const ProbeRecord& rec, ProbeTimestamp ts)
+{
+    return rec.flags & (1 << ts);
+}
+
+int64_t timestamp(const ProbeRecord& rec, ProbeTimestamp ts)
+{
+    switch (ts)
+    {
+    case PROBE_T1:
+        return rec.t1;
+    case PROBE_T2:
+        return rec.t2;
+    case PROBE_T3:
+        return rec.t3;
+    default:
+        return rec.t4;
+    }
+}
+
+double bin_edge(size_t i)
+{
+    return MIN_RATE_BPS * std::pow(10.0, static_cast<double>(i) / RateHistogram::BINS_PER_DECADE);
+}
+
+void print_direction(std::ostream& os, const char *name, const DispersionEstimate& est)
+{
+    os << ' ' << name << ' ';
+    if (!est.pairs)
+    {
+        os << "-";
+    }
+    else
+    {
+        os << est.capacity_bps / 1e6 << " Mbit/s (" << est.capacity_low_bps / 1e6 << '-'
+           << est.capacity_high_bps / 1e6 << ", " << est.pairs << " pairs, " << est.sender_limited
+           << " sender limited)";
+    }
+    if (est.trains)
+    {
+        os << " adr " << est.adr_bps / 1e6 << " Mbit/s (" << est.trains << " trains)";
+    }
+}
+}
+
+size_t wire_len(size_t probe_len, int domain)
+{
+    const size_t UDP_HEADER = 8;
+    const size_t ETHERNET = 14 + 4 + 8 + 12;    // header, FCS, preamble and SFD, inter-frame gap
+    return probe_len + UDP_HEADER + (domain == AF_INET6 ? 40 : 20) + ETHERNET;
+}
+
+RateHistogram::RateHistogram() : bins(NR_BINS), sums(NR_BINS), total(0)
+{
+}
+
+void RateHistogram::add(double bps)
+{
+    double pos = std::log10(std::max(bps, MIN_RATE_BPS) / MIN_RATE_BPS) * BINS_PER_DECADE;
+    size_t i = std::min(static_cast<size_t>(pos), NR_BINS - 1);
+    bins[i]++;
+    sums[i] += bps;
+    total++;
+}
+
+double RateHistogram::mode(double *low_bps, double *high_bps) const
+{
+    *low_bps = *high_bps = 0;
+    if (!total)
+    {
+        return 0;
+    }
+    uint64_t window = 0;
+    for (size_t i = 0; i < MODE_BINS; i++)
+    {
+        window += bins[i];
+    }
+    uint64_t best = window;
+    size_t best_start = 0;
+    for (size_t start = 1; start + MODE_BINS <= NR_BINS; start++)
+    {
+        window += bins[start + MODE_BINS - 1] - bins[start - 1];
+        if (window > best)
+        {
+            best = window;
+            best_start = start;
+        }
+    }
+    double sum = 0;
+    for (size_t i = best_start; i < best_start + MODE_BINS; i++)
+    {
+        sum += sums[i];
+    }
+    *low_bps = bin_edge(best_start);
+    *high_bps = bin_edge(best_start + MODE_BINS);
+    return sum / best;
+}
+
+double RateHistogram::quantile(double q) const
+{
+    if (!total)
+    {
+        return 0;
+    }
+    uint64_t rank = std::min(static_cast<uint64_t>(q * total), total - 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NR_BINS; i++)
+    {
+        seen += bins[i];
+        if (seen > rank)
+        {
+            return sums[i] / bins[i];
+        }
+    }
+    return 0;
+}
+
+DispersionEstimator::DispersionEstimator(size_t wire_len) : bits(wire_len * 8.0)
+{
+    if (!wire_len)
+    {
+        throw std::runtime_error("Dispersion needs the length of the probes");
+    }
+}
+
+void DispersionEstimator::add_train(const ProbeRecord *recs, size_t n)
+{
+    add(&fwd, recs, n, PROBE_T2);
+    add(&rtt, recs, n, PROBE_T4);
+}
+
+void DispersionEstimator::add(Direction *dir, const ProbeRecord *recs, size_t n, ProbeTimestamp ts)
+{
+    size_t first = n;
+    size_t last = n;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!has(recs[i], ts))
+        {
+            continue;
+        }
+        if (first == n)
+        {
+            first = i;
+        }
+        last = i;
+        if (!i || !has(recs[i - 1], ts))
+        {
+            continue;
+        }
+        int64_t gap_out = timestamp(recs[i], ts) - timestamp(recs[i - 1], ts);
+        if (gap_out <= 0)
+        {
+            continue;
+        }
+        if (has(recs[i], PROBE_T1) && has(recs[i - 1], PROBE_T1) && recs[i].t1 - recs[i - 1].t1 >= gap_out)
+        {
+            dir->sender_limited++;
+            continue;
+        }
+        dir->pairs.add(bits * 1e9 / gap_out);
+    }
+    if (first == last || first == n)
+    {
+        return;
+    }
+    int64_t span = timestamp(recs[last], ts) - timestamp(recs[first], ts);
+    if (span > 0)
+    {
+        dir->trains.add((last - first) * bits * 1e9 / span);
+    }
+}
+
+DispersionEstimate DispersionEstimator::estimate(const Direction& dir) const
+{
+    DispersionEstimate est;
+    est.pairs = dir.pairs.count();
+    est.sender_limited = dir.sender_limited;
+    est.trains = dir.trains.count();
+    est.capacity_bps = dir.pairs.mode(&est.capacity_low_bps, &est.capacity_high_bps);
+    est.adr_bps = dir.trains.quantile(0.5);
+    return est;
+}
+
+DispersionEstimate DispersionEstimator::forward() const
+{
+    return estimate(fwd);
+}
+
+DispersionEstimate DispersionEstimator::round_trip() const
+{
+    return estimate(rtt);
+}
+
+void print_dispersion(std::ostream& os, const DispersionEstimator& estimator)
+{
+    os << "capacity:";
+    print_direction(os, "fwd", estimator.forward());
+    print_direction(os, "rtt", estimator.round_trip());
+    os << '\n';
+}
+};
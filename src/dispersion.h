@@ -0,0 +1,104 @@
+#ifndef _DISPERSION_H_
+#define _DISPERSION_H_
+
+#include <ostream>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "probe_matcher.h"
+
+namespace Netrounds
+{
+// Bytes a UDP payload of probe_len takes on an Ethernet link: UDP and IP (domain AF_INET or AF_INET6) headers,
+// Ethernet header and FCS, preamble and inter-frame gap. Rates are of the link, not of the payload.
+size_t wire_len(size_t probe_len, int domain);
+
+// Counts of rates in bins a fixed fraction wide, from 100 kbit/s to 10 Tbit/s, in fixed memory.
+class RateHistogram
+{
+public:
+    static const size_t BINS_PER_DECADE = 100;    // bins are 2.3% wide
+    static const size_t NR_BINS = 8 * BINS_PER_DECADE;
+
+    RateHistogram();
+
+    void add(double bps);
+
+    uint64_t count() const
+    {
+        return total;
+    }
+
+    // The densest range of MODE_BINS neighbouring bins: low and high are its edges, the result the mean of the
+    // rates in it. 0 if empty.
+    double mode(double *low_bps, double *high_bps) const;
+
+    // Rate below which fraction q (0..1) of them are, to the bin. 0 if empty.
+    double quantile(double q) const;
+
+private:
+    static const size_t MODE_BINS = 5;
+
+    std::vector<uint64_t> bins;
+    std::vector<double> sums;    // of the rates in each bin
+    uint64_t total;
+};
+
+// What the dispersion of one direction says about the path.
+struct DispersionEstimate
+{
+    uint64_t pairs;              // packet pairs that gave a rate
+    uint64_t sender_limited;     // pairs the sender itself had spaced wider than they arrived
+    uint64_t trains;             // trains with at least two timestamps
+    double capacity_bps;         // bottleneck capacity, the modal pair rate; 0 without pairs
+    double capacity_low_bps;     // edges of the modal range
+    double capacity_high_bps;
+    double adr_bps;              // median rate of whole trains
+};
+
+// Bottleneck capacity from the dispersion of back-to-back probes. Two probes that queue together behind the narrowest
+// link leave it spaced by the time it takes to send one, wire_len * 8 / C, and keep that spacing if nothing gets in
+// between further on. Cross traffic stretches some gaps (queued in between) and squeezes others (the first probe held
+// up downstream), so single pairs scatter to both sides of C; the mode of many pairs is where the undisturbed ones
+// pile up. Pairs the sender did not send tighter than they arrived (t1) are left out, they only show the sender.
+//
+// A whole train of n probes spans (n - 1) * wire_len * 8 / R. Its rate R, the asymptotic dispersion rate, is below C
+// as soon as cross traffic shares the bottleneck, and above the bandwidth left over by it; the median over trains is
+// reported next to the capacity.
+//
+// Forward is from the reflector's t2, round trip from our t4, whose spacing is also set by the way back and by how
+// the reflector forwards. Probes missing the timestamp are passed over; pairs are only formed from neighbours.
+class DispersionEstimator
+{
+public:
+    explicit DispersionEstimator(size_t wire_len);
+
+    // The records of one train in the order the probes were sent.
+    void add_train(const ProbeRecord *recs, size_t n);
+
+    DispersionEstimate forward() const;
+    DispersionEstimate round_trip() const;
+
+private:
+    struct Direction
+    {
+        RateHistogram pairs;
+        RateHistogram trains;
+        uint64_t sender_limited = 0;
+    };
+
+    void add(Direction *dir, const ProbeRecord *recs, size_t n, ProbeTimestamp ts);
+    DispersionEstimate estimate(const Direction& dir) const;
+
+    double bits;
+    Direction fwd;
+    Direction rtt;
+};
+
+// "capacity: fwd 941.2 Mbit/s (930.5-952.0, 1200 pairs, 3 sender limited) adr 912.7 Mbit/s (600 trains) rtt ..."
+void print_dispersion(std::ostream& os, const DispersionEstimator& estimator);
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include "engine.h"
+#include "packet.h"
+#include "timestamp_report.h"
+#include "util.h"
+
+namespace Netrounds
+{
+bool SeqTracker::update(uint32_t seq)
+{
+    bool in_order = seen && seq == prev + 1;
+
+    if (!seen)
+    {
+        seen = true;
+    }
+    else if (static_cast<int32_t>(seq - prev) > 0)
+    {
+        lost += seq - prev - 1;
+    }
+    else
+    {
+        reordered++;
+        return false;
+    }
+    prev = seq;
+    return in_order;
+}
+
+const size_t ReflectorEngine::SESSION_WAYS;
+
+ReflectorEngine::ReflectorEngine(Transport& transport, size_t max_sessions) :
+    transport(transport), auth(nullptr), admission(nullptr), nr_evicted(0), nr_reflected(0), nr_ignored(0),
+    nr_rejected(0), nr_shed(0)
+{
+    size_t slots = SESSION_WAYS;
+    while (slots < max_sessions)
+    {
+        slots *= 2;
+    }
+    EngineSession free_slot;
+    memset(&free_slot.peer, 0, sizeof(free_slot.peer));
+    free_slot.peer.ss_family = AF_UNSPEC;
+    free_slot.refl_seq = 0;
+    free_slot.reflected = 0;
+    free_slot.last_ns = 0;
+    table.assign(slots, free_slot);
+    set_mask = slots / SESSION_WAYS - 1;
+}
+
+EngineSession& ReflectorEngine::session(const sockaddr_storage& peer)
+{
+    EngineSession *set = &table[(peer_hash(peer) & set_mask) * SESSION_WAYS];
+    EngineSession *victim = &set[0];
+    for (size_t way = 0; way < SESSION_WAYS; way++)
+    {
+        EngineSession& s = set[way];
+        if (same_peer(s.peer, peer))
+        {
+            return s;
+        }
+        // A free slot if there is one, else the quietest.
+        if (victim->peer.ss_family != AF_UNSPEC &&
+            (s.peer.ss_family == AF_UNSPEC || s.last_ns < victim->last_ns))
+        {
+            victim = &s;
+        }
+    }
+    if (victim->peer.ss_family != AF_UNSPEC)
+    {
+        nr_evicted++;
+    }
+    victim->peer = peer;
+    victim->seq = SeqTracker();
+    victim->refl_seq = 0;
+    victim->reflected = 0;
+    return *victim;
+}
+
+std::vector<EngineSession> ReflectorEngine::sessions() const
+{
+    std::vector<EngineSession> used;
+    for (const EngineSession& s : table)
+    {
+        if (s.peer.ss_family != AF_UNSPEC)
+        {
+            used.push_back(s);
+        }
+    }
+    return used;
+}
+
+bool ReflectorEngine::poll()
+{
+    RxInfo info;
+    char *buf = transport.receive_buffer(own_buf, BUF_LEN);
+    if (!transport.receive(buf, BUF_LEN, &info))
+    {
+        return false;
+    }
+    int64_t t2_prime = transport.now_ns();
+
+    PacketType type;
+    if (!peek_packet_type(buf, info.len, &type) || type != FROM_SENDER)
+    {
+        nr_ignored++;
+        return true;
+    }
+    // Ahead of the MAC, so a flood costs one table lookup per probe rather than a CMAC.
+    uint32_t shed = 0;
+    if (admission && !admission->admit(info.peer, t2_prime, &shed))
+    {
+        nr_shed++;
+        return true;
+    }
+    uint32_t session_id = 0;
+    if (auth && !auth->verify(buf, info.len, &session_id))
+    {
+        nr_rejected++;
+        return true;
+    }
+    uint32_t seq;
+    memcpy(&seq, buf + offsetof(SenderPacket, sender_seq), sizeof(seq));
+    seq = ntohl(seq);
+
+    EngineSession& s = session(info.peer);
+    s.last_ns = t2_prime;
+    s.seq.update(seq);
+
+    ReflectorPacket reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = FROM_REFLECTOR;
+    reply.sender_seq = seq;
+    reply.refl_seq = s.refl_seq++;
+    reply.shed = shed;
+    // Without hardware timestamps the kernel's software RX timestamp is the next best t2.
+    reply.t2 = info.hw_ns ? info.hw_ns : info.sw_ns;
+    reply.t2_prime = t2_prime;
+    reply.t3_prime = transport.now_ns();
+    // Replies are as long as the probe, so both directions carry the same load, and echo its payload past the reply
+    // header for senders that check it (payload_pattern.h).
+    size_t len = std::max(serialize_reflector_packet(reply, buf, BUF_LEN), info.len);
+    if (auth)
+    {
+        // Probes too short for a reply header and trailer get a reply that has room for them.
+        size_t signed_len = std::max(len, PacketAuth::min_len(FROM_REFLECTOR));
+        memset(buf + len, 0, signed_len - len);
+        len = signed_len;
+        auth->sign(buf, len, session_id);
+    }
+    transport.send(info.peer, buf, len,
+                   transport.one_step_tx() ? offsetof(ReflectorPacket, t3) : Transport::NO_TX_STAMP);
+    s.reflected++;
+    nr_reflected++;
+    return true;
+}
+
+SenderEngine::SenderEngine(Transport& transport, const sockaddr_storage& reflector, uint64_t count,
+                           int64_t interval_ns, size_t probe_len, size_t match_window, ProbeMatcher::Sink sink) :
+    transport(transport), reflector(reflector), total(count), interval_ns(interval_ns),
+    start_ns(transport.now_ns()), probe_len(probe_len), matcher(match_window, sink), nr_sent(0), nr_replies(0),
+    nr_reports(0)
+{
+    if (probe_len < sizeof(SenderPacket) || probe_len > sizeof(probe))
+    {
+        throw std::runtime_error("SenderEngine probe length out of range");
+    }
+    memset(probe, 0, sizeof(probe));
+}
+
+int64_t SenderEngine::next_send_ns() const
+{
+    if (done())
+    {
+        return std::numeric_limits<int64_t>::max();
+    }
+    return start_ns + static_cast<int64_t>(nr_sent) * interval_ns;
+}
+
+bool SenderEngine::poll()
+{
+    bool busy = false;
+
+    // Probes are due on a fixed grid from the start, so a late send does not shift the ones after it.
+    if (transport.now_ns() >= next_send_ns())
+    {
+        uint32_t seq = static_cast<uint32_t>(nr_sent);
+        prepare_packet(probe, probe_len, seq);
+        int64_t t1 = transport.send(reflector, probe, probe_len, Transport::NO_TX_STAMP);
+        if (t1)
+        {
+            matcher.add(seq, PROBE_T1, t1);
+        }
+        nr_sent++;
+        busy = true;
+    }
+
+    RxInfo info;
+    ReflectorPacket reply;
+    if (transport.receive(rx, sizeof(rx), &info))
+    {
+        busy = true;
+        PacketType type;
+        bool known = peek_packet_type(rx, info.len, &type);
+        if (known && type == FROM_REFLECTOR_ONLY_TIMESTAMPS && merge_timestamp_report(rx, info.len, &matcher))
+        {
+            nr_reports++;
+        }
+        else if (known && type == FROM_REFLECTOR && decode_reflector_packet(rx, info.len, &reply))
+        {
+            nr_replies++;
+            replies_seq.update(reply.sender_seq);
+            if (reply.t2)
+            {
+                matcher.add(reply.sender_seq, PROBE_T2, reply.t2);
+            }
+            if (reply.t3)
+            {
+                matcher.add(reply.sender_seq, PROBE_T3, reply.t3);
+            }
+            if (info.hw_ns)
+            {
+                matcher.add(reply.sender_seq, PROBE_T4, info.hw_ns);
+            }
+        }
+    }
+    return busy;
+}
+
+void SenderEngine::flush()
+{
+    matcher.flush();
+}
+};
@@ -0,0 +1,187 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+#include "admission.h"
+#include "packet_auth.h"
+#include "probe_matcher.h"
+#include "transport.h"
+
+namespace Netrounds
+{
+// Loss and reordering bookkeeping of one probe stream, as seen by its receiver.
+struct SeqTracker
+{
+    SeqTracker() : prev(0), seen(false), lost(0), reordered(0)
+    {
+    }
+
+    // True if seq directly follows the previous one. A gap counts as lost, an older seq as reordered (and does not
+    // give back the loss counted for it).
+    bool update(uint32_t seq);
+
+    uint32_t prev;
+    bool seen;
+    uint64_t lost;
+    uint64_t reordered;
+};
+
+struct EngineSession
+{
+    sockaddr_storage peer;       // AF_UNSPEC for a free slot
+    SeqTracker seq;
+    uint32_t refl_seq;
+    uint64_t reflected;
+    int64_t last_ns;             // of the latest probe, for eviction
+};
+
+// Reflector protocol logic on top of a Transport: FROM_SENDER probes in, FROM_REFLECTOR replies out. The reply
+// carries t2 and, on transports with one-step TX timestamps, t3.
+//
+// Sessions (one per peer address and port) live in a fixed table of SESSION_WAYS-way sets, like AdmissionControl's,
+// so a sweep of source addresses costs one hash and a few compares per probe and no memory beyond the table. A new
+// peer whose set is full takes the slot of the one that has been quiet longest, which then starts over if it returns.
+class ReflectorEngine
+{
+public:
+    static const size_t BUF_LEN = 9000;   // jumbo frames
+    static const size_t SESSION_WAYS = 8;
+    static const size_t DEFAULT_SESSIONS = 4096;
+
+    // max_sessions is rounded up to a power of two, at least SESSION_WAYS.
+    explicit ReflectorEngine(Transport& transport, size_t max_sessions = DEFAULT_SESSIONS);
+
+    // Authenticated mode: probes without a valid trailer are dropped, replies are signed for the probe's session.
+    // auth must outlive the engine.
+    void set_auth(PacketAuth *packet_auth)
+    {
+        auth = packet_auth;
+    }
+
+    // Per-source rate limit: probes over it are dropped before anything else is done with them, and replies tell
+    // the sender how many of its probes were. admission must outlive the engine.
+    void set_admission(AdmissionControl *admission_control)
+    {
+        admission = admission_control;
+    }
+
+    // Handles one datagram if one is available, false if there was none.
+    bool poll();
+
+    // The sessions in use, in table order.
+    std::vector<EngineSession> sessions() const;
+
+    // Sessions that lost their slot to a new peer.
+    uint64_t evicted() const
+    {
+        return nr_evicted;
+    }
+
+    uint64_t reflected() const
+    {
+        return nr_reflected;
+    }
+
+    // Datagrams that were not FROM_SENDER probes.
+    uint64_t ignored() const
+    {
+        return nr_ignored;
+    }
+
+    // Probes that failed authentication.
+    uint64_t rejected() const
+    {
+        return nr_rejected;
+    }
+
+    // Probes dropped by admission control.
+    uint64_t shed() const
+    {
+        return nr_shed;
+    }
+
+private:
+    EngineSession& session(const sockaddr_storage& peer);
+
+    Transport& transport;
+    PacketAuth *auth;
+    AdmissionControl *admission;
+    std::vector<EngineSession> table;
+    size_t set_mask;
+    uint64_t nr_evicted;
+    uint64_t nr_reflected;
+    uint64_t nr_ignored;
+    uint64_t nr_rejected;
+    uint64_t nr_shed;
+    char own_buf[BUF_LEN];
+};
+
+// Sender protocol logic on top of a Transport: count probes to one reflector paced interval_ns apart, replies and
+// timestamp reports (timestamp_report.h) joined with the send timestamps by sender_seq. Finished (or, after
+// match_window later probes, abandoned) probes go to the sink.
+class SenderEngine
+{
+public:
+    SenderEngine(Transport& transport, const sockaddr_storage& reflector, uint64_t count, int64_t interval_ns,
+                 size_t probe_len, size_t match_window, ProbeMatcher::Sink sink);
+
+    // Sends the next probe if it is due and handles one reply if one is available. False if neither happened.
+    bool poll();
+
+    // Emits all probes still waiting for timestamps.
+    void flush();
+
+    // When the next probe is due, INT64_MAX after the last one.
+    int64_t next_send_ns() const;
+
+    bool done() const
+    {
+        return nr_sent == total;
+    }
+
+    uint64_t sent() const
+    {
+        return nr_sent;
+    }
+
+    uint64_t replies() const
+    {
+        return nr_replies;
+    }
+
+    // FROM_REFLECTOR_ONLY_TIMESTAMPS reports merged.
+    uint64_t reports() const
+    {
+        return nr_reports;
+    }
+
+    // sender_seq of the replies: round-trip loss and reordering.
+    const SeqTracker& reply_seq() const
+    {
+        return replies_seq;
+    }
+
+private:
+    Transport& transport;
+    sockaddr_storage reflector;
+    uint64_t total;
+    int64_t interval_ns;
+    int64_t start_ns;
+    size_t probe_len;
+    ProbeMatcher matcher;
+    SeqTracker replies_seq;
+    uint64_t nr_sent;
+    uint64_t nr_replies;
+    uint64_t nr_reports;
+    char probe[1500];
+    char rx[1500];
+};
+};
+
+#endif
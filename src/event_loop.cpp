@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <ctime>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "event_loop.h"
+#include "metrics.h"
+#include "util.h"
+
+namespace Netrounds
+{
+const int64_t EventLoop::NO_DEADLINE;
+
+EventLoop::EventLoop() : epfd(epoll_create1(EPOLL_CLOEXEC)), next_id(1)
+{
+    if (epfd == -1)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    // Frames of unfinished tasks may still hold waits, drop them before the bookkeeping they point into.
+    spawned.clear();
+    close(epfd);
+}
+
+int64_t EventLoop::now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_ns(ts);
+}
+
+void EventLoop::spawn(Task<void> task)
+{
+    std::coroutine_handle<> h = task.handle;
+    task.handle.promise().owner = this;
+    spawned.emplace(h.address(), std::move(task));
+    ready.push_back(h);
+}
+
+void EventLoop::add_wait(Wait *w)
+{
+    if (w->kind != WAIT_TIMER)
+    {
+        Watch& watch = watches[w->sock];
+        if (watch.waits[w->kind])
+        {
+            throw std::runtime_error("Socket already has a waiting coroutine of that kind");
+        }
+        watch.waits[w->kind] = w;
+        update_epoll(w->sock, watch);
+    }
+    w->id = next_id++;
+    pending[w->id] = w;
+    if (w->deadline_ns != NO_DEADLINE)
+    {
+        timers.push({ w->deadline_ns, w->id });
+    }
+}
+
+void EventLoop::wake(Wait *w, bool timed_out)
+{
+    pending.erase(w->id);
+    if (w->kind != WAIT_TIMER)
+    {
+        // The epoll registration is left as it is: the coroutine most likely waits on the same socket again right
+        // away. poll_events() drops interest nobody has any more when it fires.
+        watches[w->sock].waits[w->kind] = nullptr;
+    }
+    w->timed_out = timed_out;
+    ready.push_back(w->handle);
+}
+
+void EventLoop::update_epoll(int sock, Watch& watch)
+{
+    uint32_t events = (watch.waits[WAIT_READABLE] ? EPOLLIN : 0u) | (watch.waits[WAIT_WRITABLE] ? EPOLLOUT : 0u);
+    bool wanted = watch.waits[WAIT_READABLE] || watch.waits[WAIT_WRITABLE] || watch.waits[WAIT_ERRQUEUE];
+    int op;
+
+    if (!wanted)
+    {
+        // EPOLLERR cannot be masked, only leaving the set stops a queued TX timestamp from waking us.
+        if (!watch.registered)
+        {
+            return;
+        }
+        op = EPOLL_CTL_DEL;
+    }
+    else if (!watch.registered)
+    {
+        op = EPOLL_CTL_ADD;
+    }
+    else if (events != watch.events)
+    {
+        op = EPOLL_CTL_MOD;
+    }
+    else
+    {
+        return;
+    }
+
+    epoll_event ev;
+    ev.events = events;
+    ev.data.fd = sock;
+    if (epoll_ctl(epfd, op, sock, &ev) == -1)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+    watch.registered = wanted;
+    watch.events = events;
+}
+
+void EventLoop::poll_events(int64_t timeout_ns)
+{
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    timespec ts;
+    timespec *timeout = nullptr;
+
+    if (timeout_ns != NO_DEADLINE)
+    {
+        ts.tv_sec = timeout_ns / 1000000000;
+        ts.tv_nsec = timeout_ns % 1000000000;
+        timeout = &ts;
+    }
+    int n = epoll_pwait2(epfd, events, MAX_EVENTS, timeout, nullptr);
+    if (n == -1)
+    {
+        // A signal (e.g. SIGUSR1 for a flight recorder dump) just ends this round early.
+        if (errno == EINTR)
+        {
+            return;
+        }
+        throw std::system_error(errno, std::system_category());
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        int sock = events[i].data.fd;
+        uint32_t ev = events[i].events;
+        Watch& watch = watches[sock];
+        bool unclaimed = false;
+        const uint32_t trigger[NR_WAIT_KINDS] = { EPOLLIN | EPOLLHUP, EPOLLOUT | EPOLLHUP, EPOLLERR };
+
+        for (int kind = 0; kind < NR_WAIT_KINDS; kind++)
+        {
+            if (!(ev & trigger[kind]))
+            {
+                continue;
+            }
+            if (watch.waits[kind])
+            {
+                wake(watch.waits[kind], false);
+            }
+            else
+            {
+                unclaimed = true;
+            }
+        }
+        if (unclaimed)
+        {
+            update_epoll(sock, watch);
+        }
+    }
+}
+
+void EventLoop::expire_timers()
+{
+    int64_t now = now_ns();
+    while (!timers.empty() && timers.top().deadline_ns <= now)
+    {
+        auto it = pending.find(timers.top().id);
+        timers.pop();
+        if (it != pending.end())
+        {
+            wake(it->second, true);
+        }
+    }
+}
+
+void EventLoop::reap()
+{
+    while (!finished.empty())
+    {
+        std::coroutine_handle<> h = finished.back();
+        finished.pop_back();
+        auto it = spawned.find(h.address());
+        std::exception_ptr error = it->second.handle.promise().error;
+        spawned.erase(it);
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void EventLoop::run()
+{
+    std::vector<std::coroutine_handle<>> runnable;
+    for (;;)
+    {
+        while (!ready.empty())
+        {
+            runnable.swap(ready);
+            for (std::coroutine_handle<> h : runnable)
+            {
+                h.resume();
+            }
+            runnable.clear();
+            reap();
+        }
+        if (spawned.empty())
+        {
+            return;
+        }
+        if (pending.empty())
+        {
+            throw std::runtime_error("EventLoop tasks are suspended on something other than the loop");
+        }
+
+        // Timers of waits that were woken by their socket stay in the heap until they come up; skip those here.
+        while (!timers.empty() && !pending.count(timers.top().id))
+        {
+            timers.pop();
+        }
+        int64_t timeout = NO_DEADLINE;
+        if (!timers.empty())
+        {
+            timeout = std::max<int64_t>(0, timers.top().deadline_ns - now_ns());
+        }
+        poll_events(timeout);
+        expire_timers();
+    }
+}
+
+Task<void> EventLoop::send(int sock, const sockaddr_storage& peer, const char *buf, size_t len)
+{
+    while (!try_sendpacket(&peer, sock, buf, len))
+    {
+        co_await wait(sock, WAIT_WRITABLE, NO_DEADLINE);
+    }
+}
+
+Task<bool> EventLoop::receive(int sock, char *buf, size_t buflen, RxInfo *info, int64_t deadline_ns)
+{
+    for (;;)
+    {
+        ssize_t len = try_recvpacket(sock, 0, buf, buflen, &info->peer, &info->hw_ns);
+        if (len >= 0)
+        {
+            info->len = len;
+            info->sw_ns = 0;
+            co_return true;
+        }
+        if (!co_await wait(sock, WAIT_READABLE, deadline_ns))
+        {
+            co_return false;
+        }
+    }
+}
+
+Task<int64_t> EventLoop::tx_timestamp(int sock, uint32_t key, int64_t deadline_ns)
+{
+    for (;;)
+    {
+        uint32_t got;
+        int64_t hw_ns;
+        while (try_read_tx_timestamp(sock, &got, &hw_ns))
+        {
+            if (got == key)
+            {
+                co_return hw_ns;
+            }
+            // Keys wrap around, so compare by distance.
+            if (static_cast<int32_t>(got - key) > 0)
+            {
+                co_return 0;
+            }
+            Netrounds::count(Netrounds::M_TX_STAMP_STALE);
+        }
+        if (!co_await wait(sock, WAIT_ERRQUEUE, deadline_ns))
+        {
+            Netrounds::count(Netrounds::M_ERRQUEUE_TIMEOUT);
+            co_return 0;
+        }
+    }
+}
+};
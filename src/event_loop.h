@@ -0,0 +1,325 @@
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <coroutine>
+#include <exception>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+#include "transport.h"
+
+namespace Netrounds
+{
+class EventLoop;
+
+namespace detail
+{
+struct PromiseBase
+{
+    std::coroutine_handle<> continuation;
+    EventLoop *owner = nullptr;   // set for tasks started with EventLoop::spawn()
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept;
+
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        error = std::current_exception();
+    }
+};
+
+template <typename T>
+struct Promise : PromiseBase
+{
+    T value;
+
+    void return_value(T v)
+    {
+        value = std::move(v);
+    }
+
+    T result()
+    {
+        return std::move(value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase
+{
+    void return_void()
+    {
+    }
+
+    void result()
+    {
+    }
+};
+};
+
+// A lazily started coroutine. co_await runs it to completion and resumes the awaiting coroutine with its result (or
+// exception) by symmetric transfer, so chains of awaited tasks do not grow the stack. A task that is never awaited
+// is simply destroyed; hand it to EventLoop::spawn() to run it on its own.
+template <typename T = void>
+class Task
+{
+public:
+    struct promise_type : detail::Promise<T>
+    {
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume()
+    {
+        if (handle.promise().error)
+        {
+            std::rethrow_exception(handle.promise().error);
+        }
+        return handle.promise().result();
+    }
+
+private:
+    friend class EventLoop;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle)
+    {
+    }
+
+    void destroy()
+    {
+        if (handle)
+        {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Single-threaded epoll loop running coroutines: any number of them wait on sockets and deadlines at the same time,
+// with no thread per coroutine and no blocking sleeps. Sockets must not be used by two coroutines for the same kind
+// of wait (receive, send or TX timestamp) at once.
+//
+// Readiness is level-triggered and a socket is only in the epoll set while a coroutine waits on it, so data nobody
+// asked for does not wake the loop. The exception is the error queue: EPOLLERR is always reported, so a coroutine
+// that sends with TX timestamping on should collect each timestamp (tx_timestamp()) before it only waits to receive.
+class EventLoop
+{
+public:
+    static const int64_t NO_DEADLINE = INT64_MAX;
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Runs task from the next run() on. The loop owns it from now on.
+    void spawn(Task<void> task);
+
+    // Runs until every spawned task has finished. The first exception escaping a task is rethrown here, after the
+    // task is destroyed; the others keep their state and a later run() continues them.
+    void run();
+
+    // CLOCK_MONOTONIC in ns, the time line of all deadlines.
+    static int64_t now_ns();
+
+    size_t tasks() const
+    {
+        return spawned.size();
+    }
+
+    enum WaitKind
+    {
+        WAIT_READABLE,
+        WAIT_WRITABLE,
+        WAIT_ERRQUEUE,
+        NR_WAIT_KINDS,
+        WAIT_TIMER = NR_WAIT_KINDS
+    };
+
+    // Suspends until sock is ready for kind or deadline_ns has passed. Resumes with false on timeout.
+    class Wait
+    {
+    public:
+        Wait(EventLoop& loop, int sock, WaitKind kind, int64_t deadline_ns) :
+            loop(loop), sock(sock), kind(kind), deadline_ns(deadline_ns), id(0), timed_out(false)
+        {
+        }
+
+        // A sleep that is already due does not go through the loop.
+        bool await_ready() const noexcept
+        {
+            return kind == WAIT_TIMER && deadline_ns <= now_ns();
+        }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            handle = h;
+            loop.add_wait(this);
+        }
+
+        bool await_resume() const noexcept
+        {
+            return !timed_out;
+        }
+
+    private:
+        friend class EventLoop;
+
+        EventLoop& loop;
+        int sock;
+        WaitKind kind;
+        int64_t deadline_ns;
+        uint64_t id;
+        bool timed_out;
+        std::coroutine_handle<> handle;
+    };
+
+    Wait wait(int sock, WaitKind kind, int64_t deadline_ns)
+    {
+        return Wait(*this, sock, kind, deadline_ns);
+    }
+
+    Wait sleep_until(int64_t deadline_ns)
+    {
+        return Wait(*this, -1, WAIT_TIMER, deadline_ns);
+    }
+
+    // Sends the datagram, waiting for room in the socket buffer as long as it takes.
+    Task<void> send(int sock, const sockaddr_storage& peer, const char *buf, size_t len);
+
+    // Next datagram on sock into buf, false if none arrived by deadline_ns.
+    Task<bool> receive(int sock, char *buf, size_t buflen, RxInfo *info, int64_t deadline_ns);
+
+    // Hardware TX timestamp of the datagram sent on sock with OPT_ID key (SOF_TIMESTAMPING_OPT_ID, the number of
+    // datagrams sent on sock before it), 0 if it did not arrive by deadline_ns, had no hardware timestamp or was lost
+    // (a later send's came first). Timestamps of earlier sends still on the queue are dropped.
+    Task<int64_t> tx_timestamp(int sock, uint32_t key, int64_t deadline_ns);
+
+    // Called by a spawned task as it finishes, the loop destroys it once it is fully suspended.
+    void task_finished(std::coroutine_handle<> h)
+    {
+        finished.push_back(h);
+    }
+
+private:
+    struct Watch
+    {
+        Wait *waits[NR_WAIT_KINDS] = {};
+        bool registered = false;
+        uint32_t events = 0;   // as registered with epoll
+    };
+
+    struct Timer
+    {
+        int64_t deadline_ns;
+        uint64_t id;
+
+        bool operator>(const Timer& other) const
+        {
+            return deadline_ns > other.deadline_ns || (deadline_ns == other.deadline_ns && id > other.id);
+        }
+    };
+
+    void add_wait(Wait *w);
+    void wake(Wait *w, bool timed_out);
+    void update_epoll(int sock, Watch& watch);
+    void poll_events(int64_t timeout_ns);
+    void expire_timers();
+    void reap();
+
+    int epfd;
+    uint64_t next_id;
+    std::unordered_map<int, Watch> watches;
+    std::unordered_map<uint64_t, Wait *> pending;   // waits that have not been woken, by id
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::vector<std::coroutine_handle<>> ready;
+    std::unordered_map<void *, Task<void>> spawned;
+    std::vector<std::coroutine_handle<>> finished;
+};
+
+template <typename Promise>
+std::coroutine_handle<> detail::PromiseBase::FinalAwaiter::await_suspend(std::coroutine_handle<Promise> h) noexcept
+{
+    PromiseBase& promise = h.promise();
+    if (promise.continuation)
+    {
+        return promise.continuation;
+    }
+    if (promise.owner)
+    {
+        promise.owner->task_finished(h);
+    }
+    return std::noop_coroutine();
+}
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+#include "flight_recorder.h"
+#include "pcap_format.h"
+#include "tsc_clock.h"
+
+using std::string;
+using std::vector;
+
+namespace Netrounds
+{
+namespace
+{
+class PcapngFile
+{
+public:
+    explicit PcapngFile(const string& path) : f(fopen(path.c_str(), "wb"))
+    {
+        if (!f)
+        {
+            throw std::system_error(errno, std::system_category(), path);
+        }
+    }
+
+    ~PcapngFile()
+    {
+        if (f)
+        {
+            fclose(f);
+        }
+    }
+
+    void block(uint32_t type, const vector<uint8_t>& body)
+    {
+        uint32_t total = sizeof(Pcap::BlockHeader) + Pcap::pad4(body.size()) + sizeof(uint32_t);
+        const uint32_t zero = 0;
+        write(&type, sizeof(type));
+        write(&total, sizeof(total));
+        write(body.data(), body.size());
+        write(&zero, Pcap::pad4(body.size()) - body.size());
+        write(&total, sizeof(total));
+    }
+
+    void close()
+    {
+        if (fclose(f))
+        {
+            f = nullptr;
+            throw std::system_error(errno, std::system_category());
+        }
+        f = nullptr;
+    }
+
+private:
+    void write(const void *p, size_t len)
+    {
+        if (len && fwrite(p, len, 1, f) != 1)
+        {
+            throw std::system_error(errno, std::system_category());
+        }
+    }
+
+    FILE *f;
+};
+
+template<class T> void put(vector<uint8_t>& v, const T& val)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&val);
+    v.insert(v.end(), p, p + sizeof(val));
+}
+
+void put_option(vector<uint8_t>& v, uint16_t code, const void *val, uint16_t len)
+{
+    Pcap::OptionHeader opt = { code, len };
+    put(v, opt);
+    const uint8_t *p = static_cast<const uint8_t *>(val);
+    v.insert(v.end(), p, p + len);
+    v.resize(Pcap::pad4(v.size()), 0);
+}
+
+uint16_t ip_checksum(const uint8_t *hdr, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2)
+    {
+        sum += (hdr[i] << 8) | hdr[i + 1];
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+// IPv4/IPv6 + UDP header for a datagram of udp_payload_len bytes between src and dst.
+void put_ip_udp_header(vector<uint8_t>& v, const sockaddr_storage& src, const sockaddr_storage& dst,
+                       uint32_t udp_payload_len)
+{
+    uint16_t udp_len = 8 + udp_payload_len;
+    uint16_t sport;
+    uint16_t dport;
+
+    if (src.ss_family == AF_INET6)
+    {
+        const sockaddr_in6 *s6 = reinterpret_cast<const sockaddr_in6 *>(&src);
+        const sockaddr_in6 *d6 = reinterpret_cast<const sockaddr_in6 *>(&dst);
+        uint8_t ip[40];
+        memset(ip, 0, sizeof(ip));
+        ip[0] = 0x60;
+        ip[4] = udp_len >> 8;
+        ip[5] = udp_len & 0xff;
+        ip[6] = IPPROTO_UDP;
+        ip[7] = 64;
+        memcpy(ip + 8, &s6->sin6_addr, 16);
+        memcpy(ip + 24, &d6->sin6_addr, 16);
+        v.insert(v.end(), ip, ip + sizeof(ip));
+        sport = s6->sin6_port;
+        dport = d6->sin6_port;
+    }
+    else
+    {
+        const sockaddr_in *s4 = reinterpret_cast<const sockaddr_in *>(&src);
+        const sockaddr_in *d4 = reinterpret_cast<const sockaddr_in *>(&dst);
+        uint16_t total = 20 + udp_len;
+        uint8_t ip[20];
+        memset(ip, 0, sizeof(ip));
+        ip[0] = 0x45;
+        ip[2] = total >> 8;
+        ip[3] = total & 0xff;
+        ip[8] = 64;
+        ip[9] = IPPROTO_UDP;
+        memcpy(ip + 12, &s4->sin_addr, 4);
+        memcpy(ip + 16, &d4->sin_addr, 4);
+        uint16_t csum = ip_checksum(ip, sizeof(ip));
+        ip[10] = csum >> 8;
+        ip[11] = csum & 0xff;
+        v.insert(v.end(), ip, ip + sizeof(ip));
+        sport = s4->sin_port;
+        dport = d4->sin_port;
+    }
+
+    // Ports are already in network order, the checksum is left out (0).
+    uint16_t len_be = htons(udp_len);
+    const uint16_t zero = 0;
+    put(v, sport);
+    put(v, dport);
+    put(v, len_be);
+    put(v, zero);
+}
+}
+
+volatile sig_atomic_t FlightRecorder::signalled = 0;
+
+FlightRecorder::FlightRecorder(size_t nr_slots, const string& prefix) : slots(nr_slots), head(0), prefix(prefix)
+{
+    if (!nr_slots)
+    {
+        throw std::runtime_error("FlightRecorder needs at least one slot");
+    }
+}
+
+void FlightRecorder::record(const FlightInfo& info, const void *payload, size_t len)
+{
+    Slot& slot = slots[head++ % slots.size()];
+    slot.info = info;
+    memset(&slot.src, 0, sizeof(slot.src));
+    memset(&slot.dst, 0, sizeof(slot.dst));
+    if (info.src)
+    {
+        slot.src = *info.src;
+    }
+    if (info.dst)
+    {
+        slot.dst = *info.dst;
+    }
+    slot.origlen = len;
+    slot.caplen = len < SNAPLEN ? len : SNAPLEN;
+    memcpy(slot.data, payload, slot.caplen);
+}
+
+string FlightRecorder::dump()
+{
+    signalled = 0;
+    std::ostringstream name;
+    name << prefix << '-' << TscClock::instance().realtime_ns() << ".pcapng";
+    PcapngFile file(name.str());
+
+    vector<uint8_t> body;
+    Pcap::SectionHeader shb = { Pcap::BYTE_ORDER_MAGIC, 1, 0, -1 };
+    put(body, shb);
+    file.block(Pcap::BLOCK_SHB, body);
+
+    body.clear();
+    Pcap::InterfaceDescription idb = { Pcap::LINKTYPE_RAW, 0, 65535 };
+    put(body, idb);
+    const uint8_t tsresol = 9;
+    put_option(body, Pcap::OPT_IF_TSRESOL, &tsresol, sizeof(tsresol));
+    put_option(body, Pcap::OPT_ENDOFOPT, nullptr, 0);
+    file.block(Pcap::BLOCK_IDB, body);
+
+    size_t used = head < slots.size() ? head : slots.size();
+    for (uint64_t i = head - used; i < head; i++)
+    {
+        const Slot& slot = slots[i % slots.size()];
+        const FlightInfo& info = slot.info;
+
+        vector<uint8_t> packet;
+        put_ip_udp_header(packet, slot.src, slot.dst, slot.origlen);
+        uint32_t hdrlen = packet.size();
+        packet.insert(packet.end(), slot.data, slot.data + slot.caplen);
+
+        body.clear();
+        uint64_t ts = info.ts_ns;
+        Pcap::EnhancedPacket epb = { 0, static_cast<uint32_t>(ts >> 32), static_cast<uint32_t>(ts),
+                                     static_cast<uint32_t>(packet.size()), hdrlen + slot.origlen };
+        put(body, epb);
+        body.insert(body.end(), packet.begin(), packet.end());
+        body.resize(Pcap::pad4(body.size()), 0);
+
+        uint32_t epb_flags = info.direction;
+        put_option(body, Pcap::OPT_EPB_FLAGS, &epb_flags, sizeof(epb_flags));
+        std::ostringstream comment;
+        comment << "seq=" << info.seq << " t1=" << info.hw[0] << " t2=" << info.hw[1] << " t2'=" << info.sw[0]
+                << " t3=" << info.hw[2] << " t3'=" << info.sw[1] << " t4=" << info.hw[3];
+        string text = comment.str();
+        put_option(body, Pcap::OPT_COMMENT, text.data(), text.size());
+        put_option(body, Pcap::OPT_ENDOFOPT, nullptr, 0);
+        file.block(Pcap::BLOCK_EPB, body);
+    }
+    file.close();
+
+    return name.str();
+}
+
+void FlightRecorder::on_signal(int)
+{
+    signalled = 1;
+}
+
+void FlightRecorder::install_signal_handler()
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    // Blocking socket calls of the sender and receiver loops carry on; the ones that are never restarted (select,
+    // epoll, sockets with a timeout) handle EINTR themselves.
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGUSR1, &sa, nullptr) == -1)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+}
+
+bool FlightRecorder::dump_requested()
+{
+    return signalled;
+}
+
+LatencyDetector::LatencyDetector(int64_t threshold_ns, double cusum_slack_ns, double cusum_limit_ns, double alpha,
+                                 uint64_t holdoff) :
+    threshold_ns(threshold_ns), slack(cusum_slack_ns), limit(cusum_limit_ns), alpha(alpha), holdoff(holdoff),
+    primed(false), mean(0), cusum(0), quiet(0)
+{
+}
+
+bool LatencyDetector::update(int64_t latency_ns)
+{
+    double x = static_cast<double>(latency_ns);
+    if (!primed)
+    {
+        primed = true;
+        mean = x;
+        return false;
+    }
+
+    bool triggered = threshold_ns > 0 && latency_ns > threshold_ns;
+    if (limit > 0)
+    {
+        cusum = std::max(0.0, cusum + x - mean - slack);
+        triggered = triggered || cusum > limit;
+    }
+    // Baseline keeps tracking slow drift; a sustained jump is caught by the CUSUM before the EWMA absorbs it.
+    mean += alpha * (x - mean);
+
+    if (quiet)
+    {
+        quiet--;
+        return false;
+    }
+    if (triggered)
+    {
+        cusum = 0;
+        quiet = holdoff;
+    }
+    return triggered;
+}
+};
@@ -0,0 +1,100 @@
+#ifndef _FLIGHT_RECORDER_H_
+#define _FLIGHT_RECORDER_H_
+
+#include <string>
+#include <vector>
+
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+namespace Netrounds
+{
+enum FlightDirection
+{
+    FLIGHT_INBOUND = 1,
+    FLIGHT_OUTBOUND = 2
+};
+
+// Everything we know about one probe datagram. Timestamps are ns, 0 when not known. hw[] is indexed by
+// ProbeTimestamp (t1..t4), sw[] holds the userspace t2'/t3'.
+struct FlightInfo
+{
+    int64_t ts_ns;
+    FlightDirection direction;
+    const sockaddr_storage *src;
+    const sockaddr_storage *dst;
+    uint32_t seq;
+    int64_t hw[4];
+    int64_t sw[2];
+};
+
+// Ring of the last N probes, written out as pcapng (LINKTYPE_RAW, ns resolution) when something looks wrong.
+// record() is a fixed-size copy into a preallocated slot; headers are only synthesized when dumping. One writer thread.
+class FlightRecorder
+{
+public:
+    static const size_t SNAPLEN = 128;
+
+    FlightRecorder(size_t nr_slots, const std::string& prefix);
+
+    void record(const FlightInfo& info, const void *payload, size_t len);
+
+    // Write the ring, oldest first, to <prefix>-<realtime ns>.pcapng and return the file name.
+    std::string dump();
+
+    // SIGUSR1 requests a dump, which the I/O loop performs when it sees dump_requested().
+    static void install_signal_handler();
+    static bool dump_requested();
+
+private:
+    struct Slot
+    {
+        FlightInfo info;
+        sockaddr_storage src;
+        sockaddr_storage dst;
+        uint32_t caplen;
+        uint32_t origlen;
+        uint8_t data[SNAPLEN];
+    };
+
+    std::vector<Slot> slots;
+    uint64_t head;
+    std::string prefix;
+
+    static volatile sig_atomic_t signalled;
+    static void on_signal(int);
+};
+
+// Streaming latency anomaly detector: a fixed threshold and a one-sided CUSUM on top of an EWMA baseline. After
+// triggering it stays quiet for holdoff samples, so one spike gives one dump.
+class LatencyDetector
+{
+public:
+    LatencyDetector(int64_t threshold_ns, double cusum_slack_ns, double cusum_limit_ns, double alpha = 0.01,
+                    uint64_t holdoff = 1000);
+
+    bool update(int64_t latency_ns);
+
+    double baseline_ns() const
+    {
+        return mean;
+    }
+
+private:
+    int64_t threshold_ns;
+    double slack;
+    double limit;
+    double alpha;
+    uint64_t holdoff;
+
+    bool primed;
+    double mean;
+    double cusum;
+    uint64_t quiet;
+};
+};
+
+#endif
@@ -9,6 +9,7 @@
 #include <linux/errqueue.h>
 
 #include "gpl_code_remove.h"
+#include "tsc_clock.h"
 
 
 
@@ -24,13 +25,11 @@ void printpacket(struct msghdr *msg, int res,
     struct cmsghdr *cmsg;
     struct timeval tv;
     struct timespec ts;
-    struct timeval now;
+    uint64_t now = Netrounds::TscClock::instance().realtime_ns();
     memset(ts_result, 0, sizeof(*ts_result));
 
-    gettimeofday(&now, 0);
-
-    printf("%ld.%06ld: received %s data, %d bytes from %s, %zu bytes control messages\n",
-           (long)now.tv_sec, (long)now.tv_usec,
+    printf("%ld.%09ld: received %s data, %d bytes from %s, %zu bytes control messages\n",
+           (long)(now / 1000000000), (long)(now % 1000000000),
            (recvmsg_flags & MSG_ERRQUEUE) ? "error" : "regular",
            res,
            inet_ntoa(from_addr->sin_addr),
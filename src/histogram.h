@@ -0,0 +1,112 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <atomic>
+
+#include <cstdint>
+#include <cstddef>
+
+namespace Netrounds
+{
+// Power-of-two latency histogram over nanosecond values. Bucket i counts values in [2^(MIN_SHIFT+i-1), 2^(MIN_SHIFT+i)),
+// the first bucket also takes everything below 2^MIN_SHIFT and the last one is the overflow (+Inf) bucket.
+//
+// Single writer: only the owning thread calls record(), which does relaxed load/store pairs instead of locked
+// read-modify-write. Any thread may read the buckets, e.g. when the metrics endpoint is scraped.
+class Log2Histogram
+{
+public:
+    static const int MIN_SHIFT = 6;  // 64 ns
+    static const int MAX_SHIFT = 32; // ~4.3 s
+    static const int NR_BUCKETS = MAX_SHIFT - MIN_SHIFT + 2;
+
+    Log2Histogram()
+    {
+        reset();
+    }
+
+    void record(uint64_t ns)
+    {
+        bump(buckets[bucket_index(ns)]);
+        bump(sum_ns, ns);
+    }
+
+    static int bucket_index(uint64_t ns)
+    {
+        if (ns < (1ULL << MIN_SHIFT))
+        {
+            return 0;
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        int idx = msb - MIN_SHIFT + 1;
+        return idx < NR_BUCKETS - 1 ? idx : NR_BUCKETS - 1;
+    }
+
+    // Exclusive upper bound of bucket idx in ns, 0 for the overflow bucket.
+    static uint64_t bucket_upper_ns(int idx)
+    {
+        return idx < NR_BUCKETS - 1 ? (1ULL << (MIN_SHIFT + idx)) : 0;
+    }
+
+    uint64_t bucket(int idx) const
+    {
+        return buckets[idx].load(std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        uint64_t total = 0;
+        for (int i = 0; i < NR_BUCKETS; i++)
+        {
+            total += bucket(i);
+        }
+        return total;
+    }
+
+    uint64_t sum() const
+    {
+        return sum_ns.load(std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding quantile q (0..1), 0 if empty or in the overflow bucket.
+    uint64_t quantile_upper_ns(double q) const
+    {
+        uint64_t total = count();
+        if (!total)
+        {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * (total - 1)) + 1;
+        uint64_t cumulative = 0;
+        for (int i = 0; i < NR_BUCKETS; i++)
+        {
+            cumulative += bucket(i);
+            if (cumulative >= rank)
+            {
+                return bucket_upper_ns(i);
+            }
+        }
+        return 0;
+    }
+
+    void reset()
+    {
+        for (int i = 0; i < NR_BUCKETS; i++)
+        {
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+        sum_ns.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static void bump(std::atomic<uint64_t>& c, uint64_t n = 1)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets[NR_BUCKETS];
+    std::atomic<uint64_t> sum_ns;
+};
+};
+
+#endif
@@ -0,0 +1,410 @@
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#include <cstring>
+#include <errno.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "snmp.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+using std::map;
+using std::unique_ptr;
+using std::ostringstream;
+
+namespace Netrounds
+{
+namespace
+{
+struct Registry
+{
+    std::mutex lock;
+    vector<unique_ptr<CounterBlock> > threads;
+    map<string, unique_ptr<CounterBlock> > sessions;
+    map<string, vector<std::pair<string, const Log2Histogram *> > > histograms;
+};
+
+Registry& registry()
+{
+    static Registry reg;
+    return reg;
+}
+
+struct CounterInfo
+{
+    const char *name;
+    const char *help;
+};
+
+const CounterInfo counter_info[NR_METRIC_COUNTERS] =
+{
+    { "packets_sent_total", "Probe packets sent." },
+    { "packets_received_total", "Probe packets received." },
+    { "packets_reflected_total", "Probe packets reflected back to the sender." },
+    { "send_eagain_total", "sendto() calls that returned EAGAIN/EWOULDBLOCK." },
+    { "errqueue_timeouts_total", "Waits for a TX timestamp on the error queue that timed out." },
+    { "hw_timestamp_missing_total", "Received packets without a hardware timestamp." },
+    { "rx_truncated_total", "Received datagrams truncated by recvmsg (MSG_TRUNC)." },
+    { "seq_lost_total", "Probes missing from the sequence number stream." },
+    { "seq_reordered_total", "Probes that arrived with an older sequence number than already seen." },
+    { "rxq_overflow_drops_total", "Datagrams dropped locally because the socket receive queue was full." },
+    { "result_sink_dropped_total", "Output records dropped because the result writer fell behind." },
+    { "result_sink_blocked_total", "Output records that had to wait for room in the result queue." },
+    { "payload_corrupted_total", "Replies whose echoed payload pattern came back altered or cut short." },
+    { "auth_failed_total", "Probes or replies dropped because their authentication tag did not check out." },
+    { "probes_shed_total", "Probes the reflector dropped because their source went over its rate limit." },
+    { "tx_timestamps_stale_total", "TX timestamps of earlier sends that were skipped while waiting for a later one." },
+};
+
+void format_block(ostringstream& out, MetricCounter c, const string& labels, uint64_t val)
+{
+    out << "netrounds_" << counter_info[c].name;
+    if (!labels.empty())
+    {
+        out << '{' << labels << '}';
+    }
+    out << ' ' << val << '\n';
+}
+
+void format_histogram(ostringstream& out, const string& name, const string& labels, const uint64_t *buckets,
+                      uint64_t sum_ns)
+{
+    const string sep = labels.empty() ? "" : ",";
+    uint64_t cumulative = 0;
+    for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+    {
+        cumulative += buckets[i];
+        out << "netrounds_" << name << "_seconds_bucket{" << labels << sep << "le=\"";
+        uint64_t upper = Log2Histogram::bucket_upper_ns(i);
+        if (upper)
+        {
+            out << upper / 1e9;
+        }
+        else
+        {
+            out << "+Inf";
+        }
+        out << "\"} " << cumulative << '\n';
+    }
+    string braces = labels.empty() ? "" : "{" + labels + "}";
+    out << "netrounds_" << name << "_seconds_sum" << braces << ' ' << sum_ns / 1e9 << '\n';
+    out << "netrounds_" << name << "_seconds_count" << braces << ' ' << cumulative << '\n';
+}
+
+void snapshot_histogram(const Log2Histogram& h, uint64_t *buckets)
+{
+    for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+    {
+        buckets[i] += h.bucket(i);
+    }
+}
+
+void add_block(MetricsSnapshot *snap, const CounterBlock& block)
+{
+    for (int c = 0; c < NR_METRIC_COUNTERS; c++)
+    {
+        snap->counters[c] += block.get(static_cast<MetricCounter>(c));
+    }
+    snapshot_histogram(block.latency, snap->buckets);
+    snap->latency_sum_ns += block.latency.sum();
+}
+
+void clear_snapshot(MetricsSnapshot *snap, const string& session)
+{
+    snap->session = session;
+    memset(snap->counters, 0, sizeof(snap->counters));
+    memset(snap->buckets, 0, sizeof(snap->buckets));
+    snap->latency_sum_ns = 0;
+}
+}
+
+CounterBlock& thread_counters()
+{
+    static thread_local CounterBlock *block = nullptr;
+    if (!block)
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> guard(reg.lock);
+        reg.threads.push_back(unique_ptr<CounterBlock>(new CounterBlock));
+        block = reg.threads.back().get();
+    }
+    return *block;
+}
+
+CounterBlock *session_counters(const string& session)
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    unique_ptr<CounterBlock>& block = reg.sessions[session];
+    if (!block)
+    {
+        block.reset(new CounterBlock);
+    }
+    return block.get();
+}
+
+void release_session_counters(const string& session)
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    reg.sessions.erase(session);
+}
+
+void register_histogram(const string& name, const string& labels, const Log2Histogram *hist)
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    reg.histograms[name].push_back(std::make_pair(labels, hist));
+}
+
+string format_metrics()
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    ostringstream out;
+
+    for (int c = 0; c < NR_METRIC_COUNTERS; c++)
+    {
+        MetricCounter mc = static_cast<MetricCounter>(c);
+        out << "# HELP netrounds_" << counter_info[c].name << ' ' << counter_info[c].help << '\n';
+        out << "# TYPE netrounds_" << counter_info[c].name << " counter\n";
+
+        uint64_t total = 0;
+        for (auto& block : reg.threads)
+        {
+            total += block->get(mc);
+        }
+        format_block(out, mc, "", total);
+        for (auto& entry : reg.sessions)
+        {
+            format_block(out, mc, "session=\"" + entry.first + "\"", entry.second->get(mc));
+        }
+    }
+
+    out << "# HELP netrounds_latency_seconds Probe latency (RTT on the sender, residence time on the reflector).\n";
+    out << "# TYPE netrounds_latency_seconds histogram\n";
+    uint64_t buckets[Log2Histogram::NR_BUCKETS];
+    uint64_t sum_ns = 0;
+    memset(buckets, 0, sizeof(buckets));
+    for (auto& block : reg.threads)
+    {
+        snapshot_histogram(block->latency, buckets);
+        sum_ns += block->latency.sum();
+    }
+    format_histogram(out, "latency", "", buckets, sum_ns);
+    for (auto& entry : reg.sessions)
+    {
+        memset(buckets, 0, sizeof(buckets));
+        snapshot_histogram(entry.second->latency, buckets);
+        format_histogram(out, "latency", "session=\"" + entry.first + "\"", buckets, entry.second->latency.sum());
+    }
+
+    for (auto& entry : reg.histograms)
+    {
+        out << "# TYPE netrounds_" << entry.first << "_seconds histogram\n";
+        for (auto& labelled : entry.second)
+        {
+            memset(buckets, 0, sizeof(buckets));
+            snapshot_histogram(*labelled.second, buckets);
+            format_histogram(out, entry.first, labelled.first, buckets, labelled.second->sum());
+        }
+    }
+
+    UdpSnmp snmp;
+    if (read_udp_snmp(&snmp))
+    {
+        out << "# HELP netrounds_host_udp_rcvbuf_errors_total UDP RcvbufErrors of the whole host (/proc/net/snmp).\n";
+        out << "# TYPE netrounds_host_udp_rcvbuf_errors_total counter\n";
+        out << "netrounds_host_udp_rcvbuf_errors_total " << snmp.rcvbuf_errors << '\n';
+        out << "# HELP netrounds_host_udp_sndbuf_errors_total UDP SndbufErrors of the whole host (/proc/net/snmp).\n";
+        out << "# TYPE netrounds_host_udp_sndbuf_errors_total counter\n";
+        out << "netrounds_host_udp_sndbuf_errors_total " << snmp.sndbuf_errors << '\n';
+    }
+
+    return out.str();
+}
+
+const char *metric_counter_name(MetricCounter c)
+{
+    return counter_info[c].name;
+}
+
+void snapshot_metrics(vector<MetricsSnapshot> *out)
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    out->resize(1 + reg.sessions.size());
+    clear_snapshot(&(*out)[0], "");
+    for (auto& block : reg.threads)
+    {
+        add_block(&(*out)[0], *block);
+    }
+    size_t i = 1;
+    for (auto& entry : reg.sessions)
+    {
+        clear_snapshot(&(*out)[i], entry.first);
+        add_block(&(*out)[i], *entry.second);
+        i++;
+    }
+}
+
+MetricsServer::MetricsServer(const string& endpoint) : listen_sock(-1), stop(false)
+{
+    int result;
+
+    if (!endpoint.empty() && endpoint[0] == '/')
+    {
+        sockaddr_un su;
+        if (endpoint.size() >= sizeof(su.sun_path))
+        {
+            throw std::runtime_error("Metrics socket path too long!");
+        }
+        memset(&su, 0, sizeof(su));
+        su.sun_family = AF_UNIX;
+        memcpy(su.sun_path, endpoint.c_str(), endpoint.size());
+
+        listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_sock == -1)
+        {
+            throw std::system_error(errno, std::system_category());
+        }
+        unlink(endpoint.c_str());
+        result = bind(listen_sock, (sockaddr *)&su, sizeof(su));
+        unix_path = endpoint;
+    }
+    else
+    {
+        size_t colon = endpoint.rfind(':');
+        if (colon == string::npos)
+        {
+            throw std::runtime_error("Metrics endpoint must be <host>:<port> or a Unix socket path!");
+        }
+        string host = endpoint.substr(0, colon);
+        int domain = AF_INET;
+        if (host.size() > 1 && host[0] == '[' && host[host.size() - 1] == ']')
+        {
+            host = host.substr(1, host.size() - 2);
+            domain = AF_INET6;
+        }
+        sockaddr_storage ss;
+        create_sockaddr_storage(domain, host, std::stoi(endpoint.substr(colon + 1)), &ss);
+
+        listen_sock = socket(domain, SOCK_STREAM, 0);
+        if (listen_sock == -1)
+        {
+            throw std::system_error(errno, std::system_category());
+        }
+        int enabled = 1;
+        setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+        result = bind(listen_sock, (sockaddr *)&ss, sizeof(ss));
+    }
+
+    if (result == -1 || listen(listen_sock, 8) == -1)
+    {
+        int saved_errno = errno;
+        close(listen_sock);
+        throw std::system_error(saved_errno, std::system_category());
+    }
+
+    thread = std::thread(&MetricsServer::serve, this);
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop = true;
+    thread.join();
+    close(listen_sock);
+    if (!unix_path.empty())
+    {
+        unlink(unix_path.c_str());
+    }
+}
+
+void MetricsServer::serve()
+{
+    const int POLL_TIMEOUT_MS = 200;
+
+    while (!stop)
+    {
+        pollfd pfd;
+        pfd.fd = listen_sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int retval = poll(&pfd, 1, POLL_TIMEOUT_MS);
+        if (retval <= 0)
+        {
+            continue;
+        }
+        int client = accept(listen_sock, nullptr, nullptr);
+        if (client == -1)
+        {
+            continue;
+        }
+        handle_client(client);
+        close(client);
+    }
+}
+
+void MetricsServer::handle_client(int client)
+{
+    // We serve the same document for any request, so just drain the request head before answering.
+    const int READ_TIMEOUT_MS = 1000;
+    char req[2048];
+    size_t reqlen = 0;
+    while (reqlen < sizeof(req) - 1)
+    {
+        pollfd pfd;
+        pfd.fd = client;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, READ_TIMEOUT_MS) <= 0)
+        {
+            return;
+        }
+        ssize_t len = recv(client, req + reqlen, sizeof(req) - 1 - reqlen, 0);
+        if (len <= 0)
+        {
+            return;
+        }
+        reqlen += len;
+        req[reqlen] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+        {
+            break;
+        }
+    }
+
+    string body = format_metrics();
+    ostringstream resp;
+    resp << "HTTP/1.0 200 OK\r\n"
+         << "Content-Type: text/plain; version=0.0.4\r\n"
+         << "Content-Length: " << body.size() << "\r\n"
+         << "Connection: close\r\n\r\n"
+         << body;
+    string out = resp.str();
+
+    size_t sent = 0;
+    while (sent < out.size())
+    {
+        ssize_t len = send(client, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (len <= 0)
+        {
+            return;
+        }
+        sent += len;
+    }
+}
+};
@@ -0,0 +1,123 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+#include "histogram.h"
+
+namespace Netrounds
+{
+enum MetricCounter
+{
+    M_PKTS_SENT,
+    M_PKTS_RECEIVED,
+    M_PKTS_REFLECTED,
+    M_SEND_EAGAIN,
+    M_ERRQUEUE_TIMEOUT,
+    M_HWTS_MISSING,
+    M_RX_TRUNCATED,
+    M_SEQ_LOST,
+    M_SEQ_REORDERED,
+    M_RXQ_OVERFLOW,
+    M_SINK_DROPPED,
+    M_SINK_BLOCKED,
+    M_PAYLOAD_CORRUPTED,
+    M_AUTH_FAILED,
+    M_PROBES_SHED,
+    M_TX_STAMP_STALE,
+    NR_METRIC_COUNTERS
+};
+
+// One set of counters plus a latency histogram. A block has exactly one writer thread, so increments are relaxed
+// load/store pairs; the metrics endpoint reads them concurrently and only formats text when scraped.
+struct CounterBlock
+{
+    CounterBlock()
+    {
+        for (int i = 0; i < NR_METRIC_COUNTERS; i++)
+        {
+            counters[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void inc(MetricCounter c, uint64_t n = 1)
+    {
+        counters[c].store(counters[c].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t get(MetricCounter c) const
+    {
+        return counters[c].load(std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> counters[NR_METRIC_COUNTERS];
+    Log2Histogram latency;
+};
+
+// Per-process counters of the calling thread. The block is registered on first use and lives until exit.
+CounterBlock& thread_counters();
+
+inline void count(MetricCounter c, uint64_t n = 1)
+{
+    thread_counters().inc(c, n);
+}
+
+// Per-session counters, keyed by e.g. peer "addr:port". Lookup takes a lock, so callers cache the returned pointer;
+// a session must only be updated from one thread.
+CounterBlock *session_counters(const std::string& session);
+
+// Drops a session's counters, e.g. of a peer that went away, so that they no longer take memory and exposition
+// space. The pointer session_counters() returned is invalid afterwards; a later session_counters() starts from 0.
+void release_session_counters(const std::string& session);
+
+// Export an extra histogram as Prometheus metric netrounds_<name>_seconds with the given label set (e.g.
+// "stage=\"decode\""). The histogram must outlive the process-wide registry, i.e. be static or leaked.
+void register_histogram(const std::string& name, const std::string& labels, const Log2Histogram *hist);
+
+// Prometheus text exposition of all process and session counters.
+std::string format_metrics();
+
+// Prometheus name of a counter, e.g. "packets_sent_total".
+const char *metric_counter_name(MetricCounter c);
+
+// A copy of one counter block, or of the sum over all thread blocks for the process totals.
+struct MetricsSnapshot
+{
+    std::string session;    // empty for the process totals
+    uint64_t counters[NR_METRIC_COUNTERS];
+    uint64_t buckets[Log2Histogram::NR_BUCKETS];
+    uint64_t latency_sum_ns;
+};
+
+// The process totals first, then every session in the order of their names. Reuses the entries of out, so calling
+// it periodically with the same vector does not allocate once the sessions are known.
+void snapshot_metrics(std::vector<MetricsSnapshot> *out);
+
+// Serves format_metrics() over HTTP on a background thread. The endpoint is either "host:port" for TCP (e.g.
+// "127.0.0.1:9100") or an absolute path for a Unix stream socket.
+class MetricsServer
+{
+public:
+    explicit MetricsServer(const std::string& endpoint);
+    ~MetricsServer();
+
+private:
+    MetricsServer(const MetricsServer&);
+    MetricsServer& operator=(const MetricsServer&);
+
+    void serve();
+    void handle_client(int client);
+
+    int listen_sock;
+    std::string unix_path;
+    std::atomic<bool> stop;
+    std::thread thread;
+};
+};
+
+#endif
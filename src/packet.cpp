@@ -6,6 +6,7 @@
 #include <cassert>
 
 #include <arpa/inet.h>
+#include <endian.h>
 
 #include "packet.h"
 
@@ -19,7 +20,11 @@ using std::tuple;
 
 template<class T1> T1 serialize(T1 val)
 {
-    if (sizeof(T1) == sizeof(uint32_t))
+    if (sizeof(T1) == sizeof(uint64_t))
+    {
+        return static_cast<T1>(htobe64(val));
+    }
+    else if (sizeof(T1) == sizeof(uint32_t))
     {
         return static_cast<T1>(htonl(val));
     }
@@ -42,6 +47,11 @@ template<class T1> T1 deserialize(uint32_t val)
     }
 }
 
+uint64_t deserialize(uint64_t val)
+{
+    return be64toh(val);
+}
+
 namespace Netrounds
 {
 void prepare_packet(char* buf, size_t buflen, uint32_t seq)
@@ -71,12 +81,69 @@ shared_ptr<SenderPacket> decode_packet(char *data, size_t datalen)
     return pkt;
 }
 
+bool peek_packet_type(const char *data, size_t datalen, PacketType *type)
+{
+    uint32_t raw;
+
+    if (datalen < sizeof(SenderPacket))
+    {
+        return false;
+    }
+    memcpy(&raw, data, sizeof(raw));
+    *type = deserialize<PacketType>(raw);
+    switch (*type)
+    {
+    case FROM_SENDER:
+        return true;
+    case FROM_REFLECTOR:
+        return datalen >= sizeof(ReflectorPacket);
+    case FROM_REFLECTOR_ONLY_TIMESTAMPS:
+        return datalen >= sizeof(TimestampReportHeader);
+    default:
+        return false;
+    }
+}
+
+shared_ptr<ReflectorPacket> decode_reflector_packet(const char *data, size_t datalen)
+{
+    assert(datalen >= sizeof(ReflectorPacket));
+
+    shared_ptr<ReflectorPacket> pkt(new ReflectorPacket);
+    decode_reflector_packet(data, datalen, pkt.get());
+
+    return pkt;
+}
+
+bool decode_reflector_packet(const char *data, size_t datalen, ReflectorPacket *pkt)
+{
+    if (datalen < sizeof(ReflectorPacket))
+    {
+        return false;
+    }
+    memcpy(pkt, data, sizeof(*pkt));
+    pkt->type = deserialize<PacketType>(pkt->type);
+    pkt->sender_seq = ntohl(pkt->sender_seq);
+    pkt->refl_seq = ntohl(pkt->refl_seq);
+    pkt->shed = ntohl(pkt->shed);
+    pkt->t2 = deserialize(pkt->t2);
+    pkt->t2_prime = deserialize(pkt->t2_prime);
+    pkt->t3 = deserialize(pkt->t3);
+    pkt->t3_prime = deserialize(pkt->t3_prime);
+
+    return true;
+}
+
 tuple<shared_ptr<char>, size_t> serialize_reflector_packet(shared_ptr<ReflectorPacket>& pkt)
 {
     size_t BUFLEN = 1472;
     pkt->type = serialize(pkt->type);
     pkt->sender_seq = htonl(pkt->sender_seq);
     pkt->refl_seq = htonl(pkt->refl_seq);
+    pkt->shed = htonl(pkt->shed);
+    pkt->t2 = serialize(pkt->t2);
+    pkt->t2_prime = serialize(pkt->t2_prime);
+    pkt->t3 = serialize(pkt->t3);
+    pkt->t3_prime = serialize(pkt->t3_prime);
 
     shared_ptr<char> data(new char[BUFLEN]);
     memset(data.get(), 0, BUFLEN); // TODO: Remove? Not really necessary, but convenient to zero out buffer at start.
@@ -84,4 +151,77 @@ tuple<shared_ptr<char>, size_t> serialize_reflector_packet(shared_ptr<ReflectorP
 
     return tuple<shared_ptr<char>, size_t>(data, BUFLEN);
 }
+
+size_t serialize_reflector_packet(const ReflectorPacket& pkt, char *buf, size_t buflen)
+{
+    ReflectorPacket wire;
+
+    assert(sizeof(wire) <= buflen);
+    memset(&wire, 0, sizeof(wire));
+    wire.type = serialize(pkt.type);
+    wire.sender_seq = htonl(pkt.sender_seq);
+    wire.refl_seq = htonl(pkt.refl_seq);
+    wire.shed = htonl(pkt.shed);
+    wire.t2 = serialize(pkt.t2);
+    wire.t2_prime = serialize(pkt.t2_prime);
+    wire.t3 = serialize(pkt.t3);
+    wire.t3_prime = serialize(pkt.t3_prime);
+    memcpy(buf, &wire, sizeof(wire));
+
+    return sizeof(wire);
+}
+
+size_t serialize_timestamp_report(const TimestampReportEntry *entries, size_t n, char *buf, size_t buflen)
+{
+    TimestampReportHeader header;
+    size_t len = sizeof(header) + n * sizeof(TimestampReportEntry);
+
+    assert(n <= MAX_REPORT_ENTRIES && len <= buflen);
+    header.type = serialize(FROM_REFLECTOR_ONLY_TIMESTAMPS);
+    header.count = htonl(n);
+    memcpy(buf, &header, sizeof(header));
+    char *p = buf + sizeof(header);
+    for (size_t i = 0; i < n; i++)
+    {
+        TimestampReportEntry wire;
+        wire.sender_seq = htonl(entries[i].sender_seq);
+        wire.refl_seq = htonl(entries[i].refl_seq);
+        wire.t2 = serialize(entries[i].t2);
+        wire.t3 = serialize(entries[i].t3);
+        memcpy(p, &wire, sizeof(wire));
+        p += sizeof(wire);
+    }
+
+    return len;
+}
+
+bool decode_timestamp_report(const char *data, size_t datalen, TimestampReportEntry *entries, size_t *n)
+{
+    TimestampReportHeader header;
+
+    if (datalen < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    uint32_t count = ntohl(header.count);
+    if (deserialize<PacketType>(header.type) != FROM_REFLECTOR_ONLY_TIMESTAMPS || count > MAX_REPORT_ENTRIES ||
+        datalen < sizeof(header) + count * sizeof(TimestampReportEntry))
+    {
+        return false;
+    }
+    const char *p = data + sizeof(header);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        memcpy(&entries[i], p, sizeof(entries[i]));
+        entries[i].sender_seq = ntohl(entries[i].sender_seq);
+        entries[i].refl_seq = ntohl(entries[i].refl_seq);
+        entries[i].t2 = deserialize(entries[i].t2);
+        entries[i].t3 = deserialize(entries[i].t3);
+        p += sizeof(entries[i]);
+    }
+    *n = count;
+
+    return true;
+}
 };
@@ -12,7 +12,8 @@ enum PacketType
 {
     FROM_SENDER,
     FROM_REFLECTOR,
-    FROM_REFLECTOR_ONLY_TIMESTAMPS // Used for packets that are 'unsolicited', i.e. not a reflected pkt.
+    FROM_REFLECTOR_ONLY_TIMESTAMPS // Used for packets that are 'unsolicited', i.e. not a reflected pkt: a
+                                   // TimestampReportHeader and its entries.
 };
 
 typedef uint64_t timestamp_t;
@@ -25,22 +26,56 @@ struct SenderPacket
 
 struct ReflectorPacket
 {
-    PacketType type; // FROM_REFLECTOR for normal reflected packet, FROM_REFLECTOR_ONLY_TIMESTAMPS for 'extra' packet.
+    PacketType type; // FROM_REFLECTOR
     uint32_t sender_seq;
     uint32_t refl_seq;
+    // Probes of this sender the reflector's admission control has dropped so far, 0 without one.
+    uint32_t shed;
 
     // Filled in by receiver in returned packet The _prime are SW timestamps from userspace, and are optional. With
     // them, we can compute approximate time spent between HW receive/'return send' timestamp and SW userspace
     // receive/send (need to correlate hw tstamp and system clocks, which is difficul to do)
+    // The _prime values are CLOCK_REALTIME ns read from the calibrated TSC clock, 0 if not filled in.
     timestamp_t t2;
-    // timestamp_t t2_prime;
+    timestamp_t t2_prime;
     timestamp_t t3;
-    // timestamp_t t3_prime;
+    timestamp_t t3_prime;
 };
 
+// Reflector timestamps of probes already replied to, for the t3 that only comes back from the TX timestamp queue
+// once the reply is gone (timestamp_report.h). Many probes share one report datagram: the header, then count entries.
+struct TimestampReportHeader
+{
+    PacketType type; // FROM_REFLECTOR_ONLY_TIMESTAMPS
+    uint32_t count;
+};
+
+struct TimestampReportEntry
+{
+    uint32_t sender_seq;
+    uint32_t refl_seq;
+    timestamp_t t2;
+    timestamp_t t3;
+};
+
+// As many entries as fit a report in an unfragmented IPv6 datagram of 1280 bytes.
+const size_t MAX_REPORT_ENTRIES = (1280 - 48 - sizeof(TimestampReportHeader)) / sizeof(TimestampReportEntry);
+
 void prepare_packet(char* buf, size_t buflen, uint32_t seq);
 std::shared_ptr<SenderPacket> decode_packet(char *data, size_t datalen);
+// Type of a probe datagram of either direction, false if it is too short or not one of ours.
+bool peek_packet_type(const char *data, size_t datalen, PacketType *type);
+std::shared_ptr<ReflectorPacket> decode_reflector_packet(const char *data, size_t datalen);
+// Same without allocating, false if data is too short for a ReflectorPacket.
+bool decode_reflector_packet(const char *data, size_t datalen, ReflectorPacket *pkt);
 std::tuple<std::shared_ptr<char>, size_t> serialize_reflector_packet(std::shared_ptr<ReflectorPacket>& pkt);
+// Wire image of pkt into buf without allocating, returns the bytes written (sizeof(ReflectorPacket)).
+size_t serialize_reflector_packet(const ReflectorPacket& pkt, char *buf, size_t buflen);
+// Wire image of a report of n (at most MAX_REPORT_ENTRIES) entries into buf, returns the bytes written.
+size_t serialize_timestamp_report(const TimestampReportEntry *entries, size_t n, char *buf, size_t buflen);
+// Entries of a report into entries (room for MAX_REPORT_ENTRIES), returns their number. False if data is not a
+// complete report.
+bool decode_timestamp_report(const char *data, size_t datalen, TimestampReportEntry *entries, size_t *n);
 };
 
 #endif
@@ -0,0 +1,579 @@
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <cctype>
+#include <cstring>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AUTH_X86
+#endif
+
+#include <arpa/inet.h>
+
+#include "packet.h"
+#include "packet_auth.h"
+
+namespace Netrounds
+{
+namespace
+{
+const uint8_t SBOX[256] =
+{
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+const uint8_t RCON[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+// Derivation input of a session key, followed by the session id.
+const char SESSION_LABEL[8] = { 'N', 'R', 'a', 'u', 't', 'h', '1', 0 };
+
+inline uint32_t load_be32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 | static_cast<uint32_t>(p[2]) << 8 |
+        p[3];
+}
+
+inline void store_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+inline uint32_t ror32(uint32_t v, int n)
+{
+    return v >> n | v << (32 - n);
+}
+
+// One combined SubBytes/MixColumns table per row, the portable kernel's round is then 16 lookups.
+struct AesTables
+{
+    AesTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            uint32_t s = SBOX[i];
+            uint32_t s2 = (s << 1 ^ (s & 0x80 ? 0x1b : 0)) & 0xff;
+            uint32_t word = s2 << 24 | s << 16 | s << 8 | (s2 ^ s);
+            te[0][i] = word;
+            te[1][i] = ror32(word, 8);
+            te[2][i] = ror32(word, 16);
+            te[3][i] = ror32(word, 24);
+        }
+    }
+
+    uint32_t te[4][256];
+};
+
+const AesTables& aes_tables()
+{
+    static const AesTables tables;
+    return tables;
+}
+
+void encrypt_portable(const uint8_t (*rk)[AesCmac::BLOCK], const uint8_t *in, uint8_t *out)
+{
+    const AesTables& t = aes_tables();
+    uint32_t s0 = load_be32(in) ^ load_be32(rk[0]);
+    uint32_t s1 = load_be32(in + 4) ^ load_be32(rk[0] + 4);
+    uint32_t s2 = load_be32(in + 8) ^ load_be32(rk[0] + 8);
+    uint32_t s3 = load_be32(in + 12) ^ load_be32(rk[0] + 12);
+    for (int r = 1; r < 10; r++)
+    {
+        uint32_t t0 = t.te[0][s0 >> 24] ^ t.te[1][(s1 >> 16) & 0xff] ^ t.te[2][(s2 >> 8) & 0xff] ^
+            t.te[3][s3 & 0xff] ^ load_be32(rk[r]);
+        uint32_t t1 = t.te[0][s1 >> 24] ^ t.te[1][(s2 >> 16) & 0xff] ^ t.te[2][(s3 >> 8) & 0xff] ^
+            t.te[3][s0 & 0xff] ^ load_be32(rk[r] + 4);
+        uint32_t t2 = t.te[0][s2 >> 24] ^ t.te[1][(s3 >> 16) & 0xff] ^ t.te[2][(s0 >> 8) & 0xff] ^
+            t.te[3][s1 & 0xff] ^ load_be32(rk[r] + 8);
+        uint32_t t3 = t.te[0][s3 >> 24] ^ t.te[1][(s0 >> 16) & 0xff] ^ t.te[2][(s1 >> 8) & 0xff] ^
+            t.te[3][s2 & 0xff] ^ load_be32(rk[r] + 12);
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+    // The last round has no MixColumns.
+    uint32_t s[4] = { s0, s1, s2, s3 };
+    for (int c = 0; c < 4; c++)
+    {
+        uint32_t word = static_cast<uint32_t>(SBOX[s[c] >> 24]) << 24 |
+            static_cast<uint32_t>(SBOX[(s[(c + 1) % 4] >> 16) & 0xff]) << 16 |
+            static_cast<uint32_t>(SBOX[(s[(c + 2) % 4] >> 8) & 0xff]) << 8 | SBOX[s[(c + 3) % 4] & 0xff];
+        store_be32(out + 4 * c, word ^ load_be32(rk[10] + 4 * c));
+    }
+}
+
+void expand_key(const uint8_t *key, uint8_t (*rk)[AesCmac::BLOCK])
+{
+    uint32_t w[44];
+    for (int i = 0; i < 4; i++)
+    {
+        w[i] = load_be32(key + 4 * i);
+    }
+    for (int i = 4; i < 44; i++)
+    {
+        uint32_t temp = w[i - 1];
+        if (i % 4 == 0)
+        {
+            temp = (static_cast<uint32_t>(SBOX[(temp >> 16) & 0xff]) << 24 |
+                    static_cast<uint32_t>(SBOX[(temp >> 8) & 0xff]) << 16 |
+                    static_cast<uint32_t>(SBOX[temp & 0xff]) << 8 | SBOX[temp >> 24]) ^
+                static_cast<uint32_t>(RCON[i / 4 - 1]) << 24;
+        }
+        w[i] = w[i - 4] ^ temp;
+    }
+    for (int i = 0; i < 44; i++)
+    {
+        store_be32(rk[i / 4] + 4 * (i % 4), w[i]);
+    }
+}
+
+// Doubling in GF(2^128), how RFC 4493 gets the subkeys.
+void double_block(const uint8_t *in, uint8_t *out)
+{
+    uint8_t carry = in[0] & 0x80 ? 0x87 : 0;
+    for (size_t i = 0; i < AesCmac::BLOCK - 1; i++)
+    {
+        out[i] = in[i] << 1 | in[i + 1] >> 7;
+    }
+    out[AesCmac::BLOCK - 1] = (in[AesCmac::BLOCK - 1] << 1) ^ carry;
+}
+
+inline size_t nr_blocks(size_t len)
+{
+    return len ? (len + AesCmac::BLOCK - 1) / AesCmac::BLOCK : 1;
+}
+
+// The last block of a message with its subkey already added: K1 if it is complete, else padded 10* and K2.
+void last_block(const uint8_t *msg, size_t len, const uint8_t *k1, const uint8_t *k2, uint8_t *out)
+{
+    size_t off = (nr_blocks(len) - 1) * AesCmac::BLOCK;
+    size_t rest = len - off;
+    const uint8_t *k = rest == AesCmac::BLOCK ? k1 : k2;
+    for (size_t i = 0; i < AesCmac::BLOCK; i++)
+    {
+        uint8_t m = i < rest ? msg[off + i] : (i == rest ? 0x80 : 0);
+        out[i] = m ^ k[i];
+    }
+}
+
+#ifdef AUTH_X86
+__attribute__((target("aes"))) inline __m128i encrypt_aesni(const uint8_t (*rk)[AesCmac::BLOCK], __m128i x)
+{
+    x = _mm_xor_si128(x, _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk[0])));
+    for (int r = 1; r < 10; r++)
+    {
+        x = _mm_aesenc_si128(x, _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk[r])));
+    }
+    return _mm_aesenclast_si128(x, _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk[10])));
+}
+
+__attribute__((target("aes"))) void mac_aesni(const uint8_t (*rk)[AesCmac::BLOCK], const uint8_t *msg, size_t len,
+                                              const uint8_t *last, uint8_t *tag)
+{
+    __m128i x = _mm_setzero_si128();
+    size_t blocks = nr_blocks(len);
+    for (size_t b = 0; b + 1 < blocks; b++)
+    {
+        x = encrypt_aesni(rk, _mm_xor_si128(x, _mm_loadu_si128(reinterpret_cast<const __m128i *>(msg + b * 16))));
+    }
+    x = encrypt_aesni(rk, _mm_xor_si128(x, _mm_loadu_si128(reinterpret_cast<const __m128i *>(last))));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(tag), x);
+}
+
+// Round by round across the lanes: each aesenc depends on the previous one of its lane only, so with N lanes in
+// flight the unit is kept busy instead of waiting out each result. N is a template parameter so that the lanes stay
+// in registers.
+template <size_t N>
+__attribute__((target("aes"))) void mac_lanes_aesni(const uint8_t (*const *rk)[AesCmac::BLOCK],
+                                                    const uint8_t *const *msgs, size_t len,
+                                                    const uint8_t (*last)[AesCmac::BLOCK],
+                                                    uint8_t (*tags)[AesCmac::BLOCK])
+{
+    __m128i x[N];
+    size_t blocks = nr_blocks(len);
+    for (size_t l = 0; l < N; l++)
+    {
+        x[l] = _mm_setzero_si128();
+    }
+    for (size_t b = 0; b < blocks; b++)
+    {
+        for (size_t l = 0; l < N; l++)
+        {
+            const uint8_t *in = b + 1 < blocks ? msgs[l] + b * 16 : last[l];
+            x[l] = _mm_xor_si128(x[l], _mm_loadu_si128(reinterpret_cast<const __m128i *>(in)));
+            x[l] = _mm_xor_si128(x[l], _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk[l][0])));
+        }
+        for (int r = 1; r < 10; r++)
+        {
+            for (size_t l = 0; l < N; l++)
+            {
+                x[l] = _mm_aesenc_si128(x[l], _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk[l][r])));
+            }
+        }
+        for (size_t l = 0; l < N; l++)
+        {
+            x[l] = _mm_aesenclast_si128(x[l], _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk[l][10])));
+        }
+    }
+    for (size_t l = 0; l < N; l++)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(tags[l]), x[l]);
+    }
+}
+
+void mac_batch_aesni(const uint8_t (*const *rk)[AesCmac::BLOCK], const uint8_t *const *msgs, size_t len,
+                     const uint8_t (*last)[AesCmac::BLOCK], uint8_t (*tags)[AesCmac::BLOCK], size_t n)
+{
+    static_assert(AesCmac::MAX_BATCH == 8, "one case per batch size");
+    switch (n)
+    {
+    case 1:
+        return mac_lanes_aesni<1>(rk, msgs, len, last, tags);
+    case 2:
+        return mac_lanes_aesni<2>(rk, msgs, len, last, tags);
+    case 3:
+        return mac_lanes_aesni<3>(rk, msgs, len, last, tags);
+    case 4:
+        return mac_lanes_aesni<4>(rk, msgs, len, last, tags);
+    case 5:
+        return mac_lanes_aesni<5>(rk, msgs, len, last, tags);
+    case 6:
+        return mac_lanes_aesni<6>(rk, msgs, len, last, tags);
+    case 7:
+        return mac_lanes_aesni<7>(rk, msgs, len, last, tags);
+    case 8:
+        return mac_lanes_aesni<8>(rk, msgs, len, last, tags);
+    }
+}
+#endif
+
+void mac_portable(const uint8_t (*rk)[AesCmac::BLOCK], const uint8_t *msg, size_t len, const uint8_t *last,
+                  uint8_t *tag)
+{
+    uint8_t x[AesCmac::BLOCK] = {};
+    size_t blocks = nr_blocks(len);
+    for (size_t b = 0; b < blocks; b++)
+    {
+        const uint8_t *in = b + 1 < blocks ? msg + b * AesCmac::BLOCK : last;
+        for (size_t i = 0; i < AesCmac::BLOCK; i++)
+        {
+            x[i] ^= in[i];
+        }
+        encrypt_portable(rk, x, x);
+    }
+    memcpy(tag, x, AesCmac::BLOCK);
+}
+
+AuthKernel detect_kernel()
+{
+#ifdef AUTH_X86
+    if (__builtin_cpu_supports("aes"))
+    {
+        return AUTH_AESNI;
+    }
+#endif
+    return AUTH_PORTABLE;
+}
+
+int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c = tolower(static_cast<unsigned char>(c));
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// Tags compared in time independent of where they differ.
+bool same_tag(const uint8_t *x, const uint8_t *y)
+{
+    uint8_t diff = 0;
+    for (size_t i = 0; i < AUTH_TAG_LEN; i++)
+    {
+        diff |= x[i] ^ y[i];
+    }
+    return !diff;
+}
+}
+
+AuthKernel best_auth_kernel()
+{
+    static const AuthKernel kernel = detect_kernel();
+    return kernel;
+}
+
+const char *auth_kernel_name(AuthKernel kernel)
+{
+    static const char *names[] = { "portable", "aes-ni" };
+    return names[kernel];
+}
+
+AesCmac::AesCmac(const uint8_t key[AUTH_KEY_LEN], AuthKernel kernel) : kernel(kernel)
+{
+    uint8_t zero[BLOCK] = {};
+    uint8_t l[BLOCK];
+    expand_key(key, round_keys);
+    encrypt_block(zero, l);
+    double_block(l, k1);
+    double_block(k1, k2);
+}
+
+void AesCmac::encrypt_block(const uint8_t in[BLOCK], uint8_t out[BLOCK]) const
+{
+#ifdef AUTH_X86
+    if (kernel == AUTH_AESNI)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                         encrypt_aesni(round_keys, _mm_loadu_si128(reinterpret_cast<const __m128i *>(in))));
+        return;
+    }
+#endif
+    encrypt_portable(round_keys, in, out);
+}
+
+void AesCmac::mac(const void *msg, size_t len, uint8_t tag[BLOCK]) const
+{
+    const uint8_t *m = static_cast<const uint8_t *>(msg);
+    uint8_t last[BLOCK];
+    last_block(m, len, k1, k2, last);
+#ifdef AUTH_X86
+    if (kernel == AUTH_AESNI)
+    {
+        mac_aesni(round_keys, m, len, last, tag);
+        return;
+    }
+#endif
+    mac_portable(round_keys, m, len, last, tag);
+}
+
+void AesCmac::mac_batch(const AesCmac *const *keys, const uint8_t *const *msgs, size_t len, uint8_t (*tags)[BLOCK],
+                        size_t n)
+{
+#ifdef AUTH_X86
+    bool all_aesni = true;
+    for (size_t l = 0; l < n; l++)
+    {
+        all_aesni = all_aesni && keys[l]->kernel == AUTH_AESNI;
+    }
+    if (all_aesni)
+    {
+        const uint8_t (*rk[MAX_BATCH])[BLOCK];
+        uint8_t last[MAX_BATCH][BLOCK];
+        for (size_t l = 0; l < n; l++)
+        {
+            rk[l] = keys[l]->round_keys;
+            last_block(msgs[l], len, keys[l]->k1, keys[l]->k2, last[l]);
+        }
+        mac_batch_aesni(rk, msgs, len, last, tags, n);
+        return;
+    }
+#endif
+    for (size_t l = 0; l < n; l++)
+    {
+        keys[l]->mac(msgs[l], len, tags[l]);
+    }
+}
+
+std::vector<uint8_t> load_auth_key(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    std::string line;
+    std::getline(in, line);
+    std::vector<uint8_t> key;
+    size_t i = 0;
+    while (i < line.size() && isspace(static_cast<unsigned char>(line[i])))
+    {
+        i++;
+    }
+    for (; i + 1 < line.size() && key.size() < AUTH_KEY_LEN; i += 2)
+    {
+        int hi = hex_digit(line[i]);
+        int lo = hex_digit(line[i + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            break;
+        }
+        key.push_back(hi << 4 | lo);
+    }
+    while (i < line.size() && isspace(static_cast<unsigned char>(line[i])))
+    {
+        i++;
+    }
+    if (key.size() != AUTH_KEY_LEN || i != line.size())
+    {
+        throw std::runtime_error(path + ": the key must be 32 hex digits");
+    }
+    return key;
+}
+
+PacketAuth::PacketAuth(const uint8_t master[AUTH_KEY_LEN], AuthKernel kernel) :
+    master_cmac(master, kernel), kern(kernel), cache(CACHE_SLOTS)
+{
+    for (auto& slot : cache)
+    {
+        slot.valid = false;
+    }
+}
+
+size_t PacketAuth::min_len(uint32_t type)
+{
+    return (type == FROM_SENDER ? sizeof(SenderPacket) : sizeof(ReflectorPacket)) + AUTH_TRAILER_LEN;
+}
+
+size_t PacketAuth::cache_slot(uint32_t session_id)
+{
+    return (session_id * 0x9e3779b1u) >> 24;
+}
+
+const AesCmac& PacketAuth::session_key(uint32_t session_id)
+{
+    CachedKey& slot = cache[cache_slot(session_id)];
+    if (!slot.valid || slot.session_id != session_id)
+    {
+        uint8_t input[sizeof(SESSION_LABEL) + sizeof(uint32_t)];
+        uint8_t key[AesCmac::BLOCK];
+        memcpy(input, SESSION_LABEL, sizeof(SESSION_LABEL));
+        store_be32(input + sizeof(SESSION_LABEL), session_id);
+        master_cmac.mac(input, sizeof(input), key);
+        slot.cmac = AesCmac(key, kern);
+        slot.session_id = session_id;
+        slot.valid = true;
+    }
+    return slot.cmac;
+}
+
+size_t PacketAuth::message(const char *buf, size_t len, uint8_t *msg) const
+{
+    PacketType type;
+    if (!peek_packet_type(buf, len, &type) || len < min_len(type))
+    {
+        return 0;
+    }
+    size_t covered = type == FROM_SENDER ? sizeof(SenderPacket) : sizeof(ReflectorPacket);
+    memcpy(msg, buf, covered);
+    if (type != FROM_SENDER)
+    {
+        memset(msg + offsetof(ReflectorPacket, t3), 0, sizeof(timestamp_t));
+    }
+    memcpy(msg + covered, buf + len - AUTH_TRAILER_LEN + offsetof(AuthTrailer, session_id), sizeof(uint32_t));
+    return covered + sizeof(uint32_t);
+}
+
+bool PacketAuth::sign(char *buf, size_t len, uint32_t session_id)
+{
+    uint8_t msg[sizeof(ReflectorPacket) + sizeof(uint32_t)];
+    uint8_t tag[AesCmac::BLOCK];
+    uint32_t id = htonl(session_id);
+    PacketType type;
+    if (!peek_packet_type(buf, len, &type) || len < min_len(type))
+    {
+        return false;
+    }
+    memcpy(buf + len - AUTH_TRAILER_LEN + offsetof(AuthTrailer, session_id), &id, sizeof(id));
+    size_t msg_len = message(buf, len, msg);
+    session_key(session_id).mac(msg, msg_len, tag);
+    memcpy(buf + len - AUTH_TRAILER_LEN + offsetof(AuthTrailer, tag), tag, AUTH_TAG_LEN);
+    return true;
+}
+
+bool PacketAuth::verify(const char *buf, size_t len, uint32_t *session_id)
+{
+    bool ok;
+    uint32_t id;
+    verify_batch(&buf, &len, 1, &ok, &id);
+    if (ok && session_id)
+    {
+        *session_id = id;
+    }
+    return ok;
+}
+
+size_t PacketAuth::verify_batch(const char *const *bufs, const size_t *lens, size_t n, bool *ok,
+                                uint32_t *session_ids)
+{
+    const size_t MAX_MSG = sizeof(ReflectorPacket) + sizeof(uint32_t);
+    uint8_t msgs[AesCmac::MAX_BATCH][MAX_MSG];
+    const uint8_t *msg_ptrs[AesCmac::MAX_BATCH];
+    const AesCmac *keys[AesCmac::MAX_BATCH];
+    size_t slots[AesCmac::MAX_BATCH];
+    size_t index[AesCmac::MAX_BATCH];
+    uint8_t tags[AesCmac::MAX_BATCH][AesCmac::BLOCK];
+    size_t passed = 0;
+
+    size_t i = 0;
+    while (i < n)
+    {
+        // Gather datagrams with MAC inputs of one length. A session whose key would evict that of another one in the
+        // batch starts the next batch, the cache hands out references.
+        size_t batch = 0;
+        size_t msg_len = 0;
+        for (; i < n && batch < AesCmac::MAX_BATCH; i++)
+        {
+            size_t len = message(bufs[i], lens[i], msgs[batch]);
+            if (!len)
+            {
+                ok[i] = false;
+                continue;
+            }
+            if (batch && len != msg_len)
+            {
+                break;
+            }
+            uint32_t id;
+            memcpy(&id, bufs[i] + lens[i] - AUTH_TRAILER_LEN + offsetof(AuthTrailer, session_id), sizeof(id));
+            id = ntohl(id);
+            size_t slot = cache_slot(id);
+            bool evicts = false;
+            for (size_t l = 0; l < batch; l++)
+            {
+                evicts = evicts || (slots[l] == slot && session_ids[index[l]] != id);
+            }
+            if (evicts)
+            {
+                break;
+            }
+            msg_len = len;
+            session_ids[i] = id;
+            keys[batch] = &session_key(id);
+            msg_ptrs[batch] = msgs[batch];
+            slots[batch] = slot;
+            index[batch] = i;
+            batch++;
+        }
+        AesCmac::mac_batch(keys, msg_ptrs, msg_len, tags, batch);
+        for (size_t l = 0; l < batch; l++)
+        {
+            const char *trailer = bufs[index[l]] + lens[index[l]] - AUTH_TRAILER_LEN;
+            ok[index[l]] = same_tag(tags[l], reinterpret_cast<const uint8_t *>(trailer) + offsetof(AuthTrailer, tag));
+            passed += ok[index[l]];
+        }
+    }
+    return passed;
+}
+};
@@ -0,0 +1,119 @@
+#ifndef _PACKET_AUTH_H_
+#define _PACKET_AUTH_H_
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Netrounds
+{
+// Authenticated probes: each datagram ends in a trailer with the sender's session id and an AES-128-CMAC (RFC 4493)
+// tag, truncated to AUTH_TAG_LEN bytes, over the probe or reply header and that session id. The key of a session is
+// derived from a pre-shared master key and the session id, so a reflector needs only the master key and a captured
+// session's tags say nothing about the next one's. The MAC covers the header only, sequence numbers and timestamps,
+// not the padding: --pattern is there for that. t3 is left out, as a one-step TX timestamp is written into the
+// reply after it is signed.
+const size_t AUTH_KEY_LEN = 16;
+const size_t AUTH_TAG_LEN = 12;
+
+struct AuthTrailer
+{
+    uint32_t session_id;          // network order
+    uint8_t tag[AUTH_TAG_LEN];
+} __attribute__((packed));
+
+const size_t AUTH_TRAILER_LEN = sizeof(AuthTrailer);
+
+enum AuthKernel
+{
+    AUTH_PORTABLE,
+    AUTH_AESNI
+};
+
+// AES-NI if this CPU has it, decided once.
+AuthKernel best_auth_kernel();
+const char *auth_kernel_name(AuthKernel kernel);
+
+// AES-128-CMAC with a fixed key: the expanded key and both subkeys.
+class AesCmac
+{
+public:
+    static const size_t BLOCK = 16;
+    static const size_t MAX_BATCH = 8;
+
+    // Without a key yet, one has to be assigned before use.
+    AesCmac() : kernel(AUTH_PORTABLE)
+    {
+    }
+
+    AesCmac(const uint8_t key[AUTH_KEY_LEN], AuthKernel kernel = best_auth_kernel());
+
+    void mac(const void *msg, size_t len, uint8_t tag[BLOCK]) const;
+
+    // n (up to MAX_BATCH) messages of the same length, each under its own key. With AES-NI the blocks of all of them
+    // go through the rounds together, which hides most of the instruction latency one message alone would wait on.
+    static void mac_batch(const AesCmac *const *keys, const uint8_t *const *msgs, size_t len, uint8_t (*tags)[BLOCK],
+                          size_t n);
+
+    void encrypt_block(const uint8_t in[BLOCK], uint8_t out[BLOCK]) const;
+
+private:
+    uint8_t round_keys[11][BLOCK];
+    uint8_t k1[BLOCK];
+    uint8_t k2[BLOCK];
+    AuthKernel kernel;
+};
+
+// 32 hex digits from the first line of the file, so the key stays off the command line.
+std::vector<uint8_t> load_auth_key(const std::string& path);
+
+// Signs and checks probe datagrams (FROM_SENDER, FROM_REFLECTOR, FROM_REFLECTOR_ONLY_TIMESTAMPS) with the trailer in
+// their last AUTH_TRAILER_LEN bytes. Session keys are derived on first use and kept in a small cache.
+class PacketAuth
+{
+public:
+    PacketAuth(const uint8_t master[AUTH_KEY_LEN], AuthKernel kernel = best_auth_kernel());
+
+    // Shortest datagram that has room for the header of type (as a PacketType) and the trailer.
+    static size_t min_len(uint32_t type);
+
+    // Writes the trailer of buf[0, len) for session_id. False if buf is not a probe datagram or is too short.
+    bool sign(char *buf, size_t len, uint32_t session_id);
+
+    // True if the trailer's tag is the one of its session; session_id (if not null) gets that session.
+    bool verify(const char *buf, size_t len, uint32_t *session_id);
+
+    // verify() of n datagrams: ok[i] and session_ids[i] (if ok) for each, in batches of up to AesCmac::MAX_BATCH
+    // consecutive datagrams of the same type. Returns how many passed.
+    size_t verify_batch(const char *const *bufs, const size_t *lens, size_t n, bool *ok, uint32_t *session_ids);
+
+    AuthKernel kernel() const
+    {
+        return kern;
+    }
+
+private:
+    static const size_t CACHE_SLOTS = 256;    // direct-mapped on the session id
+
+    struct CachedKey
+    {
+        uint32_t session_id;
+        bool valid;
+        AesCmac cmac;
+    };
+
+    static size_t cache_slot(uint32_t session_id);
+    const AesCmac& session_key(uint32_t session_id);
+    // The MAC input of buf: covered header bytes (t3 zeroed) and the trailer's session id. Returns its length, 0 if
+    // buf is not a probe datagram with room for the trailer.
+    size_t message(const char *buf, size_t len, uint8_t *msg) const;
+
+    AesCmac master_cmac;
+    AuthKernel kern;
+    std::vector<CachedKey> cache;
+};
+};
+
+#endif
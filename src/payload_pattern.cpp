@@ -0,0 +1,256 @@
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PATTERN_X86
+#endif
+
+#include "payload_pattern.h"
+
+namespace Netrounds
+{
+namespace
+{
+// murmur3's finalizer: cheap, and every input bit reaches every output bit.
+const uint32_t MIX1 = 0x85ebca6b;
+const uint32_t MIX2 = 0xc2b2ae35;
+
+inline uint32_t mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= MIX1;
+    x ^= x >> 13;
+    x *= MIX2;
+    x ^= x >> 16;
+    return x;
+}
+
+// Pattern word at packet offset o is mix(key + o / 4).
+inline uint32_t pattern_key(uint32_t seq)
+{
+    return seq * 0x9e3779b1u;
+}
+
+// Scalar from offset o (a multiple of 4) on, for the scalar kernel and the tails of the vector ones.
+void fill_from(char *buf, size_t o, size_t len, uint32_t key)
+{
+    for (; o + 4 <= len; o += 4)
+    {
+        uint32_t word = mix(key + static_cast<uint32_t>(o / 4));
+        memcpy(buf + o, &word, 4);
+    }
+    if (o < len)
+    {
+        uint32_t word = mix(key + static_cast<uint32_t>(o / 4));
+        memcpy(buf + o, &word, len - o);
+    }
+}
+
+void note_bad(size_t offset, uint32_t *bad, size_t max_bad, size_t *nr_bad)
+{
+    if (*nr_bad < max_bad)
+    {
+        bad[*nr_bad] = offset;
+    }
+    (*nr_bad)++;
+}
+
+void verify_word(const char *buf, size_t o, size_t n, uint32_t word, uint32_t *bad, size_t max_bad, size_t *nr_bad)
+{
+    const char *want = reinterpret_cast<const char *>(&word);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (buf[o + i] != want[i])
+        {
+            note_bad(o + i, bad, max_bad, nr_bad);
+        }
+    }
+}
+
+void verify_from(const char *buf, size_t o, size_t len, uint32_t key, uint32_t *bad, size_t max_bad, size_t *nr_bad)
+{
+    for (; o + 4 <= len; o += 4)
+    {
+        uint32_t word = mix(key + static_cast<uint32_t>(o / 4));
+        uint32_t got;
+        memcpy(&got, buf + o, 4);
+        if (got != word)
+        {
+            verify_word(buf, o, 4, word, bad, max_bad, nr_bad);
+        }
+    }
+    if (o < len)
+    {
+        verify_word(buf, o, len - o, mix(key + static_cast<uint32_t>(o / 4)), bad, max_bad, nr_bad);
+    }
+}
+
+#ifdef PATTERN_X86
+// Bit i of mask set: byte base + i differs.
+void note_bad_mask(uint32_t mask, size_t base, uint32_t *bad, size_t max_bad, size_t *nr_bad)
+{
+    while (mask)
+    {
+        note_bad(base + __builtin_ctz(mask), bad, max_bad, nr_bad);
+        mask &= mask - 1;
+    }
+}
+
+__attribute__((target("sse4.1"))) inline __m128i mix4(__m128i x)
+{
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    x = _mm_mullo_epi32(x, _mm_set1_epi32(MIX1));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 13));
+    x = _mm_mullo_epi32(x, _mm_set1_epi32(MIX2));
+    return _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+}
+
+__attribute__((target("sse4.1"))) inline __m128i first_index4(size_t o, uint32_t key)
+{
+    return _mm_add_epi32(_mm_set1_epi32(key + static_cast<uint32_t>(o / 4)), _mm_setr_epi32(0, 1, 2, 3));
+}
+
+// 16 bytes a step from offset o on, the rest scalar. Also the tail of the AVX2 kernel.
+__attribute__((target("sse4.1"))) void fill_sse41(char *buf, size_t o, size_t len, uint32_t key)
+{
+    __m128i idx = first_index4(o, key);
+    for (; o + 16 <= len; o += 16)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buf + o), mix4(idx));
+        idx = _mm_add_epi32(idx, _mm_set1_epi32(4));
+    }
+    fill_from(buf, o, len, key);
+}
+
+__attribute__((target("sse4.1"))) void verify_sse41(const char *buf, size_t o, size_t len, uint32_t key,
+                                                    uint32_t *bad, size_t max_bad, size_t *nr_bad)
+{
+    __m128i idx = first_index4(o, key);
+    for (; o + 16 <= len; o += 16)
+    {
+        __m128i got = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + o));
+        uint32_t same = _mm_movemask_epi8(_mm_cmpeq_epi8(got, mix4(idx)));
+        if (same != 0xffffu)
+        {
+            note_bad_mask(~same & 0xffffu, o, bad, max_bad, nr_bad);
+        }
+        idx = _mm_add_epi32(idx, _mm_set1_epi32(4));
+    }
+    verify_from(buf, o, len, key, bad, max_bad, nr_bad);
+}
+
+__attribute__((target("avx2"))) inline __m256i mix8(__m256i x)
+{
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(MIX1));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 13));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(MIX2));
+    return _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+}
+
+__attribute__((target("avx2"))) inline __m256i first_index8(size_t o, uint32_t key)
+{
+    return _mm256_add_epi32(_mm256_set1_epi32(key + static_cast<uint32_t>(o / 4)),
+                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("avx2"))) void fill_avx2(char *buf, size_t o, size_t len, uint32_t key)
+{
+    __m256i idx = first_index8(o, key);
+    for (; o + 32 <= len; o += 32)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(buf + o), mix8(idx));
+        idx = _mm256_add_epi32(idx, _mm256_set1_epi32(8));
+    }
+    // The tail is legacy SSE code, which stalls on dirty upper halves of the ymm registers.
+    _mm256_zeroupper();
+    fill_sse41(buf, o, len, key);
+}
+
+__attribute__((target("avx2"))) void verify_avx2(const char *buf, size_t o, size_t len, uint32_t key, uint32_t *bad,
+                                                 size_t max_bad, size_t *nr_bad)
+{
+    __m256i idx = first_index8(o, key);
+    for (; o + 32 <= len; o += 32)
+    {
+        __m256i got = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buf + o));
+        uint32_t same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(got, mix8(idx)));
+        if (same != 0xffffffffu)
+        {
+            note_bad_mask(~same, o, bad, max_bad, nr_bad);
+        }
+        idx = _mm256_add_epi32(idx, _mm256_set1_epi32(8));
+    }
+    _mm256_zeroupper();
+    verify_sse41(buf, o, len, key, bad, max_bad, nr_bad);
+}
+#endif
+
+PatternKernel detect_kernel()
+{
+#ifdef PATTERN_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return PATTERN_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1"))
+    {
+        return PATTERN_SSE41;
+    }
+#endif
+    return PATTERN_SCALAR;
+}
+}
+
+PatternKernel best_pattern_kernel()
+{
+    static const PatternKernel kernel = detect_kernel();
+    return kernel;
+}
+
+const char *pattern_kernel_name(PatternKernel kernel)
+{
+    static const char *names[] = { "scalar", "sse4.1", "avx2" };
+    return names[kernel];
+}
+
+void fill_pattern(char *buf, size_t len, uint32_t seq, PatternKernel kernel)
+{
+    uint32_t key = pattern_key(seq);
+    switch (kernel)
+    {
+#ifdef PATTERN_X86
+    case PATTERN_AVX2:
+        fill_avx2(buf, PATTERN_OFFSET, len, key);
+        break;
+    case PATTERN_SSE41:
+        fill_sse41(buf, PATTERN_OFFSET, len, key);
+        break;
+#endif
+    default:
+        fill_from(buf, PATTERN_OFFSET, len, key);
+        break;
+    }
+}
+
+size_t verify_pattern(const char *buf, size_t len, uint32_t seq, uint32_t *bad, size_t max_bad, PatternKernel kernel)
+{
+    uint32_t key = pattern_key(seq);
+    size_t nr_bad = 0;
+    switch (kernel)
+    {
+#ifdef PATTERN_X86
+    case PATTERN_AVX2:
+        verify_avx2(buf, PATTERN_OFFSET, len, key, bad, max_bad, &nr_bad);
+        break;
+    case PATTERN_SSE41:
+        verify_sse41(buf, PATTERN_OFFSET, len, key, bad, max_bad, &nr_bad);
+        break;
+#endif
+    default:
+        verify_from(buf, PATTERN_OFFSET, len, key, bad, max_bad, &nr_bad);
+        break;
+    }
+    return nr_bad;
+}
+};
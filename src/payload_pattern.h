@@ -0,0 +1,38 @@
+#ifndef _PAYLOAD_PATTERN_H_
+#define _PAYLOAD_PATTERN_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "packet.h"
+
+namespace Netrounds
+{
+// Probe padding as a pseudo-random pattern of the sequence number instead of zeros, so corruption or truncation on
+// the way shows up in the echoed reply. The pattern starts after the reply header, which the reflector writes over
+// the probe's, and its 32-bit word at packet offset o is a hash of the sequence number and o / 4: every word is
+// computed on its own, so the kernels below do 8 (AVX2) or 4 (SSE4.1) of them per step, and a shifted payload
+// does not match itself.
+const size_t PATTERN_OFFSET = sizeof(ReflectorPacket);
+
+enum PatternKernel
+{
+    PATTERN_SCALAR,
+    PATTERN_SSE41,
+    PATTERN_AVX2
+};
+
+// The widest kernel this CPU runs, decided once.
+PatternKernel best_pattern_kernel();
+const char *pattern_kernel_name(PatternKernel kernel);
+
+// Fills buf[PATTERN_OFFSET, len) with the pattern of seq. Nothing to do for len <= PATTERN_OFFSET.
+void fill_pattern(char *buf, size_t len, uint32_t seq, PatternKernel kernel = best_pattern_kernel());
+
+// Compares buf[PATTERN_OFFSET, len) with the pattern of seq and returns how many bytes differ. The packet offsets
+// of the first max_bad of them go to bad.
+size_t verify_pattern(const char *buf, size_t len, uint32_t seq, uint32_t *bad, size_t max_bad,
+                      PatternKernel kernel = best_pattern_kernel());
+};
+
+#endif
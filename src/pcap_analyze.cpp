@@ -0,0 +1,154 @@
+#include <stdexcept>
+#include <string>
+#include <iostream>
+#include <memory>
+
+#include <getopt.h>
+
+#include "capture_stream.h"
+#include "clock_offset.h"
+#include "probe_matcher.h"
+#include "result_store.h"
+#include "window_summary.h"
+
+using std::cout;
+using std::string;
+using std::shared_ptr;
+
+using namespace Netrounds;
+
+// Offline counterpart of the sender: reads captures taken on the sender side (t1, t4) and optionally the reflector
+// side (t2, t3), pairs probes by sender_seq and reports the same per-window statistics as the live path. Without a
+// reflector side capture, t2 and t3 are those the reflector put in its replies. With both sides the one-way delays
+// are corrected for the clock offset between the hosts (clock_offset.h).
+
+int main(int argc, char *argv[])
+{
+    int port = 0;
+    size_t window = 100000;
+    size_t match_window = 65536;
+    bool print_records = false;
+    bool print_one_way_series = false;
+
+    const option long_options[] =
+    {
+        { "port", required_argument, 0, 'p' },
+        { "window", required_argument, 0, 'w' },
+        { "match-window", required_argument, 0, 'M' },
+        { "records", no_argument, 0, 'r' },
+        { "one-way", no_argument, 0, 'o' },
+        { 0, 0, 0, 0 }
+    };
+
+    try
+    {
+        int opt;
+        while ((opt = getopt_long(argc, argv, "p:w:M:ro", long_options, 0)) != -1)
+        {
+            switch (opt)
+            {
+            case 'p':
+                port = std::stoi(optarg);
+                break;
+            case 'w':
+                window = std::stoul(optarg);
+                break;
+            case 'M':
+                match_window = std::stoul(optarg);
+                break;
+            case 'r':
+                print_records = true;
+                break;
+            case 'o':
+                print_one_way_series = true;
+                break;
+            default:
+                throw std::runtime_error("Unknown option");
+            }
+        }
+        if (argc - optind < 1 || argc - optind > 2)
+        {
+            throw std::runtime_error("Usage: pcap_analyze [--port <udp port>] [--window <records per report>] "
+                                     "[--match-window <probes>] [--records | --one-way] <sender side capture> "
+                                     "[<reflector side capture>]");
+        }
+
+        CaptureStream sender_side(argv[optind], true, port);
+        shared_ptr<CaptureStream> reflector_side;
+        if (argc - optind == 2)
+        {
+            reflector_side.reset(new CaptureStream(argv[optind + 1], false, port));
+        }
+
+        if (print_records && print_one_way_series)
+        {
+            throw std::runtime_error("--records and --one-way are two different CSV outputs, pick one");
+        }
+
+        ResultStore store(window);
+        ClockOffsetEstimator clock_offset;
+        OneWaySummary one_way;
+        clear_one_way(&one_way);
+        int64_t last_t1 = 0;
+        auto report = [&]()
+        {
+            print_window_summary(cout, summarize_window(store));
+            if (one_way.forward.count)
+            {
+                print_one_way(cout, one_way, clock_offset.estimate(last_t1));
+            }
+            store.clear();
+            clear_one_way(&one_way);
+        };
+        if (print_records)
+        {
+            cout << "seq,t1,t2,t3,t4,flags\n";
+        }
+        if (print_one_way_series)
+        {
+            cout << "seq,t1,forward_ns,reverse_ns,bound_ns\n";
+        }
+        ProbeMatcher matcher(match_window, [&](const ProbeRecord& rec)
+        {
+            if (print_records)
+            {
+                cout << rec.seq << ',' << rec.t1 << ',' << rec.t2 << ',' << rec.t3 << ',' << rec.t4 << ','
+                     << static_cast<int>(rec.flags) << '\n';
+            }
+            OneWayDelay delay = clock_offset.update(rec);
+            if (delay.valid)
+            {
+                add_one_way(&one_way, delay);
+                last_t1 = rec.t1;
+                if (print_one_way_series)
+                {
+                    cout << rec.seq << ',' << rec.t1 << ',' << delay.forward_ns << ',' << delay.reverse_ns << ','
+                         << delay.bound_ns << '\n';
+                }
+            }
+            store.append(rec.seq, rec.t1, rec.t2, rec.t3, rec.t4, rec.flags);
+            if (store.size() == store.capacity())
+            {
+                report();
+            }
+        });
+
+        match_captures(sender_side, reflector_side.get(), &matcher);
+        matcher.flush();
+        if (store.size())
+        {
+            report();
+        }
+        if (matcher.duplicates())
+        {
+            cout << "Ignored " << matcher.duplicates() << " duplicate timestamps\n";
+        }
+    }
+    catch (std::exception &exc)
+    {
+        cout << "Got exception: " << exc.what() << '\n';
+        exit(1);
+    }
+
+    return 0;
+}
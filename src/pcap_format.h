@@ -0,0 +1,93 @@
+#ifndef _PCAP_FORMAT_H_
+#define _PCAP_FORMAT_H_
+
+#include <cstdint>
+
+// On-disk layout of classic pcap and pcapng files, see
+// https://www.tcpdump.org/manpages/pcap-savefile.5.html and https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng
+namespace Pcap
+{
+const uint32_t MAGIC_USEC = 0xa1b2c3d4;
+const uint32_t MAGIC_NSEC = 0xa1b23c4d;
+
+const uint32_t LINKTYPE_ETHERNET = 1;
+const uint32_t LINKTYPE_RAW = 101;
+const uint32_t LINKTYPE_LINUX_SLL = 113;
+const uint32_t LINKTYPE_IPV4 = 228;
+const uint32_t LINKTYPE_IPV6 = 229;
+const uint32_t LINKTYPE_LINUX_SLL2 = 276;
+
+struct FileHeader
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct RecordHeader
+{
+    uint32_t ts_sec;
+    uint32_t ts_frac; // usec or nsec depending on the file magic
+    uint32_t caplen;
+    uint32_t origlen;
+};
+
+// pcapng
+const uint32_t BLOCK_SHB = 0x0a0d0d0a;
+const uint32_t BLOCK_IDB = 0x00000001;
+const uint32_t BLOCK_SPB = 0x00000003;
+const uint32_t BLOCK_EPB = 0x00000006;
+const uint32_t BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+
+const uint16_t OPT_ENDOFOPT = 0;
+const uint16_t OPT_COMMENT = 1;
+const uint16_t OPT_IF_TSRESOL = 9;
+const uint16_t OPT_EPB_FLAGS = 2;
+
+struct BlockHeader
+{
+    uint32_t type;
+    uint32_t total_len;
+};
+
+struct SectionHeader
+{
+    uint32_t byte_order_magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int64_t section_len;
+};
+
+struct InterfaceDescription
+{
+    uint16_t linktype;
+    uint16_t reserved;
+    uint32_t snaplen;
+};
+
+struct EnhancedPacket
+{
+    uint32_t interface_id;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    uint32_t caplen;
+    uint32_t origlen;
+};
+
+struct OptionHeader
+{
+    uint16_t code;
+    uint16_t len;
+};
+
+inline uint32_t pad4(uint32_t len)
+{
+    return (len + 3) & ~3U;
+}
+};
+
+#endif
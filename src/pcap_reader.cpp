@@ -0,0 +1,416 @@
+#include <stdexcept>
+#include <system_error>
+
+#include <cstddef>
+#include <cstring>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <byteswap.h>
+
+#include "pcap_format.h"
+#include "pcap_reader.h"
+
+using std::string;
+
+namespace Netrounds
+{
+namespace
+{
+// Drop mapped pages once this much has been consumed behind the read position.
+const size_t RELEASE_CHUNK = 64 * 1024 * 1024;
+
+const uint16_t ETHERTYPE_IPV4 = 0x0800;
+const uint16_t ETHERTYPE_IPV6 = 0x86dd;
+const uint16_t ETHERTYPE_VLAN = 0x8100;
+const uint16_t ETHERTYPE_QINQ = 0x88a8;
+
+uint16_t be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+}
+
+PcapReader::PcapReader(const string& path) : fd(-1), map(nullptr), map_len(0), pos(0), released(0), swapped(false),
+                                             pcapng(false), linktype(0), nsec(false)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        int saved_errno = errno;
+        close(fd);
+        throw std::system_error(saved_errno, std::system_category(), path);
+    }
+    map_len = st.st_size;
+    if (map_len < sizeof(uint32_t))
+    {
+        close(fd);
+        throw std::runtime_error("Capture file too short: " + path);
+    }
+    void *p = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        int saved_errno = errno;
+        close(fd);
+        throw std::system_error(saved_errno, std::system_category(), path);
+    }
+    map = static_cast<const uint8_t *>(p);
+    madvise(p, map_len, MADV_SEQUENTIAL);
+
+    uint32_t magic;
+    memcpy(&magic, map, sizeof(magic));
+    if (magic == Pcap::BLOCK_SHB)
+    {
+        // Byte order is set by the section header, which next_pcapng() reads first.
+        pcapng = true;
+        return;
+    }
+
+    if (magic == Pcap::MAGIC_USEC || magic == Pcap::MAGIC_NSEC)
+    {
+        swapped = false;
+    }
+    else if (bswap_32(magic) == Pcap::MAGIC_USEC || bswap_32(magic) == Pcap::MAGIC_NSEC)
+    {
+        swapped = true;
+    }
+    else
+    {
+        close_file();
+        throw std::runtime_error("Not a pcap or pcapng file: " + path);
+    }
+    if (map_len < sizeof(Pcap::FileHeader))
+    {
+        close_file();
+        throw std::runtime_error("Truncated pcap header: " + path);
+    }
+    nsec = rd32(map) == Pcap::MAGIC_NSEC;
+    linktype = rd32(map + offsetof(Pcap::FileHeader, linktype)) & 0xffff;
+    pos = sizeof(Pcap::FileHeader);
+}
+
+PcapReader::~PcapReader()
+{
+    close_file();
+}
+
+void PcapReader::close_file()
+{
+    if (map)
+    {
+        munmap(const_cast<uint8_t *>(map), map_len);
+        map = nullptr;
+    }
+    if (fd != -1)
+    {
+        close(fd);
+        fd = -1;
+    }
+}
+
+uint32_t PcapReader::rd32(const uint8_t *p) const
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return swapped ? bswap_32(v) : v;
+}
+
+uint16_t PcapReader::rd16(const uint8_t *p) const
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return swapped ? bswap_16(v) : v;
+}
+
+void PcapReader::release_consumed()
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t upto = pos / page * page;
+    if (upto >= released + RELEASE_CHUNK)
+    {
+        madvise(const_cast<uint8_t *>(map) + released, upto - released, MADV_DONTNEED);
+        released = upto;
+    }
+}
+
+bool PcapReader::next(CapturedPacket *pkt)
+{
+    release_consumed();
+    return pcapng ? next_pcapng(pkt) : next_classic(pkt);
+}
+
+bool PcapReader::next_classic(CapturedPacket *pkt)
+{
+    if (pos + sizeof(Pcap::RecordHeader) > map_len)
+    {
+        return false;
+    }
+    const uint8_t *hdr = map + pos;
+    uint32_t caplen = rd32(hdr + offsetof(Pcap::RecordHeader, caplen));
+    if (pos + sizeof(Pcap::RecordHeader) + caplen > map_len)
+    {
+        // tcpdump killed mid-write, treat as end of capture.
+        return false;
+    }
+    int64_t frac = rd32(hdr + offsetof(Pcap::RecordHeader, ts_frac));
+    pkt->ts_ns = static_cast<int64_t>(rd32(hdr)) * 1000000000LL + (nsec ? frac : frac * 1000);
+    pkt->linktype = linktype;
+    pkt->caplen = caplen;
+    pkt->origlen = rd32(hdr + offsetof(Pcap::RecordHeader, origlen));
+    pkt->data = hdr + sizeof(Pcap::RecordHeader);
+    pos += sizeof(Pcap::RecordHeader) + caplen;
+    return true;
+}
+
+void PcapReader::parse_idb(const uint8_t *body, uint32_t body_len)
+{
+    if (body_len < sizeof(Pcap::InterfaceDescription))
+    {
+        throw std::runtime_error("pcapng: truncated interface description block");
+    }
+    Interface iface;
+    iface.linktype = rd16(body);
+    iface.units_per_sec = 1000000;
+
+    const uint8_t *opt = body + sizeof(Pcap::InterfaceDescription);
+    const uint8_t *end = body + body_len;
+    while (opt + sizeof(Pcap::OptionHeader) <= end)
+    {
+        uint16_t code = rd16(opt);
+        uint16_t len = rd16(opt + 2);
+        const uint8_t *val = opt + sizeof(Pcap::OptionHeader);
+        if (code == Pcap::OPT_ENDOFOPT || val + len > end)
+        {
+            break;
+        }
+        if (code == Pcap::OPT_IF_TSRESOL && len >= 1)
+        {
+            // MSB clear: negative power of 10, set: negative power of 2.
+            uint8_t res = val[0];
+            uint64_t units = 1;
+            for (int i = 0; i < (res & 0x7f); i++)
+            {
+                units *= (res & 0x80) ? 2 : 10;
+            }
+            iface.units_per_sec = units;
+        }
+        opt = val + Pcap::pad4(len);
+    }
+    interfaces.push_back(iface);
+}
+
+bool PcapReader::next_pcapng(CapturedPacket *pkt)
+{
+    for (;;)
+    {
+        if (pos + sizeof(Pcap::BlockHeader) > map_len)
+        {
+            return false;
+        }
+        const uint8_t *block = map + pos;
+        uint32_t type;
+        memcpy(&type, block, sizeof(type));
+
+        if (type == Pcap::BLOCK_SHB)
+        {
+            if (pos + sizeof(Pcap::BlockHeader) + sizeof(Pcap::SectionHeader) > map_len)
+            {
+                return false;
+            }
+            uint32_t bom;
+            memcpy(&bom, block + sizeof(Pcap::BlockHeader), sizeof(bom));
+            if (bom == Pcap::BYTE_ORDER_MAGIC)
+            {
+                swapped = false;
+            }
+            else if (bswap_32(bom) == Pcap::BYTE_ORDER_MAGIC)
+            {
+                swapped = true;
+            }
+            else
+            {
+                throw std::runtime_error("pcapng: bad byte order magic");
+            }
+            interfaces.clear();
+        }
+
+        uint32_t total_len = rd32(block + 4);
+        if (total_len < sizeof(Pcap::BlockHeader) + sizeof(uint32_t) || total_len % 4)
+        {
+            throw std::runtime_error("pcapng: bad block length");
+        }
+        if (pos + total_len > map_len)
+        {
+            return false;
+        }
+        const uint8_t *body = block + sizeof(Pcap::BlockHeader);
+        uint32_t body_len = total_len - sizeof(Pcap::BlockHeader) - sizeof(uint32_t);
+        pos += total_len;
+
+        if (type == Pcap::BLOCK_SHB)
+        {
+            continue;
+        }
+        type = rd32(block);
+        if (type == Pcap::BLOCK_IDB)
+        {
+            parse_idb(body, body_len);
+        }
+        else if (type == Pcap::BLOCK_EPB)
+        {
+            if (body_len < sizeof(Pcap::EnhancedPacket))
+            {
+                throw std::runtime_error("pcapng: truncated enhanced packet block");
+            }
+            uint32_t ifid = rd32(body);
+            if (ifid >= interfaces.size())
+            {
+                throw std::runtime_error("pcapng: packet for undeclared interface");
+            }
+            const Interface& iface = interfaces[ifid];
+            uint64_t units = (static_cast<uint64_t>(rd32(body + 4)) << 32) | rd32(body + 8);
+            pkt->ts_ns = static_cast<int64_t>(static_cast<unsigned __int128>(units) * 1000000000ULL /
+                                              iface.units_per_sec);
+            pkt->linktype = iface.linktype;
+            pkt->caplen = rd32(body + offsetof(Pcap::EnhancedPacket, caplen));
+            pkt->origlen = rd32(body + offsetof(Pcap::EnhancedPacket, origlen));
+            pkt->data = body + sizeof(Pcap::EnhancedPacket);
+            if (sizeof(Pcap::EnhancedPacket) + pkt->caplen > body_len)
+            {
+                throw std::runtime_error("pcapng: packet data exceeds block");
+            }
+            return true;
+        }
+        // Simple packet blocks carry no timestamp and are useless to us, other blocks are skipped as well.
+    }
+}
+
+bool extract_udp(const CapturedPacket& pkt, UdpDatagram *udp)
+{
+    const uint8_t *p = pkt.data;
+    const uint8_t *end = pkt.data + pkt.caplen;
+    uint16_t ethertype;
+
+    switch (pkt.linktype)
+    {
+    case Pcap::LINKTYPE_ETHERNET:
+        if (end - p < 14)
+        {
+            return false;
+        }
+        ethertype = be16(p + 12);
+        p += 14;
+        while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ) && end - p >= 4)
+        {
+            ethertype = be16(p + 2);
+            p += 4;
+        }
+        break;
+    case Pcap::LINKTYPE_LINUX_SLL:
+        if (end - p < 16)
+        {
+            return false;
+        }
+        ethertype = be16(p + 14);
+        p += 16;
+        break;
+    case Pcap::LINKTYPE_LINUX_SLL2:
+        if (end - p < 20)
+        {
+            return false;
+        }
+        ethertype = be16(p);
+        p += 20;
+        break;
+    case Pcap::LINKTYPE_RAW:
+        if (end - p < 1)
+        {
+            return false;
+        }
+        ethertype = (p[0] >> 4) == 6 ? ETHERTYPE_IPV6 : ETHERTYPE_IPV4;
+        break;
+    case Pcap::LINKTYPE_IPV4:
+        ethertype = ETHERTYPE_IPV4;
+        break;
+    case Pcap::LINKTYPE_IPV6:
+        ethertype = ETHERTYPE_IPV6;
+        break;
+    default:
+        return false;
+    }
+
+    memset(&udp->src, 0, sizeof(udp->src));
+    memset(&udp->dst, 0, sizeof(udp->dst));
+    if (ethertype == ETHERTYPE_IPV4)
+    {
+        if (end - p < 20 || (p[0] >> 4) != 4 || p[9] != IPPROTO_UDP)
+        {
+            return false;
+        }
+        // Fragment offset or MF set: our probes are never fragmented.
+        if (be16(p + 6) & 0x3fff)
+        {
+            return false;
+        }
+        sockaddr_in *src = reinterpret_cast<sockaddr_in *>(&udp->src);
+        sockaddr_in *dst = reinterpret_cast<sockaddr_in *>(&udp->dst);
+        src->sin_family = dst->sin_family = AF_INET;
+        memcpy(&src->sin_addr, p + 12, 4);
+        memcpy(&dst->sin_addr, p + 16, 4);
+        p += (p[0] & 0x0f) * 4;
+    }
+    else if (ethertype == ETHERTYPE_IPV6)
+    {
+        if (end - p < 40 || (p[0] >> 4) != 6 || p[6] != IPPROTO_UDP)
+        {
+            return false;
+        }
+        sockaddr_in6 *src = reinterpret_cast<sockaddr_in6 *>(&udp->src);
+        sockaddr_in6 *dst = reinterpret_cast<sockaddr_in6 *>(&udp->dst);
+        src->sin6_family = dst->sin6_family = AF_INET6;
+        memcpy(&src->sin6_addr, p + 8, 16);
+        memcpy(&dst->sin6_addr, p + 24, 16);
+        p += 40;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (end - p < 8)
+    {
+        return false;
+    }
+    uint16_t sport = be16(p);
+    uint16_t dport = be16(p + 2);
+    size_t udp_len = be16(p + 4);
+    if (udp->src.ss_family == AF_INET)
+    {
+        reinterpret_cast<sockaddr_in *>(&udp->src)->sin_port = htons(sport);
+        reinterpret_cast<sockaddr_in *>(&udp->dst)->sin_port = htons(dport);
+    }
+    else
+    {
+        reinterpret_cast<sockaddr_in6 *>(&udp->src)->sin6_port = htons(sport);
+        reinterpret_cast<sockaddr_in6 *>(&udp->dst)->sin6_port = htons(dport);
+    }
+    p += 8;
+    if (udp_len < 8)
+    {
+        return false;
+    }
+    // The capture may be cut by the snaplen, hand out what we have.
+    udp->payload = p;
+    udp->len = udp_len - 8 < static_cast<size_t>(end - p) ? udp_len - 8 : end - p;
+    return true;
+}
+};
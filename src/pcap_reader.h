@@ -0,0 +1,83 @@
+#ifndef _PCAP_READER_H_
+#define _PCAP_READER_H_
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+namespace Netrounds
+{
+struct CapturedPacket
+{
+    int64_t ts_ns;
+    uint32_t linktype;
+    const uint8_t *data;
+    uint32_t caplen;
+    uint32_t origlen;
+};
+
+// Streams packets out of a classic pcap (usec or nsec) or pcapng file of either byte order. The file is mmapped and
+// pages behind the read position are dropped as we go, so memory use stays constant for multi-GB captures. Packet
+// data points into the mapping and is valid until the next call to next().
+class PcapReader
+{
+public:
+    explicit PcapReader(const std::string& path);
+    ~PcapReader();
+
+    // Returns false at end of file. Throws on a malformed capture.
+    bool next(CapturedPacket *pkt);
+
+private:
+    PcapReader(const PcapReader&);
+    PcapReader& operator=(const PcapReader&);
+
+    struct Interface
+    {
+        uint32_t linktype;
+        uint64_t units_per_sec;
+    };
+
+    uint32_t rd32(const uint8_t *p) const;
+    uint16_t rd16(const uint8_t *p) const;
+    void close_file();
+    bool next_classic(CapturedPacket *pkt);
+    bool next_pcapng(CapturedPacket *pkt);
+    void parse_idb(const uint8_t *body, uint32_t body_len);
+    void release_consumed();
+
+    int fd;
+    const uint8_t *map;
+    size_t map_len;
+    size_t pos;
+    size_t released;
+    bool swapped;
+    bool pcapng;
+
+    // classic pcap
+    uint32_t linktype;
+    bool nsec;
+
+    // pcapng, per section
+    std::vector<Interface> interfaces;
+};
+
+// UDP datagram found inside a captured frame.
+struct UdpDatagram
+{
+    sockaddr_storage src;
+    sockaddr_storage dst;
+    const uint8_t *payload;
+    size_t len;
+};
+
+// Strip link, IPv4/IPv6 and UDP headers. Returns false for anything that is not an unfragmented UDP datagram. The
+// payload may be shorter than the datagram if the capture used a snaplen.
+bool extract_udp(const CapturedPacket& pkt, UdpDatagram *udp);
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include <iomanip>
+#include <system_error>
+
+#include <cstring>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf_counters.h"
+
+namespace Netrounds
+{
+namespace
+{
+struct PerfEvent
+{
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+};
+
+const PerfEvent EVENTS[2][PERF_NR_COUNTERS] =
+{
+    {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" }
+    },
+    {
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock-ns" },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches" },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults" },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations" }
+    }
+};
+
+int perf_event_open(perf_event_attr *attr, int group_fd)
+{
+    // pid 0 and cpu -1: the calling thread, on whichever CPU it runs.
+    return syscall(SYS_perf_event_open, attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+}
+
+PerfCounters::PerfCounters(bool allow_hardware) : events(PERF_SOFTWARE), exclude_kernel(false)
+{
+    for (int i = 0; i < PERF_NR_COUNTERS; i++)
+    {
+        fds[i] = -1;
+    }
+    if (allow_hardware && (open_group(PERF_HARDWARE, false) || open_group(PERF_HARDWARE, true)))
+    {
+        return;
+    }
+    if (open_group(PERF_SOFTWARE, false) || open_group(PERF_SOFTWARE, true))
+    {
+        return;
+    }
+    throw std::system_error(errno, std::system_category(), "perf_event_open");
+}
+
+PerfCounters::~PerfCounters()
+{
+    close_group();
+}
+
+// False with errno set if any event of the set could not be opened; a partial group is of no use.
+bool PerfCounters::open_group(PerfEventSet set, bool user_only)
+{
+    for (int i = 0; i < PERF_NR_COUNTERS; i++)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = EVENTS[set][i].type;
+        attr.config = EVENTS[set][i].config;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = i == 0;
+        attr.exclude_hv = 1;
+        attr.exclude_kernel = user_only;
+        fds[i] = perf_event_open(&attr, i == 0 ? -1 : fds[0]);
+        if (fds[i] == -1)
+        {
+            int saved = errno;
+            close_group();
+            errno = saved;
+            return false;
+        }
+    }
+    if (ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == -1)
+    {
+        throw std::system_error(errno, std::system_category(), "PERF_EVENT_IOC_ENABLE");
+    }
+    events = set;
+    exclude_kernel = user_only;
+    return true;
+}
+
+void PerfCounters::close_group()
+{
+    for (int i = PERF_NR_COUNTERS - 1; i >= 0; i--)
+    {
+        if (fds[i] != -1)
+        {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+const char *PerfCounters::name(int i) const
+{
+    return EVENTS[events][i].name;
+}
+
+PerfReading PerfCounters::read() const
+{
+    struct
+    {
+        uint64_t nr;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        uint64_t value[PERF_NR_COUNTERS];
+    } group;
+
+    if (::read(fds[0], &group, sizeof(group)) != static_cast<ssize_t>(sizeof(group)))
+    {
+        throw std::system_error(errno, std::system_category(), "perf counter read");
+    }
+    PerfReading reading;
+    for (int i = 0; i < PERF_NR_COUNTERS; i++)
+    {
+        reading.value[i] = group.value[i];
+        if (group.time_running && group.time_running < group.time_enabled)
+        {
+            reading.value[i] = static_cast<uint64_t>(static_cast<double>(group.value[i]) * group.time_enabled /
+                                                     group.time_running);
+        }
+    }
+    return reading;
+}
+
+PerfProfile::PerfProfile(PerfCounters& counters, uint64_t interval, std::ostream& os) :
+    counters(counters), interval(interval), os(os), last(counters.read()), last_packets(0),
+    last_time(std::chrono::steady_clock::now())
+{
+}
+
+void PerfProfile::report(uint64_t packets)
+{
+    PerfReading now = counters.read();
+    auto time = std::chrono::steady_clock::now();
+    double n = packets - last_packets;
+    double seconds = std::chrono::duration<double>(time - last_time).count();
+
+    std::streamsize precision = os.precision();
+    os << std::setprecision(4) << packets - last_packets << " packets at " << n / seconds / 1e6
+       << " Mpps, per packet:";
+    for (int i = 0; i < PERF_NR_COUNTERS; i++)
+    {
+        os << ' ' << (now.value[i] - last.value[i]) / n << ' ' << counters.name(i);
+    }
+    if (counters.event_set() == PERF_HARDWARE && now.value[0] != last.value[0])
+    {
+        os << " (IPC " << static_cast<double>(now.value[1] - last.value[1]) / (now.value[0] - last.value[0]) << ')';
+    }
+    os << '\n';
+    os.precision(precision);
+
+    last = counters.read();
+    last_packets = packets;
+    last_time = std::chrono::steady_clock::now();
+}
+};
@@ -0,0 +1,87 @@
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+#include <chrono>
+#include <ostream>
+
+#include <cstdint>
+
+namespace Netrounds
+{
+enum PerfEventSet
+{
+    PERF_HARDWARE, // cycles, instructions, cache-misses, branch-misses
+    PERF_SOFTWARE  // task-clock, context-switches, page-faults, cpu-migrations: where the PMU is not exposed (VMs)
+};
+
+const int PERF_NR_COUNTERS = 4;
+
+struct PerfReading
+{
+    uint64_t value[PERF_NR_COUNTERS]; // scaled up if the group was multiplexed off the PMU part of the time
+};
+
+// A perf_event_open group counting the calling thread only, read with one read() of the leader. Uses the hardware
+// events when the PMU is available and falls back to the software ones otherwise; if kernel counting is not
+// permitted (perf_event_paranoid) only user space is counted.
+class PerfCounters
+{
+public:
+    explicit PerfCounters(bool allow_hardware = true);
+    ~PerfCounters();
+
+    PerfEventSet event_set() const
+    {
+        return events;
+    }
+
+    bool user_only() const
+    {
+        return exclude_kernel;
+    }
+
+    const char *name(int i) const;
+
+    PerfReading read() const;
+
+private:
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+
+    bool open_group(PerfEventSet set, bool user_only);
+    void close_group();
+
+    int fds[PERF_NR_COUNTERS];
+    PerfEventSet events;
+    bool exclude_kernel;
+};
+
+// Prints the counter deltas per packet, next to the packet rate, every interval packets. sample() is meant for
+// the hot loop: it only compares until a report is due. The counters are read again after printing, so the
+// report itself is not charged to the next interval.
+class PerfProfile
+{
+public:
+    PerfProfile(PerfCounters& counters, uint64_t interval, std::ostream& os);
+
+    void sample(uint64_t packets)
+    {
+        if (packets - last_packets >= interval)
+        {
+            report(packets);
+        }
+    }
+
+private:
+    void report(uint64_t packets);
+
+    PerfCounters& counters;
+    uint64_t interval;
+    std::ostream& os;
+    PerfReading last;
+    uint64_t last_packets;
+    std::chrono::steady_clock::time_point last_time;
+};
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdexcept>
+
+#include "probe_matcher.h"
+#include "result_store.h"
+
+namespace Netrounds
+{
+ProbeMatcher::ProbeMatcher(size_t window, Sink sink) : slots(window), sink(sink), nr_duplicates(0)
+{
+    if (!window)
+    {
+        throw std::runtime_error("ProbeMatcher window must be > 0");
+    }
+    for (auto& slot : slots)
+    {
+        slot.flags = 0;
+    }
+}
+
+void ProbeMatcher::add(uint32_t seq, ProbeTimestamp which, int64_t ts_ns)
+{
+    ProbeRecord& slot = slots[seq % slots.size()];
+    uint8_t bit = static_cast<uint8_t>(1 << which);
+
+    if (slot.flags && slot.seq != seq)
+    {
+        sink(slot);
+        slot.flags = 0;
+    }
+    if (!slot.flags)
+    {
+        slot.seq = seq;
+        slot.t1 = slot.t2 = slot.t3 = slot.t4 = 0;
+    }
+    if (slot.flags & bit)
+    {
+        // Retransmission or the same packet seen twice (e.g. on two interfaces), keep the first.
+        nr_duplicates++;
+        return;
+    }
+
+    switch (which)
+    {
+    case PROBE_T1:
+        slot.t1 = ts_ns;
+        break;
+    case PROBE_T2:
+        slot.t2 = ts_ns;
+        break;
+    case PROBE_T3:
+        slot.t3 = ts_ns;
+        break;
+    case PROBE_T4:
+        slot.t4 = ts_ns;
+        break;
+    }
+    slot.flags |= bit;
+
+    if (slot.flags == RESULT_COMPLETE)
+    {
+        sink(slot);
+        slot.flags = 0;
+    }
+}
+
+void ProbeMatcher::flush()
+{
+    for (auto& slot : slots)
+    {
+        if (slot.flags)
+        {
+            sink(slot);
+            slot.flags = 0;
+        }
+    }
+}
+};
@@ -0,0 +1,57 @@
+#ifndef _PROBE_MATCHER_H_
+#define _PROBE_MATCHER_H_
+
+#include <functional>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Netrounds
+{
+// t1..t4 of one probe, keyed by sender_seq. flags are ResultFlags.
+struct ProbeRecord
+{
+    uint32_t seq;
+    int64_t t1;
+    int64_t t2;
+    int64_t t3;
+    int64_t t4;
+    uint8_t flags;
+};
+
+// Bit (1 << ProbeTimestamp) is the matching RESULT_HAS_* flag.
+enum ProbeTimestamp
+{
+    PROBE_T1, // sender TX
+    PROBE_T2, // reflector RX
+    PROBE_T3, // reflector TX
+    PROBE_T4  // sender RX
+};
+
+// Joins timestamps of the same probe that arrive separately, e.g. from different capture files. Pending probes live
+// in a fixed ring indexed by seq, so memory is bounded by the window: a probe is emitted when all four timestamps
+// are in, when a probe window sequence numbers later needs its slot, or on flush().
+class ProbeMatcher
+{
+public:
+    typedef std::function<void(const ProbeRecord&)> Sink;
+
+    ProbeMatcher(size_t window, Sink sink);
+
+    void add(uint32_t seq, ProbeTimestamp which, int64_t ts_ns);
+    void flush();
+
+    uint64_t duplicates() const
+    {
+        return nr_duplicates;
+    }
+
+private:
+    std::vector<ProbeRecord> slots;
+    Sink sink;
+    uint64_t nr_duplicates;
+};
+};
+
+#endif
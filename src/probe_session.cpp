@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "packet.h"
+#include "payload_pattern.h"
+#include "probe_session.h"
+#include "probe_train.h"
+#include "result_store.h"
+#include "timestamp_report.h"
+#include "tsc_clock.h"
+#include "util.h"
+
+namespace Netrounds
+{
+Task<void> probe_session(EventLoop& loop, int sock, ProbeSessionConfig config, ProbeMatcher::Sink sink,
+                         ProbeSessionStats *stats)
+{
+    char probe[MAX_SESSION_PROBE_LEN];
+    char rx[MAX_SESSION_PROBE_LEN];
+
+    if (config.probe_len < sizeof(SenderPacket) || config.probe_len > sizeof(probe))
+    {
+        throw std::runtime_error("Probe session length out of range");
+    }
+    memset(probe, 0, sizeof(probe));
+    memset(stats, 0, sizeof(*stats));
+    ProbeMatcher matcher(config.timestamp_reports ? REPORT_MATCH_WINDOW : 1, sink);
+
+    int64_t start = loop.now_ns();
+    for (uint32_t seq = 0; seq < config.count; seq++)
+    {
+        co_await loop.sleep_until(start + static_cast<int64_t>(seq) * config.interval_ns);
+
+        prepare_packet(probe, config.probe_len, seq);
+        if (config.pattern)
+        {
+            fill_pattern(probe, config.probe_len, seq);
+        }
+        co_await loop.send(sock, config.reflector, probe, config.probe_len);
+        stats->sent++;
+        count(M_PKTS_SENT);
+        int64_t deadline = loop.now_ns() + config.reply_timeout_ns;
+
+        ProbeRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.seq = seq;
+        if (config.tx_timestamps)
+        {
+            rec.t1 = co_await loop.tx_timestamp(sock, seq, deadline);
+        }
+
+        RxInfo info;
+        ReflectorPacket reply;
+        bool answered = false;
+        while (!answered && co_await loop.receive(sock, rx, sizeof(rx), &info, deadline))
+        {
+            PacketType type;
+            if (!same_peer(info.peer, config.reflector))
+            {
+                stats->foreign++;
+                continue;
+            }
+            if (!peek_packet_type(rx, info.len, &type))
+            {
+                continue;
+            }
+            if (type == FROM_REFLECTOR_ONLY_TIMESTAMPS && config.timestamp_reports &&
+                merge_timestamp_report(rx, info.len, &matcher))
+            {
+                stats->reports++;
+                continue;
+            }
+            if (type != FROM_REFLECTOR || !decode_reflector_packet(rx, info.len, &reply))
+            {
+                continue;
+            }
+            count(M_PKTS_RECEIVED);
+            if (reply.sender_seq != seq)
+            {
+                stats->stale++;
+                continue;
+            }
+            answered = true;
+            rec.t2 = reply.t2;
+            rec.t3 = reply.t3;
+            rec.t4 = info.hw_ns;
+            if (config.pattern && (info.len != config.probe_len || verify_pattern(rx, info.len, seq, nullptr, 0)))
+            {
+                stats->corrupted++;
+                count(M_PAYLOAD_CORRUPTED);
+            }
+        }
+        if (answered)
+        {
+            stats->replies++;
+        }
+        else
+        {
+            stats->timeouts++;
+        }
+
+        rec.flags = (rec.t1 ? RESULT_HAS_T1 : 0) | (rec.t2 ? RESULT_HAS_T2 : 0) | (rec.t3 ? RESULT_HAS_T3 : 0) |
+            (rec.t4 ? RESULT_HAS_T4 : 0);
+        if (!config.timestamp_reports || !rec.flags)
+        {
+            sink(rec);
+            continue;
+        }
+        // The matcher joins them with t3 from a report, in either order.
+        const int64_t *ts[4] = { &rec.t1, &rec.t2, &rec.t3, &rec.t4 };
+        for (int which = PROBE_T1; which <= PROBE_T4; which++)
+        {
+            if (*ts[which])
+            {
+                matcher.add(seq, static_cast<ProbeTimestamp>(which), *ts[which]);
+            }
+        }
+    }
+
+    if (config.timestamp_reports)
+    {
+        RxInfo info;
+        int64_t deadline = loop.now_ns() + config.reply_timeout_ns;
+        while (co_await loop.receive(sock, rx, sizeof(rx), &info, deadline))
+        {
+            PacketType type;
+            if (!same_peer(info.peer, config.reflector))
+            {
+                stats->foreign++;
+            }
+            else if (peek_packet_type(rx, info.len, &type) && type == FROM_REFLECTOR_ONLY_TIMESTAMPS &&
+                     merge_timestamp_report(rx, info.len, &matcher))
+            {
+                stats->reports++;
+            }
+        }
+        matcher.flush();
+    }
+}
+
+Task<void> multicast_session(EventLoop& loop, int sock, ProbeSessionConfig config, MulticastSink sink,
+                             ProbeSessionStats *stats)
+{
+    char probe[MAX_SESSION_PROBE_LEN];
+    char rx[MAX_SESSION_PROBE_LEN];
+
+    if (config.probe_len < sizeof(SenderPacket) || config.probe_len > sizeof(probe))
+    {
+        throw std::runtime_error("Probe session length out of range");
+    }
+    memset(probe, 0, sizeof(probe));
+    memset(stats, 0, sizeof(*stats));
+
+    int64_t start = loop.now_ns();
+    for (uint32_t seq = 0; seq < config.count; seq++)
+    {
+        co_await loop.sleep_until(start + static_cast<int64_t>(seq) * config.interval_ns);
+
+        prepare_packet(probe, config.probe_len, seq);
+        co_await loop.send(sock, config.reflector, probe, config.probe_len);
+        stats->sent++;
+        count(M_PKTS_SENT);
+        int64_t deadline = std::min(loop.now_ns() + config.reply_timeout_ns,
+                                    start + static_cast<int64_t>(seq + 1) * config.interval_ns);
+
+        ProbeRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.seq = seq;
+        if (config.tx_timestamps)
+        {
+            rec.t1 = co_await loop.tx_timestamp(sock, seq, deadline);
+        }
+
+        RxInfo info;
+        ReflectorPacket reply;
+        uint64_t answers = 0;
+        while (co_await loop.receive(sock, rx, sizeof(rx), &info, deadline))
+        {
+            PacketType type;
+            if (!peek_packet_type(rx, info.len, &type) || type != FROM_REFLECTOR ||
+                !decode_reflector_packet(rx, info.len, &reply))
+            {
+                continue;
+            }
+            count(M_PKTS_RECEIVED);
+            if (reply.sender_seq != seq)
+            {
+                stats->stale++;
+                continue;
+            }
+            answers++;
+            rec.t2 = reply.t2;
+            rec.t3 = reply.t3;
+            rec.t4 = info.hw_ns;
+            rec.flags = (rec.t1 ? RESULT_HAS_T1 : 0) | (rec.t2 ? RESULT_HAS_T2 : 0) | (rec.t3 ? RESULT_HAS_T3 : 0) |
+                (rec.t4 ? RESULT_HAS_T4 : 0);
+            sink(info.peer, rec);
+        }
+        stats->replies += answers;
+        if (!answers)
+        {
+            stats->timeouts++;
+        }
+    }
+}
+
+Task<void> dispersion_session(EventLoop& loop, int sock, ProbeSessionConfig config, size_t train_len,
+                              TrainRecordSink sink, ProbeSessionStats *stats)
+{
+    char rx[MAX_SESSION_PROBE_LEN];
+
+    if (config.probe_len < sizeof(SenderPacket) || config.probe_len > sizeof(rx))
+    {
+        throw std::runtime_error("Probe session length out of range");
+    }
+    if (train_len < 2 || train_len > TRAIN_MAX_SEGMENTS)
+    {
+        throw std::runtime_error("Dispersion trains take 2 to 64 probes");
+    }
+    std::vector<char> probes(train_len * config.probe_len);
+    std::vector<ProbeRecord> recs(train_len);
+    std::vector<bool> answers(train_len);
+    memset(stats, 0, sizeof(*stats));
+
+    int64_t start = loop.now_ns();
+    uint32_t first_seq = 0;
+    for (uint64_t train = 0; first_seq < config.count; train++)
+    {
+        co_await loop.sleep_until(start + static_cast<int64_t>(train) * config.interval_ns);
+
+        size_t n = std::min<size_t>(train_len, config.count - first_seq);
+        build_train(probes.data(), config.probe_len, first_seq, n);
+        size_t sent = send_burst(sock, &config.reflector, probes.data(), config.probe_len, n);
+        if (sent != n)
+        {
+            // The rest no longer leaves right behind the first ones, the sender-limited check sorts that out.
+            stats->split++;
+        }
+        while (sent != n)
+        {
+            co_await loop.wait(sock, EventLoop::WAIT_WRITABLE, EventLoop::NO_DEADLINE);
+            sent += send_burst(sock, &config.reflector, probes.data() + sent * config.probe_len, config.probe_len,
+                               n - sent);
+        }
+        stats->sent += n;
+        int64_t deadline = loop.now_ns() + config.reply_timeout_ns;
+
+        memset(recs.data(), 0, sizeof(recs[0]) * n);
+        std::fill(answers.begin(), answers.end(), false);
+        for (size_t i = 0; i < n; i++)
+        {
+            recs[i].seq = first_seq + i;
+            if (config.tx_timestamps)
+            {
+                recs[i].t1 = co_await loop.tx_timestamp(sock, recs[i].seq, deadline);
+            }
+        }
+
+        RxInfo info;
+        ReflectorPacket reply;
+        size_t answered = 0;
+        while (answered < n && co_await loop.receive(sock, rx, sizeof(rx), &info, deadline))
+        {
+            PacketType type;
+            if (!peek_packet_type(rx, info.len, &type) || type != FROM_REFLECTOR ||
+                !decode_reflector_packet(rx, info.len, &reply))
+            {
+                continue;
+            }
+            count(M_PKTS_RECEIVED);
+            uint32_t i = reply.sender_seq - first_seq;
+            if (i >= n || answers[i])
+            {
+                stats->stale++;
+                continue;
+            }
+            answers[i] = true;
+            answered++;
+            recs[i].t2 = reply.t2;
+            recs[i].t3 = reply.t3;
+            recs[i].t4 = info.hw_ns;
+        }
+        stats->replies += answered;
+        stats->timeouts += n - answered;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            ProbeRecord& rec = recs[i];
+            rec.flags = (rec.t1 ? RESULT_HAS_T1 : 0) | (rec.t2 ? RESULT_HAS_T2 : 0) |
+                (rec.t3 ? RESULT_HAS_T3 : 0) | (rec.t4 ? RESULT_HAS_T4 : 0);
+        }
+        sink(recs.data(), n);
+        first_seq += n;
+    }
+}
+
+Task<void> reflect_session(EventLoop& loop, int sock, uint64_t count)
+{
+    char buf[1500];
+    uint32_t refl_seq = 0;
+    TscClock& clock = TscClock::instance();
+
+    for (uint64_t n = 0; !count || n < count;)
+    {
+        RxInfo info;
+        co_await loop.receive(sock, buf, sizeof(buf), &info, EventLoop::NO_DEADLINE);
+        int64_t t2_prime = clock.realtime_ns();
+
+        PacketType type;
+        if (!peek_packet_type(buf, info.len, &type) || type != FROM_SENDER)
+        {
+            continue;
+        }
+        uint32_t seq;
+        memcpy(&seq, buf + offsetof(SenderPacket, sender_seq), sizeof(seq));
+
+        ReflectorPacket reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.type = FROM_REFLECTOR;
+        reply.sender_seq = ntohl(seq);
+        reply.refl_seq = refl_seq++;
+        reply.t2 = info.hw_ns;
+        reply.t2_prime = t2_prime;
+        reply.t3_prime = clock.realtime_ns();
+        // Replies are as long as the probe and echo its payload, as in ReflectorEngine.
+        size_t len = std::max(serialize_reflector_packet(reply, buf, sizeof(buf)), info.len);
+        co_await loop.send(sock, info.peer, buf, len);
+        Netrounds::count(M_PKTS_REFLECTED);
+        n++;
+    }
+}
+};
@@ -0,0 +1,78 @@
+#ifndef _PROBE_SESSION_H_
+#define _PROBE_SESSION_H_
+
+#include <functional>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+#include "event_loop.h"
+#include "probe_matcher.h"
+
+namespace Netrounds
+{
+const size_t MAX_SESSION_PROBE_LEN = 9000;   // jumbo frames
+
+struct ProbeSessionConfig
+{
+    sockaddr_storage reflector;
+    uint32_t count;
+    int64_t interval_ns;        // probe i is sent interval_ns * i after the start, or as soon as the previous is done
+    size_t probe_len;           // up to MAX_SESSION_PROBE_LEN
+    int64_t reply_timeout_ns;   // from the send, covers both the TX timestamp and the reply
+    bool tx_timestamps;         // the socket has TX hardware timestamping on, OPT_ID numbered from the first probe
+    bool pattern = false;       // probe padding is the payload pattern, checked in the echoed replies
+    bool timestamp_reports = false; // probe_session(): t3 may come later in timestamp reports (timestamp_report.h)
+};
+
+struct ProbeSessionStats
+{
+    uint64_t sent;
+    uint64_t replies;
+    uint64_t timeouts;
+    uint64_t stale;   // replies that came after their probe had timed out
+    uint64_t corrupted; // with config.pattern, replies whose echoed pattern was altered or cut short
+    uint64_t split;     // dispersion_session(), trains the socket buffer took in more than one go
+    uint64_t reports;   // with config.timestamp_reports, reports merged
+    uint64_t foreign;   // probe_session(), datagrams from other than config.reflector, ignored
+};
+
+// One sender session as a coroutine: send a probe, await its TX timestamp, await the reply until the deadline, hand
+// the record to sink, next probe. Any number of them run side by side on one EventLoop, one socket each. stats must
+// outlive the session.
+//
+// With config.timestamp_reports, records that the reply left without t3 wait in a ProbeMatcher of
+// REPORT_MATCH_WINDOW probes for a report to bring it, and go to sink when it does. Those whose report is lost go when
+// the window moves past them or at the end, after one more reply timeout for the last reports.
+const size_t REPORT_MATCH_WINDOW = 4096;
+
+Task<void> probe_session(EventLoop& loop, int sock, ProbeSessionConfig config, ProbeMatcher::Sink sink,
+                         ProbeSessionStats *stats);
+
+// A reply to a multicast probe, the reflector being the reply's source address.
+typedef std::function<void(const sockaddr_storage& reflector, const ProbeRecord& rec)> MulticastSink;
+
+// probe_session() for a multicast group as config.reflector: each probe is sent once for all reflectors of the
+// group, and every reply until the reply timeout or the next probe, whichever is first, goes to sink. Reflectors
+// that do not answer a probe are simply missing from its records. stats->replies counts replies of all reflectors,
+// stats->timeouts the probes nobody answered.
+Task<void> multicast_session(EventLoop& loop, int sock, ProbeSessionConfig config, MulticastSink sink,
+                             ProbeSessionStats *stats);
+
+// The records of one train, in the order its probes were sent.
+typedef std::function<void(const ProbeRecord *recs, size_t n)> TrainRecordSink;
+
+// probe_session() for dispersion measurements (dispersion.h): every interval_ns a train of train_len probes goes out
+// back to back in one send_burst(), config.count probes in all. Then the TX timestamps and the replies of the whole
+// train are collected until the reply timeout, and the train's records go to sink together. Probes that got no reply
+// count as timeouts and keep only t1.
+Task<void> dispersion_session(EventLoop& loop, int sock, ProbeSessionConfig config, size_t train_len,
+                              TrainRecordSink sink, ProbeSessionStats *stats);
+
+// Reflects count probes arriving on sock (0 for no limit) with t2 and the software timestamps filled in.
+Task<void> reflect_session(EventLoop& loop, int sock, uint64_t count);
+};
+
+#endif
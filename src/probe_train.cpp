@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <cstring>
+#include <errno.h>
+
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "metrics.h"
+#include "packet.h"
+#include "probe_train.h"
+#include "util.h"
+
+namespace Netrounds
+{
+const int TRAIN_TX_TIMESTAMPING = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+    SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_OPT_ID |
+    SOF_TIMESTAMPING_OPT_TSONLY;
+
+size_t train_segments(size_t probe_len, size_t wanted)
+{
+    if (probe_len < sizeof(SenderPacket) || probe_len > TRAIN_MAX_BYTES)
+    {
+        throw std::runtime_error("Train probe length out of range");
+    }
+    return std::min(std::min(wanted, TRAIN_MAX_SEGMENTS), TRAIN_MAX_BYTES / probe_len);
+}
+
+void build_train(char *buf, size_t probe_len, uint32_t first_seq, size_t nr_probes, PacketAuth *auth,
+                 uint32_t session_id)
+{
+    for (size_t i = 0; i < nr_probes; i++)
+    {
+        prepare_packet(buf + i * probe_len, probe_len, first_seq + i);
+        if (auth)
+        {
+            auth->sign(buf + i * probe_len, probe_len, session_id);
+        }
+    }
+}
+
+bool send_train(int sock, const sockaddr_storage *dest, const char *buf, size_t probe_len, size_t nr_probes)
+{
+    msghdr msg;
+    iovec entry;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))];
+
+    memset(&msg, 0, sizeof(msg));
+    entry.iov_base = const_cast<char *>(buf);
+    entry.iov_len = probe_len * nr_probes;
+    msg.msg_name = const_cast<sockaddr_storage *>(dest);
+    msg.msg_namelen = dest->ss_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+    msg.msg_iov = &entry;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t segment = probe_len;
+    memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+
+    if (sendmsg(sock, &msg, MSG_DONTWAIT) == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            count(M_SEND_EAGAIN);
+            return false;
+        }
+        throw std::system_error(errno, std::system_category(), "GSO send");
+    }
+    count(M_PKTS_SENT, nr_probes);
+    return true;
+}
+
+size_t send_burst(int sock, const sockaddr_storage *dest, const char *buf, size_t probe_len, size_t nr_probes)
+{
+    mmsghdr msgs[TRAIN_MAX_SEGMENTS];
+    iovec entries[TRAIN_MAX_SEGMENTS];
+
+    nr_probes = std::min(nr_probes, TRAIN_MAX_SEGMENTS);
+    memset(msgs, 0, sizeof(msgs[0]) * nr_probes);
+    for (size_t i = 0; i < nr_probes; i++)
+    {
+        entries[i].iov_base = const_cast<char *>(buf + i * probe_len);
+        entries[i].iov_len = probe_len;
+        msgs[i].msg_hdr.msg_name = const_cast<sockaddr_storage *>(dest);
+        msgs[i].msg_hdr.msg_namelen = dest->ss_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+        msgs[i].msg_hdr.msg_iov = &entries[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int sent = sendmmsg(sock, msgs, nr_probes, MSG_DONTWAIT);
+    if (sent == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            count(M_SEND_EAGAIN);
+            return 0;
+        }
+        throw std::system_error(errno, std::system_category(), "sendmmsg");
+    }
+    count(M_PKTS_SENT, sent);
+    return sent;
+}
+
+size_t drain_train_tx_timestamps(int sock, uint32_t *last_key)
+{
+    size_t stamps = 0;
+    for (;;)
+    {
+        msghdr msg;
+        alignas(cmsghdr) char control[512];
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return stamps;
+            }
+            throw std::system_error(errno, std::system_category());
+        }
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+            {
+                stamps++;
+            }
+            else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                     (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+                {
+                    *last_key = err.ee_data;
+                }
+            }
+        }
+    }
+}
+
+void enable_gro(int sock)
+{
+    int enabled = 1;
+    if (setsockopt(sock, SOL_UDP, UDP_GRO, &enabled, sizeof(enabled)) == -1)
+    {
+        throw std::system_error(errno, std::system_category(), "UDP_GRO");
+    }
+}
+
+ssize_t receive_train(int sock, char *buf, size_t buflen, size_t *segment_len, int64_t *sw_ns)
+{
+    msghdr msg;
+    iovec entry;
+    alignas(cmsghdr) char control[512];
+
+    ssize_t len;
+    // A read that does not fit is not a train of ours: count it and go on with the next one.
+    do
+    {
+        memset(&msg, 0, sizeof(msg));
+        entry.iov_base = buf;
+        entry.iov_len = buflen;
+        msg.msg_iov = &entry;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        len = recvmsg(sock, &msg, MSG_DONTWAIT);
+        if (len == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return -1;
+            }
+            throw std::system_error(errno, std::system_category());
+        }
+        if (msg.msg_flags & MSG_TRUNC)
+        {
+            count(M_RX_TRUNCATED);
+        }
+    } while (msg.msg_flags & MSG_TRUNC);
+
+    *segment_len = len;
+    *sw_ns = 0;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+        {
+            int segment;
+            memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+            *segment_len = segment;
+        }
+        else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+        {
+            timespec stamps[3];
+            memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            *sw_ns = timespec_to_ns(stamps[0]);
+        }
+    }
+    return len;
+}
+
+TrainSink::TrainSink(int sock) :
+    sock(sock), auth(nullptr), buf(TRAIN_MAX_BYTES + 28), verified(new bool[buf.size() / sizeof(SenderPacket) + 1])
+{
+    memset(&rx_stats, 0, sizeof(rx_stats));
+    enable_gro(sock);
+}
+
+size_t TrainSink::poll()
+{
+    size_t probes = 0;
+    size_t segment_len;
+    int64_t sw_ns;
+    ssize_t len;
+    while ((len = receive_train(sock, buf.data(), buf.size(), &segment_len, &sw_ns)) >= 0)
+    {
+        rx_stats.reads++;
+        if (sw_ns)
+        {
+            rx_stats.stamped_reads++;
+        }
+        // The last segment of a coalesced read may be shorter than the others.
+        segments.clear();
+        segment_lens.clear();
+        for (size_t off = 0; off < static_cast<size_t>(len); off += segment_len)
+        {
+            segments.push_back(buf.data() + off);
+            segment_lens.push_back(std::min(segment_len, len - off));
+        }
+        // A read holds up to UDP_MAX_SEGMENTS datagrams, so they are verified together rather than one at a time.
+        if (auth)
+        {
+            session_ids.resize(segments.size());
+            auth->verify_batch(segments.data(), segment_lens.data(), segments.size(), verified.get(),
+                               session_ids.data());
+        }
+        uint64_t nr_segments = 0;
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            PacketType type;
+            if (!peek_packet_type(segments[i], segment_lens[i], &type) || type != FROM_SENDER)
+            {
+                continue;
+            }
+            if (auth && !verified[i])
+            {
+                rx_stats.rejected++;
+                count(M_AUTH_FAILED);
+                continue;
+            }
+            uint32_t seq;
+            memcpy(&seq, segments[i] + offsetof(SenderPacket, sender_seq), sizeof(seq));
+            seq_tracker.update(ntohl(seq));
+            nr_segments++;
+        }
+        rx_stats.probes += nr_segments;
+        rx_stats.max_segments = std::max(rx_stats.max_segments, nr_segments);
+        probes += nr_segments;
+    }
+    count(M_PKTS_RECEIVED, probes);
+    return probes;
+}
+};
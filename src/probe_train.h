@@ -0,0 +1,107 @@
+#ifndef _PROBE_TRAIN_H_
+#define _PROBE_TRAIN_H_
+
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "engine.h"
+#include "packet_auth.h"
+
+namespace Netrounds
+{
+// Trains of equal-size probes for throughput tests, sent with UDP GSO: one sendmsg() carries the probes of a train
+// back to back in one buffer and the stack (or the NIC) cuts it into datagrams of probe_len. A UDP_GRO socket gets
+// them back coalesced, with the segment size in a UDP_GRO cmsg.
+//
+// Timestamping follows the coalesced units, not the probes: a GSO send gets one TX timestamp, the kernel keeping the
+// request on the first segment only, and a GRO read one RX timestamp. Senders and sinks count them so this shows in
+// their reports.
+const size_t TRAIN_MAX_SEGMENTS = 64;    // UDP_MAX_SEGMENTS
+const size_t TRAIN_MAX_BYTES = 65507;    // largest IPv4 UDP payload, also used for IPv6
+
+// SO_TIMESTAMPING flags for a train sender: TX timestamps in software and, where the device does them, hardware,
+// numbered per send (OPT_ID) and without the looped back payload.
+extern const int TRAIN_TX_TIMESTAMPING;
+
+// How many probes of probe_len one send can carry, at most wanted.
+size_t train_segments(size_t probe_len, size_t wanted);
+
+// Writes nr_probes probe headers with consecutive sequence numbers from first_seq, probe_len apart, each signed for
+// session_id if auth is given.
+void build_train(char *buf, size_t probe_len, uint32_t first_seq, size_t nr_probes, PacketAuth *auth = nullptr,
+                 uint32_t session_id = 0);
+
+// One GSO send of the nr_probes probes in buf. False if the socket buffer is full.
+bool send_train(int sock, const sockaddr_storage *dest, const char *buf, size_t probe_len, size_t nr_probes);
+
+// The nr_probes probes in buf as separate datagrams in one sendmmsg(), so they leave back to back and each gets its
+// own TX timestamp. Returns how many went, 0 if the socket buffer is full.
+size_t send_burst(int sock, const sockaddr_storage *dest, const char *buf, size_t probe_len, size_t nr_probes);
+
+// Reads the TX timestamps queued on the error queue without waiting. Returns how many there were; last_key gets the
+// OPT_ID (send number) of the last one.
+size_t drain_train_tx_timestamps(int sock, uint32_t *last_key);
+
+void enable_gro(int sock);
+
+// One non-blocking read from a UDP_GRO socket, -1 if nothing is queued. segment_len gets the length of the
+// coalesced datagrams (the whole read when it is a single one), sw_ns the software RX timestamp or 0. Reads longer
+// than buflen are dropped (M_RX_TRUNCATED), it returns the next one.
+ssize_t receive_train(int sock, char *buf, size_t buflen, size_t *segment_len, int64_t *sw_ns);
+
+// What a train sink saw: reads against probes shows how far GRO coalesced them.
+struct TrainRxStats
+{
+    uint64_t reads;
+    uint64_t probes;
+    uint64_t stamped_reads;
+    uint64_t max_segments;    // most probes in one read
+    uint64_t rejected;        // probes that failed authentication
+};
+
+// Receive side of a train test: reads a UDP_GRO socket, splits the reads into probes and tracks their sequence.
+class TrainSink
+{
+public:
+    explicit TrainSink(int sock);
+
+    // Authenticated mode: the probes of a read are verified together (PacketAuth::verify_batch()) and those that
+    // fail are not counted. auth must outlive the sink.
+    void set_auth(PacketAuth *packet_auth)
+    {
+        auth = packet_auth;
+    }
+
+    // Reads everything queued, returns the number of probes.
+    size_t poll();
+
+    const TrainRxStats& stats() const
+    {
+        return rx_stats;
+    }
+
+    const SeqTracker& seq() const
+    {
+        return seq_tracker;
+    }
+
+private:
+    int sock;
+    PacketAuth *auth;
+    std::vector<char> buf;
+    std::vector<const char *> segments;
+    std::vector<size_t> segment_lens;
+    std::vector<uint32_t> session_ids;
+    std::unique_ptr<bool[]> verified;    // one per segment a read can hold
+    TrainRxStats rx_stats;
+    SeqTracker seq_tracker;
+};
+};
+
+#endif
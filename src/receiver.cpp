@@ -1,19 +1,43 @@
+#include <algorithm>
+#include <limits>
 #include <stdexcept>
 #include <string>
 #include <iostream>
+#include <memory>
 #include <system_error>
+#include <vector>
 
 #include <cstring>
 #include <cassert>
 
 #include <unistd.h>
+#include <poll.h>
+#include <getopt.h>
 #include <netinet/in.h>
 #include <linux/net_tstamp.h>
 #include <bsd/string.h>
 
 #include "packet.h"
 #include "util.h"
+#include "metrics.h"
+#include "stage_timer.h"
+#include "tsc_clock.h"
+#include "flight_recorder.h"
+#include "probe_matcher.h"
+#include "engine.h"
+#include "packet_auth.h"
+#include "admission.h"
+#include "timestamp_report.h"
+#include "perf_counters.h"
+#include "rx_path.h"
+#include "probe_train.h"
+#include "zerocopy.h"
+#include "snmp.h"
+#include "stats_page.h"
 #include "sender.h"
+#ifdef XDP_REFLECTOR
+#include "xdp_reflector.h"
+#endif
 
 using std::stoi;
 using std::cout;
@@ -23,7 +47,214 @@ using std::shared_ptr;
 
 using namespace Netrounds;
 
-void receive_loop(string address, in_port_t listen_port, int domain, string iface_name)
+#ifdef XDP_REFLECTOR
+#define XDP_USAGE "[--xdp <skb|native|tc>] [--xdp-object <file>] "
+#else
+#define XDP_USAGE ""
+#endif
+
+// Optional reflector features, set from the command line.
+struct ReflectorConfig
+{
+    ReflectorConfig() : flight_slots(0), flight_threshold_ns(0), fast_path(false), ts_mode(TS_HARDWARE),
+        train_sink(false), zerocopy(false), perf(false), rate_limit_pps(0), rate_burst(16),
+        report_entries(0), report_delay_ns(DEFAULT_REPORT_DELAY_NS)
+#ifdef XDP_REFLECTOR
+        , in_kernel(false), reflect_mode(REFLECT_XDP_SKB), bpf_object_path("xdp_reflector.bpf.o")
+#endif
+    {
+    }
+
+    size_t flight_slots;         // 0 disables the flight recorder
+    int64_t flight_threshold_ns; // residence time that triggers a dump, 0 for CUSUM only
+    SocketBuffers buffers;
+    bool fast_path;              // ReflectorEngine on an RxPath instead of receive_loop()
+    TimestampMode ts_mode;
+    string multicast_group;      // joined on the interface, empty for unicast only
+    bool train_sink;             // count GSO probe trains with UDP_GRO instead of reflecting
+    bool zerocopy;               // fast path replies with MSG_ZEROCOPY
+    bool perf;                   // fast path reports perf counters per reflected packet
+    string auth_key_path;        // authenticated probes only (packet_auth.h), empty to take any
+    double rate_limit_pps;       // per-source admission control (admission.h), 0 for none
+    double rate_burst;
+    size_t report_entries;       // receive_loop() sends t3 in timestamp reports of this many probes, 0 for none
+    int64_t report_delay_ns;     // or when the oldest probe of a report has waited this long
+#ifdef XDP_REFLECTOR
+    bool in_kernel;              // reflect from XDP/tc instead of receive_loop()
+    ReflectMode reflect_mode;
+    string bpf_object_path;
+#endif
+};
+
+// Multicast probes are reflected like unicast ones, the reply going unicast to the sender.
+void join_configured_group(int sock, int domain, string iface_name, const ReflectorConfig& config)
+{
+    if (config.multicast_group.empty())
+    {
+        return;
+    }
+    sockaddr_storage group;
+    create_sockaddr_storage(domain, config.multicast_group, 0, &group);
+    join_multicast_group(sock, &group, iface_name);
+    cout << "Joined multicast group " << config.multicast_group << " on " << iface_name << '\n';
+}
+
+struct ReflectorSession
+{
+    string name;                 // "addr:port", of the counters
+    CounterBlock *counters;
+    SeqTracker seq;
+    sockaddr_storage peer;
+    TimestampBatch reports;
+    int64_t last_ns;             // monotonic, of the latest probe
+};
+
+// receive_loop() sessions by peer address and port, in a fixed table of SESSION_WAYS-way sets like
+// ReflectorEngine's: one hash and at most SESSION_WAYS compares per probe, making room for a new peer included. A
+// session whose peer has been quiet for SESSION_IDLE_NS goes, counters and all; a new peer whose set is full regardless
+// takes the place of the set's quietest. Free slots have an AF_UNSPEC peer.
+struct SessionTable
+{
+    static const size_t SESSION_WAYS = 8;
+
+    std::vector<ReflectorSession> table;
+    size_t set_mask;
+    int64_t next_report_ns;      // realtime, no report is due before
+};
+const size_t MAX_SESSIONS = 4096;
+const int64_t SESSION_IDLE_NS = 60 * 1000000000LL;
+
+void init_sessions(SessionTable& sessions)
+{
+    ReflectorSession free_slot;
+    free_slot.counters = nullptr;
+    memset(&free_slot.peer, 0, sizeof(free_slot.peer));
+    free_slot.peer.ss_family = AF_UNSPEC;
+    free_slot.last_ns = 0;
+    sessions.table.assign(MAX_SESSIONS, free_slot);
+    sessions.set_mask = MAX_SESSIONS / SessionTable::SESSION_WAYS - 1;
+    sessions.next_report_ns = std::numeric_limits<int64_t>::max();
+}
+
+// Sends the session's timestamp report without a TX timestamp, which would only have to be waited for and thrown
+// away lest it pass for that of the next reply. A report the socket has no room for is dropped, the sender does
+// without its t3.
+void send_timestamp_report(int sock, ReflectorSession& session)
+{
+    char buf[sizeof(TimestampReportHeader) + MAX_REPORT_ENTRIES * sizeof(TimestampReportEntry)];
+    size_t len = session.reports.take(buf, sizeof(buf));
+    try_send_untimestamped(&session.peer, sock, buf, len);
+}
+
+// Sends the timestamp reports that are due by age, returns when the next one will be. Goes over the table only once
+// one is due.
+int64_t send_due_reports(int sock, SessionTable& sessions, int64_t now_ns)
+{
+    if (now_ns < sessions.next_report_ns)
+    {
+        return sessions.next_report_ns;
+    }
+    int64_t next = std::numeric_limits<int64_t>::max();
+    for (ReflectorSession& session : sessions.table)
+    {
+        if (session.reports.deadline_ns() <= now_ns)
+        {
+            send_timestamp_report(sock, session);
+        }
+        next = std::min(next, session.reports.deadline_ns());
+    }
+    sessions.next_report_ns = next;
+    return next;
+}
+
+// Sends what the session still has to report, then forgets it and its counters, and frees its slot.
+void end_session(int sock, ReflectorSession& session)
+{
+    if (!session.reports.empty())
+    {
+        send_timestamp_report(sock, session);
+    }
+    release_session_counters(session.name);
+    session.name.clear();
+    session.counters = nullptr;
+    session.peer.ss_family = AF_UNSPEC;
+}
+
+// Ends the sessions idle since before now_ns - SESSION_IDLE_NS.
+void expire_sessions(int sock, SessionTable& sessions, int64_t now_ns)
+{
+    for (ReflectorSession& session : sessions.table)
+    {
+        if (session.peer.ss_family != AF_UNSPEC && now_ns - session.last_ns >= SESSION_IDLE_NS)
+        {
+            end_session(sock, session);
+        }
+    }
+}
+
+// The session of peer, a new one if there is none.
+ReflectorSession& find_session(int sock, SessionTable& sessions, const sockaddr_storage& peer, int64_t now_ns,
+                               const ReflectorConfig& config)
+{
+    ReflectorSession *set = &sessions.table[(peer_hash(peer) & sessions.set_mask) * SessionTable::SESSION_WAYS];
+    ReflectorSession *victim = &set[0];
+    for (size_t way = 0; way < SessionTable::SESSION_WAYS; way++)
+    {
+        ReflectorSession& s = set[way];
+        if (same_peer(s.peer, peer))
+        {
+            s.last_ns = now_ns;
+            return s;
+        }
+        // A free slot if there is one, else the quietest.
+        if (victim->peer.ss_family != AF_UNSPEC &&
+            (s.peer.ss_family == AF_UNSPEC || s.last_ns < victim->last_ns))
+        {
+            victim = &s;
+        }
+    }
+    if (victim->peer.ss_family != AF_UNSPEC)
+    {
+        end_session(sock, *victim);
+    }
+    ReflectorSession& session = *victim;
+    session.name = sockaddr_to_string(&peer);
+    session.counters = session_counters(session.name);
+    session.seq = SeqTracker();
+    session.peer = peer;
+    session.last_ns = now_ns;
+    if (config.report_entries)
+    {
+        session.reports = TimestampBatch(config.report_entries, config.report_delay_ns);
+    }
+    return session;
+}
+
+// Returns true if seq directly follows the previous probe of the session.
+bool update_seq_stats(ReflectorSession& session, uint32_t seq)
+{
+    uint64_t lost = session.seq.lost;
+    uint64_t reordered = session.seq.reordered;
+    bool in_order = session.seq.update(seq);
+
+    session.counters->inc(M_SEQ_LOST, session.seq.lost - lost);
+    session.counters->inc(M_SEQ_REORDERED, session.seq.reordered - reordered);
+    return in_order;
+}
+
+// The AdmissionControl for --rate-limit, null without.
+std::unique_ptr<AdmissionControl> configured_admission(const ReflectorConfig& config)
+{
+    if (!config.rate_limit_pps)
+    {
+        return nullptr;
+    }
+    std::unique_ptr<AdmissionControl> admission(new AdmissionControl(config.rate_limit_pps, config.rate_burst));
+    cout << "Rate limit " << config.rate_limit_pps << " probes/s per source, bursts of " << config.rate_burst << '\n';
+    return admission;
+}
+
+void receive_loop(string address, in_port_t listen_port, int domain, string iface_name, const ReflectorConfig& config)
 {
     int sock;
     const time_t SLEEP_TIME = 5;
@@ -31,14 +262,40 @@ void receive_loop(string address, in_port_t listen_port, int domain, string ifac
     int datalen = 0;
     sockaddr_storage ss;
     sockaddr_storage bind_addr;
-    uint32_t prev_sender_seq = 0;
+    SessionTable sessions;
+    init_sessions(sessions);
+    const int64_t EXPIRY_INTERVAL_NS = 1000000000;
+    int64_t last_expiry_ns = 0;
+    STAGE_TIMER(stage_timer);
+    TscClock& clock = TscClock::instance();
 
-    sock = setup_socket(domain, SOCK_DGRAM, SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE);
+    // Residence time is normally a few us, flag sustained increases of 20 us or more.
+    const double CUSUM_SLACK_NS = 5000;
+    const double CUSUM_LIMIT_NS = 20000;
+    shared_ptr<FlightRecorder> recorder;
+    LatencyDetector detector(config.flight_threshold_ns, CUSUM_SLACK_NS, CUSUM_LIMIT_NS);
+    if (config.flight_slots)
+    {
+        recorder.reset(new FlightRecorder(config.flight_slots, "flight-reflector"));
+        FlightRecorder::install_signal_handler();
+    }
+
+    sock = setup_socket(domain, SOCK_DGRAM, SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE, config.buffers);
     set_nonblocking(sock);
     setup_device(sock, iface_name, SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE);
 
     create_sockaddr_storage(domain, address, listen_port, &bind_addr);
     do_bind(sock, &bind_addr);
+    join_configured_group(sock, domain, iface_name, config);
+
+    // The drop count is per socket, so it is charged to the session of the packet that reports it even though the
+    // dropped probes may have come from any peer.
+    RxqDrops rxq_drops;
+    uint32_t rxq_dropped = 0;
+    UdpSnmp snmp_prev;
+    bool have_snmp = read_udp_snmp(&snmp_prev);
+
+    std::unique_ptr<AdmissionControl> admission = configured_admission(config);
 
     uint32_t refl_counter = 1234;
     for (;;)
@@ -48,6 +305,22 @@ void receive_loop(string address, in_port_t listen_port, int domain, string ifac
         timespec ts;
         int retval;
 
+        if (recorder && FlightRecorder::dump_requested())
+        {
+            cout << "Flight recorder dumped to " << recorder->dump() << '\n';
+        }
+        int64_t now_ns = clock.monotonic_ns();
+        if (now_ns - last_expiry_ns >= EXPIRY_INTERVAL_NS)
+        {
+            expire_sessions(sock, sessions, now_ns);
+            last_expiry_ns = now_ns;
+        }
+        int64_t report_deadline = std::numeric_limits<int64_t>::max();
+        if (config.report_entries)
+        {
+            report_deadline = send_due_reports(sock, sessions, clock.realtime_ns());
+        }
+
         timespec t2;
         timespec t2_prev;
         timespec t3;
@@ -66,36 +339,101 @@ void receive_loop(string address, in_port_t listen_port, int domain, string ifac
         /* Wait up to five seconds. */
         ts.tv_sec = SLEEP_TIME;
         ts.tv_nsec = 0;
+        // Wake up for the next timestamp report rather than sleep through its deadline.
+        bool report_wait = false;
+        if (report_deadline - clock.realtime_ns() < SLEEP_TIME * 1000000000LL)
+        {
+            int64_t wait_ns = std::max<int64_t>(report_deadline - clock.realtime_ns(), 0);
+            ts.tv_sec = wait_ns / 1000000000;
+            ts.tv_nsec = wait_ns % 1000000000;
+            report_wait = true;
+        }
 
         retval = pselect(sock+1, &rfds, NULL, &efds, &ts, NULL);
+        if (retval == -1 && errno == EINTR)
+        {
+            continue;
+        }
         if (retval == -1)
         {
             throw std::system_error(errno, std::system_category());
         }
+        if (retval == 0 && report_wait)
+        {
+            continue;
+        }
         if (retval == 0)
         {
             cout << "Slept " << SLEEP_TIME << " seconds without traffic...\n";
+            UdpSnmp snmp;
+            if (have_snmp && read_udp_snmp(&snmp))
+            {
+                cout << "Local receive queue drops: " << rxq_drops.last << ", host UDP RcvbufErrors +"
+                     << snmp.rcvbuf_errors - snmp_prev.rcvbuf_errors << " SndbufErrors +"
+                     << snmp.sndbuf_errors - snmp_prev.sndbuf_errors << '\n';
+                snmp_prev = snmp;
+            }
+            STAGE_REPORT(stage_timer, cout);
             continue;
         }
 
         if (FD_ISSET(sock, &rfds))
         {
             t2_prev = t2;
-            tie(data, datalen, ss, t2) = recvpacket(sock, 0);
+            STAGE_START(stage_timer);
+            tie(data, datalen, ss, t2) = recvpacket(sock, 0, &rxq_dropped);
+            STAGE_CHECKPOINT(stage_timer, STAGE_RECVMSG);
+            timestamp_t t2_prime = clock.realtime_ns();
             if (datalen == 0)
             {
                 cout << "sock marked as readable by select(), but no data read!\n";
                 continue;
             }
+            // Before the decode and the session lookup, so probes over the limit cost as little as possible.
+            uint32_t shed = 0;
+            if (admission && !admission->admit(ss, clock.monotonic_ns(), &shed))
+            {
+                count(M_PROBES_SHED);
+                continue;
+            }
             shared_ptr<SenderPacket> pkt = decode_packet(data.get(), datalen);
+            STAGE_CHECKPOINT(stage_timer, STAGE_DECODE);
+            count(M_PKTS_RECEIVED);
+
+            ReflectorSession& session = find_session(sock, sessions, ss, clock.monotonic_ns(), config);
+            session.counters->inc(M_PKTS_RECEIVED);
+            uint32_t dropped = rxq_drops.update(rxq_dropped);
+            if (dropped)
+            {
+                count(M_RXQ_OVERFLOW, dropped);
+                session.counters->inc(M_RXQ_OVERFLOW, dropped);
+            }
+
+            FlightInfo flight;
+            if (recorder)
+            {
+                memset(&flight, 0, sizeof(flight));
+                flight.ts_ns = t2_prime;
+                flight.direction = FLIGHT_INBOUND;
+                flight.src = &ss;
+                flight.dst = &bind_addr;
+                flight.seq = pkt->sender_seq;
+                flight.hw[PROBE_T2] = timespec_to_ns(t2);
+                flight.sw[0] = t2_prime;
+                recorder->record(flight, data.get(), datalen);
+            }
 
             // bounce the packet back
+            uint32_t refl_seq = refl_counter;
             shared_ptr<ReflectorPacket> retpkt(new ReflectorPacket);
             memset(retpkt.get(), 0, sizeof(*retpkt));
             retpkt->type = FROM_REFLECTOR;
             retpkt->sender_seq = pkt->sender_seq;
             retpkt->refl_seq = refl_counter;
-            if (prev_sender_seq == (pkt->sender_seq - 1))
+            retpkt->shed = shed;
+            retpkt->t2 = timespec_to_ns(t2);
+            retpkt->t2_prime = t2_prime;
+            if (update_seq_stats(session, pkt->sender_seq))
             {
                 //retpkt->t2 = t2_prev;
                 //retpkt->t3 = t3;
@@ -104,20 +442,238 @@ void receive_loop(string address, in_port_t listen_port, int domain, string ifac
             {
                 cout << "Missed prev pkt, cannot piggyback hw timestaps\n";
             }
-            prev_sender_seq = pkt->sender_seq;
+            retpkt->t3_prime = clock.realtime_ns();
+            timestamp_t t3_prime = retpkt->t3_prime;
             tie(data, datalen) = serialize_reflector_packet(retpkt);
+            STAGE_CHECKPOINT(stage_timer, STAGE_SERIALIZE);
+            shared_ptr<char> reply = data;
+            int reply_len = datalen;
             //char tmp[] = "abcdefghijklmnopqrsquvxyz";
             //strlcpy(data.get(), tmp, sizeof(tmp));
             sendpacket(&ss, sock, data.get(), datalen);
+            STAGE_CHECKPOINT(stage_timer, STAGE_SENDTO);
             refl_counter++;
+            count(M_PKTS_REFLECTED);
+            session.counters->inc(M_PKTS_REFLECTED);
             cout << "Sent reply, now get HW send timestamp...\n";
             wait_for_errqueue_data(sock);
             t3_prev = t3;
-            tie(data, datalen, ss, t3) = receive_send_timestamp(sock);
+            sockaddr_storage errqueue_addr;
+            tie(data, datalen, errqueue_addr, t3) = receive_send_timestamp(sock);
+            STAGE_CHECKPOINT(stage_timer, STAGE_TX_TIMESTAMP);
+            if (config.report_entries && timespec_to_ns(t3))
+            {
+                TimestampReportEntry entry = { pkt->sender_seq, refl_seq, static_cast<timestamp_t>(timespec_to_ns(t2)),
+                                               static_cast<timestamp_t>(timespec_to_ns(t3)) };
+                if (session.reports.add(entry, clock.realtime_ns()))
+                {
+                    send_timestamp_report(sock, session);
+                }
+                sessions.next_report_ns = std::min(sessions.next_report_ns, session.reports.deadline_ns());
+            }
+            bool anomaly = false;
+            if (timespec_to_ns(t2) && timespec_to_ns(t3))
+            {
+                int64_t residence = timespec_to_ns(t3) - timespec_to_ns(t2);
+                session.counters->latency.record(residence);
+                anomaly = detector.update(residence);
+            }
+
+            if (recorder)
+            {
+                flight.ts_ns = t3_prime;
+                flight.direction = FLIGHT_OUTBOUND;
+                flight.src = &bind_addr;
+                flight.dst = &ss;
+                flight.hw[PROBE_T3] = timespec_to_ns(t3);
+                flight.sw[1] = t3_prime;
+                recorder->record(flight, reply.get(), reply_len);
+                if (anomaly)
+                {
+                    cout << "Residence time anomaly, flight recorder dumped to " << recorder->dump() << '\n';
+                }
+            }
         }
     }
 }
 
+// The PacketAuth for --auth-key, null without.
+std::unique_ptr<PacketAuth> configured_auth(const ReflectorConfig& config)
+{
+    if (config.auth_key_path.empty())
+    {
+        return nullptr;
+    }
+    std::vector<uint8_t> key = load_auth_key(config.auth_key_path);
+    std::unique_ptr<PacketAuth> auth(new PacketAuth(key.data()));
+    cout << "Authenticated probes only, " << auth_kernel_name(auth->kernel()) << " AES-CMAC\n";
+    return auth;
+}
+
+// Reflects with ReflectorEngine over the receive path specialized for the timestamp mode, without the per-packet
+// logging, flight recorder and TX timestamps of receive_loop().
+void fast_path_loop(string address, in_port_t listen_port, int domain, string iface_name, const ReflectorConfig& config)
+{
+    const int SLEEP_MS = 5000;
+    sockaddr_storage bind_addr;
+
+    int sock = setup_socket(domain, SOCK_DGRAM, rx_path_so_flags(config.ts_mode), config.buffers);
+    if (config.ts_mode == TS_HARDWARE || config.ts_mode == TS_BOTH)
+    {
+        setup_device(sock, iface_name, SOF_TIMESTAMPING_RX_HARDWARE);
+    }
+    create_sockaddr_storage(domain, address, listen_port, &bind_addr);
+    do_bind(sock, &bind_addr);
+    join_configured_group(sock, domain, iface_name, config);
+
+    // Replies are as long as their probes, so with jumbo probes the copy into the kernel is worth avoiding.
+    const size_t ZEROCOPY_BUFFERS = 256;
+    std::unique_ptr<Transport> rx_transport = make_rx_path_transport(sock, config.ts_mode, domain);
+    std::unique_ptr<ZerocopyTransport> zerocopy;
+    if (config.zerocopy)
+    {
+        zerocopy.reset(new ZerocopyTransport(sock, *rx_transport, ZEROCOPY_BUFFERS, ReflectorEngine::BUF_LEN));
+    }
+    ReflectorEngine engine(zerocopy ? *zerocopy : *rx_transport);
+    std::unique_ptr<PacketAuth> auth = configured_auth(config);
+    engine.set_auth(auth.get());
+    std::unique_ptr<AdmissionControl> admission = configured_admission(config);
+    engine.set_admission(admission.get());
+
+    // Counted on this thread, which is the one reflecting.
+    const uint64_t PERF_REPORT_PACKETS = 10000;
+    std::unique_ptr<PerfCounters> perf_counters;
+    std::unique_ptr<PerfProfile> profile;
+    if (config.perf)
+    {
+        perf_counters.reset(new PerfCounters());
+        cout << "Perf counters: " << (perf_counters->event_set() == PERF_HARDWARE ? "hardware" : "software")
+             << " events" << (perf_counters->user_only() ? ", user space only" : "") << '\n';
+        profile.reset(new PerfProfile(*perf_counters, PERF_REPORT_PACKETS, cout));
+    }
+
+    uint64_t reflected = 0;
+    uint64_t ignored = 0;
+    uint64_t rejected = 0;
+    uint64_t shed = 0;
+    for (;;)
+    {
+        while (engine.poll())
+        {
+            if (profile)
+            {
+                profile->sample(engine.reflected());
+            }
+        }
+        count(M_PKTS_RECEIVED, engine.reflected() - reflected + engine.ignored() - ignored +
+              engine.rejected() - rejected + engine.shed() - shed);
+        count(M_PKTS_REFLECTED, engine.reflected() - reflected);
+        count(M_AUTH_FAILED, engine.rejected() - rejected);
+        count(M_PROBES_SHED, engine.shed() - shed);
+        reflected = engine.reflected();
+        ignored = engine.ignored();
+        rejected = engine.rejected();
+        shed = engine.shed();
+
+        pollfd pfd = { sock, POLLIN, 0 };
+        int retval = poll(&pfd, 1, SLEEP_MS);
+        if (retval == -1 && errno != EINTR)
+        {
+            throw std::system_error(errno, std::system_category());
+        }
+        if (retval == 0)
+        {
+            cout << "Slept " << SLEEP_MS / 1000 << " seconds without traffic, reflected " << reflected << " from "
+                 << engine.sessions().size() << " peers";
+            if (auth)
+            {
+                cout << ", rejected " << rejected << " unauthenticated";
+            }
+            if (admission)
+            {
+                cout << ", shed " << shed << " over the rate limit (" << admission->sources() << " sources tracked, "
+                     << admission->overflowed() << " probes through the overflow bucket)";
+            }
+            cout << '\n';
+            if (zerocopy)
+            {
+                const ZerocopyPool& pool = zerocopy->pool();
+                cout << "Zerocopy: " << pool.zerocopy_sends() << " sends, " << pool.copied_sends()
+                     << " copied by the kernel after all, " << pool.fallback_sends() << " sent as copies, "
+                     << zerocopy->pool_exhausted() << " copied with all buffers in flight\n";
+            }
+        }
+    }
+}
+
+// --gro: the receiving end of sender --train. Nothing is reflected; reports what arrived, and how GRO coalesced it,
+// whenever the probes pause for the sleep time.
+void train_sink_loop(string address, in_port_t listen_port, int domain, string iface_name, const ReflectorConfig& config)
+{
+    const int SLEEP_MS = 5000;
+    sockaddr_storage bind_addr;
+
+    int sock = setup_socket(domain, SOCK_DGRAM, SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE,
+                            config.buffers);
+    create_sockaddr_storage(domain, address, listen_port, &bind_addr);
+    do_bind(sock, &bind_addr);
+    join_configured_group(sock, domain, iface_name, config);
+
+    TrainSink sink(sock);
+    std::unique_ptr<PacketAuth> auth = configured_auth(config);
+    sink.set_auth(auth.get());
+    uint64_t reported = 0;
+    for (;;)
+    {
+        sink.poll();
+        pollfd pfd = { sock, POLLIN, 0 };
+        int retval = poll(&pfd, 1, SLEEP_MS);
+        if (retval == -1 && errno != EINTR)
+        {
+            throw std::system_error(errno, std::system_category());
+        }
+        const TrainRxStats& stats = sink.stats();
+        if (retval == 0 && stats.probes != reported)
+        {
+            reported = stats.probes;
+            cout << "Train sink: " << stats.probes << " probes in " << stats.reads << " reads (up to "
+                 << stats.max_segments << " per read), lost " << sink.seq().lost << " reordered "
+                 << sink.seq().reordered << ", RX timestamps on " << stats.stamped_reads << " reads";
+            if (auth)
+            {
+                cout << ", rejected " << stats.rejected << " unauthenticated";
+            }
+            cout << '\n';
+        }
+    }
+}
+
+#ifdef XDP_REFLECTOR
+volatile sig_atomic_t stop_requested = 0;
+
+void on_stop(int)
+{
+    stop_requested = 1;
+}
+
+// The BPF program does the reflecting, this only keeps the metrics up to date until SIGINT/SIGTERM, when the
+// XdpReflector destructor detaches the program again.
+void in_kernel_loop(in_port_t listen_port, string iface_name, const ReflectorConfig& config)
+{
+    XdpReflector reflector(config.bpf_object_path, iface_name, listen_port, config.reflect_mode);
+    signal(SIGINT, on_stop);
+    signal(SIGTERM, on_stop);
+    cout << "Reflecting in kernel on " << iface_name << ", port " << listen_port << '\n';
+
+    while (!stop_requested)
+    {
+        sleep(1);
+        reflector.sync();
+    }
+    cout << "Reflected " << reflector.counter(XDP_CNT_REFLECTED) << " of " << reflector.counter(XDP_CNT_PROBES)
+         << " probes\n";
+}
+#endif
 
 int main(int argc, char *argv[])
 {
@@ -126,23 +682,197 @@ int main(int argc, char *argv[])
     int domain;
     int ipver;
     string iface_name;
+    string metrics_endpoint;
+    shared_ptr<MetricsServer> metrics_server;
+    string stats_page_name;
+    std::unique_ptr<Netrounds::StatsPageWriter> stats_page;
+    ReflectorConfig config;
+
+    const option long_options[] =
+    {
+        { "metrics", required_argument, 0, 'm' },
+        { "flight-recorder", required_argument, 0, 'f' },
+        { "flight-threshold-us", required_argument, 0, 'F' },
+        { "rcvbuf", required_argument, 0, 'R' },
+        { "sndbuf", required_argument, 0, 'S' },
+        { "force-bufs", no_argument, 0, 'B' },
+        { "fast-path", required_argument, 0, 'p' },
+        { "join", required_argument, 0, 'j' },
+        { "gro", no_argument, 0, 'g' },
+        { "zerocopy", no_argument, 0, 'z' },
+        { "perf", no_argument, 0, 'c' },
+        { "auth-key", required_argument, 0, 'a' },
+        { "stats-page", required_argument, 0, 'w' },
+        { "rate-limit", required_argument, 0, 'l' },
+        { "rate-burst", required_argument, 0, 'b' },
+        { "ts-reports", required_argument, 0, 'T' },
+        { "ts-report-delay-us", required_argument, 0, 'D' },
+#ifdef XDP_REFLECTOR
+        { "xdp", required_argument, 0, 'x' },
+        { "xdp-object", required_argument, 0, 'X' },
+#endif
+        { 0, 0, 0, 0 }
+    };
 
     try
     {
-        if (argc != 5)
+        int opt;
+        while ((opt = getopt_long(argc, argv, "m:f:F:R:S:Bp:j:gzca:x:X:w:l:b:T:D:", long_options, 0)) != -1)
         {
-            throw std::runtime_error("Usage: receiver <bind ip (can be 0.0.0.0)> <bind port> <ip ver (4 or 6)> <iface>");
+            switch (opt)
+            {
+            case 'm':
+                metrics_endpoint = optarg;
+                break;
+            case 'w':
+                stats_page_name = optarg;
+                break;
+            case 'f':
+                config.flight_slots = std::stoul(optarg);
+                break;
+            case 'F':
+                config.flight_threshold_ns = std::stoll(optarg) * 1000;
+                break;
+            case 'R':
+                config.buffers.rcvbuf = std::stoi(optarg);
+                break;
+            case 'S':
+                config.buffers.sndbuf = std::stoi(optarg);
+                break;
+            case 'B':
+                config.buffers.force = true;
+                break;
+            case 'p':
+                config.fast_path = true;
+                config.ts_mode = parse_timestamp_mode(optarg);
+                break;
+            case 'j':
+                config.multicast_group = optarg;
+                break;
+            case 'g':
+                config.train_sink = true;
+                break;
+            case 'z':
+                config.zerocopy = true;
+                break;
+            case 'c':
+                config.perf = true;
+                break;
+            case 'a':
+                config.auth_key_path = optarg;
+                break;
+            case 'l':
+                config.rate_limit_pps = std::stod(optarg);
+                break;
+            case 'b':
+                config.rate_burst = std::stod(optarg);
+                break;
+            case 'T':
+                config.report_entries = std::stoul(optarg);
+                break;
+            case 'D':
+                config.report_delay_ns = std::stoll(optarg) * 1000;
+                break;
+#ifdef XDP_REFLECTOR
+            case 'x':
+                config.in_kernel = true;
+                config.reflect_mode = parse_reflect_mode(optarg);
+                break;
+            case 'X':
+                config.bpf_object_path = optarg;
+                break;
+#endif
+            default:
+                throw std::runtime_error("Unknown option");
+            }
+        }
+
+        if (argc - optind != 4)
+        {
+            throw std::runtime_error("Usage: receiver [--metrics <host:port|/unix/path>] [--stats-page <shm name>] "
+                                     "[--flight-recorder <slots>] "
+                                     "[--flight-threshold-us <us>] [--rcvbuf <bytes>] [--sndbuf <bytes>] [--force-bufs] "
+                                     "[--fast-path <none|sw|hw|both>] [--join <multicast group>] [--gro] "
+                                     "[--zerocopy (with --fast-path)] [--perf (with --fast-path)] "
+                                     "[--auth-key <key file> (with --fast-path or --gro)] "
+                                     "[--rate-limit <probes/s per source> [--rate-burst <probes>]] "
+                                     "[--ts-reports <probes per report> [--ts-report-delay-us <us>]] " XDP_USAGE
+                                     "<bind ip (can be 0.0.0.0)> <bind port> "
+                                     "<ip ver (4 or 6)> <iface>");
         }
         else
         {
-            address = string(argv[1]);
-            port = stoi(argv[2]);
-            ipver = stoi(argv[3]);
+            address = string(argv[optind]);
+            port = stoi(argv[optind + 1]);
+            ipver = stoi(argv[optind + 2]);
             domain = ipver == 6 ? AF_INET6 : AF_INET;
-            iface_name = string(argv[4]);
+            iface_name = string(argv[optind + 3]);
         }
 
-        receive_loop(address, port, domain, iface_name);
+        if (!metrics_endpoint.empty())
+        {
+            metrics_server.reset(new MetricsServer(metrics_endpoint));
+        }
+        if (!stats_page_name.empty())
+        {
+            stats_page.reset(new Netrounds::StatsPageWriter(stats_page_name, Netrounds::STATS_PAGE_PERIOD_NS));
+        }
+
+#ifdef XDP_REFLECTOR
+        if (config.in_kernel)
+        {
+            if (!config.multicast_group.empty())
+            {
+                throw std::runtime_error("--join is not supported with --xdp");
+            }
+            if (!config.auth_key_path.empty())
+            {
+                throw std::runtime_error("--auth-key is not supported with --xdp");
+            }
+            if (config.rate_limit_pps)
+            {
+                throw std::runtime_error("--rate-limit is not supported with --xdp");
+            }
+            if (config.report_entries)
+            {
+                throw std::runtime_error("--ts-reports is not supported with --xdp");
+            }
+            in_kernel_loop(port, iface_name, config);
+            return 0;
+        }
+#endif
+        if (config.report_entries && (config.fast_path || config.train_sink))
+        {
+            throw std::runtime_error("--ts-reports is for the default reflector, the one that waits for its TX "
+                                     "timestamps");
+        }
+        if (config.train_sink && config.rate_limit_pps)
+        {
+            throw std::runtime_error("--rate-limit is not supported with --gro, nothing is reflected there");
+        }
+        if (config.train_sink)
+        {
+            train_sink_loop(address, port, domain, iface_name, config);
+            return 0;
+        }
+        if (config.zerocopy && !config.fast_path)
+        {
+            throw std::runtime_error("--zerocopy needs --fast-path, the other reflectors reply with the header only");
+        }
+        if (config.perf && !config.fast_path)
+        {
+            throw std::runtime_error("--perf needs --fast-path");
+        }
+        if (!config.auth_key_path.empty() && !config.fast_path)
+        {
+            throw std::runtime_error("--auth-key needs --fast-path or --gro");
+        }
+        if (config.fast_path)
+        {
+            fast_path_loop(address, port, domain, iface_name, config);
+            return 0;
+        }
+        receive_loop(address, port, domain, iface_name, config);
     }
     catch (std::exception &exc)
     {
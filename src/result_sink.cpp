@@ -0,0 +1,395 @@
+#include <charconv>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+
+#include <cstring>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "result_sink.h"
+
+using std::string;
+using std::cout;
+
+namespace Netrounds
+{
+namespace
+{
+void append_int(string& out, int64_t v)
+{
+    char buf[24];
+    out.append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr);
+}
+
+template <typename T>
+void append_raw(string& out, T v)
+{
+    out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+int64_t mean(const DelayStats& stats)
+{
+    return stats.count ? stats.sum / static_cast<int64_t>(stats.count) : 0;
+}
+
+class CsvFormat : public RecordFormat
+{
+public:
+    void header(string& out) override
+    {
+        out += "type,seq,t1_ns,t2_ns,t3_ns,t4_ns,flags,records,rtt_count,rtt_min_ns,rtt_mean_ns,rtt_max_ns,jitter_ns,"
+               "forward_mean_ns,reverse_mean_ns\n";
+    }
+
+    void append(const OutputRecord& rec, string& out) override
+    {
+        if (rec.kind == OutputRecord::PROBE)
+        {
+            const ProbeRecord& p = rec.probe;
+            out += "probe,";
+            append_int(out, p.seq);
+            for (int64_t t : { p.t1, p.t2, p.t3, p.t4 })
+            {
+                out += ',';
+                append_int(out, t);
+            }
+            out += ',';
+            append_int(out, p.flags);
+            out += ",,,,,,,,\n";
+            return;
+        }
+
+        const WindowSummary& w = rec.window;
+        out += "window,,,,,,,";
+        append_int(out, w.records);
+        out += ',';
+        append_int(out, w.rtt.count);
+        out += ',';
+        if (w.rtt.count)
+        {
+            append_int(out, w.rtt.min);
+            out += ',';
+            append_int(out, mean(w.rtt));
+            out += ',';
+            append_int(out, w.rtt.max);
+        }
+        else
+        {
+            out += ",";
+        }
+        out += ',';
+        if (w.ipdv.count)
+        {
+            append_int(out, w.ipdv.abs_sum / static_cast<int64_t>(w.ipdv.count));
+        }
+        out += ',';
+        if (w.forward.count)
+        {
+            append_int(out, mean(w.forward));
+        }
+        out += ',';
+        if (w.reverse.count)
+        {
+            append_int(out, mean(w.reverse));
+        }
+        out += '\n';
+    }
+};
+
+class JsonLinesFormat : public RecordFormat
+{
+public:
+    void header(string&) override
+    {
+    }
+
+    void append(const OutputRecord& rec, string& out) override
+    {
+        if (rec.kind == OutputRecord::PROBE)
+        {
+            const ProbeRecord& p = rec.probe;
+            out += "{\"type\":\"probe\",\"seq\":";
+            append_int(out, p.seq);
+            out += ",\"t1\":";
+            append_int(out, p.t1);
+            out += ",\"t2\":";
+            append_int(out, p.t2);
+            out += ",\"t3\":";
+            append_int(out, p.t3);
+            out += ",\"t4\":";
+            append_int(out, p.t4);
+            out += ",\"flags\":";
+            append_int(out, p.flags);
+            out += "}\n";
+            return;
+        }
+
+        const WindowSummary& w = rec.window;
+        out += "{\"type\":\"window\",\"records\":";
+        append_int(out, w.records);
+        stats(out, "rtt", w.rtt);
+        stats(out, "ipdv", w.ipdv);
+        stats(out, "forward", w.forward);
+        stats(out, "reverse", w.reverse);
+        out += "}\n";
+    }
+
+private:
+    // ,"name":{"count":n,"min":..,"mean":..,"max":..,"abs_mean":..}, only the count when empty.
+    static void stats(string& out, const char *name, const DelayStats& s)
+    {
+        out += ",\"";
+        out += name;
+        out += "\":{\"count\":";
+        append_int(out, s.count);
+        if (s.count)
+        {
+            out += ",\"min\":";
+            append_int(out, s.min);
+            out += ",\"mean\":";
+            append_int(out, mean(s));
+            out += ",\"max\":";
+            append_int(out, s.max);
+            out += ",\"abs_mean\":";
+            append_int(out, s.abs_sum / static_cast<int64_t>(s.count));
+        }
+        out += '}';
+    }
+};
+
+class BinaryFormat : public RecordFormat
+{
+public:
+    static const uint8_t VERSION = 1;
+
+    void header(string& out) override
+    {
+        out += "NRRS";
+        append_raw(out, VERSION);
+    }
+
+    void append(const OutputRecord& rec, string& out) override
+    {
+        append_raw(out, static_cast<uint8_t>(rec.kind));
+        if (rec.kind == OutputRecord::PROBE)
+        {
+            const ProbeRecord& p = rec.probe;
+            append_raw(out, p.seq);
+            append_raw(out, p.t1);
+            append_raw(out, p.t2);
+            append_raw(out, p.t3);
+            append_raw(out, p.t4);
+            append_raw(out, p.flags);
+            return;
+        }
+
+        const WindowSummary& w = rec.window;
+        append_raw(out, static_cast<uint64_t>(w.records));
+        for (const DelayStats *s : { &w.rtt, &w.ipdv, &w.forward, &w.reverse })
+        {
+            append_raw(out, static_cast<uint64_t>(s->count));
+            append_raw(out, s->min);
+            append_raw(out, s->max);
+            append_raw(out, s->sum);
+            append_raw(out, s->abs_sum);
+        }
+    }
+};
+}
+
+std::unique_ptr<RecordFormat> make_record_format(const string& name)
+{
+    if (name == "csv")
+    {
+        return std::unique_ptr<RecordFormat>(new CsvFormat);
+    }
+    if (name == "jsonl")
+    {
+        return std::unique_ptr<RecordFormat>(new JsonLinesFormat);
+    }
+    if (name == "binary")
+    {
+        return std::unique_ptr<RecordFormat>(new BinaryFormat);
+    }
+    throw std::runtime_error("Unknown output format " + name + ", expected csv, jsonl or binary");
+}
+
+OverflowPolicy parse_overflow_policy(const string& policy)
+{
+    if (policy == "drop")
+    {
+        return OVERFLOW_DROP;
+    }
+    if (policy == "block")
+    {
+        return OVERFLOW_BLOCK;
+    }
+    throw std::runtime_error("Unknown output policy " + policy + ", expected drop or block");
+}
+
+ResultSink::ResultSink(int fd, std::unique_ptr<RecordFormat> format, OverflowPolicy policy, size_t queue_len) :
+    fd(fd), format(std::move(format)), policy(policy), ring(queue_len), head(0), tail(0), closed(false),
+    nr_dropped(0), nr_blocked(0), nr_written(0)
+{
+    if (queue_len < 2)
+    {
+        throw std::runtime_error("ResultSink queue must hold at least 2 records");
+    }
+    writer = std::thread(&ResultSink::writer_loop, this);
+}
+
+ResultSink::~ResultSink()
+{
+    close();
+}
+
+int ResultSink::open_output(const string& path)
+{
+    int fd = path == "-" ? dup(STDOUT_FILENO) : open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    return fd;
+}
+
+OutputRecord *ResultSink::reserve(bool always_wait)
+{
+    uint64_t h = head.load(std::memory_order_relaxed);
+    uint64_t t = tail.load(std::memory_order_acquire);
+    if (h - t >= ring.size())
+    {
+        if (policy == OVERFLOW_DROP && !always_wait)
+        {
+            nr_dropped.store(nr_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            count(M_SINK_DROPPED);
+            return nullptr;
+        }
+        nr_blocked.store(nr_blocked.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        count(M_SINK_BLOCKED);
+        while (h - t >= ring.size())
+        {
+            tail.wait(t, std::memory_order_acquire);
+            t = tail.load(std::memory_order_acquire);
+        }
+    }
+    return &ring[h % ring.size()];
+}
+
+void ResultSink::commit()
+{
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    head.notify_one();
+}
+
+void ResultSink::push(const ProbeRecord& rec)
+{
+    OutputRecord *slot = reserve(false);
+    if (slot)
+    {
+        slot->kind = OutputRecord::PROBE;
+        slot->probe = rec;
+        commit();
+    }
+}
+
+void ResultSink::push(const WindowSummary& summary)
+{
+    OutputRecord *slot = reserve(false);
+    if (slot)
+    {
+        slot->kind = OutputRecord::WINDOW;
+        slot->window = summary;
+        commit();
+    }
+}
+
+void ResultSink::close()
+{
+    if (closed)
+    {
+        return;
+    }
+    closed = true;
+    // The stop marker always waits for room, whatever the policy, so nothing pushed before is lost.
+    reserve(true)->kind = OutputRecord::STOP;
+    commit();
+    writer.join();
+    ::close(fd);
+}
+
+void ResultSink::write_out(string& batch)
+{
+    const char *p = batch.data();
+    size_t left = batch.size();
+    while (left && fd != -1)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // Keep draining the queue so the I/O loop is never stuck behind a dead output.
+            cout << "Result output failed, discarding further records: " << strerror(errno) << '\n';
+            ::close(fd);
+            fd = -1;
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+    batch.clear();
+}
+
+void ResultSink::writer_loop()
+{
+    string batch;
+    batch.reserve(2 * BATCH_BYTES);
+    format->header(batch);
+
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        uint64_t h = head.load(std::memory_order_acquire);
+        if (h == t)
+        {
+            // Nothing queued: whatever is batched goes out now rather than waiting for more.
+            if (!batch.empty())
+            {
+                write_out(batch);
+            }
+            head.wait(h, std::memory_order_acquire);
+            continue;
+        }
+
+        uint64_t done = 0;
+        for (; t != h; t++)
+        {
+            const OutputRecord& rec = ring[t % ring.size()];
+            if (rec.kind == OutputRecord::STOP)
+            {
+                write_out(batch);
+                nr_written.store(nr_written.load(std::memory_order_relaxed) + done, std::memory_order_relaxed);
+                return;
+            }
+            format->append(rec, batch);
+            done++;
+            if (batch.size() >= BATCH_BYTES)
+            {
+                tail.store(t + 1, std::memory_order_release);
+                tail.notify_one();
+                write_out(batch);
+            }
+        }
+        tail.store(t, std::memory_order_release);
+        tail.notify_one();
+        nr_written.store(nr_written.load(std::memory_order_relaxed) + done, std::memory_order_relaxed);
+    }
+}
+};
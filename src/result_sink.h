@@ -0,0 +1,122 @@
+#ifndef _RESULT_SINK_H_
+#define _RESULT_SINK_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "probe_matcher.h"
+#include "window_summary.h"
+
+namespace Netrounds
+{
+// A finished probe or a finished measurement window, on its way to the output file.
+struct OutputRecord
+{
+    enum Kind : uint8_t
+    {
+        STOP = 0,   // internal, ends the writer
+        PROBE = 1,
+        WINDOW = 2
+    };
+
+    Kind kind;
+    ProbeRecord probe;      // PROBE
+    WindowSummary window;   // WINDOW
+};
+
+// How records are laid out in the output. Formatters append to the writer's batch buffer.
+class RecordFormat
+{
+public:
+    virtual ~RecordFormat()
+    {
+    }
+
+    // Written once at the start of the file.
+    virtual void header(std::string& out) = 0;
+    virtual void append(const OutputRecord& rec, std::string& out) = 0;
+};
+
+// "csv": one row per record with the columns of both kinds, the ones that do not apply left empty.
+// "jsonl": one JSON object per line, "type" being "probe" or "window".
+// "binary": a "NRRS" magic and version byte, then per record a kind byte and the fields in host byte order
+// (seq u32, t1..t4 i64, flags u8 for probes; records u64 and rtt, ipdv, forward, reverse as count, min, max, sum,
+// abs_sum for windows).
+std::unique_ptr<RecordFormat> make_record_format(const std::string& name);
+
+// What push() does when the writer has fallen a whole queue behind.
+enum OverflowPolicy
+{
+    OVERFLOW_DROP,   // drop the record and count it, the I/O loop never waits
+    OVERFLOW_BLOCK   // wait for room, the output is complete but probing stalls with it
+};
+
+OverflowPolicy parse_overflow_policy(const std::string& policy);
+
+// Moves output off the I/O loop: push() puts the record into a bounded single-producer/single-consumer ring and a
+// writer thread formats batches of them into large write()s. push() is called from one thread only.
+class ResultSink
+{
+public:
+    static const size_t BATCH_BYTES = 1 << 16;
+
+    // fd is written to and closed by the sink.
+    ResultSink(int fd, std::unique_ptr<RecordFormat> format, OverflowPolicy policy, size_t queue_len = 1 << 14);
+    ~ResultSink();
+
+    ResultSink(const ResultSink&) = delete;
+    ResultSink& operator=(const ResultSink&) = delete;
+
+    // Opens path for writing (truncating it), "-" for stdout.
+    static int open_output(const std::string& path);
+
+    void push(const ProbeRecord& rec);
+    void push(const WindowSummary& summary);
+
+    // Writes everything pushed so far and stops the writer. Also done by the destructor.
+    void close();
+
+    uint64_t dropped() const
+    {
+        return nr_dropped.load(std::memory_order_relaxed);
+    }
+
+    // Pushes that had to wait for room (OVERFLOW_BLOCK).
+    uint64_t blocked() const
+    {
+        return nr_blocked.load(std::memory_order_relaxed);
+    }
+
+    uint64_t written() const
+    {
+        return nr_written.load(std::memory_order_relaxed);
+    }
+
+private:
+    // The slot to fill, or nullptr if the record is to be dropped. always_wait ignores OVERFLOW_DROP.
+    OutputRecord *reserve(bool always_wait);
+    void commit();
+    void writer_loop();
+    void write_out(std::string& batch);
+
+    int fd;
+    std::unique_ptr<RecordFormat> format;
+    OverflowPolicy policy;
+    std::vector<OutputRecord> ring;
+    std::atomic<uint64_t> head;   // next slot to fill, written by push()
+    std::atomic<uint64_t> tail;   // next slot to write out, written by the writer
+    bool closed;
+    std::atomic<uint64_t> nr_dropped;
+    std::atomic<uint64_t> nr_blocked;
+    std::atomic<uint64_t> nr_written;
+    std::thread writer;
+};
+};
+
+#endif
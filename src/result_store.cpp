@@ -0,0 +1,281 @@
+#include <new>
+#include <stdexcept>
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "result_store.h"
+
+namespace Netrounds
+{
+namespace
+{
+const size_t ALIGNMENT = 64;
+
+template<class T> T *alloc_column(size_t n)
+{
+    void *p = nullptr;
+    if (posix_memalign(&p, ALIGNMENT, n ? n * sizeof(T) : ALIGNMENT))
+    {
+        throw std::bad_alloc();
+    }
+    return static_cast<T *>(p);
+}
+
+// Flag bits a delay needs, computed as (a - b) - (c - d) or a - b.
+const uint8_t RTT_FLAGS = RESULT_COMPLETE;
+const uint8_t FORWARD_FLAGS = RESULT_HAS_T1 | RESULT_HAS_T2;
+const uint8_t REVERSE_FLAGS = RESULT_HAS_T3 | RESULT_HAS_T4;
+
+void diff_scalar(const int64_t *a, const int64_t *b, const int64_t *c, const int64_t *d, const uint8_t *flags,
+                 uint8_t required, size_t n, int64_t *out)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if ((flags[i] & required) != required)
+        {
+            out[i] = NO_DELAY;
+        }
+        else
+        {
+            out[i] = c ? (a[i] - b[i]) - (c[i] - d[i]) : a[i] - b[i];
+        }
+    }
+}
+
+void ipdv_scalar(const int64_t *delays, size_t n, int64_t *out)
+{
+    for (size_t i = 0; i + 1 < n; i++)
+    {
+        out[i] = (delays[i] == NO_DELAY || delays[i + 1] == NO_DELAY) ? NO_DELAY : delays[i + 1] - delays[i];
+    }
+}
+
+void stats_scalar(const int64_t *delays, size_t n, DelayStats *stats)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        int64_t v = delays[i];
+        if (v == NO_DELAY)
+        {
+            continue;
+        }
+        stats->count++;
+        stats->min = v < stats->min ? v : stats->min;
+        stats->max = v > stats->max ? v : stats->max;
+        stats->sum += v;
+        stats->abs_sum += v < 0 ? -v : v;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+void diff_avx2(const int64_t *a, const int64_t *b, const int64_t *c, const int64_t *d, const uint8_t *flags,
+               uint8_t required, size_t n, int64_t *out)
+{
+    const __m256i req = _mm256_set1_epi64x(required);
+    const __m256i none = _mm256_set1_epi64x(NO_DELAY);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        int32_t f;
+        memcpy(&f, flags + i, sizeof(f));
+        __m256i fl = _mm256_and_si256(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(f)), req);
+        __m256i ok = _mm256_cmpeq_epi64(fl, req);
+
+        __m256i v = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                     _mm256_loadu_si256((const __m256i *)(b + i)));
+        if (c)
+        {
+            v = _mm256_sub_epi64(v, _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)(c + i)),
+                                                     _mm256_loadu_si256((const __m256i *)(d + i))));
+        }
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_blendv_epi8(none, v, ok));
+    }
+    diff_scalar(a + i, b + i, c ? c + i : c, d ? d + i : d, flags + i, required, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+void ipdv_avx2(const int64_t *delays, size_t n, int64_t *out)
+{
+    const __m256i none = _mm256_set1_epi64x(NO_DELAY);
+    size_t i = 0;
+
+    for (; i + 5 <= n; i += 4)
+    {
+        __m256i cur = _mm256_loadu_si256((const __m256i *)(delays + i));
+        __m256i next = _mm256_loadu_si256((const __m256i *)(delays + i + 1));
+        __m256i missing = _mm256_or_si256(_mm256_cmpeq_epi64(cur, none), _mm256_cmpeq_epi64(next, none));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_blendv_epi8(_mm256_sub_epi64(next, cur), none, missing));
+    }
+    if (n > i)
+    {
+        ipdv_scalar(delays + i, n - i, out + i);
+    }
+}
+
+__attribute__((target("avx2")))
+void stats_avx2(const int64_t *delays, size_t n, DelayStats *stats)
+{
+    const __m256i none = _mm256_set1_epi64x(NO_DELAY);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i vmin = _mm256_set1_epi64x(INT64_MAX);
+    __m256i vmax = _mm256_set1_epi64x(INT64_MIN);
+    __m256i vsum = zero;
+    __m256i vabs = zero;
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(delays + i));
+        __m256i missing = _mm256_cmpeq_epi64(v, none);
+        stats->count += 4 - __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(missing)));
+
+        // NO_DELAY is INT64_MIN, so it never wins a max; keep it out of the min.
+        __m256i vmin_cand = _mm256_blendv_epi8(v, vmin, missing);
+        vmin = _mm256_blendv_epi8(vmin, vmin_cand, _mm256_cmpgt_epi64(vmin, vmin_cand));
+        vmax = _mm256_blendv_epi8(vmax, v, _mm256_cmpgt_epi64(v, vmax));
+
+        __m256i valid = _mm256_andnot_si256(missing, v);
+        vsum = _mm256_add_epi64(vsum, valid);
+        __m256i sign = _mm256_cmpgt_epi64(zero, valid);
+        vabs = _mm256_add_epi64(vabs, _mm256_sub_epi64(_mm256_xor_si256(valid, sign), sign));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, vmin);
+    for (int l = 0; l < 4; l++)
+    {
+        stats->min = lanes[l] < stats->min ? lanes[l] : stats->min;
+    }
+    _mm256_storeu_si256((__m256i *)lanes, vmax);
+    for (int l = 0; l < 4; l++)
+    {
+        stats->max = lanes[l] > stats->max ? lanes[l] : stats->max;
+    }
+    _mm256_storeu_si256((__m256i *)lanes, vsum);
+    stats->sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i *)lanes, vabs);
+    stats->abs_sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    stats_scalar(delays + i, n - i, stats);
+}
+#endif
+
+typedef void (*diff_fn)(const int64_t *, const int64_t *, const int64_t *, const int64_t *, const uint8_t *, uint8_t,
+                        size_t, int64_t *);
+
+diff_fn select_diff(SimdLevel level)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (level == SIMD_AVX2)
+    {
+        return diff_avx2;
+    }
+#endif
+    return diff_scalar;
+}
+}
+
+ResultStore::ResultStore(size_t capacity) : cap(capacity), count(0), seq_col(nullptr), t1_col(nullptr),
+                                            t2_col(nullptr), t3_col(nullptr), t4_col(nullptr), flags_col(nullptr)
+{
+    try
+    {
+        seq_col = alloc_column<uint32_t>(cap);
+        t1_col = alloc_column<int64_t>(cap);
+        t2_col = alloc_column<int64_t>(cap);
+        t3_col = alloc_column<int64_t>(cap);
+        t4_col = alloc_column<int64_t>(cap);
+        flags_col = alloc_column<uint8_t>(cap);
+    }
+    catch (...)
+    {
+        free_columns();
+        throw;
+    }
+}
+
+ResultStore::~ResultStore()
+{
+    free_columns();
+}
+
+void ResultStore::free_columns()
+{
+    free(seq_col);
+    free(t1_col);
+    free(t2_col);
+    free(t3_col);
+    free(t4_col);
+    free(flags_col);
+}
+
+void ResultStore::append(uint32_t seq, int64_t t1, int64_t t2, int64_t t3, int64_t t4, uint8_t flags)
+{
+    if (count == cap)
+    {
+        throw std::runtime_error("ResultStore full!");
+    }
+    seq_col[count] = seq;
+    t1_col[count] = t1;
+    t2_col[count] = t2;
+    t3_col[count] = t3;
+    t4_col[count] = t4;
+    flags_col[count] = flags;
+    count++;
+}
+
+SimdLevel simd_level()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static const SimdLevel level = __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SCALAR;
+    return level;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+void compute_rtt(const ResultStore& store, int64_t *out, SimdLevel level)
+{
+    select_diff(level)(store.t4(), store.t1(), store.t3(), store.t2(), store.flags(), RTT_FLAGS, store.size(), out);
+}
+
+void compute_one_way(const ResultStore& store, int64_t *forward, int64_t *reverse, SimdLevel level)
+{
+    diff_fn diff = select_diff(level);
+    diff(store.t2(), store.t1(), nullptr, nullptr, store.flags(), FORWARD_FLAGS, store.size(), forward);
+    diff(store.t4(), store.t3(), nullptr, nullptr, store.flags(), REVERSE_FLAGS, store.size(), reverse);
+}
+
+void compute_ipdv(const int64_t *delays, size_t n, int64_t *out, SimdLevel level)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (level == SIMD_AVX2)
+    {
+        ipdv_avx2(delays, n, out);
+        return;
+    }
+#endif
+    ipdv_scalar(delays, n, out);
+}
+
+DelayStats compute_stats(const int64_t *delays, size_t n, SimdLevel level)
+{
+    DelayStats stats = { 0, INT64_MAX, INT64_MIN, 0, 0 };
+#if defined(__x86_64__) || defined(__i386__)
+    if (level == SIMD_AVX2)
+    {
+        stats_avx2(delays, n, &stats);
+        return stats;
+    }
+#endif
+    stats_scalar(delays, n, &stats);
+    return stats;
+}
+};
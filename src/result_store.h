@@ -0,0 +1,113 @@
+#ifndef _RESULT_STORE_H_
+#define _RESULT_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Netrounds
+{
+// Which of t1..t4 are present in a record.
+enum ResultFlags
+{
+    RESULT_HAS_T1 = 1,
+    RESULT_HAS_T2 = 2,
+    RESULT_HAS_T3 = 4,
+    RESULT_HAS_T4 = 8,
+    RESULT_COMPLETE = RESULT_HAS_T1 | RESULT_HAS_T2 | RESULT_HAS_T3 | RESULT_HAS_T4
+};
+
+// Marks a delay that could not be computed because a timestamp was missing. Kernels skip it and propagate it.
+const int64_t NO_DELAY = INT64_MIN;
+
+// Columnar store of probe results for one measurement window. Every column is a separate cache line aligned array,
+// so the delay kernels below stream through exactly the timestamps they need. Timestamps are in ns.
+class ResultStore
+{
+public:
+    explicit ResultStore(size_t capacity);
+    ~ResultStore();
+
+    void append(uint32_t seq, int64_t t1, int64_t t2, int64_t t3, int64_t t4, uint8_t flags);
+    void clear()
+    {
+        count = 0;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+    size_t capacity() const
+    {
+        return cap;
+    }
+
+    const uint32_t *seq() const
+    {
+        return seq_col;
+    }
+    const int64_t *t1() const
+    {
+        return t1_col;
+    }
+    const int64_t *t2() const
+    {
+        return t2_col;
+    }
+    const int64_t *t3() const
+    {
+        return t3_col;
+    }
+    const int64_t *t4() const
+    {
+        return t4_col;
+    }
+    const uint8_t *flags() const
+    {
+        return flags_col;
+    }
+
+private:
+    ResultStore(const ResultStore&);
+    ResultStore& operator=(const ResultStore&);
+
+    void free_columns();
+
+    size_t cap;
+    size_t count;
+    uint32_t *seq_col;
+    int64_t *t1_col;
+    int64_t *t2_col;
+    int64_t *t3_col;
+    int64_t *t4_col;
+    uint8_t *flags_col;
+};
+
+enum SimdLevel
+{
+    SIMD_SCALAR,
+    SIMD_AVX2
+};
+
+// Best level supported by the CPU we run on.
+SimdLevel simd_level();
+
+struct DelayStats
+{
+    size_t count;    // delays that were not NO_DELAY
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+    int64_t abs_sum; // sum of |delay|, gives mean absolute IPDV (jitter) when run over an IPDV vector
+};
+
+// out[i] = (t4 - t1) - (t3 - t2), the RTT without reflector residence time.
+void compute_rtt(const ResultStore& store, int64_t *out, SimdLevel level = simd_level());
+// Raw one-way delays t2 - t1 and t4 - t3, still including the offset between sender and reflector clocks.
+void compute_one_way(const ResultStore& store, int64_t *forward, int64_t *reverse, SimdLevel level = simd_level());
+// out[i] = delays[i + 1] - delays[i] for i < n - 1.
+void compute_ipdv(const int64_t *delays, size_t n, int64_t *out, SimdLevel level = simd_level());
+DelayStats compute_stats(const int64_t *delays, size_t n, SimdLevel level = simd_level());
+};
+
+#endif
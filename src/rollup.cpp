@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "rollup.h"
+
+using std::vector;
+
+namespace Netrounds
+{
+void RollupBucket::clear(int64_t start)
+{
+    memset(this, 0, sizeof(*this));
+    start_ns = start;
+    min = std::numeric_limits<int64_t>::max();
+    max = std::numeric_limits<int64_t>::min();
+}
+
+void RollupBucket::merge(const RollupBucket& other)
+{
+    sent += other.sent;
+    lost += other.lost;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    sum += other.sum;
+    ipdv_abs_sum += other.ipdv_abs_sum;
+    ipdv_count += other.ipdv_count;
+    for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+    {
+        hist[i] += other.hist[i];
+    }
+}
+
+uint64_t RollupBucket::quantile_upper_ns(double q) const
+{
+    uint64_t total = received();
+    if (!total)
+    {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * (total - 1)) + 1;
+    uint64_t cumulative = 0;
+    for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+    {
+        cumulative += hist[i];
+        if (cumulative >= rank)
+        {
+            return Log2Histogram::bucket_upper_ns(i);
+        }
+    }
+    return 0;
+}
+
+vector<RollupLevel> Rollup::default_levels(size_t slots_per_level)
+{
+    const int64_t SECOND = 1000000000LL;
+    vector<RollupLevel> levels;
+    levels.push_back({ SECOND, slots_per_level ? slots_per_level : 300 });
+    levels.push_back({ 60 * SECOND, slots_per_level ? slots_per_level : 1440 });
+    levels.push_back({ 3600 * SECOND, slots_per_level ? slots_per_level : 168 });
+    return levels;
+}
+
+Rollup::Rollup(const vector<RollupLevel>& configs) : prev_delay(-1)
+{
+    if (configs.empty())
+    {
+        throw std::runtime_error("Rollup needs at least one level");
+    }
+    for (size_t i = 0; i < configs.size(); i++)
+    {
+        const RollupLevel& c = configs[i];
+        if (c.interval_ns <= 0 || !c.slots)
+        {
+            throw std::runtime_error("Rollup level needs a positive interval and at least one slot");
+        }
+        if (i && c.interval_ns % configs[i - 1].interval_ns)
+        {
+            throw std::runtime_error("Rollup interval must be a multiple of the previous level's");
+        }
+        Level level;
+        level.config = c;
+        level.ring.resize(c.slots);
+        level.head = 0;
+        level.count = 0;
+        level.has_open = false;
+        levels.push_back(level);
+    }
+}
+
+int64_t Rollup::align(size_t i, int64_t ts_ns) const
+{
+    int64_t interval = levels[i].config.interval_ns;
+    int64_t rem = ts_ns % interval;
+    return ts_ns - (rem < 0 ? rem + interval : rem);
+}
+
+RollupBucket& Rollup::open_bucket(size_t i, int64_t ts_ns)
+{
+    Level& level = levels[i];
+    int64_t start = align(i, ts_ns);
+    if (level.has_open && start > level.open.start_ns)
+    {
+        close(i);
+    }
+    if (!level.has_open)
+    {
+        level.open.clear(start);
+        level.has_open = true;
+    }
+    return level.open;
+}
+
+void Rollup::close(size_t i)
+{
+    Level& level = levels[i];
+    level.ring[level.head] = level.open;
+    level.head = (level.head + 1) % level.ring.size();
+    level.count = std::min(level.count + 1, level.ring.size());
+    level.has_open = false;
+    if (i + 1 < levels.size())
+    {
+        open_bucket(i + 1, level.open.start_ns).merge(level.open);
+    }
+}
+
+void Rollup::add(int64_t ts_ns, int64_t delay_ns)
+{
+    RollupBucket& b = open_bucket(0, ts_ns);
+    b.sent++;
+    if (delay_ns < 0)
+    {
+        b.lost++;
+        return;
+    }
+    b.min = std::min(b.min, delay_ns);
+    b.max = std::max(b.max, delay_ns);
+    b.sum += delay_ns;
+    b.hist[Log2Histogram::bucket_index(delay_ns)]++;
+    if (prev_delay >= 0)
+    {
+        b.ipdv_abs_sum += std::abs(delay_ns - prev_delay);
+        b.ipdv_count++;
+    }
+    prev_delay = delay_ns;
+}
+
+void Rollup::advance(int64_t now_ns)
+{
+    // Finest first, so a closing interval lands in its parent before the parent itself is checked.
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        Level& level = levels[i];
+        if (level.has_open && level.open.start_ns + level.config.interval_ns <= now_ns)
+        {
+            close(i);
+        }
+    }
+}
+
+const RollupBucket& Rollup::closed(size_t i, size_t n) const
+{
+    const Level& level = levels[i];
+    if (n >= level.count)
+    {
+        throw std::out_of_range("Rollup interval not held");
+    }
+    return level.ring[(level.head + level.ring.size() - 1 - n) % level.ring.size()];
+}
+
+RollupBucket Rollup::query(size_t i, int64_t from_ns, int64_t to_ns) const
+{
+    const Level& level = levels[i];
+    RollupBucket result;
+    result.clear(0);
+
+    auto take = [&](const RollupBucket& b)
+    {
+        result.merge(b);
+        result.start_ns = b.start_ns;
+    };
+    if (level.has_open && level.open.start_ns >= from_ns && level.open.start_ns < to_ns)
+    {
+        take(level.open);
+    }
+    // Closed intervals are in start order, so stop at the first one before the window.
+    for (size_t n = 0; n < level.count; n++)
+    {
+        const RollupBucket& b = closed(i, n);
+        if (b.start_ns < from_ns)
+        {
+            break;
+        }
+        if (b.start_ns < to_ns)
+        {
+            take(b);
+        }
+    }
+    return result;
+}
+
+size_t Rollup::memory_bytes() const
+{
+    size_t bytes = 0;
+    for (const Level& level : levels)
+    {
+        bytes += (level.ring.size() + 1) * sizeof(RollupBucket);
+    }
+    return bytes;
+}
+
+void print_rollup(std::ostream& os, const char *name, const RollupBucket& bucket)
+{
+    os << name << ": sent " << bucket.sent << " lost " << bucket.lost;
+    if (bucket.received())
+    {
+        os << " rtt min/mean/max " << bucket.min / 1000.0 << '/'
+           << static_cast<double>(bucket.sum) / bucket.received() / 1000.0 << '/' << bucket.max / 1000.0 << " p99 <"
+           << bucket.quantile_upper_ns(0.99) / 1000.0;
+    }
+    if (bucket.ipdv_count)
+    {
+        os << " jitter " << static_cast<double>(bucket.ipdv_abs_sum) / bucket.ipdv_count / 1000.0;
+    }
+    os << " us\n";
+}
+};
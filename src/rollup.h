@@ -0,0 +1,119 @@
+#ifndef _ROLLUP_H_
+#define _ROLLUP_H_
+
+#include <ostream>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "histogram.h"
+
+namespace Netrounds
+{
+// Summary of the probes sent in one interval. Delays are RTTs in ns, jitter is the mean absolute difference between
+// the RTTs of consecutive answered probes (IPDV, as in WindowSummary).
+struct RollupBucket
+{
+    int64_t start_ns;   // interval start, aligned to the interval length
+    uint64_t sent;
+    uint64_t lost;
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+    uint64_t ipdv_abs_sum;
+    uint64_t ipdv_count;
+    uint64_t hist[Log2Histogram::NR_BUCKETS];
+
+    void clear(int64_t start);
+    void merge(const RollupBucket& other);
+
+    uint64_t received() const
+    {
+        return sent - lost;
+    }
+
+    // Upper bound of the Log2Histogram bucket holding quantile q (0..1) of the delays, 0 if there are none.
+    uint64_t quantile_upper_ns(double q) const;
+};
+
+// One level of a rollup: interval length and how many closed intervals it keeps.
+struct RollupLevel
+{
+    int64_t interval_ns;
+    size_t slots;
+};
+
+// Per-second, per-minute and per-hour (or any other) statistics of a long-running session in fixed memory. Probes
+// go into the open interval of the finest level. When an interval closes it is stored in that level's ring and merged
+// into the open interval of the next coarser level, which closes in turn when its own time is up, so coarser levels
+// never go back to raw data. Each ring overwrites its oldest interval, and intervals without probes take no slot.
+//
+// Single writer, not thread safe.
+class Rollup
+{
+public:
+    // Default levels: 300 seconds, 1440 minutes and 168 hours, about 550 kB.
+    static std::vector<RollupLevel> default_levels(size_t slots_per_level = 0);
+
+    // Every interval must be a multiple of the one before it. Throws std::runtime_error otherwise.
+    explicit Rollup(const std::vector<RollupLevel>& levels = default_levels());
+
+    // A probe sent at ts_ns, delay_ns < 0 if it went unanswered. Probes older than the open interval are counted in
+    // it anyway, as a late reply should not reopen history.
+    void add(int64_t ts_ns, int64_t delay_ns);
+
+    // Close every interval that ends at or before now_ns, so that queries see them even if no probe follows.
+    void advance(int64_t now_ns);
+
+    // Merge of the intervals of level starting in [from_ns, to_ns), including the open one. Walks only those
+    // intervals, newest first. start_ns of the result is that of the oldest interval merged, sent is 0 if none. The
+    // open interval of a coarser level holds only the finer intervals closed so far.
+    RollupBucket query(size_t level, int64_t from_ns, int64_t to_ns) const;
+
+    size_t nr_levels() const
+    {
+        return levels.size();
+    }
+
+    const RollupLevel& level(size_t i) const
+    {
+        return levels[i].config;
+    }
+
+    // Closed intervals held by level i, at most its slots.
+    size_t size(size_t i) const
+    {
+        return levels[i].count;
+    }
+
+    // Closed interval n of level i, 0 being the newest.
+    const RollupBucket& closed(size_t i, size_t n) const;
+
+    // Bytes held for the buckets, fixed at construction.
+    size_t memory_bytes() const;
+
+private:
+    struct Level
+    {
+        RollupLevel config;
+        std::vector<RollupBucket> ring;
+        size_t head;    // next slot to write
+        size_t count;
+        RollupBucket open;
+        bool has_open;
+    };
+
+    int64_t align(size_t i, int64_t ts_ns) const;
+    RollupBucket& open_bucket(size_t i, int64_t ts_ns);
+    void close(size_t i);
+
+    std::vector<Level> levels;
+    int64_t prev_delay;
+};
+
+// "last 60 s: sent 600 lost 1 rtt min/mean/max 10.1/10.3/12.0 p99 <16.4 jitter 0.2 us"
+void print_rollup(std::ostream& os, const char *name, const RollupBucket& bucket);
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "rx_path.h"
+
+using std::string;
+
+namespace Netrounds
+{
+TimestampMode parse_timestamp_mode(const string& mode)
+{
+    if (mode == "none")
+    {
+        return TS_NONE;
+    }
+    if (mode == "sw")
+    {
+        return TS_SOFTWARE;
+    }
+    if (mode == "hw")
+    {
+        return TS_HARDWARE;
+    }
+    if (mode == "both")
+    {
+        return TS_BOTH;
+    }
+    throw std::runtime_error("Unknown timestamp mode " + mode + ", expected none, sw, hw or both");
+}
+
+int rx_path_so_flags(TimestampMode mode)
+{
+    int flags = 0;
+    dispatch_rx_path(mode, AF_INET, [&flags](auto path)
+                     {
+                         flags = decltype(path)::SO_FLAGS;
+                     });
+    return flags;
+}
+
+std::unique_ptr<Transport> make_rx_path_transport(int sock, TimestampMode mode, int family)
+{
+    std::unique_ptr<Transport> transport;
+    dispatch_rx_path(mode, family, [&](auto path)
+                     {
+                         transport.reset(new RxPathTransport<decltype(path)>(sock));
+                     });
+    return transport;
+}
+};
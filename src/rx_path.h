@@ -0,0 +1,274 @@
+#ifndef _RX_PATH_H_
+#define _RX_PATH_H_
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "metrics.h"
+#include "transport.h"
+#include "tsc_clock.h"
+#include "util.h"
+
+namespace Netrounds
+{
+// Which RX timestamps a socket asks for. Fixed for the life of the socket, so the receive path is specialized for it
+// at compile time (RxPath) and picked once at startup (dispatch_rx_path()).
+enum TimestampMode
+{
+    TS_NONE,
+    TS_SOFTWARE,
+    TS_HARDWARE,   // raw hardware timestamps, needs setup_device()
+    TS_BOTH
+};
+
+TimestampMode parse_timestamp_mode(const std::string& mode);
+
+template <int Family>
+struct FamilyTraits;
+
+template <>
+struct FamilyTraits<AF_INET>
+{
+    typedef sockaddr_in Address;
+    // setup_socket() turns on IP_PKTINFO, which only IPv4 sockets deliver.
+    static constexpr size_t PKTINFO_SPACE = CMSG_SPACE(sizeof(in_pktinfo));
+};
+
+template <>
+struct FamilyTraits<AF_INET6>
+{
+    typedef sockaddr_in6 Address;
+    static constexpr size_t PKTINFO_SPACE = 0;
+};
+
+// Receive and reply for one timestamp mode and address family. The control buffer holds exactly the cmsgs such a
+// socket from setup_socket() gets (timestamps, SO_RXQ_OVFL and, for IPv4, IP_PKTINFO), the peer address is the
+// family's own sockaddr, and cmsgs the mode cannot produce are never looked for.
+template <TimestampMode Mode, int Family>
+class RxPath
+{
+public:
+    static constexpr bool HAS_SW = Mode == TS_SOFTWARE || Mode == TS_BOTH;
+    static constexpr bool HAS_HW = Mode == TS_HARDWARE || Mode == TS_BOTH;
+    static constexpr int SO_FLAGS = (HAS_SW ? SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE : 0) |
+        (HAS_HW ? SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE : 0);
+    static constexpr size_t CONTROL_LEN = (Mode != TS_NONE ? CMSG_SPACE(sizeof(scm_timestamping)) : 0) +
+        CMSG_SPACE(sizeof(uint32_t)) + FamilyTraits<Family>::PKTINFO_SPACE;
+
+    typedef typename FamilyTraits<Family>::Address Address;
+
+    // -1 if nothing is queued. rxq_dropped gets the socket's cumulative SO_RXQ_OVFL count when the packet has one.
+    // Datagrams longer than buflen are counted (M_RX_TRUNCATED) and dropped: anyone can send one, and none of ours
+    // is that long.
+    static ssize_t receive(int sock, char *buf, size_t buflen, Address *from, int64_t *sw_ns, int64_t *hw_ns,
+                           uint32_t *rxq_dropped)
+    {
+        msghdr msg;
+        iovec entry;
+        alignas(cmsghdr) char control[CONTROL_LEN];
+        ssize_t len;
+
+        do
+        {
+            entry.iov_base = buf;
+            entry.iov_len = buflen;
+            msg.msg_name = from;
+            msg.msg_namelen = sizeof(*from);
+            msg.msg_iov = &entry;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            msg.msg_flags = 0;
+
+            len = recvmsg(sock, &msg, MSG_DONTWAIT);
+            if (len == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    return -1;
+                }
+                throw std::system_error(errno, std::system_category());
+            }
+            if (msg.msg_flags & MSG_TRUNC)
+            {
+                count(M_RX_TRUNCATED);
+            }
+        } while (msg.msg_flags & MSG_TRUNC);
+
+        *sw_ns = 0;
+        *hw_ns = 0;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET)
+            {
+                continue;
+            }
+            if constexpr (Mode != TS_NONE)
+            {
+                if (cmsg->cmsg_type == SO_TIMESTAMPING)
+                {
+                    scm_timestamping stamps;
+                    memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+                    if constexpr (HAS_SW)
+                    {
+                        *sw_ns = timespec_to_ns(stamps.ts[0]);
+                    }
+                    if constexpr (HAS_HW)
+                    {
+                        *hw_ns = timespec_to_ns(stamps.ts[2]);
+                    }
+                    continue;
+                }
+            }
+            if (cmsg->cmsg_type == SO_RXQ_OVFL)
+            {
+                memcpy(rxq_dropped, CMSG_DATA(cmsg), sizeof(*rxq_dropped));
+            }
+        }
+        if constexpr (HAS_HW)
+        {
+            if (!*hw_ns)
+            {
+                count(M_HWTS_MISSING);
+            }
+        }
+        return len;
+    }
+
+    // false if the socket buffer is full.
+    static bool reply(int sock, const Address& to, const char *buf, size_t len)
+    {
+        if (sendto(sock, buf, len, MSG_DONTWAIT, reinterpret_cast<const sockaddr *>(&to), sizeof(to)) == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                count(M_SEND_EAGAIN);
+                return false;
+            }
+            throw std::system_error(errno, std::system_category());
+        }
+        return true;
+    }
+};
+
+// Calls fn(RxPath<Mode, Family>()) for the runtime mode and family, so everything fn instantiates is specialized.
+template <typename Fn>
+void dispatch_rx_path(TimestampMode mode, int family, Fn&& fn)
+{
+    if (family != AF_INET && family != AF_INET6)
+    {
+        throw std::runtime_error("Address neither IPv4 or v6!");
+    }
+    bool v4 = family == AF_INET;
+    switch (mode)
+    {
+    case TS_NONE:
+        if (v4)
+        {
+            fn(RxPath<TS_NONE, AF_INET>());
+        }
+        else
+        {
+            fn(RxPath<TS_NONE, AF_INET6>());
+        }
+        break;
+    case TS_SOFTWARE:
+        if (v4)
+        {
+            fn(RxPath<TS_SOFTWARE, AF_INET>());
+        }
+        else
+        {
+            fn(RxPath<TS_SOFTWARE, AF_INET6>());
+        }
+        break;
+    case TS_HARDWARE:
+        if (v4)
+        {
+            fn(RxPath<TS_HARDWARE, AF_INET>());
+        }
+        else
+        {
+            fn(RxPath<TS_HARDWARE, AF_INET6>());
+        }
+        break;
+    case TS_BOTH:
+        if (v4)
+        {
+            fn(RxPath<TS_BOTH, AF_INET>());
+        }
+        else
+        {
+            fn(RxPath<TS_BOTH, AF_INET6>());
+        }
+        break;
+    }
+}
+
+// Kernel socket transport on an RxPath. Non-blocking, and without TX timestamps: a reflector cannot put t3 into the
+// reply it belongs to anyway, and unread TX timestamps would eat into the receive buffer.
+template <typename Path>
+class RxPathTransport : public Transport
+{
+public:
+    explicit RxPathTransport(int sock) : sock(sock)
+    {
+    }
+
+    int64_t send(const sockaddr_storage& peer, const char *buf, size_t len, size_t) override
+    {
+        Path::reply(sock, reinterpret_cast<const typename Path::Address&>(peer), buf, len);
+        return 0;
+    }
+
+    bool receive(char *buf, size_t buflen, RxInfo *info) override
+    {
+        uint32_t rxq_dropped = rxq_drops.last;
+        ssize_t len = Path::receive(sock, buf, buflen, reinterpret_cast<typename Path::Address *>(&info->peer),
+                                    &info->sw_ns, &info->hw_ns, &rxq_dropped);
+        if (len < 0)
+        {
+            return false;
+        }
+        info->len = len;
+        uint32_t dropped = rxq_drops.update(rxq_dropped);
+        if (dropped)
+        {
+            count(M_RXQ_OVERFLOW, dropped);
+        }
+        return true;
+    }
+
+    int64_t now_ns() override
+    {
+        return TscClock::instance().realtime_ns();
+    }
+
+    bool one_step_tx() const override
+    {
+        return false;
+    }
+
+private:
+    int sock;
+    RxqDrops rxq_drops;
+};
+
+// The socket must have been set up with RxPath<mode, family>::SO_FLAGS.
+std::unique_ptr<Transport> make_rx_path_transport(int sock, TimestampMode mode, int family);
+int rx_path_so_flags(TimestampMode mode);
+};
+
+#endif
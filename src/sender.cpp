@@ -1,15 +1,42 @@
+#include <algorithm>
 #include <stdexcept>
 #include <string>
 #include <iostream>
 #include <system_error>
+#include <map>
 #include <memory>
+#include <random>
+#include <vector>
+
+#include <cstring>
 
 #include <unistd.h>
+#include <poll.h>
+#include <getopt.h>
 #include <netinet/in.h>
 #include <linux/net_tstamp.h>
 
 #include "util.h"
+#include "clock_offset.h"
+#include "dispersion.h"
 #include "packet.h"
+#include "packet_auth.h"
+#include "payload_pattern.h"
+#include "metrics.h"
+#include "result_store.h"
+#include "rollup.h"
+#include "window_summary.h"
+#include "flight_recorder.h"
+#include "probe_matcher.h"
+#include "probe_session.h"
+#include "probe_train.h"
+#include "trace_replay.h"
+#include "zerocopy.h"
+#include "result_sink.h"
+#include "tsc_clock.h"
+#include "snmp.h"
+#include "stats_page.h"
+#include "timestamp_report.h"
 #include "sender.h"
 
 using std::stoi;
@@ -18,6 +45,456 @@ using std::string;
 using std::shared_ptr;
 
 using Netrounds::prepare_packet;
+using Netrounds::CounterBlock;
+using Netrounds::MetricsServer;
+using Netrounds::ResultStore;
+using Netrounds::ReflectorPacket;
+using Netrounds::FlightRecorder;
+using Netrounds::FlightInfo;
+using Netrounds::ResultSink;
+
+// Window summaries go to the terminal and, with --output, to the result file as well.
+void report_window(const ResultStore& results, ResultSink *output)
+{
+    Netrounds::WindowSummary summary = summarize_window(results);
+    print_window_summary(cout, summary);
+    if (output)
+    {
+        output->push(summary);
+    }
+}
+
+// A record of the event loop sessions into the current result window, reported once it is full.
+void store_record(ResultStore& results, ResultSink *output, const Netrounds::ProbeRecord& rec)
+{
+    results.append(rec.seq, rec.t1, rec.t2, rec.t3, rec.t4, rec.flags);
+    if (output)
+    {
+        output->push(rec);
+    }
+    if (results.size() == results.capacity())
+    {
+        report_window(results, output);
+        results.clear();
+    }
+}
+
+void close_output(ResultSink *output)
+{
+    if (output)
+    {
+        output->close();
+        cout << "Result output: " << output->written() << " records written, " << output->dropped() << " dropped, "
+             << output->blocked() << " waited for room\n";
+    }
+}
+
+// Last minute and last hour from the rollup, which also covers sessions far longer than a result window.
+void print_rollups(Netrounds::Rollup& rollup, int64_t now_ns)
+{
+    const int64_t MINUTE = 60000000000LL;
+    rollup.advance(now_ns);
+    Netrounds::print_rollup(cout, "last minute", rollup.query(0, now_ns - MINUTE, now_ns));
+    Netrounds::print_rollup(cout, "last hour", rollup.query(1, now_ns - 60 * MINUTE, now_ns));
+}
+
+// --sessions: the probe sessions run as coroutines on one event loop, one socket each (the first one being sock), in
+// place of the blocking loop of main(). Results of all sessions go through the same result windows.
+void run_sessions(int nr_sessions, int sock, int domain, int so_timestamping_flags, const SocketBuffers& buffers,
+                  const sockaddr_storage& dest, uint32_t nr_packets, int64_t interval_ns, size_t probe_len,
+                  bool pattern, bool timestamp_reports, ResultSink *output)
+{
+    const size_t RESULT_WINDOW = 1000;
+    const int64_t REPLY_TIMEOUT_NS = 1000000000;
+    Netrounds::EventLoop loop;
+    ResultStore results(RESULT_WINDOW);
+    std::vector<int> socks(1, sock);
+    std::vector<Netrounds::ProbeSessionStats> stats(nr_sessions);
+
+    Netrounds::ProbeSessionConfig config;
+    config.reflector = dest;
+    config.count = nr_packets;
+    config.interval_ns = interval_ns;
+    config.probe_len = probe_len;
+    config.reply_timeout_ns = REPLY_TIMEOUT_NS;
+    config.tx_timestamps = true;
+    config.pattern = pattern;
+    config.timestamp_reports = timestamp_reports;
+    auto sink = [&results, output](const Netrounds::ProbeRecord& rec)
+    {
+        store_record(results, output, rec);
+    };
+    for (int i = 0; i < nr_sessions; i++)
+    {
+        if (i)
+        {
+            socks.push_back(setup_socket(domain, SOCK_DGRAM, so_timestamping_flags, buffers));
+        }
+        loop.spawn(Netrounds::probe_session(loop, socks[i], config, sink, &stats[i]));
+    }
+    loop.run();
+    if (results.size())
+    {
+        report_window(results, output);
+    }
+
+    Netrounds::ProbeSessionStats total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < nr_sessions; i++)
+    {
+        total.sent += stats[i].sent;
+        total.replies += stats[i].replies;
+        total.timeouts += stats[i].timeouts;
+        total.stale += stats[i].stale;
+        total.corrupted += stats[i].corrupted;
+        total.reports += stats[i].reports;
+        if (i)
+        {
+            close(socks[i]);
+        }
+    }
+    cout << nr_sessions << " sessions: sent " << total.sent << " replies " << total.replies << " timeouts "
+         << total.timeouts << " late replies " << total.stale << '\n';
+    if (timestamp_reports)
+    {
+        cout << "Timestamp reports: " << total.reports << " merged\n";
+    }
+    if (pattern)
+    {
+        cout << "Payload pattern: " << total.corrupted << " of " << total.replies
+             << " replies corrupted or cut short\n";
+    }
+}
+
+// A reflector answering --multicast probes, identified by the source address of its replies.
+struct MulticastReflector
+{
+    explicit MulticastReflector(size_t window) : results(window), first_seq(0), last_seq(0), replies(0)
+    {
+    }
+
+    ResultStore results;
+    uint32_t first_seq;   // the first probe it answered, earlier ones may have been sent before it joined
+    uint32_t last_seq;
+    uint64_t replies;
+    CounterBlock *counters;
+};
+
+// --multicast: dest is a group, one probe per interval reaches every reflector that joined it, and the unicast
+// replies are told apart by their source. Result windows are kept per reflector.
+void run_multicast(int sock, int domain, const string& iface_name, int ttl, const sockaddr_storage& dest,
+                   uint32_t nr_packets, int64_t interval_ns, size_t probe_len)
+{
+    const size_t RESULT_WINDOW = 1000;
+    const int64_t REPLY_TIMEOUT_NS = 1000000000;
+    if (!is_multicast(&dest))
+    {
+        throw std::runtime_error("--multicast needs a multicast group address");
+    }
+    setup_multicast_sender(sock, domain, iface_name, ttl);
+
+    Netrounds::EventLoop loop;
+    std::map<string, MulticastReflector> reflectors;
+    Netrounds::ProbeSessionStats stats;
+    Netrounds::ProbeSessionConfig config;
+    config.reflector = dest;
+    config.count = nr_packets;
+    config.interval_ns = interval_ns;
+    config.probe_len = probe_len;
+    config.reply_timeout_ns = REPLY_TIMEOUT_NS;
+    config.tx_timestamps = true;
+    auto sink = [&reflectors, RESULT_WINDOW](const sockaddr_storage& from, const Netrounds::ProbeRecord& rec)
+    {
+        string name = sockaddr_to_string(&from);
+        auto it = reflectors.find(name);
+        if (it == reflectors.end())
+        {
+            it = reflectors.try_emplace(name, RESULT_WINDOW).first;
+            it->second.first_seq = rec.seq;
+            it->second.counters = Netrounds::session_counters(name);
+            cout << "New reflector " << name << " from probe " << rec.seq << '\n';
+        }
+        MulticastReflector& refl = it->second;
+        refl.last_seq = rec.seq;
+        refl.replies++;
+        refl.counters->inc(Netrounds::M_PKTS_RECEIVED);
+        if (rec.t1 && rec.t4)
+        {
+            refl.counters->latency.record(rec.t4 - rec.t1);
+        }
+        refl.results.append(rec.seq, rec.t1, rec.t2, rec.t3, rec.t4, rec.flags);
+        if (refl.results.size() == refl.results.capacity())
+        {
+            cout << "Reflector " << name << ":\n";
+            print_window_summary(cout, summarize_window(refl.results));
+            refl.results.clear();
+        }
+    };
+    loop.spawn(Netrounds::multicast_session(loop, sock, config, sink, &stats));
+    loop.run();
+
+    for (auto& entry : reflectors)
+    {
+        MulticastReflector& refl = entry.second;
+        cout << "Reflector " << entry.first << ": " << refl.replies << " replies to " << nr_packets - refl.first_seq
+             << " probes since it first answered\n";
+        if (refl.results.size())
+        {
+            print_window_summary(cout, summarize_window(refl.results));
+        }
+    }
+    cout << "Multicast: sent " << stats.sent << " probes, " << stats.replies << " replies from "
+         << reflectors.size() << " reflectors, " << stats.timeouts << " probes unanswered, " << stats.stale
+         << " late replies\n";
+}
+
+// --train: one-way throughput test, nr_packets probes in trains of train_len, each train a single GSO send, one
+// train per interval. The receiver counts them with --gro. Reports how many TX timestamps the trains got.
+void run_train(int sock, const sockaddr_storage& dest, uint32_t nr_packets, size_t train_len, int64_t interval_ns,
+               size_t probe_len, Netrounds::PacketAuth *auth, uint32_t session_id)
+{
+    const int64_t DRAIN_NS = 100000000;
+    size_t segments = Netrounds::train_segments(probe_len, train_len);
+    if (segments < train_len)
+    {
+        cout << "Trains of " << probe_len << " byte probes limited to " << segments << " per send\n";
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &Netrounds::TRAIN_TX_TIMESTAMPING,
+                   sizeof(Netrounds::TRAIN_TX_TIMESTAMPING)) == -1)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    std::vector<char> buf(segments * probe_len);
+    uint64_t trains = 0;
+    uint64_t full_buffer = 0;
+    size_t stamps = 0;
+    uint32_t last_key = 0;
+    int64_t start = Netrounds::EventLoop::now_ns();
+    for (uint32_t seq = 0; seq < nr_packets;)
+    {
+        size_t n = std::min<size_t>(segments, nr_packets - seq);
+        Netrounds::build_train(buf.data(), probe_len, seq, n, auth, session_id);
+        if (!Netrounds::send_train(sock, &dest, buf.data(), probe_len, n))
+        {
+            // Back off until the queue drains rather than spin on EAGAIN.
+            full_buffer++;
+            usleep(100);
+            continue;
+        }
+        seq += n;
+        trains++;
+        stamps += Netrounds::drain_train_tx_timestamps(sock, &last_key);
+        if (interval_ns && seq < nr_packets)
+        {
+            int64_t next = start + static_cast<int64_t>(trains) * interval_ns;
+            int64_t now = Netrounds::EventLoop::now_ns();
+            if (next > now)
+            {
+                usleep((next - now) / 1000);
+            }
+        }
+    }
+    double elapsed_s = (Netrounds::EventLoop::now_ns() - start) / 1e9;
+    usleep(DRAIN_NS / 1000);
+    stamps += Netrounds::drain_train_tx_timestamps(sock, &last_key);
+
+    cout << "Sent " << nr_packets << " probes in " << trains << " trains in " << elapsed_s << " s, "
+         << nr_packets / elapsed_s << " probes/s, " << full_buffer << " sends retried on a full buffer\n";
+    cout << "TX timestamps: " << stamps << " for " << trains << " trains (" << nr_packets
+         << " probes), last for send " << last_key << '\n';
+}
+
+// --dispersion: trains of train_len probes sent back to back, one train per interval, for the bottleneck capacity
+// from how far apart they arrive (dispersion.h). The estimate so far is printed every REPORT_TRAINS trains.
+void run_dispersion(int sock, int domain, const sockaddr_storage& dest, uint32_t nr_packets, size_t train_len,
+                    int64_t interval_ns, size_t probe_len)
+{
+    const uint64_t REPORT_TRAINS = 100;
+    const int64_t REPLY_TIMEOUT_NS = 1000000000;
+    Netrounds::EventLoop loop;
+    Netrounds::DispersionEstimator estimator(Netrounds::wire_len(probe_len, domain));
+    Netrounds::ProbeSessionStats stats;
+    Netrounds::ProbeSessionConfig config;
+    config.reflector = dest;
+    config.count = nr_packets;
+    config.interval_ns = interval_ns;
+    config.probe_len = probe_len;
+    config.reply_timeout_ns = REPLY_TIMEOUT_NS;
+    config.tx_timestamps = true;
+    uint64_t trains = 0;
+    auto sink = [&](const Netrounds::ProbeRecord *recs, size_t n)
+    {
+        estimator.add_train(recs, n);
+        if (++trains % REPORT_TRAINS == 0)
+        {
+            Netrounds::print_dispersion(cout, estimator);
+        }
+    };
+    cout << "Dispersion: " << nr_packets << " probes of " << probe_len << " bytes ("
+         << Netrounds::wire_len(probe_len, domain) << " on the wire) in trains of " << train_len << '\n';
+    loop.spawn(Netrounds::dispersion_session(loop, sock, config, train_len, sink, &stats));
+    loop.run();
+
+    Netrounds::print_dispersion(cout, estimator);
+    cout << "Dispersion: sent " << stats.sent << " probes in " << trains << " trains, " << stats.replies
+         << " replies, " << stats.timeouts << " unanswered, " << stats.stale << " late replies, " << stats.split
+         << " trains split by a full socket buffer\n";
+}
+
+// --replay: the probes follow a recorded traffic pattern instead of a fixed interval, open loop, so bursts reach the
+// reflector as they were captured. At most max_probes of the trace are sent, all of it for 0. Results go through the
+// result windows like those of --sessions; the report adds how closely the sends kept to the schedule.
+void run_replay(int sock, const sockaddr_storage& dest, const string& trace_path, double time_scale,
+                uint32_t max_probes, ResultSink *output)
+{
+    const size_t RESULT_WINDOW = 1000;
+    const int64_t REPLY_TIMEOUT_NS = 1000000000;
+    std::vector<Netrounds::TraceEntry> trace = Netrounds::load_trace(trace_path);
+    if (max_probes && trace.size() > max_probes)
+    {
+        trace.resize(max_probes);
+    }
+    if (trace.empty())
+    {
+        throw std::runtime_error("No datagrams in trace " + trace_path);
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &Netrounds::REPLAY_TIMESTAMPING,
+                   sizeof(Netrounds::REPLAY_TIMESTAMPING)) == -1)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+    cout << "Replaying " << trace.size() << " probes over " << trace.back().offset_ns * time_scale / 1e9
+         << " s (time scale " << time_scale << ")\n";
+
+    Netrounds::EventLoop loop;
+    ResultStore results(RESULT_WINDOW);
+    Netrounds::ReplayStats stats;
+    Netrounds::ReplayConfig config;
+    config.reflector = dest;
+    config.time_scale = time_scale;
+    config.max_len = 9000;
+    config.reply_timeout_ns = REPLY_TIMEOUT_NS;
+    config.window = 1 << 16;
+    config.tx_timestamps = true;
+    auto sink = [&results, output](const Netrounds::ProbeRecord& rec)
+    {
+        store_record(results, output, rec);
+    };
+    loop.spawn(Netrounds::replay_session(loop, sock, config, trace, sink, &stats));
+    loop.run();
+    if (results.size())
+    {
+        report_window(results, output);
+    }
+
+    cout << "Replay: sent " << stats.sent << " replies " << stats.replies << " timeouts " << stats.timeouts
+         << " late replies " << stats.stale << ", " << stats.resized << " probes resized to fit\n";
+    cout << "Replay timing: sent over " << stats.duration_ns / 1e9 << " s for a schedule of "
+         << (trace.back().offset_ns - trace.front().offset_ns) * time_scale / 1e9 << " s, sends late by mean "
+         << stats.late.sum() / stats.late.count() << " ns, p50 < " << stats.late.quantile_upper_ns(0.5)
+         << " ns, p99 < " << stats.late.quantile_upper_ns(0.99) << " ns, max " << stats.max_late_ns << " ns\n";
+}
+
+// A pool buffer for the next --zerocopy probe, waiting for completions of earlier sends if all are in flight.
+char *acquire_zerocopy_buffer(int sock, Netrounds::ZerocopyPool& pool)
+{
+    int64_t sw_ns;
+    int64_t hw_ns;
+    uint32_t key;
+    char *buf;
+    while (!(buf = pool.acquire()))
+    {
+        wait_for_errqueue_data(sock);
+        while (Netrounds::read_errqueue(sock, &pool, &sw_ns, &hw_ns, &key) != Netrounds::ERRQUEUE_EMPTY)
+        {
+        }
+    }
+    return buf;
+}
+
+// With --zerocopy the error queue carries the completions of the sends next to the TX timestamps. Completions go
+// back to the pool until the timestamp of the send with OPT_ID key turns up; zero if it does not within two waits, or
+// a later send's comes first. Timestamps of earlier sends are skipped, as in EventLoop::tx_timestamp().
+timespec zerocopy_send_timestamp(int sock, Netrounds::ZerocopyPool& pool, uint32_t key)
+{
+    const int MAX_WAITS = 2;
+    timespec ts = { 0, 0 };
+    int64_t sw_ns;
+    int64_t hw_ns;
+    uint32_t got;
+    for (int waits = 0; waits < MAX_WAITS;)
+    {
+        switch (Netrounds::read_errqueue(sock, &pool, &sw_ns, &hw_ns, &got))
+        {
+        case Netrounds::ERRQUEUE_TIMESTAMP:
+            if (got == key)
+            {
+                ts.tv_sec = hw_ns / 1000000000;
+                ts.tv_nsec = hw_ns % 1000000000;
+                return ts;
+            }
+            // Keys wrap around, so compare by distance.
+            if (static_cast<int32_t>(got - key) > 0)
+            {
+                return ts;
+            }
+            Netrounds::count(Netrounds::M_TX_STAMP_STALE);
+            break;
+        case Netrounds::ERRQUEUE_EMPTY:
+            wait_for_errqueue_data(sock);
+            waits++;
+            break;
+        default:
+            break;
+        }
+    }
+    return ts;
+}
+
+// --pattern: the reply should echo the probe's payload pattern at the probe's length. Corrupted bytes are listed by
+// their offset in the datagram. The last trailer_len bytes carry the authentication trailer instead.
+void check_echoed_pattern(const char *reply, size_t len, size_t probe_len, size_t trailer_len, uint32_t seq,
+                          uint64_t *checked, uint64_t *corrupted, uint64_t *bad_length)
+{
+    const size_t MAX_LISTED = 16;
+    (*checked)++;
+    if (len != probe_len)
+    {
+        (*bad_length)++;
+        Netrounds::count(Netrounds::M_PAYLOAD_CORRUPTED);
+        cout << "Probe " << seq << ": reply of " << len << " bytes for a probe of " << probe_len << '\n';
+        return;
+    }
+    uint32_t bad[MAX_LISTED];
+    size_t nr_bad = Netrounds::verify_pattern(reply, len - trailer_len, seq, bad, MAX_LISTED);
+    if (!nr_bad)
+    {
+        return;
+    }
+    (*corrupted)++;
+    Netrounds::count(Netrounds::M_PAYLOAD_CORRUPTED);
+    cout << "Probe " << seq << ": " << nr_bad << " payload bytes corrupted, at offsets";
+    for (size_t i = 0; i < std::min(nr_bad, MAX_LISTED); i++)
+    {
+        cout << ' ' << bad[i];
+    }
+    cout << (nr_bad > MAX_LISTED ? " ...\n" : "\n");
+}
+
+// Local drops of the window next to the host-wide UDP buffer errors since the previous call.
+void print_drop_summary(uint64_t rxq_drops, bool have_snmp, Netrounds::UdpSnmp *prev)
+{
+    cout << "Local receive queue drops: " << rxq_drops;
+    Netrounds::UdpSnmp now;
+    if (have_snmp && Netrounds::read_udp_snmp(&now))
+    {
+        cout << ", host UDP RcvbufErrors +" << now.rcvbuf_errors - prev->rcvbuf_errors << " SndbufErrors +"
+             << now.sndbuf_errors - prev->sndbuf_errors;
+        *prev = now;
+    }
+    cout << '\n';
+}
 
 int main(int argc, char *argv[])
 {
@@ -29,46 +506,564 @@ int main(int argc, char *argv[])
     int ipver = 0;
     string iface_name;
 
-    const size_t BUFLEN = 1472;
-    char buf[BUFLEN];
+    size_t probe_len = 1472;
+    bool probe_len_set = false;
+    const size_t RESULT_WINDOW = 1000;
 
     shared_ptr<char> data;
     size_t datalen;
     sockaddr_storage ss;
 
+    timespec t1;
     timespec t4;
 
+    string metrics_endpoint;
+    shared_ptr<MetricsServer> metrics_server;
+    string stats_page_name;
+    std::unique_ptr<Netrounds::StatsPageWriter> stats_page;
+    size_t flight_slots = 0;
+    int64_t flight_threshold_ns = 0;
+    SocketBuffers buffers;
+    size_t rollup_slots = 0;
+    int nr_sessions = 0;
+    int64_t interval_ns = 1000000000;
+    string output_path;
+    string output_format = "csv";
+    Netrounds::OverflowPolicy output_policy = Netrounds::OVERFLOW_DROP;
+    std::unique_ptr<ResultSink> output;
+    bool multicast = false;
+    int multicast_ttl = 1;
+    size_t train_len = 0;
+    size_t dispersion_len = 0;
+    bool zerocopy = false;
+    string replay_path;
+    bool pattern = false;
+    uint64_t pattern_checked = 0;
+    uint64_t pattern_corrupted = 0;
+    uint64_t pattern_bad_length = 0;
+    double replay_scale = 1.0;
+    string auth_key_path;
+    std::unique_ptr<Netrounds::PacketAuth> auth;
+    uint32_t auth_session = 0;
+    uint64_t auth_failed = 0;
+    bool timestamp_reports = false;
+    uint32_t reflector_shed = 0;    // as of the latest reply, the reflector counts per source address
+
+    const option long_options[] =
+    {
+        { "metrics", required_argument, 0, 'm' },
+        { "flight-recorder", required_argument, 0, 'f' },
+        { "flight-threshold-us", required_argument, 0, 'F' },
+        { "rcvbuf", required_argument, 0, 'R' },
+        { "sndbuf", required_argument, 0, 'S' },
+        { "force-bufs", no_argument, 0, 'B' },
+        { "rollup-slots", required_argument, 0, 'r' },
+        { "sessions", required_argument, 0, 'n' },
+        { "interval-us", required_argument, 0, 'i' },
+        { "output", required_argument, 0, 'o' },
+        { "format", required_argument, 0, 'O' },
+        { "output-policy", required_argument, 0, 'P' },
+        { "multicast", no_argument, 0, 'M' },
+        { "multicast-ttl", required_argument, 0, 'T' },
+        { "train", required_argument, 0, 't' },
+        { "zerocopy", no_argument, 0, 'z' },
+        { "probe-len", required_argument, 0, 'l' },
+        { "replay", required_argument, 0, 'p' },
+        { "replay-scale", required_argument, 0, 's' },
+        { "pattern", no_argument, 0, 'c' },
+        { "auth-key", required_argument, 0, 'a' },
+        { "dispersion", required_argument, 0, 'd' },
+        { "stats-page", required_argument, 0, 'w' },
+        { "timestamp-reports", no_argument, 0, 'E' },
+        { 0, 0, 0, 0 }
+    };
+
     try
     {
-        if (argc != 6)
+        int opt;
+        while ((opt = getopt_long(argc, argv, "m:f:F:R:S:Br:n:i:o:O:P:MT:t:zl:p:s:ca:d:w:E", long_options, 0)) != -1)
+        {
+            switch (opt)
+            {
+            case 'm':
+                metrics_endpoint = optarg;
+                break;
+            case 'w':
+                stats_page_name = optarg;
+                break;
+            case 'f':
+                flight_slots = std::stoul(optarg);
+                break;
+            case 'F':
+                flight_threshold_ns = std::stoll(optarg) * 1000;
+                break;
+            case 'R':
+                buffers.rcvbuf = std::stoi(optarg);
+                break;
+            case 'S':
+                buffers.sndbuf = std::stoi(optarg);
+                break;
+            case 'B':
+                buffers.force = true;
+                break;
+            case 'r':
+                rollup_slots = std::stoul(optarg);
+                break;
+            case 'n':
+                nr_sessions = std::stoi(optarg);
+                break;
+            case 'i':
+                interval_ns = std::stoll(optarg) * 1000;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'O':
+                output_format = optarg;
+                break;
+            case 'P':
+                output_policy = Netrounds::parse_overflow_policy(optarg);
+                break;
+            case 'M':
+                multicast = true;
+                break;
+            case 'T':
+                multicast_ttl = std::stoi(optarg);
+                break;
+            case 't':
+                train_len = std::stoul(optarg);
+                break;
+            case 'z':
+                zerocopy = true;
+                break;
+            case 'l':
+                probe_len = std::stoul(optarg);
+                probe_len_set = true;
+                break;
+            case 'p':
+                replay_path = optarg;
+                break;
+            case 's':
+                replay_scale = std::stod(optarg);
+                break;
+            case 'c':
+                pattern = true;
+                break;
+            case 'a':
+                auth_key_path = optarg;
+                break;
+            case 'd':
+                dispersion_len = std::stoul(optarg);
+                break;
+            case 'E':
+                timestamp_reports = true;
+                break;
+            default:
+                throw std::runtime_error("Unknown option");
+            }
+        }
+
+        if (argc - optind != 5)
         {
-            throw std::runtime_error("Usage: sender <ip addr> <port> <ip ver (4 or 6)> <nr of packets> <iface>");
+            throw std::runtime_error("Usage: sender [--metrics <host:port|/unix/path>] [--stats-page <shm name>] "
+                                     "[--flight-recorder <slots>] "
+                                     "[--flight-threshold-us <us>] [--rcvbuf <bytes>] [--sndbuf <bytes>] "
+                                     "[--force-bufs] [--rollup-slots <n>] [--sessions <n>] "
+                                     "[--output <file|-> [--format csv|jsonl|binary] [--output-policy drop|block]] "
+                                     "[--multicast [--multicast-ttl <hops>]] [--train <probes per send>] "
+                                     "[--dispersion <probes per train, 2 for pairs>] "
+                                     "[--interval-us <us> (sessions, multicast, train, dispersion)] "
+                                     "[--zerocopy (not with sessions, multicast, train, dispersion, replay)] "
+                                     "[--probe-len <bytes, up to 9000> (not with replay)] "
+                                     "[--replay <pcap|pcapng|trace file> [--replay-scale <factor>]] "
+                                     "[--pattern (needs a reflector that echoes, --fast-path; "
+                                     "not with multicast, train, dispersion, replay)] "
+                                     "[--auth-key <key file> (also with --train)] "
+                                     "[--timestamp-reports (with --sessions, for a receiver with --ts-reports; "
+                                     "always on without --sessions)] "
+                                     "<ip addr> <port> <ip ver (4 or 6)> "
+                                     "<nr of packets> <iface>");
         }
         else
         {
-            address = string(argv[1]);
-            port = stoi(argv[2]);
-            ipver = stoi(argv[3]);
+            address = string(argv[optind]);
+            port = stoi(argv[optind + 1]);
+            ipver = stoi(argv[optind + 2]);
             domain = ipver == 6 ? AF_INET6 : AF_INET;
-            nr_packets = stoi(argv[4]);
-            iface_name = string(argv[5]);
+            nr_packets = stoi(argv[optind + 3]);
+            iface_name = string(argv[optind + 4]);
         }
 
-        sock = setup_socket(domain, SOCK_DGRAM, SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE);
+        if (!metrics_endpoint.empty())
+        {
+            metrics_server.reset(new MetricsServer(metrics_endpoint));
+        }
+        if (!stats_page_name.empty())
+        {
+            stats_page.reset(new Netrounds::StatsPageWriter(stats_page_name, Netrounds::STATS_PAGE_PERIOD_NS));
+        }
+        if (!output_path.empty())
+        {
+            std::unique_ptr<Netrounds::RecordFormat> format = Netrounds::make_record_format(output_format);
+            output.reset(new ResultSink(ResultSink::open_output(output_path), std::move(format), output_policy));
+        }
+        if (!auth_key_path.empty())
+        {
+            if (!replay_path.empty() || nr_sessions || multicast || dispersion_len)
+            {
+                throw std::runtime_error("--auth-key does not combine with --replay, --sessions, --multicast or "
+                                         "--dispersion");
+            }
+            std::vector<uint8_t> key = Netrounds::load_auth_key(auth_key_path);
+            auth.reset(new Netrounds::PacketAuth(key.data()));
+            // A fresh session, and with it a fresh key, for every run.
+            auth_session = std::random_device()();
+            cout << "Authenticated session " << auth_session << ", "
+                 << Netrounds::auth_kernel_name(auth->kernel()) << " AES-CMAC\n";
+        }
+        if (timestamp_reports && (!nr_sessions || multicast || train_len || dispersion_len || !replay_path.empty()))
+        {
+            throw std::runtime_error("--timestamp-reports needs --sessions");
+        }
+        // Of the probe options, only --probe-len carries over to the other modes, and not to --replay, whose
+        // probes are as long as the trace says. --sessions checks the echoed pattern too.
+        if (zerocopy && (nr_sessions || multicast || train_len || dispersion_len || !replay_path.empty()))
+        {
+            throw std::runtime_error("--zerocopy does not combine with --sessions, --multicast, --train, "
+                                     "--dispersion or --replay");
+        }
+        if (pattern && (multicast || train_len || dispersion_len || !replay_path.empty()))
+        {
+            throw std::runtime_error("--pattern does not combine with --multicast, --train, --dispersion or --replay");
+        }
+        if (probe_len_set && !replay_path.empty())
+        {
+            throw std::runtime_error("--probe-len does not combine with --replay");
+        }
+        // Jumbo probes up to what recvpacket() takes back.
+        const size_t MAX_PROBE_LEN = 9000;
+        if (probe_len < sizeof(Netrounds::ReflectorPacket) || probe_len > MAX_PROBE_LEN)
+        {
+            throw std::runtime_error("--probe-len out of range");
+        }
+        // The reply is as long as the probe and has to hold its header and trailer.
+        if (auth && probe_len < Netrounds::PacketAuth::min_len(Netrounds::FROM_REFLECTOR))
+        {
+            throw std::runtime_error("--probe-len too short for --auth-key");
+        }
+        sockaddr_storage dest;
+        create_sockaddr_storage(domain, address, port, &dest);
+        CounterBlock *session = Netrounds::session_counters(sockaddr_to_string(&dest));
+
+        // OPT_ID numbers the TX timestamps, so that sessions match each to its probe (EventLoop::tx_timestamp()).
+        const int so_timestamping_flags = SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+            SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_OPT_ID;
+        sock = setup_socket(domain, SOCK_DGRAM, so_timestamping_flags, buffers);
         setup_device(sock, iface_name, SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE);
+        if (!replay_path.empty())
+        {
+            if (train_len || nr_sessions || multicast || dispersion_len)
+            {
+                throw std::runtime_error("--replay does not combine with --train, --sessions, --multicast or "
+                                         "--dispersion");
+            }
+            if (replay_scale <= 0)
+            {
+                throw std::runtime_error("--replay-scale must be positive");
+            }
+            run_replay(sock, dest, replay_path, replay_scale, nr_packets, output.get());
+            close_output(output.get());
+            return 0;
+        }
+        if (dispersion_len)
+        {
+            if (train_len || nr_sessions || multicast || output)
+            {
+                throw std::runtime_error("--dispersion does not combine with --train, --sessions, --multicast or "
+                                         "--output");
+            }
+            run_dispersion(sock, domain, dest, nr_packets, dispersion_len, interval_ns, probe_len);
+            return 0;
+        }
+        if (train_len)
+        {
+            if (nr_sessions || multicast || output)
+            {
+                throw std::runtime_error("--train does not combine with --sessions, --multicast or --output");
+            }
+            run_train(sock, dest, nr_packets, train_len, interval_ns, probe_len, auth.get(), auth_session);
+            return 0;
+        }
+        if (multicast)
+        {
+            if (nr_sessions || output)
+            {
+                throw std::runtime_error("--multicast does not combine with --sessions or --output");
+            }
+            run_multicast(sock, domain, iface_name, multicast_ttl, dest, nr_packets, interval_ns, probe_len);
+            return 0;
+        }
+        if (nr_sessions)
+        {
+            run_sessions(nr_sessions, sock, domain, so_timestamping_flags, buffers, dest, nr_packets, interval_ns,
+                         probe_len, pattern, timestamp_reports, output.get());
+            close_output(output.get());
+            return 0;
+        }
 
+        // The sender socket is not bound, so flight recorder dumps show the unspecified address as source.
+        sockaddr_storage local;
+        memset(&local, 0, sizeof(local));
+        local.ss_family = domain;
+        const double CUSUM_SLACK_NS = 20000;
+        const double CUSUM_LIMIT_NS = 100000;
+        shared_ptr<FlightRecorder> recorder;
+        Netrounds::LatencyDetector detector(flight_threshold_ns, CUSUM_SLACK_NS, CUSUM_LIMIT_NS);
+        Netrounds::TscClock& clock = Netrounds::TscClock::instance();
+        if (flight_slots)
+        {
+            recorder.reset(new FlightRecorder(flight_slots, "flight-sender"));
+            FlightRecorder::install_signal_handler();
+        }
+
+        // Replies lost in our own receive queue are not path loss, keep them apart.
+        RxqDrops rxq_drops;
+        uint32_t rxq_dropped = 0;
+        uint64_t window_rxq_drops = 0;
+        Netrounds::UdpSnmp snmp_start;
+        bool have_snmp = Netrounds::read_udp_snmp(&snmp_start);
+
+        std::vector<char> buf(probe_len);
+        const size_t ZEROCOPY_BUFFERS = 16;
+        std::unique_ptr<Netrounds::ZerocopyPool> pool;
+        if (zerocopy)
+        {
+            Netrounds::enable_zerocopy(sock);
+            pool.reset(new Netrounds::ZerocopyPool(ZEROCOPY_BUFFERS, probe_len));
+        }
+
+        ResultStore results(RESULT_WINDOW);
+        Netrounds::Rollup rollup(Netrounds::Rollup::default_levels(rollup_slots));
+        // One-way delays need the reflector's clock against ours, estimated from the probes themselves.
+        Netrounds::ClockOffsetEstimator clock_offset;
+        int64_t last_t1_ns = 0;   // the estimator's time line, on which it is queried
+        Netrounds::OneWaySummary one_way;
+        Netrounds::clear_one_way(&one_way);
+        auto finish_window = [&]()
+        {
+            report_window(results, output.get());
+            Netrounds::print_one_way(cout, one_way, clock_offset.estimate(last_t1_ns));
+            Netrounds::clear_one_way(&one_way);
+            print_drop_summary(window_rxq_drops, have_snmp, &snmp_start);
+            print_rollups(rollup, clock.realtime_ns());
+            results.clear();
+            window_rxq_drops = 0;
+        };
+        // A reflector with --ts-reports sends t3 in reports of its own after the replies; records wait for them once
+        // the first one is in.
+        Netrounds::ReportMerger reports(Netrounds::REPORT_MATCH_WINDOW, [&](const Netrounds::ProbeRecord& rec)
+        {
+            results.append(rec.seq, rec.t1, rec.t2, rec.t3, rec.t4, rec.flags);
+            if (output)
+            {
+                output->push(rec);
+            }
+            Netrounds::add_one_way(&one_way, clock_offset.update(rec));
+            if (rec.t1)
+            {
+                last_t1_ns = rec.t1;
+            }
+            if (results.size() == results.capacity())
+            {
+                finish_window();
+            }
+        });
         uint32_t send_counter = 0;
         for (; nr_packets; nr_packets--)
         {
-            prepare_packet(buf, BUFLEN, send_counter);
-            sendpacket(domain, address, port, sock, buf, BUFLEN);
+            uint32_t seq = send_counter;
+            if (recorder && FlightRecorder::dump_requested())
+            {
+                cout << "Flight recorder dumped to " << recorder->dump() << '\n';
+            }
+            char *probe = pool ? acquire_zerocopy_buffer(sock, *pool) : buf.data();
+            prepare_packet(probe, probe_len, send_counter);
+            if (pattern)
+            {
+                Netrounds::fill_pattern(probe, probe_len, send_counter);
+            }
+            if (auth)
+            {
+                auth->sign(probe, probe_len, auth_session);
+            }
+            if (pool)
+            {
+                while (!pool->send(sock, &dest, probe, probe_len))
+                {
+                    usleep(100);
+                }
+            }
+            else
+            {
+                sendpacket(domain, address, port, sock, probe, probe_len);
+            }
             send_counter++;
-            wait_for_errqueue_data(sock);
-            receive_send_timestamp(sock);
-            tie(data, datalen, ss, t4) = recvpacket(sock, 0);
+            Netrounds::count(Netrounds::M_PKTS_SENT);
+            session->inc(Netrounds::M_PKTS_SENT);
+            if (pool)
+            {
+                t1 = zerocopy_send_timestamp(sock, *pool, seq);
+            }
+            else
+            {
+                wait_for_errqueue_data(sock);
+                tie(data, datalen, ss, t1) = receive_send_timestamp(sock);
+            }
+            FlightInfo flight;
+            if (recorder)
+            {
+                memset(&flight, 0, sizeof(flight));
+                flight.ts_ns = clock.realtime_ns();
+                flight.direction = Netrounds::FLIGHT_OUTBOUND;
+                flight.src = &local;
+                flight.dst = &dest;
+                flight.seq = seq;
+                flight.hw[Netrounds::PROBE_T1] = timespec_to_ns(t1);
+                recorder->record(flight, probe, probe_len);
+            }
+            tie(data, datalen, ss, t4) = recvpacket(sock, 0, &rxq_dropped);
+            // Reports about earlier probes may come before the reply.
+            while (data && same_peer(ss, dest) && reports.merge(data.get(), datalen))
+            {
+                tie(data, datalen, ss, t4) = recvpacket(sock, 0, &rxq_dropped);
+            }
+            uint32_t dropped = rxq_drops.update(rxq_dropped);
+            if (dropped)
+            {
+                Netrounds::count(Netrounds::M_RXQ_OVERFLOW, dropped);
+                session->inc(Netrounds::M_RXQ_OVERFLOW, dropped);
+                window_rxq_drops += dropped;
+            }
+
+            int64_t t1_ns = timespec_to_ns(t1);
+            int64_t t2_ns = 0;
+            int64_t t3_ns = 0;
+            int64_t t4_ns = 0;
+            uint8_t flags = t1_ns ? Netrounds::RESULT_HAS_T1 : 0;
+            if (data)
+            {
+                Netrounds::count(Netrounds::M_PKTS_RECEIVED);
+                session->inc(Netrounds::M_PKTS_RECEIVED);
+                Netrounds::PacketType type;
+                uint32_t reply_session;
+                bool authentic = !auth || (auth->verify(data.get(), datalen, &reply_session) &&
+                                           reply_session == auth_session);
+                if (!authentic)
+                {
+                    auth_failed++;
+                    Netrounds::count(Netrounds::M_AUTH_FAILED);
+                    session->inc(Netrounds::M_AUTH_FAILED);
+                }
+                if (authentic && Netrounds::peek_packet_type(data.get(), datalen, &type) &&
+                    type == Netrounds::FROM_REFLECTOR)
+                {
+                    shared_ptr<ReflectorPacket> reply = Netrounds::decode_reflector_packet(data.get(), datalen);
+                    reflector_shed = std::max(reflector_shed, reply->shed);
+                    if (reply->sender_seq == seq && pattern)
+                    {
+                        check_echoed_pattern(data.get(), datalen, probe_len, auth ? Netrounds::AUTH_TRAILER_LEN : 0,
+                                             seq, &pattern_checked, &pattern_corrupted, &pattern_bad_length);
+                    }
+                    if (reply->sender_seq == seq)
+                    {
+                        t2_ns = reply->t2;
+                        t3_ns = reply->t3;
+                        t4_ns = timespec_to_ns(t4);
+                        flags |= (t2_ns ? Netrounds::RESULT_HAS_T2 : 0) | (t3_ns ? Netrounds::RESULT_HAS_T3 : 0) |
+                            (t4_ns ? Netrounds::RESULT_HAS_T4 : 0);
+                    }
+                }
+                if (t1_ns && t4_ns)
+                {
+                    session->latency.record(t4_ns - t1_ns);
+                }
+            }
+            Netrounds::ProbeRecord rec = { seq, t1_ns, t2_ns, t3_ns, t4_ns, flags };
+            reports.add(rec);
+
+            int64_t rtt_ns = -1;
+            if (flags == Netrounds::RESULT_COMPLETE)
+            {
+                rtt_ns = (t4_ns - t1_ns) - (t3_ns - t2_ns);
+            }
+            else if (t1_ns && t4_ns)
+            {
+                rtt_ns = t4_ns - t1_ns;
+            }
+            bool anomaly = rtt_ns >= 0 && detector.update(rtt_ns);
+            // On the realtime clock, that of the queries; t1 is on the NIC's clock, which may be far off it.
+            rollup.add(clock.realtime_ns(), rtt_ns);
+            if (recorder && data)
+            {
+                flight.ts_ns = clock.realtime_ns();
+                flight.direction = Netrounds::FLIGHT_INBOUND;
+                flight.src = &ss;
+                flight.dst = &local;
+                flight.hw[Netrounds::PROBE_T2] = t2_ns;
+                flight.hw[Netrounds::PROBE_T3] = t3_ns;
+                flight.hw[Netrounds::PROBE_T4] = t4_ns;
+                recorder->record(flight, data.get(), datalen);
+            }
+            if (recorder && anomaly)
+            {
+                cout << "RTT anomaly, flight recorder dumped to " << recorder->dump() << '\n';
+            }
             cout << "Sleeping...\n";
             sleep(5);
         }
+        // The last report may still be on its way.
+        const int REPORT_WAIT_MS = 1000;
+        pollfd pfd = { sock, POLLIN, 0 };
+        while (reports.reports() && poll(&pfd, 1, REPORT_WAIT_MS) > 0)
+        {
+            tie(data, datalen, ss, t4) = recvpacket(sock, 0, &rxq_dropped);
+            if (data && same_peer(ss, dest))
+            {
+                reports.merge(data.get(), datalen);
+            }
+        }
+        reports.flush();
+        if (results.size())
+        {
+            report_window(results, output.get());
+            if (one_way.forward.count)
+            {
+                Netrounds::print_one_way(cout, one_way, clock_offset.estimate(last_t1_ns));
+            }
+            print_drop_summary(window_rxq_drops, have_snmp, &snmp_start);
+        }
+        print_rollups(rollup, clock.realtime_ns());
+        if (pattern)
+        {
+            cout << "Payload pattern (" << Netrounds::pattern_kernel_name(Netrounds::best_pattern_kernel()) << "): "
+                 << pattern_checked << " replies checked, " << pattern_corrupted << " corrupted, "
+                 << pattern_bad_length << " of the wrong length\n";
+        }
+        if (auth)
+        {
+            cout << "Authentication: " << auth_failed << " replies rejected\n";
+        }
+        if (reflector_shed)
+        {
+            cout << "Reflector rate limit: " << reflector_shed << " probes from this address dropped, slow down\n";
+        }
+        if (pool)
+        {
+            cout << "Zerocopy: " << pool->zerocopy_sends() << " sends, " << pool->copied_sends()
+                 << " copied by the kernel after all, " << pool->fallback_sends() << " sent as copies, "
+                 << pool->in_flight() << " still in flight\n";
+        }
+        close_output(output.get());
     }
     catch (std::exception &exc)
     {
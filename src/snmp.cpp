@@ -0,0 +1,92 @@
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "snmp.h"
+
+using std::string;
+using std::vector;
+
+namespace Netrounds
+{
+namespace
+{
+vector<string> split(const string& line)
+{
+    std::istringstream in(line);
+    vector<string> fields;
+    string field;
+    while (in >> field)
+    {
+        fields.push_back(field);
+    }
+    return fields;
+}
+}
+
+bool parse_snmp(std::istream& in, UdpSnmp *stats)
+{
+    string header;
+    string values;
+
+    while (std::getline(in, header))
+    {
+        if (header.compare(0, 4, "Udp:") != 0 || !std::getline(in, values))
+        {
+            continue;
+        }
+        vector<string> names = split(header);
+        vector<string> counts = split(values);
+        bool found = false;
+        for (size_t i = 1; i < names.size() && i < counts.size(); i++)
+        {
+            if (names[i] == "RcvbufErrors")
+            {
+                stats->rcvbuf_errors += std::stoull(counts[i]);
+                found = true;
+            }
+            else if (names[i] == "SndbufErrors")
+            {
+                stats->sndbuf_errors += std::stoull(counts[i]);
+                found = true;
+            }
+        }
+        return found;
+    }
+    return false;
+}
+
+bool parse_snmp6(std::istream& in, UdpSnmp *stats)
+{
+    string name;
+    uint64_t count;
+    bool found = false;
+
+    while (in >> name >> count)
+    {
+        if (name == "Udp6RcvbufErrors")
+        {
+            stats->rcvbuf_errors += count;
+            found = true;
+        }
+        else if (name == "Udp6SndbufErrors")
+        {
+            stats->sndbuf_errors += count;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool read_udp_snmp(UdpSnmp *stats, const string& snmp_path, const string& snmp6_path)
+{
+    stats->rcvbuf_errors = 0;
+    stats->sndbuf_errors = 0;
+
+    std::ifstream snmp(snmp_path);
+    std::ifstream snmp6(snmp6_path);
+    bool found = snmp && parse_snmp(snmp, stats);
+    found = (snmp6 && parse_snmp6(snmp6, stats)) || found;
+    return found;
+}
+};
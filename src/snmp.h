@@ -0,0 +1,29 @@
+#ifndef _SNMP_H_
+#define _SNMP_H_
+
+#include <istream>
+#include <string>
+
+#include <cstdint>
+
+namespace Netrounds
+{
+// Host-wide UDP buffer error counters. They cover every UDP socket on the host, so they say whether the kernel
+// dropped datagrams at all; SO_RXQ_OVFL (see recvpacket()) says whether it was our socket.
+struct UdpSnmp
+{
+    uint64_t rcvbuf_errors;
+    uint64_t sndbuf_errors;
+};
+
+// "Udp:" header/value line pairs as in /proc/net/snmp. Adds to *stats, false if there is no Udp section.
+bool parse_snmp(std::istream& in, UdpSnmp *stats);
+// "Udp6RcvbufErrors <n>" lines as in /proc/net/snmp6. Adds to *stats, false if the counters are missing.
+bool parse_snmp6(std::istream& in, UdpSnmp *stats);
+
+// IPv4 plus IPv6 counters, false if neither file could be read.
+bool read_udp_snmp(UdpSnmp *stats, const std::string& snmp_path = "/proc/net/snmp",
+                   const std::string& snmp6_path = "/proc/net/snmp6");
+};
+
+#endif
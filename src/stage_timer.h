@@ -0,0 +1,103 @@
+#ifndef _STAGE_TIMER_H_
+#define _STAGE_TIMER_H_
+
+#include <ostream>
+
+#include <cstdint>
+
+#include "histogram.h"
+#include "metrics.h"
+#include "tsc_clock.h"
+
+namespace Netrounds
+{
+// Stages of reflecting one probe in receive_loop(). Each checkpoint records the time since the previous one.
+enum ReflectorStage
+{
+    STAGE_RECVMSG,      // readable socket -> recvmsg() returned
+    STAGE_DECODE,       // -> decode_packet() done
+    STAGE_SERIALIZE,    // -> serialize_reflector_packet() done
+    STAGE_SENDTO,       // -> sendto() returned
+    STAGE_TX_TIMESTAMP, // -> TX timestamp read from the error queue
+    NR_REFLECTOR_STAGES
+};
+
+inline const char *stage_name(ReflectorStage stage)
+{
+    static const char *names[NR_REFLECTOR_STAGES] = { "recvmsg", "decode", "serialize", "sendto", "tx_timestamp" };
+    return names[stage];
+}
+
+// Per-stage residence time histograms, read with the calibrated TSC clock and exported as
+// netrounds_reflector_stage_seconds{stage="..."}. Only use through the STAGE_* macros below so the checkpoints
+// compile away unless built with -DSTAGE_TIMING.
+class StageTimer
+{
+public:
+    StageTimer() : last(0)
+    {
+        for (int i = 0; i < NR_REFLECTOR_STAGES; i++)
+        {
+            register_histogram("reflector_stage", string_label(static_cast<ReflectorStage>(i)), &hist[i]);
+        }
+    }
+
+    void start()
+    {
+        last = now_ns();
+    }
+
+    void checkpoint(ReflectorStage stage)
+    {
+        uint64_t now = now_ns();
+        hist[stage].record(now - last);
+        last = now;
+    }
+
+    // Residence times of stage so far.
+    const Log2Histogram& histogram(ReflectorStage stage) const
+    {
+        return hist[stage];
+    }
+
+    void report(std::ostream& os) const
+    {
+        for (int i = 0; i < NR_REFLECTOR_STAGES; i++)
+        {
+            uint64_t n = hist[i].count();
+            os << "stage " << stage_name(static_cast<ReflectorStage>(i)) << ": n " << n
+               << " mean_ns " << (n ? hist[i].sum() / n : 0)
+               << " p50_ns < " << hist[i].quantile_upper_ns(0.5)
+               << " p99_ns < " << hist[i].quantile_upper_ns(0.99) << '\n';
+        }
+    }
+
+private:
+    static std::string string_label(ReflectorStage stage)
+    {
+        return std::string("stage=\"") + stage_name(stage) + "\"";
+    }
+
+    static uint64_t now_ns()
+    {
+        return TscClock::instance().monotonic_ns();
+    }
+
+    uint64_t last;
+    Log2Histogram hist[NR_REFLECTOR_STAGES];
+};
+};
+
+#ifdef STAGE_TIMING
+#define STAGE_TIMER(t) static Netrounds::StageTimer t
+#define STAGE_START(t) (t).start()
+#define STAGE_CHECKPOINT(t, stage) (t).checkpoint(stage)
+#define STAGE_REPORT(t, os) (t).report(os)
+#else
+#define STAGE_TIMER(t)
+#define STAGE_START(t) ((void)0)
+#define STAGE_CHECKPOINT(t, stage) ((void)0)
+#define STAGE_REPORT(t, os) ((void)0)
+#endif
+
+#endif
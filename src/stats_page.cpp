@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <cstring>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats_page.h"
+#include "tsc_clock.h"
+
+using std::string;
+
+namespace Netrounds
+{
+namespace
+{
+const char MAGIC[8] = "NRSTATS";
+const int READ_TRIES = 1000;
+
+string object_name(const string& name)
+{
+    if (name.empty())
+    {
+        throw std::runtime_error("Stats page needs a name");
+    }
+    return name[0] == '/' ? name : "/" + name;
+}
+}
+
+StatsPageWriter::StatsPageWriter(const string& page_name, int64_t period_ns, size_t max_records) :
+    name(object_name(page_name)), period_ns(period_ns),
+    map_len(sizeof(StatsPageHeader) + max_records * sizeof(StatsRecord)), generation(0), stop(false)
+{
+    static_assert(NR_METRIC_COUNTERS <= STATS_PAGE_COUNTERS, "Stats page has no room for all counters");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "Stats page needs lock-free 64-bit atomics");
+    static_assert(sizeof(std::atomic<char>) == 1 && std::atomic<char>::is_always_lock_free,
+                  "Stats page needs plain lock-free atomic chars");
+    if (!max_records)
+    {
+        throw std::runtime_error("Stats page needs at least one record");
+    }
+
+    // A page left over by a writer that did not get to clean up is replaced, not reused.
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), "shm_open " + name);
+    }
+    if (ftruncate(fd, map_len) == -1)
+    {
+        int err = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::system_error(err, std::system_category(), "ftruncate " + name);
+    }
+    void *mem = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        int err = errno;
+        shm_unlink(name.c_str());
+        throw std::system_error(err, std::system_category(), "mmap " + name);
+    }
+
+    // Fresh pages are zero, which is an empty, even seq for every record.
+    header = static_cast<StatsPageHeader *>(mem);
+    records = reinterpret_cast<StatsRecord *>(static_cast<char *>(mem) + sizeof(StatsPageHeader));
+    header->version = STATS_PAGE_VERSION;
+    header->header_size = sizeof(StatsPageHeader);
+    header->record_size = sizeof(StatsRecord);
+    header->max_records = max_records;
+    header->nr_counters = NR_METRIC_COUNTERS;
+    header->nr_buckets = Log2Histogram::NR_BUCKETS;
+    header->pid = getpid();
+    header->period_us = period_ns / 1000;
+    // Last, so a reader that sees the magic sees the rest of the header.
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, MAGIC, sizeof(MAGIC));
+
+    if (period_ns > 0)
+    {
+        thread = std::thread(&StatsPageWriter::run, this);
+    }
+}
+
+StatsPageWriter::~StatsPageWriter()
+{
+    stop = true;
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+    munmap(header, map_len);
+    shm_unlink(name.c_str());
+}
+
+StatsRecord *StatsPageWriter::record(const string& session)
+{
+    auto it = slots.find(session);
+    if (it != slots.end())
+    {
+        it->second.generation = generation;
+        return it->second.rec;
+    }
+    StatsRecord *rec = nullptr;
+    uint32_t used = header->nr_records.load(std::memory_order_relaxed);
+    bool fresh = false;
+    if (!free_records.empty())
+    {
+        rec = free_records.back();
+        free_records.pop_back();
+    }
+    else if (used < header->max_records)
+    {
+        rec = &records[used];
+        fresh = true;
+    }
+    if (rec)
+    {
+        uint64_t seq = rec->seq.load(std::memory_order_relaxed);
+        rec->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < STATS_NAME_LEN; i++)
+        {
+            rec->name[i].store(i < STATS_NAME_LEN - 1 && i < session.size() ? session[i] : '\0',
+                               std::memory_order_relaxed);
+        }
+        rec->seq.store(seq + 2, std::memory_order_release);
+        if (fresh)
+        {
+            header->nr_records.store(used + 1, std::memory_order_release);
+        }
+    }
+    else
+    {
+        header->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    slots[session] = { rec, generation };
+    return rec;
+}
+
+void StatsPageWriter::release(StatsRecord *rec)
+{
+    uint64_t seq = rec->seq.load(std::memory_order_relaxed);
+    rec->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < STATS_NAME_LEN; i++)
+    {
+        rec->name[i].store('\0', std::memory_order_relaxed);
+    }
+    rec->published_ns.store(0, std::memory_order_relaxed);
+    for (size_t c = 0; c < STATS_PAGE_COUNTERS; c++)
+    {
+        rec->counters[c].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+    {
+        rec->buckets[i].store(0, std::memory_order_relaxed);
+    }
+    rec->latency_sum_ns.store(0, std::memory_order_relaxed);
+    rec->seq.store(seq + 2, std::memory_order_release);
+    free_records.push_back(rec);
+}
+
+void StatsPageWriter::publish(const std::vector<MetricsSnapshot>& snapshots, int64_t now_ns)
+{
+    generation++;
+    for (const MetricsSnapshot& snap : snapshots)
+    {
+        StatsRecord *rec = record(snap.session);
+        if (!rec)
+        {
+            continue;
+        }
+        uint64_t seq = rec->seq.load(std::memory_order_relaxed);
+        rec->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        rec->published_ns.store(now_ns, std::memory_order_relaxed);
+        for (int c = 0; c < NR_METRIC_COUNTERS; c++)
+        {
+            rec->counters[c].store(snap.counters[c], std::memory_order_relaxed);
+        }
+        for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+        {
+            rec->buckets[i].store(snap.buckets[i], std::memory_order_relaxed);
+        }
+        rec->latency_sum_ns.store(snap.latency_sum_ns, std::memory_order_relaxed);
+        rec->seq.store(seq + 2, std::memory_order_release);
+    }
+    // Sessions missing from the snapshot have been released.
+    for (auto it = slots.begin(); it != slots.end();)
+    {
+        if (it->second.generation == generation)
+        {
+            ++it;
+            continue;
+        }
+        if (it->second.rec)
+        {
+            release(it->second.rec);
+        }
+        it = slots.erase(it);
+    }
+    header->updated_ns.store(now_ns, std::memory_order_release);
+}
+
+void StatsPageWriter::run()
+{
+    std::vector<MetricsSnapshot> snapshots;
+    TscClock& clock = TscClock::instance();
+    while (!stop)
+    {
+        snapshot_metrics(&snapshots);
+        publish(snapshots, clock.realtime_ns());
+        usleep(period_ns / 1000);
+    }
+}
+
+StatsPageReader::StatsPageReader(const string& page_name)
+{
+    string name = object_name(page_name);
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::system_category(), "shm_open " + name);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::system_category(), "fstat " + name);
+    }
+    map_len = st.st_size;
+    if (map_len < sizeof(StatsPageHeader))
+    {
+        close(fd);
+        throw std::runtime_error("Stats page " + name + " is too short");
+    }
+    void *mem = mmap(nullptr, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        throw std::system_error(errno, std::system_category(), "mmap " + name);
+    }
+    header = static_cast<const StatsPageHeader *>(mem);
+    records = reinterpret_cast<const StatsRecord *>(static_cast<const char *>(mem) + header->header_size);
+
+    string problem;
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)))
+    {
+        problem = " is not a stats page, or not set up yet";
+    }
+    else if (header->version != STATS_PAGE_VERSION)
+    {
+        problem = " has layout version " + std::to_string(header->version) + ", this reader knows " +
+            std::to_string(STATS_PAGE_VERSION);
+    }
+    else if (header->header_size != sizeof(StatsPageHeader) || header->record_size != sizeof(StatsRecord) ||
+             header->nr_counters > STATS_PAGE_COUNTERS || header->nr_buckets != Log2Histogram::NR_BUCKETS ||
+             header->header_size + static_cast<size_t>(header->max_records) * header->record_size > map_len)
+    {
+        problem = " has an inconsistent layout";
+    }
+    if (!problem.empty())
+    {
+        munmap(const_cast<StatsPageHeader *>(header), map_len);
+        throw std::runtime_error("Stats page " + name + problem);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+StatsPageReader::~StatsPageReader()
+{
+    munmap(const_cast<StatsPageHeader *>(header), map_len);
+}
+
+bool StatsPageReader::read(size_t i, StatsSnapshot *snap) const
+{
+    if (i >= size())
+    {
+        return false;
+    }
+    const StatsRecord& rec = records[i];
+    char name[STATS_NAME_LEN];
+    for (int tries = 0; tries < READ_TRIES; tries++)
+    {
+        uint64_t before = rec.seq.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            continue;
+        }
+        for (size_t n = 0; n < STATS_NAME_LEN; n++)
+        {
+            name[n] = rec.name[n].load(std::memory_order_relaxed);
+        }
+        snap->published_ns = rec.published_ns.load(std::memory_order_relaxed);
+        for (size_t c = 0; c < STATS_PAGE_COUNTERS; c++)
+        {
+            snap->counters[c] = rec.counters[c].load(std::memory_order_relaxed);
+        }
+        for (int b = 0; b < Log2Histogram::NR_BUCKETS; b++)
+        {
+            snap->buckets[b] = rec.buckets[b].load(std::memory_order_relaxed);
+        }
+        snap->latency_sum_ns = rec.latency_sum_ns.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (rec.seq.load(std::memory_order_relaxed) == before)
+        {
+            snap->name.assign(name, strnlen(name, STATS_NAME_LEN));
+            return true;
+        }
+    }
+    return false;
+}
+};
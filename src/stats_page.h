@@ -0,0 +1,145 @@
+#ifndef _STATS_PAGE_H_
+#define _STATS_PAGE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "histogram.h"
+#include "metrics.h"
+
+namespace Netrounds
+{
+// Live counters and latency histograms in a named POSIX shared memory region (/dev/shm), for local agents that want
+// them far more often than scraping the metrics endpoint allows. A publisher thread copies snapshot_metrics() into
+// the region every period; the probe threads keep counting into their CounterBlocks as before and never touch it.
+//
+// The region is a StatsPageHeader followed by max_records StatsRecords, one for the process totals and one per
+// session. Every record is a seqlock: the writer makes seq odd, updates the fields, and makes it even again, and a
+// reader copies the fields between two reads of seq and retries if they differ or were odd. Readers take no lock
+// and make no system call, and cannot hold up the writer. All fields are lock-free atomics, so the copying is free
+// of data races too.
+//
+// A session that is no longer in the snapshot has been released; its record is cleared (empty name, published_ns
+// and everything else 0) and goes to the next new session, so a page of churning sessions does not run out of
+// records. Since a record can change names, the name is copied under the seqlock too.
+//
+// Readers check magic and version first and the sizes after, so a layout change means a new STATS_PAGE_VERSION.
+const uint32_t STATS_PAGE_VERSION = 2;
+const size_t STATS_PAGE_COUNTERS = 32;    // room for MetricCounter to grow without a new version
+const size_t STATS_NAME_LEN = 64;
+const int64_t STATS_PAGE_PERIOD_NS = 1000000;    // what --stats-page of the sender and receiver publish at
+
+// Padded to the record alignment, so the records that follow it are aligned in the region too.
+struct alignas(64) StatsPageHeader
+{
+    char magic[8];                        // "NRSTATS"
+    uint32_t version;
+    uint32_t header_size;                 // the records start here
+    uint32_t record_size;
+    uint32_t max_records;
+    uint32_t nr_counters;                 // counters in use, in MetricCounter order
+    uint32_t nr_buckets;                  // Log2Histogram::NR_BUCKETS
+    int32_t pid;                          // of the writer
+    uint32_t period_us;
+    std::atomic<uint32_t> nr_records;     // records ever used, only grows; free ones among them are cleared
+    std::atomic<uint32_t> dropped;        // sessions that found no free record
+    std::atomic<int64_t> updated_ns;      // CLOCK_REALTIME of the last publication, stops when the writer does
+};
+
+struct alignas(64) StatsRecord
+{
+    std::atomic<uint64_t> seq;            // odd while an update is under way
+    std::atomic<char> name[STATS_NAME_LEN];   // session, empty for the process totals and free records
+    std::atomic<int64_t> published_ns;    // 0 for a free record
+    std::atomic<uint64_t> counters[STATS_PAGE_COUNTERS];
+    std::atomic<uint64_t> buckets[Log2Histogram::NR_BUCKETS];
+    std::atomic<uint64_t> latency_sum_ns;
+};
+
+// A consistent copy of one record.
+struct StatsSnapshot
+{
+    std::string name;
+    int64_t published_ns;
+    uint64_t counters[STATS_PAGE_COUNTERS];
+    uint64_t buckets[Log2Histogram::NR_BUCKETS];
+    uint64_t latency_sum_ns;
+};
+
+// Creates the region (replacing a stale one of the same name) and removes it again when destroyed. name is a shared
+// memory object name, a leading '/' is added if missing. With a period the snapshot is published from a background
+// thread; with 0 only by calling publish().
+class StatsPageWriter
+{
+public:
+    static const size_t DEFAULT_RECORDS = 256;
+
+    StatsPageWriter(const std::string& name, int64_t period_ns, size_t max_records = DEFAULT_RECORDS);
+    ~StatsPageWriter();
+
+    StatsPageWriter(const StatsPageWriter&) = delete;
+    StatsPageWriter& operator=(const StatsPageWriter&) = delete;
+
+    void publish(const std::vector<MetricsSnapshot>& snapshots, int64_t now_ns);
+
+private:
+    struct Slot
+    {
+        StatsRecord *rec;       // nullptr for a session that found no free record
+        uint64_t generation;    // of the last publish() the session was in
+    };
+
+    StatsRecord *record(const std::string& session);
+    void release(StatsRecord *rec);
+    void run();
+
+    std::string name;
+    int64_t period_ns;
+    size_t map_len;
+    StatsPageHeader *header;
+    StatsRecord *records;
+    std::map<std::string, Slot> slots;
+    std::vector<StatsRecord *> free_records;    // released, for record() to hand out before new ones
+    uint64_t generation;
+    std::atomic<bool> stop;
+    std::thread thread;
+};
+
+// Maps a page read-only. Throws if it does not exist or has a layout this build does not know.
+class StatsPageReader
+{
+public:
+    explicit StatsPageReader(const std::string& name);
+    ~StatsPageReader();
+
+    StatsPageReader(const StatsPageReader&) = delete;
+    StatsPageReader& operator=(const StatsPageReader&) = delete;
+
+    const StatsPageHeader& page() const
+    {
+        return *header;
+    }
+
+    size_t size() const
+    {
+        return std::min<size_t>(header->nr_records.load(std::memory_order_acquire), header->max_records);
+    }
+
+    // Copies record i. False if the writer was in the middle of it on every try, as when it died there.
+    bool read(size_t i, StatsSnapshot *snap) const;
+
+private:
+    size_t map_len;
+    const StatsPageHeader *header;
+    const StatsRecord *records;
+};
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include <stdexcept>
+#include <string>
+#include <iostream>
+
+#include <ctime>
+
+#include <unistd.h>
+#include <getopt.h>
+
+#include "metrics.h"
+#include "stats_page.h"
+
+using std::cout;
+using std::string;
+
+using namespace Netrounds;
+
+// Prints the live stats page of a sender or receiver started with --stats-page, once or every interval. Reading the
+// page takes no lock and no system call, so it can poll as often as the writer publishes.
+
+namespace
+{
+// Upper bound of the bucket holding quantile q, as Log2Histogram::quantile_upper_ns(). 0 if empty or in overflow.
+uint64_t quantile_upper_ns(const uint64_t *buckets, uint64_t total, double q)
+{
+    uint64_t rank = static_cast<uint64_t>(q * (total - 1)) + 1;
+    uint64_t cumulative = 0;
+    for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+    {
+        cumulative += buckets[i];
+        if (cumulative >= rank)
+        {
+            return Log2Histogram::bucket_upper_ns(i);
+        }
+    }
+    return 0;
+}
+
+void print_snapshot(const StatsSnapshot& snap, size_t nr_counters, bool all)
+{
+    cout << (snap.name.empty() ? string("process") : "session " + snap.name) << ':';
+    for (size_t c = 0; c < nr_counters; c++)
+    {
+        if (!snap.counters[c] && !all)
+        {
+            continue;
+        }
+        cout << ' ';
+        if (c < NR_METRIC_COUNTERS)
+        {
+            cout << metric_counter_name(static_cast<MetricCounter>(c));
+        }
+        else
+        {
+            // From a newer writer with the same layout.
+            cout << "counter_" << c;
+        }
+        cout << ' ' << snap.counters[c];
+    }
+    uint64_t total = 0;
+    for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+    {
+        total += snap.buckets[i];
+    }
+    if (total)
+    {
+        cout << " latency n " << total << " mean " << snap.latency_sum_ns / total / 1000.0 << " us p50 < "
+             << quantile_upper_ns(snap.buckets, total, 0.5) / 1000.0 << " us p99 < "
+             << quantile_upper_ns(snap.buckets, total, 0.99) / 1000.0 << " us";
+    }
+    cout << '\n';
+}
+
+void print_page(const StatsPageReader& reader, const string& name, bool all)
+{
+    const StatsPageHeader& page = reader.page();
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t age_ns = now.tv_sec * 1000000000LL + now.tv_nsec - page.updated_ns.load(std::memory_order_acquire);
+    size_t size = reader.size();
+    cout << "Page " << name << ": pid " << page.pid << ", published every " << page.period_us << " us, updated "
+         << age_ns / 1e6 << " ms ago, " << size << " records, " << page.dropped.load(std::memory_order_relaxed)
+         << " sessions without a record\n";
+    StatsSnapshot snap;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (reader.read(i, &snap))
+        {
+            // Free records, of sessions that have been released, are never published.
+            if (snap.published_ns)
+            {
+                print_snapshot(snap, page.nr_counters, all);
+            }
+        }
+        else
+        {
+            cout << "record " << i << ": no consistent copy, the writer stopped in the middle of it\n";
+        }
+    }
+}
+}
+
+int main(int argc, char *argv[])
+{
+    int64_t interval_ms = 0;
+    uint64_t count = 0;
+    bool all = false;
+
+    const option long_options[] =
+    {
+        { "interval-ms", required_argument, 0, 'i' },
+        { "count", required_argument, 0, 'n' },
+        { "all", no_argument, 0, 'a' },
+        { 0, 0, 0, 0 }
+    };
+
+    try
+    {
+        int opt;
+        while ((opt = getopt_long(argc, argv, "i:n:a", long_options, 0)) != -1)
+        {
+            switch (opt)
+            {
+            case 'i':
+                interval_ms = std::stoll(optarg);
+                break;
+            case 'n':
+                count = std::stoull(optarg);
+                break;
+            case 'a':
+                all = true;
+                break;
+            default:
+                throw std::runtime_error("Unknown option");
+            }
+        }
+        if (argc - optind != 1)
+        {
+            throw std::runtime_error("Usage: stats_reader [--interval-ms <ms> [--count <n>]] [--all (zero counters "
+                                     "too)] <page name>");
+        }
+
+        StatsPageReader reader(argv[optind]);
+        for (uint64_t n = 1;; n++)
+        {
+            print_page(reader, argv[optind], all);
+            if (!interval_ms || (count && n >= count))
+            {
+                break;
+            }
+            usleep(interval_ms * 1000);
+        }
+    }
+    catch (std::exception &exc)
+    {
+        cout << "Got exception: " << exc.what() << '\n';
+        exit(1);
+    }
+
+    return 0;
+}
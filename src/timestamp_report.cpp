@@ -0,0 +1,117 @@
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "result_store.h"
+#include "timestamp_report.h"
+
+namespace Netrounds
+{
+TimestampBatch::TimestampBatch(size_t max_entries, int64_t max_delay_ns) :
+    max_entries(max_entries), max_delay_ns(max_delay_ns), first_ns(0), nr_reports(0)
+{
+    if (!max_entries || max_entries > MAX_REPORT_ENTRIES)
+    {
+        throw std::runtime_error("Timestamp reports take 1 to " + std::to_string(MAX_REPORT_ENTRIES) + " probes");
+    }
+    entries.reserve(max_entries);
+}
+
+bool TimestampBatch::add(const TimestampReportEntry& entry, int64_t now_ns)
+{
+    if (entries.empty())
+    {
+        first_ns = now_ns;
+    }
+    entries.push_back(entry);
+    return entries.size() >= max_entries;
+}
+
+int64_t TimestampBatch::deadline_ns() const
+{
+    if (entries.empty())
+    {
+        return std::numeric_limits<int64_t>::max();
+    }
+    return first_ns + max_delay_ns;
+}
+
+size_t TimestampBatch::take(char *buf, size_t buflen)
+{
+    size_t len = serialize_timestamp_report(entries.data(), entries.size(), buf, buflen);
+    entries.clear();
+    nr_reports++;
+    return len;
+}
+
+ReportMerger::ReportMerger(size_t window, ProbeMatcher::Sink sink) :
+    matcher(window, sink), sink(sink), waiting(false), first_seq(0), nr_reports(0)
+{
+}
+
+void ReportMerger::add(const ProbeRecord& rec)
+{
+    if (!nr_reports || !rec.flags || rec.flags == RESULT_COMPLETE)
+    {
+        sink(rec);
+        return;
+    }
+    if (!waiting)
+    {
+        waiting = true;
+        first_seq = rec.seq;
+    }
+    const int64_t *ts[4] = { &rec.t1, &rec.t2, &rec.t3, &rec.t4 };
+    for (int which = PROBE_T1; which <= PROBE_T4; which++)
+    {
+        if (*ts[which])
+        {
+            matcher.add(rec.seq, static_cast<ProbeTimestamp>(which), *ts[which]);
+        }
+    }
+}
+
+bool ReportMerger::merge(const char *data, size_t datalen)
+{
+    TimestampReportEntry entries[MAX_REPORT_ENTRIES];
+    size_t n;
+    if (!decode_timestamp_report(data, datalen, entries, &n))
+    {
+        return false;
+    }
+    nr_reports++;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (waiting && entries[i].t3 && static_cast<int32_t>(entries[i].sender_seq - first_seq) >= 0)
+        {
+            matcher.add(entries[i].sender_seq, PROBE_T3, entries[i].t3);
+        }
+    }
+    return true;
+}
+
+void ReportMerger::flush()
+{
+    matcher.flush();
+}
+
+size_t merge_timestamp_report(const char *data, size_t datalen, ProbeMatcher *matcher)
+{
+    TimestampReportEntry entries[MAX_REPORT_ENTRIES];
+    size_t n;
+    if (!decode_timestamp_report(data, datalen, entries, &n))
+    {
+        return 0;
+    }
+    size_t merged = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (entries[i].t3)
+        {
+            matcher->add(entries[i].sender_seq, PROBE_T3, entries[i].t3);
+            merged++;
+        }
+    }
+    return merged;
+}
+};
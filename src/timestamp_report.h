@@ -0,0 +1,88 @@
+#ifndef _TIMESTAMP_REPORT_H_
+#define _TIMESTAMP_REPORT_H_
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "packet.h"
+#include "probe_matcher.h"
+
+namespace Netrounds
+{
+const int64_t DEFAULT_REPORT_DELAY_NS = 10000000;
+
+// Reflector side of FROM_REFLECTOR_ONLY_TIMESTAMPS reports, one batch per peer. A hardware t3 comes back from the TX
+// timestamp queue only after the reply has left, so rather than follow every reply with a datagram of its own the
+// reflector collects the timestamps and sends them in one report when max_entries are in or the oldest has waited
+// max_delay_ns, whichever is first.
+class TimestampBatch
+{
+public:
+    explicit TimestampBatch(size_t max_entries = MAX_REPORT_ENTRIES, int64_t max_delay_ns = DEFAULT_REPORT_DELAY_NS);
+
+    // True if the batch is full with entry, and take() is due.
+    bool add(const TimestampReportEntry& entry, int64_t now_ns);
+
+    // When the report is due by age, INT64_MAX while empty.
+    int64_t deadline_ns() const;
+
+    bool empty() const
+    {
+        return entries.empty();
+    }
+
+    // Report of the entries into buf (room for MAX_REPORT_ENTRIES needed), returns its length. Empties the batch.
+    size_t take(char *buf, size_t buflen);
+
+    uint64_t reports() const
+    {
+        return nr_reports;
+    }
+
+private:
+    size_t max_entries;
+    int64_t max_delay_ns;
+    std::vector<TimestampReportEntry> entries;
+    int64_t first_ns;
+    uint64_t nr_reports;
+};
+
+// Sender side: the timestamps of a report into matcher, which joins them with the probes' other timestamps. Only t3,
+// the replies have already brought t2. Returns the entries merged, 0 for a malformed report.
+size_t merge_timestamp_report(const char *data, size_t datalen, ProbeMatcher *matcher);
+
+// Sender side for a loop that finishes one probe at a time and does not know whether the reflector sends reports.
+// Records go to sink as they are added until the first report comes in; from then on, those whose reply came without
+// t3 wait in a ProbeMatcher of window probes for a report to bring it. Report entries of probes that were already
+// handed on are ignored, rather than emitted again as records of their own.
+class ReportMerger
+{
+public:
+    ReportMerger(size_t window, ProbeMatcher::Sink sink);
+
+    // A probe done with as far as its reply goes.
+    void add(const ProbeRecord& rec);
+
+    // Merges data if it is a timestamp report, false if it is not one.
+    bool merge(const char *data, size_t datalen);
+
+    // Emits all records still waiting for a report.
+    void flush();
+
+    uint64_t reports() const
+    {
+        return nr_reports;
+    }
+
+private:
+    ProbeMatcher matcher;
+    ProbeMatcher::Sink sink;
+    bool waiting;           // since first_seq, records wait for reports
+    uint32_t first_seq;
+    uint64_t nr_reports;
+};
+};
+
+#endif
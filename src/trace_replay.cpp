@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+
+#include "metrics.h"
+#include "packet.h"
+#include "pcap_reader.h"
+#include "result_store.h"
+#include "trace_replay.h"
+#include "util.h"
+
+namespace Netrounds
+{
+const int REPLAY_TIMESTAMPING = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+    SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+    SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+namespace
+{
+const char TRACE_MAGIC[4] = { 'N', 'R', 'T', 'R' };
+const uint32_t TRACE_VERSION = 1;
+
+struct TraceRecord
+{
+    uint64_t offset_ns;
+    uint32_t len;
+} __attribute__((packed));
+
+std::vector<TraceEntry> load_binary_trace(FILE *f)
+{
+    uint32_t version;
+    if (fread(&version, sizeof(version), 1, f) != 1 || version != TRACE_VERSION)
+    {
+        throw std::runtime_error("Unsupported trace version");
+    }
+    std::vector<TraceEntry> trace;
+    TraceRecord rec;
+    int64_t prev = 0;
+    while (fread(&rec, sizeof(rec), 1, f) == 1)
+    {
+        prev = std::max(prev, static_cast<int64_t>(rec.offset_ns));
+        trace.push_back(TraceEntry{ prev, rec.len });
+    }
+    if (ferror(f))
+    {
+        throw std::system_error(errno, std::system_category(), "trace read");
+    }
+    return trace;
+}
+
+std::vector<TraceEntry> load_capture_trace(const std::string& path)
+{
+    PcapReader reader(path);
+    std::vector<TraceEntry> trace;
+    CapturedPacket pkt;
+    UdpDatagram udp;
+    int64_t first = 0;
+    int64_t prev = 0;
+    while (reader.next(&pkt))
+    {
+        if (!extract_udp(pkt, &udp))
+        {
+            continue;
+        }
+        if (trace.empty())
+        {
+            first = pkt.ts_ns;
+        }
+        prev = std::max(prev, pkt.ts_ns - first);
+        // The payload as sent, before the capture cut it short.
+        uint32_t headers = udp.payload - pkt.data;
+        trace.push_back(TraceEntry{ prev, pkt.origlen - headers });
+    }
+    return trace;
+}
+
+struct PendingProbe
+{
+    ProbeRecord rec;
+    int64_t deadline_ns;
+    bool answered;
+};
+
+uint8_t record_flags(const ProbeRecord& rec)
+{
+    return (rec.t1 ? RESULT_HAS_T1 : 0) | (rec.t2 ? RESULT_HAS_T2 : 0) | (rec.t3 ? RESULT_HAS_T3 : 0) |
+        (rec.t4 ? RESULT_HAS_T4 : 0);
+}
+}
+
+std::vector<TraceEntry> load_trace(const std::string& path)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    char magic[sizeof(TRACE_MAGIC)];
+    bool binary = fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, TRACE_MAGIC, sizeof(magic));
+    if (!binary)
+    {
+        fclose(f);
+        return load_capture_trace(path);
+    }
+    try
+    {
+        std::vector<TraceEntry> trace = load_binary_trace(f);
+        fclose(f);
+        return trace;
+    }
+    catch (...)
+    {
+        fclose(f);
+        throw;
+    }
+}
+
+void save_trace(const std::string& path, const std::vector<TraceEntry>& trace)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+    {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    bool ok = fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, f) == 1 &&
+        fwrite(&TRACE_VERSION, sizeof(TRACE_VERSION), 1, f) == 1;
+    for (size_t i = 0; ok && i < trace.size(); i++)
+    {
+        TraceRecord rec = { static_cast<uint64_t>(trace[i].offset_ns), trace[i].len };
+        ok = fwrite(&rec, sizeof(rec), 1, f) == 1;
+    }
+    if (fclose(f) != 0 || !ok)
+    {
+        throw std::system_error(errno, std::system_category(), "trace write");
+    }
+}
+
+Task<void> replay_session(EventLoop& loop, int sock, ReplayConfig config, const std::vector<TraceEntry>& trace,
+                          ProbeMatcher::Sink sink, ReplayStats *stats)
+{
+    const size_t MAX_REPLY_LEN = 9000;
+    if (config.max_len < sizeof(ReflectorPacket) || !config.window)
+    {
+        throw std::runtime_error("Replay probe length or window out of range");
+    }
+    std::vector<char> probe(config.max_len);
+    std::vector<char> rx(MAX_REPLY_LEN);
+    std::vector<PendingProbe> pending(config.window);
+    stats->sent = stats->replies = stats->timeouts = stats->stale = stats->resized = 0;
+    stats->duration_ns = stats->max_late_ns = 0;
+    stats->late.reset();
+
+    uint32_t done = 0; // probes before this one have gone to sink
+    uint32_t sent = 0;
+    uint32_t total = trace.size();
+    int64_t start = loop.now_ns();
+    int64_t first_sent_ns = 0;
+    auto scheduled = [&](uint32_t seq)
+    {
+        return seq < total ? start + static_cast<int64_t>(trace[seq].offset_ns * config.time_scale)
+                           : EventLoop::NO_DEADLINE;
+    };
+    for (;;)
+    {
+        // Hand on everything that is settled, in order, and give up the oldest probe if its slot is needed now.
+        int64_t now = loop.now_ns();
+        int64_t next_send = scheduled(sent);
+        while (done < sent)
+        {
+            PendingProbe& p = pending[done % pending.size()];
+            bool need_slot = sent - done >= pending.size() && next_send <= now;
+            if (!p.answered && p.deadline_ns > now && !need_slot)
+            {
+                break;
+            }
+            if (!p.answered)
+            {
+                stats->timeouts++;
+            }
+            p.rec.flags = record_flags(p.rec);
+            sink(p.rec);
+            done++;
+        }
+        if (done == total)
+        {
+            break;
+        }
+
+        if (next_send <= now)
+        {
+            size_t len = std::clamp<size_t>(trace[sent].len, sizeof(ReflectorPacket), config.max_len);
+            if (len != trace[sent].len)
+            {
+                stats->resized++;
+            }
+            prepare_packet(probe.data(), len, sent);
+            co_await loop.send(sock, config.reflector, probe.data(), len);
+            int64_t sent_ns = loop.now_ns();
+            int64_t late = sent_ns - next_send;
+            stats->late.record(late);
+            stats->max_late_ns = std::max(stats->max_late_ns, late);
+            if (!sent)
+            {
+                first_sent_ns = sent_ns;
+            }
+            stats->duration_ns = sent_ns - first_sent_ns;
+            count(M_PKTS_SENT);
+
+            PendingProbe& p = pending[sent % pending.size()];
+            memset(&p.rec, 0, sizeof(p.rec));
+            p.rec.seq = sent;
+            p.deadline_ns = sent_ns + config.reply_timeout_ns;
+            p.answered = false;
+            sent++;
+            stats->sent++;
+            // Collect the timestamp before only waiting for replies again, as the loop cannot mask EPOLLERR. One
+            // that is not there by the next send is picked up later by its key.
+            if (config.tx_timestamps)
+            {
+                co_await loop.wait(sock, EventLoop::WAIT_ERRQUEUE, std::min(scheduled(sent), p.deadline_ns));
+            }
+        }
+
+        uint32_t key;
+        int64_t hw_ns;
+        while (config.tx_timestamps && try_read_tx_timestamp(sock, &key, &hw_ns))
+        {
+            if (hw_ns && key >= done && key < sent)
+            {
+                pending[key % pending.size()].rec.t1 = hw_ns;
+            }
+        }
+        if (next_send <= now)
+        {
+            continue;
+        }
+
+        // Replies until the next send is due or the oldest probe times out.
+        int64_t deadline = next_send;
+        if (done < sent)
+        {
+            deadline = std::min(deadline, pending[done % pending.size()].deadline_ns);
+        }
+        RxInfo info;
+        ReflectorPacket reply;
+        PacketType type;
+        while (co_await loop.receive(sock, rx.data(), rx.size(), &info, deadline))
+        {
+            if (!peek_packet_type(rx.data(), info.len, &type) || type != FROM_REFLECTOR ||
+                !decode_reflector_packet(rx.data(), info.len, &reply))
+            {
+                continue;
+            }
+            count(M_PKTS_RECEIVED);
+            if (reply.sender_seq < done || reply.sender_seq >= sent ||
+                pending[reply.sender_seq % pending.size()].answered)
+            {
+                stats->stale++;
+                continue;
+            }
+            PendingProbe& p = pending[reply.sender_seq % pending.size()];
+            p.answered = true;
+            p.rec.t2 = reply.t2;
+            p.rec.t3 = reply.t3;
+            p.rec.t4 = info.hw_ns;
+            stats->replies++;
+            if (reply.sender_seq == done)
+            {
+                break;
+            }
+        }
+    }
+}
+};
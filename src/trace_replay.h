@@ -0,0 +1,67 @@
+#ifndef _TRACE_REPLAY_H_
+#define _TRACE_REPLAY_H_
+
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+#include "event_loop.h"
+#include "histogram.h"
+#include "probe_matcher.h"
+
+namespace Netrounds
+{
+// One datagram of a recorded traffic pattern: when it was sent, relative to the first, and how long it was.
+struct TraceEntry
+{
+    int64_t offset_ns;
+    uint32_t len;
+};
+
+// A trace file is either a pcap/pcapng capture, of which every UDP datagram is taken (length as on the wire, before
+// any snaplen), or the binary format of save_trace(): "NRTR", a version (1), then offset_ns (u64) and len (u32) per
+// entry, all little-endian. Offsets that go backwards, as captures from several queues may, are clamped to the
+// previous one.
+std::vector<TraceEntry> load_trace(const std::string& path);
+void save_trace(const std::string& path, const std::vector<TraceEntry>& trace);
+
+// SO_TIMESTAMPING flags for a replaying socket: TX timestamps numbered per send (OPT_ID), so that with any number of
+// probes in flight each is matched to its own, and hardware RX timestamps for the replies. The numbering starts
+// when the flags are set, which has to be right before the replay.
+extern const int REPLAY_TIMESTAMPING;
+
+struct ReplayConfig
+{
+    sockaddr_storage reflector;
+    double time_scale;          // offsets are multiplied by this: 0.5 replays twice as fast
+    size_t max_len;             // longer entries are sent truncated
+    int64_t reply_timeout_ns;
+    size_t window;              // probes in flight at most, older ones are given up as unanswered
+    bool tx_timestamps;         // the socket has REPLAY_TIMESTAMPING on
+};
+
+struct ReplayStats
+{
+    uint64_t sent;
+    uint64_t replies;
+    uint64_t timeouts;
+    uint64_t stale;             // replies that came after their probe had been given up
+    uint64_t resized;           // entries sent at another length than recorded
+    int64_t duration_ns;        // from the first send to the last
+    int64_t max_late_ns;
+    Log2Histogram late;         // how long after its scheduled time each send() returned
+};
+
+// Sends probe i of trace at its (scaled) offset from the start, open loop: earlier replies are not waited for, so
+// bursts go out as recorded. Replies are matched by sequence number while waiting for the next send. Each probe's
+// record goes to sink, in sequence order, as soon as it is answered and all before it are done, or when it times
+// out. Probes are lengthened to carry at least the reflector's reply header. stats must outlive the session.
+Task<void> replay_session(EventLoop& loop, int sock, ReplayConfig config, const std::vector<TraceEntry>& trace,
+                          ProbeMatcher::Sink sink, ReplayStats *stats);
+};
+
+#endif
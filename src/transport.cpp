@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <limits>
+
+#include <cstring>
+
+#include <endian.h>
+
+#include "transport.h"
+#include "util.h"
+
+namespace Netrounds
+{
+const size_t Transport::NO_TX_STAMP;
+const size_t SimNetwork::MAX_COPY;
+
+namespace
+{
+sockaddr_storage sim_address(const char *ip)
+{
+    sockaddr_storage ss;
+    create_sockaddr_storage(AF_INET, ip, 5000, &ss);
+    return ss;
+}
+}
+
+SimNetwork::SimNetwork(const SimLinkConfig& a_to_b, const SimLinkConfig& b_to_a, uint64_t seed, int64_t start_ns) :
+    rng(seed ? seed : 1), order(0), now(start_ns)
+{
+    dirs[0].config = b_to_a;
+    dirs[1].config = a_to_b;
+    memset(&dirs[0].stats, 0, sizeof(dirs[0].stats));
+    memset(&dirs[1].stats, 0, sizeof(dirs[1].stats));
+    ends[0] = new SimTransport(*this, 0, sim_address("10.0.0.1"));
+    ends[1] = new SimTransport(*this, 1, sim_address("10.0.0.2"));
+}
+
+SimNetwork::~SimNetwork()
+{
+    delete ends[0];
+    delete ends[1];
+}
+
+SimTransport& SimNetwork::a()
+{
+    return *ends[0];
+}
+
+SimTransport& SimNetwork::b()
+{
+    return *ends[1];
+}
+
+void SimNetwork::advance_to(int64_t t_ns)
+{
+    now = std::max(now, t_ns);
+}
+
+int64_t SimNetwork::next_delivery_ns() const
+{
+    int64_t next = std::numeric_limits<int64_t>::max();
+    for (const Direction& dir : dirs)
+    {
+        if (!dir.heap.empty())
+        {
+            next = std::min(next, dir.heap.front().deliver_at);
+        }
+    }
+    return next;
+}
+
+const SimLinkStats& SimNetwork::stats(bool a_to_b) const
+{
+    return dirs[a_to_b ? 1 : 0].stats;
+}
+
+// xorshift64*, fast and good enough for link impairments.
+uint64_t SimNetwork::random()
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 2685821657736338717ULL;
+}
+
+double SimNetwork::uniform()
+{
+    return (random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int64_t SimNetwork::transmit(int to, const char *buf, size_t len, size_t tx_stamp_offset)
+{
+    Direction& dir = dirs[to];
+    const SimLinkConfig& cfg = dir.config;
+    int64_t tx_hw = cfg.hw_ts_missing > 0 && uniform() < cfg.hw_ts_missing ? 0 : now;
+
+    dir.stats.sent++;
+    if (cfg.loss > 0 && uniform() < cfg.loss)
+    {
+        dir.stats.lost++;
+        return tx_hw;
+    }
+
+    int64_t delay = cfg.delay_ns;
+    if (cfg.jitter_ns > 0)
+    {
+        delay += random() % cfg.jitter_ns;
+    }
+    if (cfg.reorder > 0 && uniform() < cfg.reorder)
+    {
+        delay += cfg.reorder_ns;
+        dir.stats.reordered++;
+    }
+
+    uint32_t slot;
+    if (free_slots.empty())
+    {
+        slot = pool.size();
+        pool.push_back(Packet());
+    }
+    else
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+    Packet& pkt = pool[slot];
+    pkt.len = len;
+    pkt.rx_hw_ns = cfg.hw_ts_missing > 0 && uniform() < cfg.hw_ts_missing ? 0 : now + delay;
+    memcpy(pkt.data, buf, std::min(len, MAX_COPY));
+    if (tx_stamp_offset != Transport::NO_TX_STAMP && tx_stamp_offset + sizeof(uint64_t) <= MAX_COPY)
+    {
+        uint64_t stamp = htobe64(tx_hw);
+        memcpy(pkt.data + tx_stamp_offset, &stamp, sizeof(stamp));
+    }
+
+    InFlight entry = { now + delay, order++, slot };
+    dir.heap.push_back(entry);
+    std::push_heap(dir.heap.begin(), dir.heap.end(), Later());
+    return tx_hw;
+}
+
+bool SimNetwork::deliver(int to, char *buf, size_t buflen, RxInfo *info)
+{
+    Direction& dir = dirs[to];
+    if (dir.heap.empty() || dir.heap.front().deliver_at > now)
+    {
+        return false;
+    }
+
+    std::pop_heap(dir.heap.begin(), dir.heap.end(), Later());
+    uint32_t slot = dir.heap.back().slot;
+    dir.heap.pop_back();
+
+    const Packet& pkt = pool[slot];
+    size_t len = std::min(static_cast<size_t>(pkt.len), buflen);
+    size_t copied = std::min(len, MAX_COPY);
+    memcpy(buf, pkt.data, copied);
+    memset(buf + copied, 0, len - copied);
+    info->len = len;
+    // The sender is always the other end; its address is IPv4, so skip copying the whole sockaddr_storage.
+    memcpy(&info->peer, &ends[1 - to]->addr, sizeof(sockaddr_in));
+    info->hw_ns = pkt.rx_hw_ns;
+    info->sw_ns = 0;
+    free_slots.push_back(slot);
+    dir.stats.delivered++;
+    return true;
+}
+
+int64_t SimTransport::send(const sockaddr_storage&, const char *buf, size_t len, size_t tx_stamp_offset)
+{
+    return net.transmit(1 - end, buf, len, tx_stamp_offset);
+}
+
+bool SimTransport::receive(char *buf, size_t buflen, RxInfo *info)
+{
+    return net.deliver(end, buf, buflen, info);
+}
+
+int64_t SimTransport::now_ns()
+{
+    return net.now_ns();
+}
+};
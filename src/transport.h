@@ -0,0 +1,195 @@
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+
+#include <netinet/in.h>
+
+namespace Netrounds
+{
+// A received datagram. hw_ns and sw_ns are the hardware and software RX timestamps, 0 when there is none.
+struct RxInfo
+{
+    size_t len;
+    sockaddr_storage peer;
+    int64_t hw_ns;
+    int64_t sw_ns;
+};
+
+// Where the engines (engine.h) get and put datagrams: a socket through the receive path of the fast path reflector
+// (rx_path.h, zerocopy.h) or a simulated link.
+class Transport
+{
+public:
+    static const size_t NO_TX_STAMP = SIZE_MAX;
+
+    virtual ~Transport()
+    {
+    }
+
+    // Returns the TX timestamp of the datagram in ns, 0 when none is available. A transport with one-step
+    // timestamping (like one-step PTP hardware) also writes it big-endian into the datagram at tx_stamp_offset on
+    // the way out; pass NO_TX_STAMP to leave the datagram alone.
+    virtual int64_t send(const sockaddr_storage& peer, const char *buf, size_t len, size_t tx_stamp_offset) = 0;
+
+    virtual bool one_step_tx() const = 0;
+
+    // False if no datagram is available. Datagrams longer than buflen are truncated to it.
+    virtual bool receive(char *buf, size_t buflen, RxInfo *info) = 0;
+
+    // CLOCK_REALTIME ns on this transport's time line, used for software timestamps and pacing.
+    virtual int64_t now_ns() = 0;
+
+    // Buffer of at least len bytes to receive the next datagram into; the reply is then built and sent from it in
+    // place. A transport that keeps sent buffers busy after send() (zerocopy) hands out a fresh one here, the
+    // others let the caller use its own.
+    virtual char *receive_buffer(char *own, size_t)
+    {
+        return own;
+    }
+};
+
+// One direction of a simulated link. Each datagram is delayed by delay_ns plus uniform jitter in [0, jitter_ns),
+// dropped with probability loss, and with probability reorder held back another reorder_ns so that later datagrams
+// overtake it. hw_ts_missing is the probability that a hardware timestamp (TX or RX) comes back as 0.
+struct SimLinkConfig
+{
+    SimLinkConfig() : delay_ns(0), jitter_ns(0), loss(0), reorder(0), reorder_ns(0), hw_ts_missing(0)
+    {
+    }
+
+    int64_t delay_ns;
+    int64_t jitter_ns;
+    double loss;
+    double reorder;
+    int64_t reorder_ns;
+    double hw_ts_missing;
+};
+
+// What the link actually did, the ground truth to check engine statistics against.
+struct SimLinkStats
+{
+    uint64_t sent;
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t delivered;
+};
+
+class SimTransport;
+
+// Discrete-event, in-memory point-to-point link between two SimTransport endpoints, with a virtual clock that only
+// moves when advance_to() is called. Deterministic for a given seed and call sequence. Time starts at 1 s by default
+// because a 0 timestamp means "none". Only the first MAX_COPY bytes of a datagram are carried, the rest reads back as
+// zeros; that keeps the per-packet cost flat for benchmarks.
+class SimNetwork
+{
+public:
+    static const size_t MAX_COPY = 128;
+
+    SimNetwork(const SimLinkConfig& a_to_b, const SimLinkConfig& b_to_a, uint64_t seed,
+               int64_t start_ns = 1000000000);
+    ~SimNetwork();
+
+    SimNetwork(const SimNetwork&) = delete;
+    SimNetwork& operator=(const SimNetwork&) = delete;
+
+    // The two ends. Their addresses are 10.0.0.1:5000 (a) and 10.0.0.2:5000 (b).
+    SimTransport& a();
+    SimTransport& b();
+
+    int64_t now_ns() const
+    {
+        return now;
+    }
+
+    // Move the clock forward (never back), making due datagrams receivable.
+    void advance_to(int64_t t_ns);
+
+    // Delivery time of the earliest datagram in flight towards either end, INT64_MAX if there is none.
+    int64_t next_delivery_ns() const;
+
+    const SimLinkStats& stats(bool a_to_b) const;
+
+private:
+    friend class SimTransport;
+
+    struct InFlight
+    {
+        int64_t deliver_at;
+        uint64_t order;  // tie breaker, keeps equal delivery times FIFO
+        uint32_t slot;
+    };
+
+    struct Packet
+    {
+        uint32_t len;
+        int64_t rx_hw_ns;
+        char data[MAX_COPY];
+    };
+
+    struct Direction
+    {
+        SimLinkConfig config;
+        SimLinkStats stats;
+        std::vector<InFlight> heap;
+    };
+
+    // Min-heap order on delivery time; a functor rather than a function pointer so the heap operations inline it.
+    struct Later
+    {
+        bool operator()(const InFlight& x, const InFlight& y) const
+        {
+            return x.deliver_at != y.deliver_at ? x.deliver_at > y.deliver_at : x.order > y.order;
+        }
+    };
+
+    int64_t transmit(int to, const char *buf, size_t len, size_t tx_stamp_offset);
+    bool deliver(int to, char *buf, size_t buflen, RxInfo *info);
+    uint64_t random();
+    double uniform();
+
+    Direction dirs[2];         // indexed by the receiving end, 1 is a -> b
+    std::vector<Packet> pool;
+    std::vector<uint32_t> free_slots;
+    uint64_t rng;
+    uint64_t order;
+    int64_t now;
+    SimTransport *ends[2];
+};
+
+// Has one-step TX timestamps, so a reflector on it can return t3 in the reply itself.
+class SimTransport : public Transport
+{
+public:
+    int64_t send(const sockaddr_storage& peer, const char *buf, size_t len, size_t tx_stamp_offset) override;
+    bool receive(char *buf, size_t buflen, RxInfo *info) override;
+    int64_t now_ns() override;
+
+    bool one_step_tx() const override
+    {
+        return true;
+    }
+
+    const sockaddr_storage& address() const
+    {
+        return addr;
+    }
+
+private:
+    friend class SimNetwork;
+
+    SimTransport(SimNetwork& net, int end, const sockaddr_storage& addr) : net(net), end(end), addr(addr)
+    {
+    }
+
+    SimNetwork& net;
+    int end;
+    sockaddr_storage addr;
+};
+};
+
+#endif
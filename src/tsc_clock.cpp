@@ -0,0 +1,200 @@
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "tsc_clock.h"
+
+namespace Netrounds
+{
+namespace
+{
+uint64_t clock_ns(clockid_t clk)
+{
+    timespec ts;
+    clock_gettime(clk, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// 32.32 fixed point ns per tick. In 128 bits, since the ns of a baseline longer than 2^32 (4.3 s, as after an idle
+// stretch with lazy recalibration) no longer fit in 64 once shifted.
+uint64_t ns_per_tick(uint64_t ns, uint64_t ticks)
+{
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(ns) << 32) / ticks);
+}
+}
+
+TscClock& TscClock::instance()
+{
+    static TscClock clock;
+    return clock;
+}
+
+TscClock::TscClock() : use_tsc(invariant_tsc()), seq(0), base_tsc(0), base_mono(0), real_offset(0), mult(0),
+                       next_recalibrate_tsc(0), calibrating(false)
+{
+    if (!use_tsc)
+    {
+        return;
+    }
+
+    // Initial frequency estimate over a short sleep, refined on every recalibration.
+    const long CALIBRATION_SLEEP_NS = 10000000;
+    Sample first = take_sample();
+    timespec delay = { 0, CALIBRATION_SLEEP_NS };
+    nanosleep(&delay, nullptr);
+    Sample second = take_sample();
+    if (second.tsc <= first.tsc)
+    {
+        use_tsc = false;
+        return;
+    }
+    publish(second, ns_per_tick(second.mono_ns - first.mono_ns, second.tsc - first.tsc));
+}
+
+bool TscClock::invariant_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+    {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return edx & (1 << 8);
+#else
+    return false;
+#endif
+}
+
+uint64_t TscClock::read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int aux;
+    return __rdtscp(&aux);
+#else
+    return 0;
+#endif
+}
+
+TscClock::Sample TscClock::take_sample()
+{
+    // Bracket clock_gettime() with TSC reads and keep the tightest of a few attempts, so a preemption or interrupt
+    // between the reads does not skew the calibration.
+    const int ATTEMPTS = 5;
+    Sample best = { 0, 0, 0 };
+    uint64_t best_width = ~0ULL;
+
+    for (int i = 0; i < ATTEMPTS; i++)
+    {
+        uint64_t before = read_tsc();
+        uint64_t mono = clock_ns(CLOCK_MONOTONIC_RAW);
+        uint64_t after = read_tsc();
+        uint64_t real = clock_ns(CLOCK_REALTIME);
+        if (after - before < best_width)
+        {
+            best_width = after - before;
+            best.tsc = before + (after - before) / 2;
+            best.mono_ns = mono;
+            best.real_ns = real;
+        }
+    }
+    return best;
+}
+
+void TscClock::publish(const Sample& base, uint64_t new_mult)
+{
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    base_tsc.store(base.tsc, std::memory_order_relaxed);
+    base_mono.store(base.mono_ns, std::memory_order_relaxed);
+    real_offset.store(base.real_ns - base.mono_ns, std::memory_order_relaxed);
+    mult.store(new_mult, std::memory_order_relaxed);
+    next_recalibrate_tsc.store(base.tsc + (RECALIBRATE_NS << 32) / new_mult, std::memory_order_relaxed);
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void TscClock::recalibrate()
+{
+    if (!use_tsc || calibrating.exchange(true, std::memory_order_acquire))
+    {
+        return;
+    }
+
+    Sample now = take_sample();
+    uint64_t prev_tsc = base_tsc.load(std::memory_order_relaxed);
+    uint64_t prev_mono = base_mono.load(std::memory_order_relaxed);
+    uint64_t new_mult = mult.load(std::memory_order_relaxed);
+    // Refine the frequency only over a long enough baseline, explicit early calls just refresh the offsets.
+    if (now.tsc > prev_tsc && now.mono_ns >= prev_mono + RECALIBRATE_NS / 2)
+    {
+        new_mult = ns_per_tick(now.mono_ns - prev_mono, now.tsc - prev_tsc);
+    }
+
+    // Never step backwards: if the old calibration had drifted ahead, continue from where it got to.
+    uint64_t unused;
+    uint64_t extrapolated = tsc_to_mono(now.tsc, &unused);
+    if (extrapolated > now.mono_ns)
+    {
+        now.real_ns += extrapolated - now.mono_ns;
+        now.mono_ns = extrapolated;
+    }
+    publish(now, new_mult);
+
+    calibrating.store(false, std::memory_order_release);
+}
+
+uint64_t TscClock::tsc_to_mono(uint64_t tsc, uint64_t *offset)
+{
+    uint32_t seq_before;
+    uint32_t seq_after;
+    uint64_t ns;
+
+    do
+    {
+        seq_before = seq.load(std::memory_order_acquire);
+        int64_t delta = static_cast<int64_t>(tsc - base_tsc.load(std::memory_order_relaxed));
+        __int128 scaled = (static_cast<__int128>(delta) * mult.load(std::memory_order_relaxed)) >> 32;
+        ns = base_mono.load(std::memory_order_relaxed) + static_cast<int64_t>(scaled);
+        *offset = real_offset.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq_after = seq.load(std::memory_order_relaxed);
+    } while (seq_before != seq_after || (seq_before & 1));
+
+    return ns;
+}
+
+uint64_t TscClock::monotonic_ns()
+{
+    if (!use_tsc)
+    {
+        return clock_ns(CLOCK_MONOTONIC_RAW);
+    }
+
+    uint64_t tsc = read_tsc();
+    if (tsc >= next_recalibrate_tsc.load(std::memory_order_relaxed))
+    {
+        recalibrate();
+    }
+    uint64_t offset;
+    return tsc_to_mono(tsc, &offset);
+}
+
+uint64_t TscClock::realtime_ns()
+{
+    if (!use_tsc)
+    {
+        return clock_ns(CLOCK_REALTIME);
+    }
+
+    uint64_t tsc = read_tsc();
+    if (tsc >= next_recalibrate_tsc.load(std::memory_order_relaxed))
+    {
+        recalibrate();
+    }
+    uint64_t offset;
+    return tsc_to_mono(tsc, &offset) + offset;
+}
+};
@@ -0,0 +1,65 @@
+#ifndef _TSC_CLOCK_H_
+#define _TSC_CLOCK_H_
+
+#include <atomic>
+
+#include <cstdint>
+
+namespace Netrounds
+{
+// Cheap userspace clock: converts rdtscp readings to CLOCK_MONOTONIC_RAW/CLOCK_REALTIME nanoseconds. Calibration is
+// refreshed against clock_gettime() every RECALIBRATE_NS, which also picks up steps of the realtime clock. Without an
+// invariant TSC (or off x86) every read falls back to clock_gettime().
+class TscClock
+{
+public:
+    static const uint64_t RECALIBRATE_NS = 1000000000ULL;
+
+    static TscClock& instance();
+
+    bool tsc_enabled() const
+    {
+        return use_tsc;
+    }
+
+    uint64_t monotonic_ns();
+    uint64_t realtime_ns();
+
+    static uint64_t read_tsc();
+
+    // Take a new calibration sample now. Normally done implicitly by monotonic_ns()/realtime_ns().
+    void recalibrate();
+
+private:
+    TscClock();
+    TscClock(const TscClock&);
+    TscClock& operator=(const TscClock&);
+
+    struct Sample
+    {
+        uint64_t tsc;
+        uint64_t mono_ns;
+        uint64_t real_ns;
+    };
+
+    static bool invariant_tsc();
+    static Sample take_sample();
+    void publish(const Sample& base, uint64_t mult);
+    uint64_t tsc_to_mono(uint64_t tsc, uint64_t *real_offset);
+
+    bool use_tsc;
+
+    // Seqlock protected calibration: mono_ns = base_mono + ((tsc - base_tsc) * mult) >> 32.
+    std::atomic<uint32_t> seq;
+    std::atomic<uint64_t> base_tsc;
+    std::atomic<uint64_t> base_mono;
+    std::atomic<uint64_t> real_offset;
+    std::atomic<uint64_t> mult;
+    std::atomic<uint64_t> next_recalibrate_tsc;
+
+    // Only one thread recalibrates at a time, the others keep using the current parameters.
+    std::atomic<bool> calibrating;
+};
+};
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "util.h"
 #include "gpl_code_remove.h"
+#include "metrics.h"
 
 using std::cout;
 using std::tuple;
@@ -108,7 +109,33 @@ void setup_device(int sock, string iface_name, int so_timestamping_flags)
         "; rx_filter " << hwconfig_requested.rx_filter << " requested, got " << hwconfig.rx_filter << '\n';
 }
 
-int setup_socket(int domain, int type, int so_timestamping_flags)
+static void set_buffer_size(int sock, int opt, int force_opt, int size, bool force, const char *name)
+{
+    if (!size)
+    {
+        return;
+    }
+    if (setsockopt(sock, SOL_SOCKET, force ? force_opt : opt, &size, sizeof(size)) == -1)
+    {
+        throw std::system_error(errno, std::system_category(), name);
+    }
+
+    int val;
+    socklen_t len = sizeof(val);
+    if (getsockopt(sock, SOL_SOCKET, opt, &val, &len) == -1)
+    {
+        throw std::system_error(errno, std::system_category(), name);
+    }
+    // The kernel doubles the requested size to account for bookkeeping overhead.
+    cout << name << ' ' << val << " (requested " << size << ")\n";
+    if (val < size)
+    {
+        cout << name << " capped by the system maximum, use --force-bufs or raise net.core." <<
+            (opt == SO_RCVBUF ? "rmem_max" : "wmem_max") << '\n';
+    }
+}
+
+int setup_socket(int domain, int type, int so_timestamping_flags, const SocketBuffers& buffers)
 {
     int val;
     socklen_t len;
@@ -154,6 +181,16 @@ int setup_socket(int domain, int type, int so_timestamping_flags)
         throw std::system_error(errno, std::system_category());
     }
 
+    // Count datagrams dropped because the receive queue was full, reported with every later packet.
+    result = setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &enabled, sizeof(enabled));
+    if (result == -1)
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+
+    set_buffer_size(sock, SO_RCVBUF, SO_RCVBUFFORCE, buffers.rcvbuf, buffers.force, "SO_RCVBUF");
+    set_buffer_size(sock, SO_SNDBUF, SO_SNDBUFFORCE, buffers.sndbuf, buffers.force, "SO_SNDBUF");
+
     return sock;
 }
 
@@ -187,9 +224,14 @@ void sendpacket(sockaddr_storage *ss, int sock, char *buf, size_t buflen)
         result = sendto(sock, buf, buflen, 0, (sockaddr *)ss, sizeof(*ss));
         if (result == -1)
         {
+            if (errno == EINTR)
+            {
+                continue;
+            }
             if (errno == EAGAIN || errno == EWOULDBLOCK)
             {
                 cout << "Got EAGAIN/EWOULDBLOCK, doing sleep/retry\n";
+                Netrounds::count(Netrounds::M_SEND_EAGAIN);
                 sleep(1);
                 continue;
             }
@@ -200,7 +242,180 @@ void sendpacket(sockaddr_storage *ss, int sock, char *buf, size_t buflen)
     }
 }
 
-tuple<shared_ptr<char>, int, sockaddr_storage, timespec> recvpacket(int sock, int recvmsg_flags)
+static uint32_t rxq_overflow_count(msghdr *msg)
+{
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            uint32_t dropped;
+            memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+            return dropped;
+        }
+    }
+    return 0;
+}
+
+static int64_t hw_timestamp(msghdr *msg)
+{
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+        {
+            // software, deprecated hardware-transformed, raw hardware
+            timespec stamps[3];
+            memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            return timespec_to_ns(stamps[2]);
+        }
+    }
+    return 0;
+}
+
+bool try_sendpacket(const sockaddr_storage *ss, int sock, const char *buf, size_t buflen)
+{
+    if (sendto(sock, buf, buflen, MSG_DONTWAIT, (const sockaddr *)ss, sizeof(*ss)) == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            Netrounds::count(Netrounds::M_SEND_EAGAIN);
+            return false;
+        }
+        throw std::system_error(errno, std::system_category());
+    }
+    return true;
+}
+
+bool try_send_untimestamped(const sockaddr_storage *ss, int sock, const char *buf, size_t buflen)
+{
+    msghdr msg;
+    iovec entry;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    entry.iov_base = const_cast<char *>(buf);
+    entry.iov_len = buflen;
+    msg.msg_iov = &entry;
+    msg.msg_iovlen = 1;
+    msg.msg_name = const_cast<sockaddr_storage *>(ss);
+    msg.msg_namelen = sizeof(*ss);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    // The TX recording flags of SO_TIMESTAMPING can be overridden per send (Linux 4.13), here with none.
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SO_TIMESTAMPING;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    int flags = 0;
+    memcpy(CMSG_DATA(cmsg), &flags, sizeof(flags));
+
+    if (sendmsg(sock, &msg, MSG_DONTWAIT) == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            Netrounds::count(Netrounds::M_SEND_EAGAIN);
+            return false;
+        }
+        throw std::system_error(errno, std::system_category());
+    }
+    return true;
+}
+
+ssize_t try_recvpacket(int sock, int recvmsg_flags, char *buf, size_t buflen, sockaddr_storage *from, int64_t *hw_ns,
+                       uint32_t *rxq_dropped)
+{
+    msghdr msg;
+    iovec entry;
+    alignas(cmsghdr) char control[512];
+
+    ssize_t len;
+    // A datagram that does not fit is not ours, whoever sent it: count it and go on with the next one.
+    do
+    {
+        memset(&msg, 0, sizeof(msg));
+        entry.iov_base = buf;
+        entry.iov_len = buflen;
+        msg.msg_iov = &entry;
+        msg.msg_iovlen = 1;
+        msg.msg_name = from;
+        msg.msg_namelen = sizeof(*from);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        len = recvmsg(sock, &msg, recvmsg_flags | MSG_DONTWAIT);
+        if (len == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return -1;
+            }
+            throw std::system_error(errno, std::system_category());
+        }
+        if (msg.msg_flags & MSG_TRUNC)
+        {
+            Netrounds::count(Netrounds::M_RX_TRUNCATED);
+        }
+    } while (msg.msg_flags & MSG_TRUNC);
+    *hw_ns = hw_timestamp(&msg);
+    if (!*hw_ns)
+    {
+        Netrounds::count(Netrounds::M_HWTS_MISSING);
+    }
+    if (rxq_dropped)
+    {
+        *rxq_dropped = rxq_overflow_count(&msg);
+    }
+    return len;
+}
+
+bool try_read_tx_timestamp(int sock, uint32_t *key, int64_t *hw_ns)
+{
+    for (;;)
+    {
+        msghdr msg;
+        alignas(cmsghdr) char control[512];
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return false;
+            }
+            throw std::system_error(errno, std::system_category());
+        }
+        bool stamped = false;
+        *hw_ns = 0;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+            {
+                timespec stamps[3];
+                memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+                *hw_ns = timespec_to_ns(stamps[2]);
+            }
+            else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                     (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+                {
+                    *key = err.ee_data;
+                    stamped = true;
+                }
+            }
+        }
+        if (stamped)
+        {
+            return true;
+        }
+    }
+}
+
+tuple<shared_ptr<char>, int, sockaddr_storage, timespec> recvpacket(int sock, int recvmsg_flags, uint32_t *rxq_dropped)
 {
     const size_t MAX_LEN = 9000;
     shared_ptr<char> data(new char[MAX_LEN]); // TODO: Change to vector<char> or maybe shared_array
@@ -233,6 +448,11 @@ tuple<shared_ptr<char>, int, sockaddr_storage, timespec> recvpacket(int sock, in
         len = recvmsg(sock, &msg, recvmsg_flags);
         if (len == -1)
         {
+            // A signal without SA_RESTART, e.g. SIGUSR1 for a flight recorder dump.
+            if (errno == EINTR)
+            {
+                continue;
+            }
             if (errno == EAGAIN || errno == EWOULDBLOCK)
             {
                 cout << "Got EAGAIN/EWOULDBLOCK, doing sleep/retry\n";
@@ -254,12 +474,21 @@ tuple<shared_ptr<char>, int, sockaddr_storage, timespec> recvpacket(int sock, in
         }
         else if (msg.msg_flags & MSG_TRUNC)
         {
+            Netrounds::count(Netrounds::M_RX_TRUNCATED);
             throw std::runtime_error("recvmsg, buffer too small, truncated!");
         }
         else
         {
             timespec hwts;
+            if (rxq_dropped)
+            {
+                *rxq_dropped = rxq_overflow_count(&msg);
+            }
             printpacket(&msg, len, sock, recvmsg_flags, 0, 0, &hwts);
+            if (hwts.tv_sec == 0 && hwts.tv_nsec == 0)
+            {
+                Netrounds::count(Netrounds::M_HWTS_MISSING);
+            }
             return tuple<shared_ptr<char>, int, sockaddr_storage, timespec>(data, len, from_addr, hwts);
         }
     }
@@ -342,7 +571,11 @@ void wait_for_errqueue_data(int sock)
     ts.tv_sec = 5;
     ts.tv_nsec = 0;
 
-    retval = pselect(sock+1, &rfds, NULL, &efds, &ts, NULL);
+    do
+    {
+        // A signal (e.g. SIGUSR1 for a flight recorder dump) restarts the wait.
+        retval = pselect(sock+1, &rfds, NULL, &efds, &ts, NULL);
+    } while (retval == -1 && errno == EINTR);
     if (retval == -1)
     {
         throw std::system_error(errno, std::system_category());
@@ -354,5 +587,159 @@ void wait_for_errqueue_data(int sock)
     else
     {
         cout << "No data within five seconds.\n";
+        Netrounds::count(Netrounds::M_ERRQUEUE_TIMEOUT);
+    }
+}
+
+bool is_multicast(const sockaddr_storage *ss)
+{
+    if (ss->ss_family == AF_INET)
+    {
+        return IN_MULTICAST(ntohl(reinterpret_cast<const sockaddr_in *>(ss)->sin_addr.s_addr));
     }
+    return ss->ss_family == AF_INET6 && IN6_IS_ADDR_MULTICAST(&reinterpret_cast<const sockaddr_in6 *>(ss)->sin6_addr);
+}
+
+static unsigned int iface_index(const string& iface_name)
+{
+    unsigned int index = if_nametoindex(iface_name.c_str());
+    if (!index)
+    {
+        throw std::system_error(errno, std::system_category(), iface_name);
+    }
+    return index;
+}
+
+void join_multicast_group(int sock, const sockaddr_storage *group, string iface_name)
+{
+    int result;
+    if (!is_multicast(group))
+    {
+        throw std::runtime_error(sockaddr_to_string(group) + " is not a multicast address");
+    }
+    if (group->ss_family == AF_INET)
+    {
+        ip_mreqn mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr = reinterpret_cast<const sockaddr_in *>(group)->sin_addr;
+        mreq.imr_ifindex = iface_index(iface_name);
+        result = setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+    else
+    {
+        ipv6_mreq mreq;
+        mreq.ipv6mr_multiaddr = reinterpret_cast<const sockaddr_in6 *>(group)->sin6_addr;
+        mreq.ipv6mr_interface = iface_index(iface_name);
+        result = setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq));
+    }
+    if (result == -1)
+    {
+        throw std::system_error(errno, std::system_category(), "join multicast group");
+    }
+}
+
+void setup_multicast_sender(int sock, int domain, string iface_name, int ttl)
+{
+    int result;
+    if (domain == AF_INET)
+    {
+        ip_mreqn mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_ifindex = iface_index(iface_name);
+        result = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+        if (result != -1)
+        {
+            result = setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        }
+    }
+    else
+    {
+        int index = iface_index(iface_name);
+        result = setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &index, sizeof(index));
+        if (result != -1)
+        {
+            result = setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+        }
+    }
+    if (result == -1)
+    {
+        throw std::system_error(errno, std::system_category(), "multicast sender");
+    }
+}
+
+string sockaddr_to_string(const sockaddr_storage *ss)
+{
+    char addrstr[INET6_ADDRSTRLEN];
+    const void *addr;
+    in_port_t port;
+
+    if (ss->ss_family == AF_INET)
+    {
+        addr = &((const sockaddr_in *)ss)->sin_addr;
+        port = ntohs(((const sockaddr_in *)ss)->sin_port);
+    }
+    else if (ss->ss_family == AF_INET6)
+    {
+        addr = &((const sockaddr_in6 *)ss)->sin6_addr;
+        port = ntohs(((const sockaddr_in6 *)ss)->sin6_port);
+    }
+    else
+    {
+        throw std::runtime_error("Address neither IPv4 or v6!");
+    }
+
+    if (!inet_ntop(ss->ss_family, addr, addrstr, sizeof(addrstr)))
+    {
+        throw std::system_error(errno, std::system_category());
+    }
+    if (ss->ss_family == AF_INET6)
+    {
+        return string("[") + addrstr + "]:" + std::to_string(port);
+    }
+    return string(addrstr) + ":" + std::to_string(port);
+}
+
+bool same_peer(const sockaddr_storage& x, const sockaddr_storage& y)
+{
+    if (x.ss_family != y.ss_family)
+    {
+        return false;
+    }
+    if (x.ss_family == AF_INET)
+    {
+        const sockaddr_in *a = reinterpret_cast<const sockaddr_in *>(&x);
+        const sockaddr_in *b = reinterpret_cast<const sockaddr_in *>(&y);
+        return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+    }
+    const sockaddr_in6 *a = reinterpret_cast<const sockaddr_in6 *>(&x);
+    const sockaddr_in6 *b = reinterpret_cast<const sockaddr_in6 *>(&y);
+    return a->sin6_port == b->sin6_port && memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+}
+
+uint64_t peer_hash(const sockaddr_storage& peer)
+{
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    if (peer.ss_family == AF_INET)
+    {
+        const sockaddr_in *sin = reinterpret_cast<const sockaddr_in *>(&peer);
+        lo = (static_cast<uint64_t>(sin->sin_addr.s_addr) << 16) | sin->sin_port;
+    }
+    else
+    {
+        const sockaddr_in6 *sin6 = reinterpret_cast<const sockaddr_in6 *>(&peer);
+        memcpy(&lo, &sin6->sin6_addr, sizeof(lo));
+        memcpy(&hi, reinterpret_cast<const char *>(&sin6->sin6_addr) + sizeof(lo), sizeof(hi));
+        lo ^= sin6->sin6_port;
+    }
+    uint64_t h = lo ^ (hi * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+int64_t timespec_to_ns(const timespec& ts)
+{
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
 }
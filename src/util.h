@@ -5,19 +5,79 @@
 #include <memory>
 
 #include <string>
+
+#include <cstdint>
+#include <ctime>
+
+#include <sys/types.h>
 #include <netinet/in.h>
 
 using std::string;
 
+// Socket buffer sizes for setup_socket(), 0 keeps the system default. force uses SO_RCVBUFFORCE/SO_SNDBUFFORCE,
+// which may exceed net.core.rmem_max/wmem_max but needs CAP_NET_ADMIN.
+struct SocketBuffers
+{
+    SocketBuffers() : rcvbuf(0), sndbuf(0), force(false)
+    {
+    }
+
+    int rcvbuf;
+    int sndbuf;
+    bool force;
+};
+
+// Turns the cumulative drop count of a socket (SO_RXQ_OVFL) into the increase since the previous packet.
+struct RxqDrops
+{
+    RxqDrops() : last(0)
+    {
+    }
+
+    uint32_t update(uint32_t cumulative)
+    {
+        uint32_t delta = cumulative - last;
+        last = cumulative;
+        return delta;
+    }
+
+    uint32_t last;
+};
+
 void check_equal_addresses(sockaddr_storage *ss1, sockaddr_storage *ss2);
 void do_bind(int sock, sockaddr_storage *ss);
 void set_nonblocking(int sock);
-int setup_socket(int domain, int type, int so_timestamping_flags);
+int setup_socket(int domain, int type, int so_timestamping_flags, const SocketBuffers& buffers = SocketBuffers());
 void setup_device(int sock, string iface_name, int so_timestamping_flags);
 std::tuple<std::shared_ptr<char>, int, sockaddr_storage, timespec> receive_send_timestamp(int sock);
 void create_sockaddr_storage(int domain, string address, in_port_t port, sockaddr_storage *ssp);
 void wait_for_errqueue_data(int sock);
-std::tuple<std::shared_ptr<char>, int, sockaddr_storage, timespec> recvpacket(int sock, int recvmsg_flags);
+// rxq_dropped, if given, gets the cumulative receive queue drop count of the socket (0 until the first drop).
+std::tuple<std::shared_ptr<char>, int, sockaddr_storage, timespec> recvpacket(int sock, int recvmsg_flags,
+                                                                                uint32_t *rxq_dropped = nullptr);
 void sendpacket(int domain, string address, in_port_t port, int sock, char *buf, size_t buflen);
 void sendpacket(sockaddr_storage *ss, int sock, char *buf, size_t buflen);
+// Single non-blocking attempts for event loops (event_loop.h): no retries, sleeps or logging. try_sendpacket() is
+// false and try_recvpacket() -1 when the socket would block. hw_ns gets the raw hardware timestamp, 0 if none.
+// Datagrams longer than buflen are dropped by try_recvpacket() (M_RX_TRUNCATED), it returns the next one.
+bool try_sendpacket(const sockaddr_storage *ss, int sock, const char *buf, size_t buflen);
+// try_sendpacket() with TX timestamping off for this one datagram, whatever the socket's SO_TIMESTAMPING: nothing
+// lands in the error queue for it.
+bool try_send_untimestamped(const sockaddr_storage *ss, int sock, const char *buf, size_t buflen);
+ssize_t try_recvpacket(int sock, int recvmsg_flags, char *buf, size_t buflen, sockaddr_storage *from, int64_t *hw_ns,
+                       uint32_t *rxq_dropped = nullptr);
+// The OPT_ID key (SOF_TIMESTAMPING_OPT_ID) and raw hardware timestamp (0 if none) of the next TX timestamp on the
+// error queue, false if there is none. Other messages on the queue are skipped, the looped back payload too.
+bool try_read_tx_timestamp(int sock, uint32_t *key, int64_t *hw_ns);
+bool is_multicast(const sockaddr_storage *ss);
+// Receive datagrams sent to group (its port is ignored) on iface_name.
+void join_multicast_group(int sock, const sockaddr_storage *group, string iface_name);
+// Send multicast out of iface_name with the given hop limit. Looped back copies stay on, so reflectors on the sending
+// host answer too.
+void setup_multicast_sender(int sock, int domain, string iface_name, int ttl);
+string sockaddr_to_string(const sockaddr_storage *ss);
+// Address and port equality of two IPv4 or IPv6 peers, and a hash over the same, for tables keyed by peer.
+bool same_peer(const sockaddr_storage& x, const sockaddr_storage& y);
+uint64_t peer_hash(const sockaddr_storage& peer);
+int64_t timespec_to_ns(const timespec& ts);
 #endif
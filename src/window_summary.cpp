@@ -0,0 +1,62 @@
+#include <vector>
+
+#include "window_summary.h"
+
+using std::vector;
+
+namespace Netrounds
+{
+namespace
+{
+void print_stats(std::ostream& os, const char *name, const DelayStats& stats)
+{
+    os << ' ' << name << ' ';
+    if (!stats.count)
+    {
+        os << "-";
+        return;
+    }
+    os << stats.min / 1000.0 << '/' << static_cast<double>(stats.sum) / stats.count / 1000.0 << '/'
+       << stats.max / 1000.0;
+}
+}
+
+WindowSummary summarize_window(const ResultStore& store)
+{
+    WindowSummary summary;
+    size_t n = store.size();
+    vector<int64_t> rtt(n);
+    vector<int64_t> forward(n);
+    vector<int64_t> reverse(n);
+    vector<int64_t> ipdv(n > 1 ? n - 1 : 0);
+
+    compute_rtt(store, rtt.data());
+    compute_one_way(store, forward.data(), reverse.data());
+    compute_ipdv(rtt.data(), n, ipdv.data());
+
+    summary.records = n;
+    summary.rtt = compute_stats(rtt.data(), n);
+    summary.ipdv = compute_stats(ipdv.data(), ipdv.size());
+    summary.forward = compute_stats(forward.data(), n);
+    summary.reverse = compute_stats(reverse.data(), n);
+    return summary;
+}
+
+void print_window_summary(std::ostream& os, const WindowSummary& summary)
+{
+    os << "window: records " << summary.records << " complete " << summary.rtt.count << " (min/mean/max us)";
+    print_stats(os, "rtt", summary.rtt);
+    print_stats(os, "fwd", summary.forward);
+    print_stats(os, "rev", summary.reverse);
+    os << " jitter ";
+    if (summary.ipdv.count)
+    {
+        os << static_cast<double>(summary.ipdv.abs_sum) / summary.ipdv.count / 1000.0;
+    }
+    else
+    {
+        os << "-";
+    }
+    os << '\n';
+}
+};
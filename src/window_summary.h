@@ -0,0 +1,26 @@
+#ifndef _WINDOW_SUMMARY_H_
+#define _WINDOW_SUMMARY_H_
+
+#include <ostream>
+
+#include <cstddef>
+
+#include "result_store.h"
+
+namespace Netrounds
+{
+// Statistics of one measurement window. The live sender and the offline pcap analysis both report these.
+struct WindowSummary
+{
+    size_t records;
+    DelayStats rtt;     // (t4 - t1) - (t3 - t2)
+    DelayStats ipdv;    // of rtt, abs_sum / count is the jitter
+    DelayStats forward; // t2 - t1, includes clock offset
+    DelayStats reverse; // t4 - t3, includes clock offset
+};
+
+WindowSummary summarize_window(const ResultStore& store);
+void print_window_summary(std::ostream& os, const WindowSummary& summary);
+};
+
+#endif
@@ -0,0 +1,252 @@
+// In-kernel reflector. Recognizes FROM_SENDER probes on the configured UDP port, rewrites them in place into
+// FROM_REFLECTOR replies and bounces them out of the receiving interface, either from XDP (XDP_TX) or from tc
+// ingress (redirect to egress). Session and counter state is kept in maps and read by XdpReflector (xdp_reflector.cpp).
+//
+// Build: clang -O2 -g -target bpf -mcpu=v3 -c xdp_reflector.bpf.c (see the Makefile, 'make XDP=1').
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/pkt_cls.h>
+#include <linux/udp.h>
+
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+#include "xdp_reflector_maps.h"
+
+#define AF_INET 2
+#define AF_INET6 10
+
+// PacketType values from packet.h.
+#define FROM_SENDER 0
+#define FROM_REFLECTOR 1
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct xdp_reflector_config);
+} config SEC(".maps");
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, NR_XDP_COUNTERS);
+    __type(key, __u32);
+    __type(value, __u64);
+} counters SEC(".maps");
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, XDP_REFLECTOR_MAX_SESSIONS);
+    __type(key, struct xdp_session_key);
+    __type(value, struct xdp_session);
+} sessions SEC(".maps");
+
+static __always_inline void count(__u32 which)
+{
+    __u64 *val = bpf_map_lookup_elem(&counters, &which);
+    if (val)
+    {
+        (*val)++;
+    }
+}
+
+static __always_inline __u16 csum_fold(__u32 csum)
+{
+    csum = (csum & 0xffff) + (csum >> 16);
+    csum = (csum & 0xffff) + (csum >> 16);
+    return (__u16)~csum;
+}
+
+static __always_inline void swap_bytes(__u8 *a, __u8 *b, int len)
+{
+    __u8 tmp;
+#pragma unroll
+    for (int i = 0; i < len; i++)
+    {
+        tmp = a[i];
+        a[i] = b[i];
+        b[i] = tmp;
+    }
+}
+
+// Same bookkeeping as update_seq_stats() in receiver.cpp. Concurrent probes of one session on different CPUs may race
+// on prev_sender_seq; that only skews the lost/reordered estimate.
+static __always_inline void update_seq_stats(struct xdp_session *s, __u32 seq)
+{
+    if (!s->seen)
+    {
+        s->seen = 1;
+    }
+    else if ((__s32)(seq - s->prev_sender_seq) > 0)
+    {
+        __sync_fetch_and_add(&s->seq_lost, seq - s->prev_sender_seq - 1);
+    }
+    else
+    {
+        __sync_fetch_and_add(&s->seq_reordered, 1);
+        return;
+    }
+    s->prev_sender_seq = seq;
+}
+
+static __always_inline struct xdp_session *find_session(struct xdp_session_key *key)
+{
+    struct xdp_session *s = bpf_map_lookup_elem(&sessions, key);
+    if (!s)
+    {
+        struct xdp_session zero = {};
+        bpf_map_update_elem(&sessions, key, &zero, BPF_NOEXIST);
+        s = bpf_map_lookup_elem(&sessions, key);
+    }
+    return s;
+}
+
+// Returns 1 if the frame between data and data_end was turned into a reply, 0 if it should go to the stack.
+static __always_inline int reflect(void *data, void *data_end)
+{
+    __u32 key0 = 0;
+    struct xdp_reflector_config *cfg = bpf_map_lookup_elem(&config, &key0);
+    struct ethhdr *eth = data;
+    struct xdp_session_key skey = {};
+    struct iphdr *ip = NULL;
+    struct ipv6hdr *ip6 = NULL;
+    struct udphdr *udp;
+
+    if (!cfg || (void *)(eth + 1) > data_end)
+    {
+        return 0;
+    }
+
+    if (eth->h_proto == bpf_htons(ETH_P_IP))
+    {
+        ip = (void *)(eth + 1);
+        if ((void *)(ip + 1) > data_end || ip->ihl != 5 || ip->protocol != IPPROTO_UDP ||
+            (ip->frag_off & bpf_htons(0x3fff)))
+        {
+            return 0;
+        }
+        udp = (void *)(ip + 1);
+        __builtin_memcpy(skey.addr, &ip->saddr, 4);
+        skey.family = AF_INET;
+    }
+    else if (eth->h_proto == bpf_htons(ETH_P_IPV6))
+    {
+        ip6 = (void *)(eth + 1);
+        if ((void *)(ip6 + 1) > data_end || ip6->nexthdr != IPPROTO_UDP)
+        {
+            return 0;
+        }
+        udp = (void *)(ip6 + 1);
+        __builtin_memcpy(skey.addr, &ip6->saddr, 16);
+        skey.family = AF_INET6;
+    }
+    else
+    {
+        return 0;
+    }
+
+    struct xdp_probe *probe = (void *)(udp + 1);
+    if ((void *)(udp + 1) > data_end || udp->dest != cfg->port || (void *)probe + sizeof(__be32) > data_end ||
+        probe->type != bpf_htonl(FROM_SENDER))
+    {
+        return 0;
+    }
+    count(XDP_CNT_PROBES);
+    if ((void *)(probe + 1) > data_end)
+    {
+        count(XDP_CNT_SHORT);
+        return 0;
+    }
+
+    __u64 t2_prime = bpf_ktime_get_tai_ns() + cfg->realtime_offset_ns;
+    skey.port = udp->source;
+    struct xdp_session *s = find_session(&skey);
+    if (!s)
+    {
+        count(XDP_CNT_NO_SESSION);
+        return 0;
+    }
+    __sync_fetch_and_add(&s->rx_packets, 1);
+    update_seq_stats(s, bpf_ntohl(probe->sender_seq));
+    s->last_seen_ns = t2_prime;
+
+    struct xdp_probe old;
+    __builtin_memcpy(&old, probe, sizeof(old));
+    struct xdp_probe reply = {};
+    reply.type = bpf_htonl(FROM_REFLECTOR);
+    reply.sender_seq = old.sender_seq;
+    reply.refl_seq = bpf_htonl((__u32)__sync_fetch_and_add(&s->refl_seq, 1));
+    // No hardware timestamps on this path, t2/t3 stay 0 and the sender falls back to t4 - t1.
+    reply.t2_prime = bpf_cpu_to_be64(t2_prime);
+    reply.t3_prime = bpf_cpu_to_be64(bpf_ktime_get_tai_ns() + cfg->realtime_offset_ns);
+    __builtin_memcpy(probe, &reply, sizeof(reply));
+
+    // Swapping addresses and ports leaves the UDP checksum unchanged, only the rewritten payload needs patching.
+    // A zero IPv4 UDP checksum means none was computed.
+    if (udp->check)
+    {
+        __s64 csum = bpf_csum_diff((__be32 *)&old, sizeof(old), (__be32 *)&reply, sizeof(reply),
+                                   (__u16)~udp->check);
+        udp->check = csum_fold(csum);
+        if (!udp->check)
+        {
+            udp->check = 0xffff;
+        }
+    }
+
+    if (ip)
+    {
+        __be32 addr = ip->saddr;
+        ip->saddr = ip->daddr;
+        ip->daddr = addr;
+    }
+    else
+    {
+        swap_bytes((__u8 *)&ip6->saddr, (__u8 *)&ip6->daddr, 16);
+    }
+    __be16 port = udp->source;
+    udp->source = udp->dest;
+    udp->dest = port;
+    swap_bytes(eth->h_source, eth->h_dest, ETH_ALEN);
+
+    __sync_fetch_and_add(&s->reflected, 1);
+    count(XDP_CNT_REFLECTED);
+    return 1;
+}
+
+SEC("xdp")
+int xdp_reflector(struct xdp_md *ctx)
+{
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+
+    return reflect(data, data_end) ? XDP_TX : XDP_PASS;
+}
+
+// Longest header chain we parse plus the reply, pulled into the linear part of the skb.
+#define TC_PULL_LEN (sizeof(struct ethhdr) + sizeof(struct ipv6hdr) + sizeof(struct udphdr) + sizeof(struct xdp_probe))
+
+SEC("tc")
+int tc_reflector(struct __sk_buff *skb)
+{
+    // Fails for frames shorter than TC_PULL_LEN; the bounds checks in reflect() then decide.
+    bpf_skb_pull_data(skb, TC_PULL_LEN);
+
+    void *data = (void *)(long)skb->data;
+    void *data_end = (void *)(long)skb->data_end;
+
+    if (!reflect(data, data_end))
+    {
+        return TC_ACT_OK;
+    }
+    return bpf_redirect(skb->ifindex, 0);
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,269 @@
+// Built only with 'make XDP=1', which also links libbpf and compiles xdp_reflector.bpf.c.
+#ifdef XDP_REFLECTOR
+
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <errno.h>
+
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_link.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "metrics.h"
+#include "packet.h"
+#include "util.h"
+#include "xdp_reflector.h"
+
+using std::string;
+using std::vector;
+
+static_assert(sizeof(xdp_probe) == sizeof(Netrounds::ReflectorPacket), "xdp_probe must match ReflectorPacket");
+static_assert(offsetof(xdp_probe, t2) == offsetof(Netrounds::ReflectorPacket, t2), "xdp_probe must match ReflectorPacket");
+static_assert(offsetof(xdp_probe, t3_prime) == offsetof(Netrounds::ReflectorPacket, t3_prime),
+              "xdp_probe must match ReflectorPacket");
+
+namespace Netrounds
+{
+namespace
+{
+bpf_map *find_map(bpf_object *obj, const char *name)
+{
+    bpf_map *map = bpf_object__find_map_by_name(obj, name);
+    if (!map)
+    {
+        throw std::runtime_error(string("BPF object has no map ") + name);
+    }
+    return map;
+}
+
+int64_t realtime_offset_ns()
+{
+    timespec tai;
+    timespec realtime;
+    clock_gettime(CLOCK_TAI, &tai);
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    return timespec_to_ns(realtime) - timespec_to_ns(tai);
+}
+
+string session_name(const xdp_session_key& key)
+{
+    sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    if (key.family == AF_INET)
+    {
+        sockaddr_in *sin = reinterpret_cast<sockaddr_in *>(&ss);
+        sin->sin_family = AF_INET;
+        sin->sin_port = key.port;
+        memcpy(&sin->sin_addr, key.addr, sizeof(sin->sin_addr));
+    }
+    else
+    {
+        sockaddr_in6 *sin6 = reinterpret_cast<sockaddr_in6 *>(&ss);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = key.port;
+        memcpy(&sin6->sin6_addr, key.addr, sizeof(sin6->sin6_addr));
+    }
+    return sockaddr_to_string(&ss);
+}
+}
+
+ReflectMode parse_reflect_mode(const string& mode)
+{
+    if (mode == "skb")
+    {
+        return REFLECT_XDP_SKB;
+    }
+    if (mode == "native")
+    {
+        return REFLECT_XDP_NATIVE;
+    }
+    if (mode == "tc")
+    {
+        return REFLECT_TC;
+    }
+    throw std::runtime_error("Unknown reflect mode " + mode + ", expected skb, native or tc");
+}
+
+XdpReflector::XdpReflector(const string& object_path, const string& iface_name, in_port_t port, ReflectMode mode) :
+    obj(nullptr), ifindex(if_nametoindex(iface_name.c_str())), port(port), mode(mode), xdp_flags(0),
+    tc_hook_created(false), tc_handle(0), tc_priority(0)
+{
+    memset(last_counters, 0, sizeof(last_counters));
+    if (!ifindex)
+    {
+        throw std::system_error(errno, std::system_category(), iface_name);
+    }
+
+    obj = bpf_object__open_file(object_path.c_str(), nullptr);
+    if (!obj)
+    {
+        throw std::system_error(errno, std::system_category(), object_path);
+    }
+
+    const char *prog_name = mode == REFLECT_TC ? "tc_reflector" : "xdp_reflector";
+    bpf_program *prog;
+    bpf_object__for_each_program(prog, obj)
+    {
+        bpf_program__set_autoload(prog, strcmp(bpf_program__name(prog), prog_name) == 0);
+    }
+    prog = bpf_object__find_program_by_name(obj, prog_name);
+    int err = prog ? bpf_object__load(obj) : -ENOENT;
+    if (err)
+    {
+        bpf_object__close(obj);
+        throw std::system_error(-err, std::system_category(), "loading " + object_path);
+    }
+
+    int prog_fd = bpf_program__fd(prog);
+    try
+    {
+        update_config();
+    }
+    catch (...)
+    {
+        bpf_object__close(obj);
+        throw;
+    }
+    if (mode == REFLECT_TC)
+    {
+        bpf_tc_hook hook;
+        memset(&hook, 0, sizeof(hook));
+        hook.sz = sizeof(hook);
+        hook.ifindex = ifindex;
+        hook.attach_point = BPF_TC_INGRESS;
+        err = bpf_tc_hook_create(&hook);
+        tc_hook_created = err == 0;
+        if (err == 0 || err == -EEXIST)
+        {
+            bpf_tc_opts opts;
+            memset(&opts, 0, sizeof(opts));
+            opts.sz = sizeof(opts);
+            opts.prog_fd = prog_fd;
+            err = bpf_tc_attach(&hook, &opts);
+            tc_handle = opts.handle;
+            tc_priority = opts.priority;
+        }
+    }
+    else
+    {
+        xdp_flags = mode == REFLECT_XDP_SKB ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE;
+        err = bpf_xdp_attach(ifindex, prog_fd, xdp_flags, nullptr);
+    }
+    if (err)
+    {
+        bpf_object__close(obj);
+        throw std::system_error(-err, std::system_category(), "attaching to " + iface_name);
+    }
+}
+
+XdpReflector::~XdpReflector()
+{
+    if (mode == REFLECT_TC)
+    {
+        bpf_tc_hook hook;
+        memset(&hook, 0, sizeof(hook));
+        hook.sz = sizeof(hook);
+        hook.ifindex = ifindex;
+        hook.attach_point = BPF_TC_INGRESS;
+        bpf_tc_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.sz = sizeof(opts);
+        opts.handle = tc_handle;
+        opts.priority = tc_priority;
+        bpf_tc_detach(&hook, &opts);
+        if (tc_hook_created)
+        {
+            bpf_tc_hook_destroy(&hook);
+        }
+    }
+    else
+    {
+        bpf_xdp_detach(ifindex, xdp_flags, nullptr);
+    }
+    bpf_object__close(obj);
+}
+
+void XdpReflector::update_config()
+{
+    xdp_reflector_config config;
+    memset(&config, 0, sizeof(config));
+    config.port = htons(port);
+    config.realtime_offset_ns = realtime_offset_ns();
+
+    uint32_t key = 0;
+    int err = bpf_map__update_elem(find_map(obj, "config"), &key, sizeof(key), &config, sizeof(config), BPF_ANY);
+    if (err)
+    {
+        throw std::system_error(-err, std::system_category());
+    }
+}
+
+uint64_t XdpReflector::counter(xdp_reflector_counter c) const
+{
+    vector<uint64_t> values(libbpf_num_possible_cpus());
+    uint32_t key = c;
+    int err = bpf_map__lookup_elem(find_map(obj, "counters"), &key, sizeof(key), values.data(),
+                                   values.size() * sizeof(uint64_t), 0);
+    if (err)
+    {
+        throw std::system_error(-err, std::system_category());
+    }
+
+    uint64_t sum = 0;
+    for (uint64_t v : values)
+    {
+        sum += v;
+    }
+    return sum;
+}
+
+void XdpReflector::sync()
+{
+    update_config();
+
+    uint64_t probes = counter(XDP_CNT_PROBES);
+    uint64_t reflected = counter(XDP_CNT_REFLECTED);
+    count(M_PKTS_RECEIVED, probes - last_counters[XDP_CNT_PROBES]);
+    count(M_PKTS_REFLECTED, reflected - last_counters[XDP_CNT_REFLECTED]);
+    last_counters[XDP_CNT_PROBES] = probes;
+    last_counters[XDP_CNT_REFLECTED] = reflected;
+
+    // Sessions evicted from the LRU map and seen again start over from zero; take those as new.
+    bpf_map *sessions = find_map(obj, "sessions");
+    xdp_session_key key;
+    xdp_session_key next;
+    const void *prev = nullptr;
+    while (bpf_map__get_next_key(sessions, prev, &next, sizeof(next)) == 0)
+    {
+        key = next;
+        prev = &key;
+
+        xdp_session s;
+        if (bpf_map__lookup_elem(sessions, &key, sizeof(key), &s, sizeof(s), 0))
+        {
+            continue;
+        }
+        string peer = session_name(key);
+        xdp_session& last = last_sessions[peer];
+        if (s.rx_packets < last.rx_packets)
+        {
+            memset(&last, 0, sizeof(last));
+        }
+        CounterBlock *block = session_counters(peer);
+        block->inc(M_PKTS_RECEIVED, s.rx_packets - last.rx_packets);
+        block->inc(M_PKTS_REFLECTED, s.reflected - last.reflected);
+        block->inc(M_SEQ_LOST, s.seq_lost - last.seq_lost);
+        block->inc(M_SEQ_REORDERED, s.seq_reordered - last.seq_reordered);
+        last = s;
+    }
+}
+};
+
+#endif
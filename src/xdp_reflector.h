@@ -0,0 +1,68 @@
+#ifndef _XDP_REFLECTOR_H_
+#define _XDP_REFLECTOR_H_
+
+#include <map>
+#include <string>
+
+#include <cstdint>
+
+#include <netinet/in.h>
+
+#include "xdp_reflector_maps.h"
+
+struct bpf_object;
+
+namespace Netrounds
+{
+enum ReflectMode
+{
+    REFLECT_XDP_SKB,    // generic XDP, works on any device including veth
+    REFLECT_XDP_NATIVE, // driver XDP
+    REFLECT_TC          // tc ingress, redirected back to egress
+};
+
+ReflectMode parse_reflect_mode(const std::string& mode);
+
+// Userspace side of the in-kernel reflector (xdp_reflector.bpf.c). Loads and attaches the program on construction,
+// detaches it on destruction, and mirrors the BPF map counters into the metrics registry.
+//
+// Try it without special NICs on a veth pair with generic XDP:
+//   ip netns add refl; ip link add veth0 type veth peer name veth1 netns refl
+//   ip addr add 10.11.0.1/24 dev veth0; ip link set veth0 up
+//   ip -n refl addr add 10.11.0.2/24 dev veth1; ip -n refl link set veth1 up
+//   ip netns exec refl ./receiver --xdp skb 0.0.0.0 5000 4 veth1
+// and run the sender against 10.11.0.2 on veth0. In native mode a veth only delivers XDP_TX frames if its peer has
+// an XDP program attached as well.
+class XdpReflector
+{
+public:
+    XdpReflector(const std::string& object_path, const std::string& iface_name, in_port_t port, ReflectMode mode);
+    ~XdpReflector();
+
+    XdpReflector(const XdpReflector&) = delete;
+    XdpReflector& operator=(const XdpReflector&) = delete;
+
+    // Sum over all CPUs.
+    uint64_t counter(xdp_reflector_counter c) const;
+
+    // Push counter and per-session deltas since the last call into the metrics registry, and refresh the TAI to
+    // realtime offset used for t2'/t3'.
+    void sync();
+
+private:
+    void update_config();
+
+    bpf_object *obj;
+    int ifindex;
+    in_port_t port;
+    ReflectMode mode;
+    uint32_t xdp_flags;
+    bool tc_hook_created;
+    uint32_t tc_handle;
+    uint32_t tc_priority;
+    uint64_t last_counters[NR_XDP_COUNTERS];
+    std::map<std::string, xdp_session> last_sessions;
+};
+};
+
+#endif
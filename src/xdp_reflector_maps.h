@@ -0,0 +1,59 @@
+#ifndef _XDP_REFLECTOR_MAPS_H_
+#define _XDP_REFLECTOR_MAPS_H_
+
+// Map layouts shared by the BPF reflector (xdp_reflector.bpf.c) and its userspace loader. Plain C, fixed-size types.
+
+#include <linux/types.h>
+
+#define XDP_REFLECTOR_MAX_SESSIONS 65536
+
+struct xdp_reflector_config
+{
+    __u16 port;                // reflector UDP port, network order
+    __u16 pad[3];
+    __s64 realtime_offset_ns;  // CLOCK_REALTIME - CLOCK_TAI, added to bpf_ktime_get_tai_ns()
+};
+
+enum xdp_reflector_counter
+{
+    XDP_CNT_PROBES,       // FROM_SENDER probes seen on the port
+    XDP_CNT_REFLECTED,    // rewritten and sent back from the hook
+    XDP_CNT_SHORT,        // too short to be rewritten in place, passed to the stack
+    XDP_CNT_NO_SESSION,   // session map insert failed, passed to the stack
+    NR_XDP_COUNTERS
+};
+
+// Peer address of a session. IPv4 addresses use the first four bytes of addr.
+struct xdp_session_key
+{
+    __u8 addr[16];
+    __u16 port;           // network order
+    __u16 family;         // AF_INET or AF_INET6
+};
+
+struct xdp_session
+{
+    __u64 refl_seq;
+    __u64 rx_packets;
+    __u64 reflected;
+    __u64 seq_lost;
+    __u64 seq_reordered;
+    __u64 last_seen_ns;
+    __u32 prev_sender_seq;
+    __u32 seen;
+};
+
+// Wire image of ReflectorPacket, everything big-endian.
+struct xdp_probe
+{
+    __be32 type;
+    __be32 sender_seq;
+    __be32 refl_seq;
+    __be32 shed;        // no admission control on this path, always 0
+    __be64 t2;
+    __be64 t2_prime;
+    __be64 t3;
+    __be64 t3_prime;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include <stdexcept>
+#include <system_error>
+
+#include <cstring>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+
+#include "metrics.h"
+#include "util.h"
+#include "zerocopy.h"
+
+namespace Netrounds
+{
+void enable_zerocopy(int sock)
+{
+    int enabled = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &enabled, sizeof(enabled)) == -1)
+    {
+        throw std::system_error(errno, std::system_category(), "SO_ZEROCOPY");
+    }
+}
+
+ZerocopyPool::ZerocopyPool(size_t nr_buffers, size_t buf_len) :
+    len(buf_len), storage(nr_buffers * buf_len), next_id(0), nr_zerocopy(0), nr_copied(0), nr_fallback(0)
+{
+    if (!nr_buffers || !buf_len)
+    {
+        throw std::runtime_error("ZerocopyPool needs buffers");
+    }
+    for (size_t i = nr_buffers; i > 0; i--)
+    {
+        free_list.push_back(&storage[(i - 1) * buf_len]);
+    }
+}
+
+char *ZerocopyPool::acquire()
+{
+    if (free_list.empty())
+    {
+        return nullptr;
+    }
+    char *buf = free_list.back();
+    free_list.pop_back();
+    return buf;
+}
+
+void ZerocopyPool::release(char *buf)
+{
+    free_list.push_back(buf);
+}
+
+bool ZerocopyPool::owns(const char *buf) const
+{
+    return buf >= storage.data() && buf < storage.data() + storage.size();
+}
+
+bool ZerocopyPool::send(int sock, const sockaddr_storage *dest, char *buf, size_t buflen)
+{
+    if (buflen > len)
+    {
+        throw std::runtime_error("Zerocopy send longer than its buffer");
+    }
+    socklen_t addrlen = dest->ss_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+    if (sendto(sock, buf, buflen, MSG_DONTWAIT | MSG_ZEROCOPY, reinterpret_cast<const sockaddr *>(dest),
+               addrlen) != -1)
+    {
+        sends[next_id++] = buf;
+        nr_zerocopy++;
+        return true;
+    }
+    if (errno == ENOBUFS)
+    {
+        nr_fallback++;
+        if (try_sendpacket(dest, sock, buf, buflen))
+        {
+            release(buf);
+            return true;
+        }
+        return false;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+        count(M_SEND_EAGAIN);
+        return false;
+    }
+    throw std::system_error(errno, std::system_category(), "zerocopy send");
+}
+
+void ZerocopyPool::complete(uint32_t lo, uint32_t hi, bool copied)
+{
+    // The range is inclusive and may wrap around.
+    for (uint32_t id = lo;; id++)
+    {
+        auto it = sends.find(id);
+        if (it != sends.end())
+        {
+            free_list.push_back(it->second);
+            sends.erase(it);
+            if (copied)
+            {
+                nr_copied++;
+            }
+        }
+        if (id == hi)
+        {
+            break;
+        }
+    }
+}
+
+ErrqueueEvent read_errqueue(int sock, ZerocopyPool *pool, int64_t *sw_ns, int64_t *hw_ns, uint32_t *key)
+{
+    msghdr msg;
+    alignas(cmsghdr) char control[512];
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    // The looped back payload of a timestamp is not needed, it is truncated away.
+    if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return ERRQUEUE_EMPTY;
+        }
+        throw std::system_error(errno, std::system_category());
+    }
+
+    ErrqueueEvent event = ERRQUEUE_OTHER;
+    *key = 0;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+        {
+            timespec stamps[3];
+            memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            *sw_ns = timespec_to_ns(stamps[0]);
+            *hw_ns = timespec_to_ns(stamps[2]);
+            event = ERRQUEUE_TIMESTAMP;
+        }
+        else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                 (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+        {
+            sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+            {
+                if (pool)
+                {
+                    pool->complete(err.ee_info, err.ee_data, err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+                }
+                return ERRQUEUE_ZEROCOPY;
+            }
+            if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+            {
+                *key = err.ee_data;
+            }
+        }
+    }
+    return event;
+}
+
+ZerocopyTransport::ZerocopyTransport(int sock, Transport& inner, size_t nr_buffers, size_t buf_len) :
+    sock(sock), inner(inner), buffers(nr_buffers, buf_len), current(nullptr), nr_exhausted(0)
+{
+    enable_zerocopy(sock);
+}
+
+void ZerocopyTransport::reap()
+{
+    int64_t sw_ns;
+    int64_t hw_ns;
+    uint32_t key;
+    while (read_errqueue(sock, &buffers, &sw_ns, &hw_ns, &key) != ERRQUEUE_EMPTY)
+    {
+    }
+}
+
+char *ZerocopyTransport::receive_buffer(char *own, size_t len)
+{
+    if (current)
+    {
+        return current;
+    }
+    reap();
+    if (len <= buffers.buf_len())
+    {
+        current = buffers.acquire();
+    }
+    return current ? current : own;
+}
+
+bool ZerocopyTransport::receive(char *buf, size_t buflen, RxInfo *info)
+{
+    return inner.receive(buf, buflen, info);
+}
+
+int64_t ZerocopyTransport::send(const sockaddr_storage& peer, const char *buf, size_t len, size_t tx_stamp_offset)
+{
+    if (!current || buf != current)
+    {
+        nr_exhausted++;
+        return inner.send(peer, buf, len, tx_stamp_offset);
+    }
+    if (!buffers.send(sock, &peer, current, len))
+    {
+        // A full socket buffer drops the reply, as on the copying path; the buffer is reused for the next probe.
+        return 0;
+    }
+    current = nullptr;
+    return 0;
+}
+};
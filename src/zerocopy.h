@@ -0,0 +1,138 @@
+#ifndef _ZEROCOPY_H_
+#define _ZEROCOPY_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <netinet/in.h>
+
+#include "transport.h"
+
+namespace Netrounds
+{
+// MSG_ZEROCOPY sends: the kernel pins the user pages instead of copying the payload, and reports on the error queue
+// when it is done with them, next to the TX timestamps. Until then a buffer must not be touched, so sends go from a
+// pool whose buffers come back only with their completion.
+void enable_zerocopy(int sock);
+
+// The kernel numbers the zerocopy sends of a socket from 0, and completions refer to those numbers, so every
+// MSG_ZEROCOPY send on a socket must go through the one pool, from the first.
+class ZerocopyPool
+{
+public:
+    ZerocopyPool(size_t nr_buffers, size_t buf_len);
+
+    // A free buffer of buf_len bytes, nullptr if all are in flight.
+    char *acquire();
+
+    // Gives back an acquired buffer that was not sent.
+    void release(char *buf);
+
+    bool owns(const char *buf) const;
+
+    // Sends an acquired buffer with MSG_ZEROCOPY; it is in flight until complete() sees its send. Falls back to a
+    // copying send, releasing the buffer at once, when the kernel is out of memory for notifications (ENOBUFS).
+    // False if the socket buffer is full; the buffer stays acquired then.
+    bool send(int sock, const sockaddr_storage *dest, char *buf, size_t len);
+
+    // Returns the buffers of the sends lo..hi (an SO_EE_ORIGIN_ZEROCOPY notification) to the pool. copied is set
+    // when the kernel copied the data after all (SO_EE_CODE_ZEROCOPY_COPIED), as it does over loopback.
+    void complete(uint32_t lo, uint32_t hi, bool copied);
+
+    size_t buf_len() const
+    {
+        return len;
+    }
+
+    size_t in_flight() const
+    {
+        return sends.size();
+    }
+
+    uint64_t zerocopy_sends() const
+    {
+        return nr_zerocopy;
+    }
+
+    uint64_t copied_sends() const
+    {
+        return nr_copied;
+    }
+
+    uint64_t fallback_sends() const
+    {
+        return nr_fallback;
+    }
+
+private:
+    size_t len;
+    std::vector<char> storage;
+    std::vector<char *> free_list;
+    std::unordered_map<uint32_t, char *> sends;   // by send number, counted per socket by the kernel from 0
+    uint32_t next_id;
+    uint64_t nr_zerocopy;
+    uint64_t nr_copied;   // completed, but the kernel copied after all
+    uint64_t nr_fallback; // sent as a normal copy
+};
+
+// One message from the error queue with zerocopy completions handed to the pool on the way.
+enum ErrqueueEvent
+{
+    ERRQUEUE_EMPTY,
+    ERRQUEUE_ZEROCOPY,
+    ERRQUEUE_TIMESTAMP,
+    ERRQUEUE_OTHER
+};
+
+// Non-blocking. For ERRQUEUE_TIMESTAMP, sw_ns and hw_ns get the software and raw hardware TX timestamp (0 if absent)
+// and key the OPT_ID of the send it is for (0 without SOF_TIMESTAMPING_OPT_ID).
+ErrqueueEvent read_errqueue(int sock, ZerocopyPool *pool, int64_t *sw_ns, int64_t *hw_ns, uint32_t *key);
+
+// Replies of a ReflectorEngine with MSG_ZEROCOPY: each probe is received into a pool buffer and the reply, built in
+// place, is sent from it. Receiving and the clock are the inner transport's. Without TX timestamps, like
+// RxPathTransport.
+class ZerocopyTransport : public Transport
+{
+public:
+    ZerocopyTransport(int sock, Transport& inner, size_t nr_buffers, size_t buf_len);
+
+    int64_t send(const sockaddr_storage& peer, const char *buf, size_t len, size_t tx_stamp_offset) override;
+    bool receive(char *buf, size_t buflen, RxInfo *info) override;
+    char *receive_buffer(char *own, size_t len) override;
+
+    int64_t now_ns() override
+    {
+        return inner.now_ns();
+    }
+
+    bool one_step_tx() const override
+    {
+        return false;
+    }
+
+    const ZerocopyPool& pool() const
+    {
+        return buffers;
+    }
+
+    // Replies that went from the caller's own buffer with a copy because every pool buffer was in flight.
+    uint64_t pool_exhausted() const
+    {
+        return nr_exhausted;
+    }
+
+private:
+    void reap();
+
+    int sock;
+    Transport& inner;
+    ZerocopyPool buffers;
+    char *current;   // handed out by receive_buffer() and not sent yet
+    uint64_t nr_exhausted;
+};
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include "gtest/gtest.h"
+
+#include "admission.h"
+#include "engine.h"
+#include "packet.h"
+#include "transport.h"
+
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+sockaddr_storage ipv4(uint32_t addr, in_port_t port = 5000)
+{
+    sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    sockaddr_in *sin = reinterpret_cast<sockaddr_in *>(&ss);
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = htonl(addr);
+    sin->sin_port = htons(port);
+    return ss;
+}
+
+// Hands the engine a scripted list of probes, from any number of peers, and keeps its replies.
+class ScriptTransport : public Transport
+{
+public:
+    struct Datagram
+    {
+        sockaddr_storage peer;
+        vector<char> data;
+    };
+
+    ScriptTransport() : now(1000000000)
+    {
+    }
+
+    void script(const sockaddr_storage& peer, uint32_t seq)
+    {
+        Datagram d = { peer, vector<char>(64) };
+        prepare_packet(d.data.data(), d.data.size(), seq);
+        incoming.push_back(d);
+    }
+
+    int64_t send(const sockaddr_storage& peer, const char *buf, size_t len, size_t) override
+    {
+        sent.push_back({ peer, vector<char>(buf, buf + len) });
+        return 0;
+    }
+
+    bool one_step_tx() const override
+    {
+        return false;
+    }
+
+    bool receive(char *buf, size_t buflen, RxInfo *info) override
+    {
+        if (incoming.empty())
+        {
+            return false;
+        }
+        const Datagram& d = incoming.front();
+        info->len = std::min(buflen, d.data.size());
+        memcpy(buf, d.data.data(), info->len);
+        info->peer = d.peer;
+        info->hw_ns = 0;
+        info->sw_ns = now;
+        incoming.pop_front();
+        return true;
+    }
+
+    int64_t now_ns() override
+    {
+        return now;
+    }
+
+    int64_t now;
+    std::deque<Datagram> incoming;
+    vector<Datagram> sent;
+};
+}
+
+// A source gets its burst at once and then the rate, whatever port it sends from.
+TEST(AdmissionTest, TokenBucket)
+{
+    AdmissionControl admission(1000, 4);
+    const int64_t T0 = 1000000000;
+    uint32_t shed;
+    for (int i = 0; i < 4; i++)
+    {
+        EXPECT_TRUE(admission.admit(ipv4(0x0a000001, 5000 + i), T0, &shed));
+        EXPECT_EQ(0u, shed);
+    }
+    EXPECT_FALSE(admission.admit(ipv4(0x0a000001), T0, &shed));
+    EXPECT_FALSE(admission.admit(ipv4(0x0a000001), T0 + 500000, &shed));
+    EXPECT_EQ(2u, shed);
+    // One token per ms.
+    EXPECT_TRUE(admission.admit(ipv4(0x0a000001), T0 + 1000000, &shed));
+    EXPECT_EQ(2u, shed);
+    EXPECT_FALSE(admission.admit(ipv4(0x0a000001), T0 + 1000000, &shed));
+    EXPECT_EQ(3u, shed);
+    // A long pause refills to the burst, not beyond.
+    int admitted = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        admitted += admission.admit(ipv4(0x0a000001), T0 + 1000000000, &shed);
+    }
+    EXPECT_EQ(4, admitted);
+    EXPECT_EQ(9u, admission.shed());
+    EXPECT_EQ(1u, admission.sources());
+
+    sockaddr_storage v6;
+    memset(&v6, 0, sizeof(v6));
+    v6.ss_family = AF_INET6;
+    reinterpret_cast<sockaddr_in6 *>(&v6)->sin6_addr.s6_addr[15] = 1;
+    EXPECT_TRUE(admission.admit(v6, T0, &shed));
+    EXPECT_EQ(2u, admission.sources());
+}
+
+// With more sources than slots the newcomers share the overflow bucket and leave the tracked sources alone; slots
+// whose bucket has refilled are taken over.
+TEST(AdmissionTest, SourcesBeyondTheTable)
+{
+    AdmissionControl admission(1000, 2, AdmissionControl::MAX_PROBE);
+    const int64_t T0 = 1000000000;
+    uint32_t shed;
+    for (uint32_t a = 1; a <= AdmissionControl::MAX_PROBE; a++)
+    {
+        EXPECT_TRUE(admission.admit(ipv4(a), T0, &shed));
+    }
+    EXPECT_EQ(AdmissionControl::MAX_PROBE, admission.sources());
+    int admitted = 0;
+    for (uint32_t a = 100; a < 200; a++)
+    {
+        admitted += admission.admit(ipv4(a), T0, &shed);
+    }
+    EXPECT_EQ(2, admitted);
+    EXPECT_EQ(100u, admission.overflowed());
+    for (uint32_t a = 1; a <= AdmissionControl::MAX_PROBE; a++)
+    {
+        EXPECT_TRUE(admission.admit(ipv4(a), T0, &shed));
+    }
+
+    // Source 1 keeps going, the others fall idle and refill within 2 ms.
+    EXPECT_TRUE(admission.admit(ipv4(1), T0 + 1500000, &shed));
+    EXPECT_TRUE(admission.admit(ipv4(300), T0 + 2500000, &shed));
+    EXPECT_EQ(100u, admission.overflowed());
+    EXPECT_EQ(AdmissionControl::MAX_PROBE, admission.sources());
+
+    EXPECT_THROW(AdmissionControl(0, 2), std::runtime_error);
+    EXPECT_THROW(AdmissionControl(1000, 0.5), std::runtime_error);
+}
+
+// One source floods the reflector while another probes within the limit: the flood is shed and told so in its
+// replies, the other source gets every probe reflected.
+TEST(AdmissionTest, EngineShedsTheFlooder)
+{
+    ScriptTransport transport;
+    AdmissionControl admission(1000, 8);
+    ReflectorEngine engine(transport);
+    engine.set_admission(&admission);
+
+    const sockaddr_storage flooder = ipv4(0x0a000001);
+    const sockaddr_storage polite = ipv4(0x0a000002);
+    uint32_t flood_seq = 0;
+    for (uint32_t ms = 0; ms < 100; ms++)
+    {
+        transport.now = 1000000000 + ms * 1000000LL;
+        for (int i = 0; i < 20; i++)
+        {
+            transport.script(flooder, flood_seq++);
+        }
+        if (ms % 2 == 0)
+        {
+            transport.script(polite, ms / 2);
+        }
+        while (engine.poll())
+        {
+        }
+    }
+
+    uint64_t polite_replies = 0;
+    uint64_t flood_replies = 0;
+    uint32_t last_shed = 0;
+    for (const ScriptTransport::Datagram& d : transport.sent)
+    {
+        ReflectorPacket reply;
+        ASSERT_TRUE(decode_reflector_packet(d.data.data(), d.data.size(), &reply));
+        if (!memcmp(&d.peer, &polite, sizeof(polite)))
+        {
+            EXPECT_EQ(0u, reply.shed);
+            EXPECT_EQ(polite_replies, reply.sender_seq);
+            polite_replies++;
+        }
+        else
+        {
+            EXPECT_GE(reply.shed, last_shed);
+            last_shed = reply.shed;
+            flood_replies++;
+        }
+    }
+    EXPECT_EQ(50u, polite_replies);
+    // The burst, then one a ms.
+    EXPECT_EQ(8u + 99, flood_replies);
+    EXPECT_EQ(flood_seq - flood_replies, engine.shed());
+    EXPECT_EQ(engine.shed(), admission.shed());
+    // The last reply went out for the first probe of the last ms, before its other 19 were shed.
+    EXPECT_EQ(engine.shed() - 19, last_shed);
+    EXPECT_EQ(engine.reflected(), polite_replies + flood_replies);
+}
+
+// The realtime clock stepped back by an hour: buckets neither drain nor refill from it, they go on from the new time.
+TEST(AdmissionTest, ClockSteppedBack)
+{
+    AdmissionControl admission(1000, 4, AdmissionControl::MAX_PROBE);
+    const int64_t T0 = 3600000000000LL;
+    uint32_t shed;
+    EXPECT_TRUE(admission.admit(ipv4(1), T0, &shed));
+    EXPECT_TRUE(admission.admit(ipv4(1), T0, &shed));
+    const int64_t T1 = T0 - 3600000000000LL + 1000000000;
+    EXPECT_TRUE(admission.admit(ipv4(1), T1, &shed));
+    EXPECT_TRUE(admission.admit(ipv4(1), T1, &shed));
+    EXPECT_FALSE(admission.admit(ipv4(1), T1, &shed));
+    EXPECT_EQ(1u, shed);
+    // Then at the rate again.
+    EXPECT_TRUE(admission.admit(ipv4(1), T1 + 1000000, &shed));
+    EXPECT_FALSE(admission.admit(ipv4(1), T1 + 1000000, &shed));
+
+    // Slots of sources last seen before the step are free for others.
+    for (uint32_t a = 2; a <= AdmissionControl::MAX_PROBE; a++)
+    {
+        EXPECT_TRUE(admission.admit(ipv4(a), T0, &shed));
+    }
+    EXPECT_TRUE(admission.admit(ipv4(100), T1 + 2000000, &shed));
+    EXPECT_EQ(0u, admission.overflowed());
+}
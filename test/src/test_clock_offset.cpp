@@ -0,0 +1,205 @@
+#include <cmath>
+#include <random>
+
+#include "gtest/gtest.h"
+
+#include "clock_offset.h"
+#include "packet.h"
+#include "probe_session.h"
+#include "result_store.h"
+#include "timestamp_report.h"
+
+using namespace Netrounds;
+
+namespace
+{
+// Probes every interval_ns over a path with fixed minimum delays and exponential queueing on top, against a
+// reflector clock that is offset_ns ahead and drifts drift_ppm.
+class SimulatedPath
+{
+public:
+    SimulatedPath(int64_t interval_ns, int64_t min_forward_ns, int64_t min_reverse_ns, double queueing_ns,
+                  int64_t offset_ns, double drift_ppm) :
+        interval_ns(interval_ns), min_forward_ns(min_forward_ns), min_reverse_ns(min_reverse_ns),
+        offset_ns(offset_ns), drift_ppm(drift_ppm), queueing(1 / queueing_ns), rng(7), seq(0)
+    {
+    }
+
+    // Reflector minus sender clock at sender time t.
+    double offset_at(int64_t t) const
+    {
+        return offset_ns + drift_ppm * 1e-6 * (t - START_NS);
+    }
+
+    ProbeRecord next(int64_t *forward_ns, int64_t *reverse_ns)
+    {
+        const int64_t RESIDENCE_NS = 10000;
+        *forward_ns = min_forward_ns + static_cast<int64_t>(queueing(rng));
+        *reverse_ns = min_reverse_ns + static_cast<int64_t>(queueing(rng));
+        ProbeRecord rec;
+        rec.seq = seq;
+        rec.t1 = START_NS + static_cast<int64_t>(seq) * interval_ns;
+        int64_t t3_sender = rec.t1 + *forward_ns + RESIDENCE_NS;
+        rec.t2 = rec.t1 + *forward_ns + std::llround(offset_at(rec.t1 + *forward_ns));
+        rec.t3 = t3_sender + std::llround(offset_at(t3_sender));
+        rec.t4 = t3_sender + *reverse_ns;
+        rec.flags = RESULT_COMPLETE;
+        seq++;
+        return rec;
+    }
+
+private:
+    static const int64_t START_NS = 1000000000;
+
+    int64_t interval_ns;
+    int64_t min_forward_ns;
+    int64_t min_reverse_ns;
+    int64_t offset_ns;
+    double drift_ppm;
+    std::exponential_distribution<double> queueing;
+    std::mt19937_64 rng;
+    uint32_t seq;
+};
+}
+
+// Same minimum delay both ways: offset and drift come out to within a microsecond and a fraction of a ppm, and the
+// true one-way delays are inside the bounds.
+TEST(ClockOffsetTest, TracksOffsetAndDrift)
+{
+    SimulatedPath path(10000000, 100000, 100000, 5000, 5000000, 20);
+    ClockOffsetEstimator estimator;
+    OneWaySummary summary;
+    clear_one_way(&summary);
+    for (int i = 0; i < 100000; i++)
+    {
+        int64_t forward;
+        int64_t reverse;
+        ProbeRecord rec = path.next(&forward, &reverse);
+        OneWayDelay delay = estimator.update(rec);
+        ASSERT_TRUE(delay.valid);
+        EXPECT_LE(std::abs(delay.forward_ns - forward), delay.bound_ns);
+        EXPECT_LE(std::abs(delay.reverse_ns - reverse), delay.bound_ns);
+        if (estimator.segments() >= 32)
+        {
+            ClockEstimate clock = estimator.estimate(rec.t1);
+            ASSERT_NEAR(clock.offset_ns, path.offset_at(rec.t1), 1000) << "probe " << i;
+            ASSERT_NEAR(clock.drift_ppm, 20, 0.2) << "probe " << i;
+            ASSERT_NEAR(delay.forward_ns, forward, 1000) << "probe " << i;
+            add_one_way(&summary, delay);
+        }
+    }
+    EXPECT_EQ(estimator.segments(), 100000u / 32);
+    EXPECT_GE(summary.forward.min, 100000 - 1000);
+    EXPECT_LE(summary.forward.min, 100000 + 1000);
+    EXPECT_GE(summary.reverse.min, 100000 - 1000);
+    EXPECT_LE(summary.reverse.min, 100000 + 1000);
+    // Half the minimum RTT, plus a little for the fit.
+    EXPECT_LT(summary.max_bound_ns, 110000);
+}
+
+// An asymmetric path shifts the estimate by half the difference of the minimum delays, which the bound covers.
+// Probes without all four timestamps are passed over.
+TEST(ClockOffsetTest, AsymmetryStaysWithinBound)
+{
+    SimulatedPath path(1000000, 100000, 300000, 1000, -2000000, -5);
+    ClockOffsetEstimator estimator(16, 8);
+    EXPECT_FALSE(estimator.estimate(0).valid);
+    for (int i = 0; i < 10000; i++)
+    {
+        int64_t forward;
+        int64_t reverse;
+        ProbeRecord rec = path.next(&forward, &reverse);
+        if (i % 10 == 0)
+        {
+            rec.flags &= ~RESULT_HAS_T3;
+            EXPECT_FALSE(estimator.update(rec).valid);
+            continue;
+        }
+        OneWayDelay delay = estimator.update(rec);
+        ClockEstimate clock = estimator.estimate(rec.t1);
+        ASSERT_TRUE(clock.valid);
+        EXPECT_LE(std::abs(clock.offset_ns - path.offset_at(rec.t1)), clock.bound_ns);
+        EXPECT_LE(std::abs(delay.forward_ns - forward), delay.bound_ns);
+        if (estimator.segments() >= 8)
+        {
+            ASSERT_NEAR(clock.offset_ns, path.offset_at(rec.t1) - 100000, 1000);
+        }
+    }
+    EXPECT_EQ(estimator.segments(), 9000u / 16);
+}
+
+// Days of probes at a large drift: re-centering keeps the fit as precise at the end as at the start.
+TEST(ClockOffsetTest, LongSessionsKeepPrecision)
+{
+    SimulatedPath path(1000000000, 50000, 50000, 5000, 1000000000000LL, 50);
+    ClockOffsetEstimator estimator;
+    ProbeRecord rec;
+    for (int i = 0; i < 300000; i++)
+    {
+        int64_t forward;
+        int64_t reverse;
+        rec = path.next(&forward, &reverse);
+        estimator.update(rec);
+    }
+    ClockEstimate clock = estimator.estimate(rec.t1);
+    EXPECT_NEAR(clock.offset_ns, path.offset_at(rec.t1), 500);
+    EXPECT_NEAR(clock.drift_ppm, 50, 0.01);
+}
+
+// The sender's main loop: replies bring t2 only, the reflector's reports bring t3 afterwards, and the records the
+// ReportMerger completes from both are what the estimator sees.
+TEST(ClockOffsetTest, ValidFromRepliesAndReports)
+{
+    SimulatedPath path(1000000, 50000, 50000, 5000, 3000000, 0);
+    ClockOffsetEstimator estimator;
+    ProbeRecord last = {};
+    size_t complete = 0;
+    ReportMerger merger(REPORT_MATCH_WINDOW, [&](const ProbeRecord& rec) {
+        if (rec.flags == RESULT_COMPLETE)
+        {
+            complete++;
+        }
+        estimator.update(rec);
+        last = rec;
+    });
+    TimestampBatch batch(16);
+    for (int i = 0; i < 2048; i++)
+    {
+        int64_t forward;
+        int64_t reverse;
+        ProbeRecord sent = path.next(&forward, &reverse);
+
+        ReflectorPacket reply = {};
+        reply.type = FROM_REFLECTOR;
+        reply.sender_seq = sent.seq;
+        reply.refl_seq = sent.seq;
+        reply.t2 = sent.t2;
+        char buf[sizeof(ReflectorPacket)];
+        size_t len = serialize_reflector_packet(reply, buf, sizeof(buf));
+        ASSERT_FALSE(merger.merge(buf, len));
+        ASSERT_TRUE(decode_reflector_packet(buf, len, &reply));
+        ASSERT_EQ(reply.t2, static_cast<timestamp_t>(sent.t2));
+        ASSERT_EQ(reply.t3, 0u);
+        ProbeRecord rec = sent;
+        rec.t3 = static_cast<int64_t>(reply.t3);
+        rec.flags = RESULT_HAS_T1 | RESULT_HAS_T2 | RESULT_HAS_T4;
+        merger.add(rec);
+
+        TimestampReportEntry entry = { sent.seq, sent.seq, static_cast<timestamp_t>(sent.t2),
+                                       static_cast<timestamp_t>(sent.t3) };
+        if (batch.add(entry, sent.t4))
+        {
+            char report[1280];
+            size_t report_len = batch.take(report, sizeof(report));
+            ASSERT_TRUE(merger.merge(report, report_len));
+        }
+    }
+    merger.flush();
+
+    // The first batch of replies went on before the first report told the merger to wait.
+    EXPECT_EQ(complete, 2048u - 16);
+    ClockEstimate clock = estimator.estimate(last.t1);
+    ASSERT_TRUE(clock.valid);
+    EXPECT_LE(std::abs(clock.offset_ns - path.offset_at(last.t1)), clock.bound_ns);
+    EXPECT_NEAR(clock.offset_ns, 3000000, 10000);
+}
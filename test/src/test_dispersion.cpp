@@ -0,0 +1,115 @@
+#include <random>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "gtest/gtest.h"
+
+#include "dispersion.h"
+#include "result_store.h"
+
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+const size_t WIRE_LEN = 1538;
+const double CAPACITY_BPS = 1e9;
+
+// A train sent back to back at input_gap_ns through a bottleneck of CAPACITY_BPS. Cross traffic of up to a full
+// frame gets in between two probes with probability cross, and a later hop holds up a probe (closing the gap to the
+// next one) with probability squeeze. Every probe_missing-th probe goes without t2.
+vector<ProbeRecord> send_train(std::mt19937_64& rng, size_t n, int64_t input_gap_ns, double cross, double squeeze,
+                               size_t probe_missing = 0)
+{
+    const int64_t SERVICE_NS = static_cast<int64_t>(WIRE_LEN * 8 / CAPACITY_BPS * 1e9);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    vector<ProbeRecord> recs(n);
+    int64_t t1 = 1000000000;
+    int64_t free_at = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        ProbeRecord& rec = recs[i];
+        rec.seq = i;
+        rec.t1 = t1 + i * input_gap_ns;
+        if (i && uniform(rng) < cross)
+        {
+            free_at += static_cast<int64_t>(uniform(rng) * SERVICE_NS);
+        }
+        free_at = std::max(free_at, rec.t1 + 50000) + SERVICE_NS;
+        rec.t2 = free_at + 5000000;
+        rec.t3 = rec.t2 + 10000;
+        rec.t4 = rec.t2 + 60000;
+        rec.flags = RESULT_COMPLETE;
+        if (probe_missing && i % probe_missing == probe_missing - 1)
+        {
+            rec.flags &= ~RESULT_HAS_T2;
+        }
+    }
+    for (size_t i = 0; i + 1 < n; i++)
+    {
+        if (uniform(rng) < squeeze)
+        {
+            int64_t hold = static_cast<int64_t>(uniform(rng) * (recs[i + 1].t2 - recs[i].t2));
+            recs[i].t2 += hold;
+            recs[i].t4 += hold;
+        }
+    }
+    return recs;
+}
+}
+
+// With a third of the gaps stretched by cross traffic and a tenth squeezed downstream, the modal pair rate is the
+// capacity; the whole trains come out slower.
+TEST(DispersionTest, ModeFindsCapacityUnderCrossTraffic)
+{
+    std::mt19937_64 rng(11);
+    DispersionEstimator estimator(WIRE_LEN);
+    for (int t = 0; t < 500; t++)
+    {
+        vector<ProbeRecord> recs = send_train(rng, 8, 1230, 0.3, 0.1);
+        estimator.add_train(recs.data(), recs.size());
+    }
+    for (const DispersionEstimate& est : { estimator.forward(), estimator.round_trip() })
+    {
+        // A pair squeezed tighter than it was sent looks sender limited.
+        EXPECT_LE(est.pairs + est.sender_limited, 500u * 7);
+        EXPECT_GT(est.pairs, 500u * 6);
+        EXPECT_EQ(500u, est.trains);
+        EXPECT_NEAR(est.capacity_bps, CAPACITY_BPS, 0.02 * CAPACITY_BPS);
+        EXPECT_LE(est.capacity_low_bps, CAPACITY_BPS);
+        EXPECT_GE(est.capacity_high_bps, CAPACITY_BPS);
+        EXPECT_LT(est.adr_bps, CAPACITY_BPS);
+        EXPECT_GT(est.adr_bps, 0.7 * CAPACITY_BPS);
+    }
+}
+
+// Probes the sender spaced wider than the bottleneck does say nothing about it, and pairs are not formed across a
+// probe without the timestamp; the train still spans from its first to its last timestamp.
+TEST(DispersionTest, SenderLimitedAndMissingProbes)
+{
+    std::mt19937_64 rng(3);
+    DispersionEstimator paced(WIRE_LEN);
+    vector<ProbeRecord> recs = send_train(rng, 8, 20000, 0, 0);
+    paced.add_train(recs.data(), recs.size());
+    DispersionEstimate est = paced.forward();
+    EXPECT_EQ(0u, est.pairs);
+    EXPECT_EQ(7u, est.sender_limited);
+    EXPECT_EQ(0, est.capacity_bps);
+    EXPECT_EQ(1u, est.trains);
+    EXPECT_NEAR(est.adr_bps, WIRE_LEN * 8 * 1e9 / 20000, 0.03 * est.adr_bps);
+
+    DispersionEstimator gaps(WIRE_LEN);
+    recs = send_train(rng, 8, 0, 0, 0, 3);
+    gaps.add_train(recs.data(), recs.size());
+    est = gaps.forward();
+    // Without t2: probes 2 and 5, leaving pairs 0-1, 3-4 and 6-7.
+    EXPECT_EQ(3u, est.pairs);
+    EXPECT_NEAR(est.capacity_bps, CAPACITY_BPS, 0.01 * CAPACITY_BPS);
+    EXPECT_NEAR(est.adr_bps, CAPACITY_BPS, 0.01 * CAPACITY_BPS);
+    EXPECT_EQ(7u, gaps.round_trip().pairs);
+
+    EXPECT_EQ(WIRE_LEN, wire_len(1472, AF_INET));
+    EXPECT_EQ(WIRE_LEN + 20, wire_len(1472, AF_INET6));
+}
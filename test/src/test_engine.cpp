@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include "gtest/gtest.h"
+
+#include "engine.h"
+#include "packet.h"
+#include "probe_matcher.h"
+#include "result_store.h"
+#include "transport.h"
+
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+// Runs count probes from a to b until nothing is in flight any more.
+void run(SimNetwork& net, SenderEngine& sender, ReflectorEngine& reflector)
+{
+    while (!sender.done() || net.next_delivery_ns() != INT64_MAX)
+    {
+        bool busy = sender.poll();
+        busy = reflector.poll() || busy;
+        if (!busy)
+        {
+            net.advance_to(std::min(sender.next_send_ns(), net.next_delivery_ns()));
+        }
+    }
+    sender.flush();
+}
+
+sockaddr_storage ipv4(uint32_t addr, in_port_t port = 5000)
+{
+    sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    sockaddr_in *sin = reinterpret_cast<sockaddr_in *>(&ss);
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = htonl(addr);
+    sin->sin_port = htons(port);
+    return ss;
+}
+
+// Hands the engine a scripted list of probes from any number of peers, which SimNetwork's two endpoints cannot.
+// Replies go nowhere.
+class ScriptTransport : public Transport
+{
+public:
+    struct Datagram
+    {
+        sockaddr_storage peer;
+        vector<char> data;
+    };
+
+    ScriptTransport() : now(1000000000)
+    {
+    }
+
+    void script(const sockaddr_storage& peer, uint32_t seq)
+    {
+        Datagram d = { peer, vector<char>(64) };
+        prepare_packet(d.data.data(), d.data.size(), seq);
+        incoming.push_back(d);
+    }
+
+    int64_t send(const sockaddr_storage&, const char *, size_t, size_t) override
+    {
+        return 0;
+    }
+
+    bool one_step_tx() const override
+    {
+        return false;
+    }
+
+    bool receive(char *buf, size_t buflen, RxInfo *info) override
+    {
+        if (incoming.empty())
+        {
+            return false;
+        }
+        const Datagram& d = incoming.front();
+        info->len = std::min(buflen, d.data.size());
+        memcpy(buf, d.data.data(), info->len);
+        info->peer = d.peer;
+        info->hw_ns = 0;
+        info->sw_ns = now;
+        incoming.pop_front();
+        return true;
+    }
+
+    int64_t now_ns() override
+    {
+        return now;
+    }
+
+    int64_t now;
+    std::deque<Datagram> incoming;
+};
+}
+
+TEST(EngineTest, DelaysMatchTheLink)
+{
+    SimLinkConfig forward;
+    forward.delay_ns = 50000;
+    SimLinkConfig reverse;
+    reverse.delay_ns = 70000;
+    SimNetwork net(forward, reverse, 1);
+
+    vector<ProbeRecord> records;
+    SenderEngine sender(net.a(), net.b().address(), 1000, 10000, 64, 1024,
+                        [&](const ProbeRecord& rec) { records.push_back(rec); });
+    ReflectorEngine reflector(net.b());
+    run(net, sender, reflector);
+
+    ASSERT_EQ(records.size(), 1000u);
+    for (const ProbeRecord& rec : records)
+    {
+        ASSERT_EQ(rec.flags, RESULT_COMPLETE);
+        EXPECT_EQ(rec.t2 - rec.t1, 50000);
+        EXPECT_EQ(rec.t4 - rec.t3, 70000);
+    }
+    EXPECT_EQ(reflector.sessions().size(), 1u);
+    EXPECT_EQ(reflector.sessions()[0].seq.lost, 0u);
+}
+
+TEST(EngineTest, LossAndReorderingMatchGroundTruth)
+{
+    SimLinkConfig forward;
+    forward.delay_ns = 20000;
+    forward.jitter_ns = 500;
+    forward.loss = 0.02;
+    forward.reorder = 0.01;
+    forward.reorder_ns = 50000;
+    SimLinkConfig reverse;
+    reverse.delay_ns = 20000;
+    SimNetwork net(forward, reverse, 42);
+
+    ResultStore store(20000);
+    SenderEngine sender(net.a(), net.b().address(), 20000, 10000, 64, 4096,
+                        [&](const ProbeRecord& rec)
+                        {
+                            store.append(rec.seq, rec.t1, rec.t2, rec.t3, rec.t4, rec.flags);
+                        });
+    ReflectorEngine reflector(net.b());
+    run(net, sender, reflector);
+
+    const SimLinkStats& truth = net.stats(true);
+    ASSERT_GT(truth.lost, 0u);
+    ASSERT_GT(truth.reordered, 0u);
+    SeqTracker seq = reflector.sessions()[0].seq;
+    // Every overtaken probe first shows up as a gap and later as reordered.
+    EXPECT_EQ(seq.reordered, truth.reordered);
+    EXPECT_EQ(seq.lost - seq.reordered, truth.lost);
+    EXPECT_EQ(reflector.reflected(), truth.delivered);
+    EXPECT_EQ(sender.replies(), truth.delivered);
+    EXPECT_EQ(store.size(), 20000u);
+
+    // Lost probes never complete; all others do, and none took less than the base delay.
+    vector<int64_t> rtt(store.size());
+    compute_rtt(store, rtt.data());
+    DelayStats stats = compute_stats(rtt.data(), rtt.size());
+    EXPECT_EQ(stats.count, truth.delivered);
+    EXPECT_GE(stats.min, 40000);
+    EXPECT_LT(stats.max, 40000 + 500 + 50000);
+}
+
+// A sweep over many more source addresses than the engine has session slots: the table stays at its size, a new
+// peer takes the slot of the quietest, and the peer that keeps probing keeps its session.
+TEST(EngineTest, SessionsAreBounded)
+{
+    ScriptTransport transport;
+    ReflectorEngine engine(transport, ReflectorEngine::SESSION_WAYS);
+    const sockaddr_storage steady = ipv4(0x0a000001);
+    for (uint32_t a = 0; a < 1000; a++)
+    {
+        transport.now += 1000;
+        transport.script(steady, a);
+        transport.script(ipv4(0x0b000000 + a), 0);
+        while (engine.poll())
+        {
+        }
+    }
+    vector<EngineSession> sessions = engine.sessions();
+    EXPECT_EQ(ReflectorEngine::SESSION_WAYS, sessions.size());
+    EXPECT_EQ(1000u - (ReflectorEngine::SESSION_WAYS - 1), engine.evicted());
+    EXPECT_EQ(2000u, engine.reflected());
+    auto it = std::find_if(sessions.begin(), sessions.end(), [&](const EngineSession& s)
+                           {
+                               return !memcmp(&s.peer, &steady, sizeof(steady));
+                           });
+    ASSERT_NE(sessions.end(), it);
+    EXPECT_EQ(1000u, it->reflected);
+    EXPECT_EQ(0u, it->seq.lost);
+}
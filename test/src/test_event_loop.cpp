@@ -0,0 +1,382 @@
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstring>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+
+#include "gtest/gtest.h"
+
+#include "event_loop.h"
+#include "metrics.h"
+#include "packet.h"
+#include "probe_session.h"
+#include "timestamp_report.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+const int64_t MS = 1000000;
+
+int bound_socket(in_port_t port)
+{
+    sockaddr_storage ss;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), port, &ss);
+    do_bind(sock, &ss);
+    return sock;
+}
+
+// A multicast reflector that replies from its own unicast socket, so several of them on one host still have
+// distinct reply sources.
+Task<void> reflect_multicast(EventLoop& loop, int group_sock, int reply_sock, int count)
+{
+    char buf[1500];
+    for (int n = 0; n < count; n++)
+    {
+        RxInfo info;
+        co_await loop.receive(group_sock, buf, sizeof(buf), &info, EventLoop::NO_DEADLINE);
+        uint32_t seq;
+        memcpy(&seq, buf + offsetof(SenderPacket, sender_seq), sizeof(seq));
+
+        ReflectorPacket reply;
+        memset(&reply, 0, sizeof(reply));
+        reply.type = FROM_REFLECTOR;
+        reply.sender_seq = ntohl(seq);
+        size_t len = serialize_reflector_packet(reply, buf, sizeof(buf));
+        co_await loop.send(reply_sock, info.peer, buf, len);
+    }
+}
+
+Task<void> receive_until(EventLoop& loop, int sock, int64_t deadline_ns, bool *got, vector<string> *order)
+{
+    char buf[64];
+    RxInfo info;
+    *got = co_await loop.receive(sock, buf, sizeof(buf), &info, deadline_ns);
+    order->push_back("receive");
+}
+
+Task<void> sleep_for(EventLoop& loop, int64_t ns, vector<string> *order)
+{
+    co_await loop.sleep_until(loop.now_ns() + ns);
+    order->push_back("sleep");
+}
+
+Task<int> nested(EventLoop& loop)
+{
+    co_await loop.sleep_until(loop.now_ns() + MS);
+    throw std::runtime_error("nested failure");
+}
+
+Task<void> await_nested(EventLoop& loop, bool *caught)
+{
+    try
+    {
+        co_await nested(loop);
+    }
+    catch (const std::runtime_error&)
+    {
+        *caught = true;
+        throw;
+    }
+}
+}
+
+// Hundreds of sessions and a reflector on one loop and one thread, every probe answered.
+TEST(EventLoopTest, ConcurrentSessions)
+{
+    const int NR_SESSIONS = 200;
+    const uint32_t NR_PROBES = 5;
+    EventLoop loop;
+
+    int reflector = bound_socket(5011);
+    loop.spawn(reflect_session(loop, reflector, NR_SESSIONS * NR_PROBES));
+
+    ProbeSessionConfig config;
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5011, &config.reflector);
+    config.count = NR_PROBES;
+    config.interval_ns = MS;
+    config.probe_len = 64;
+    config.reply_timeout_ns = 1000 * MS;
+    config.tx_timestamps = false;
+
+    vector<int> socks;
+    vector<ProbeSessionStats> stats(NR_SESSIONS);
+    vector<vector<uint32_t>> seqs(NR_SESSIONS);
+    for (int i = 0; i < NR_SESSIONS; i++)
+    {
+        socks.push_back(socket(AF_INET, SOCK_DGRAM, 0));
+        vector<uint32_t> *out = &seqs[i];
+        loop.spawn(probe_session(loop, socks.back(), config, [out](const ProbeRecord& rec) { out->push_back(rec.seq); },
+                                 &stats[i]));
+    }
+    EXPECT_EQ(static_cast<size_t>(NR_SESSIONS + 1), loop.tasks());
+    loop.run();
+
+    EXPECT_EQ(0u, loop.tasks());
+    for (int i = 0; i < NR_SESSIONS; i++)
+    {
+        EXPECT_EQ(NR_PROBES, stats[i].sent);
+        EXPECT_EQ(NR_PROBES, stats[i].replies);
+        EXPECT_EQ(0u, stats[i].timeouts);
+        EXPECT_EQ((vector<uint32_t>{ 0, 1, 2, 3, 4 }), seqs[i]);
+        close(socks[i]);
+    }
+    close(reflector);
+}
+
+// Trains go out whole and come back to the sink whole, the last one cut to what is left of the count.
+TEST(EventLoopTest, DispersionSessionDeliversTrains)
+{
+    EventLoop loop;
+    int reflector = bound_socket(5016);
+    loop.spawn(reflect_session(loop, reflector, 10));
+
+    ProbeSessionConfig config;
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5016, &config.reflector);
+    config.count = 10;
+    config.interval_ns = MS;
+    config.probe_len = 64;
+    config.reply_timeout_ns = 1000 * MS;
+    config.tx_timestamps = false;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    ProbeSessionStats stats;
+    vector<vector<uint32_t>> trains;
+    loop.spawn(dispersion_session(loop, sock, config, 4,
+                                  [&trains](const ProbeRecord *recs, size_t n)
+                                  {
+                                      trains.emplace_back();
+                                      for (size_t i = 0; i < n; i++)
+                                      {
+                                          trains.back().push_back(recs[i].seq);
+                                      }
+                                  },
+                                  &stats));
+    loop.run();
+
+    EXPECT_EQ(10u, stats.sent);
+    EXPECT_EQ(10u, stats.replies);
+    EXPECT_EQ(0u, stats.timeouts);
+    EXPECT_EQ(0u, stats.split);
+    EXPECT_EQ((vector<vector<uint32_t>>{ { 0, 1, 2, 3 }, { 4, 5, 6, 7 }, { 8, 9 } }), trains);
+    close(sock);
+    close(reflector);
+}
+
+// A receive deadline ends only that wait, the loop keeps running everything else meanwhile.
+TEST(EventLoopTest, DeadlineDoesNotBlockOthers)
+{
+    EventLoop loop;
+    int sock = bound_socket(5012);
+    bool got = true;
+    vector<string> order;
+
+    int64_t start = loop.now_ns();
+    loop.spawn(receive_until(loop, sock, start + 30 * MS, &got, &order));
+    loop.spawn(sleep_for(loop, 5 * MS, &order));
+    loop.run();
+
+    EXPECT_FALSE(got);
+    EXPECT_GE(loop.now_ns() - start, 30 * MS);
+    EXPECT_EQ((vector<string>{ "sleep", "receive" }), order);
+    close(sock);
+}
+
+// Exceptions travel through awaited tasks and out of run().
+TEST(EventLoopTest, ExceptionsPropagate)
+{
+    EventLoop loop;
+    bool caught = false;
+    loop.spawn(await_nested(loop, &caught));
+    EXPECT_THROW(loop.run(), std::runtime_error);
+    EXPECT_TRUE(caught);
+    EXPECT_EQ(0u, loop.tasks());
+}
+
+// One probe per interval reaches both group members, and their replies are told apart by source.
+TEST(EventLoopTest, MulticastSessionDemultiplexesReflectors)
+{
+    const uint32_t NR_PROBES = 3;
+    EventLoop loop;
+    sockaddr_storage group;
+    create_sockaddr_storage(AF_INET, string("239.255.0.1"), 5013, &group);
+
+    int group_socks[2];
+    int reply_socks[2];
+    for (int i = 0; i < 2; i++)
+    {
+        int reuse = 1;
+        group_socks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        setsockopt(group_socks[i], SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        do_bind(group_socks[i], &group);
+        join_multicast_group(group_socks[i], &group, "lo");
+        reply_socks[i] = bound_socket(5014 + i);
+        loop.spawn(reflect_multicast(loop, group_socks[i], reply_socks[i], NR_PROBES));
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    setup_multicast_sender(sock, AF_INET, "lo", 1);
+    ProbeSessionConfig config;
+    config.reflector = group;
+    config.count = NR_PROBES;
+    config.interval_ns = 20 * MS;
+    config.probe_len = 64;
+    config.reply_timeout_ns = 1000 * MS;
+    config.tx_timestamps = false;
+
+    ProbeSessionStats stats;
+    std::map<string, vector<uint32_t>> seqs;
+    loop.spawn(multicast_session(loop, sock, config,
+                                 [&seqs](const sockaddr_storage& from, const ProbeRecord& rec)
+                                 {
+                                     seqs[sockaddr_to_string(&from)].push_back(rec.seq);
+                                 },
+                                 &stats));
+    loop.run();
+
+    EXPECT_EQ(NR_PROBES, stats.sent);
+    EXPECT_EQ(2 * NR_PROBES, stats.replies);
+    EXPECT_EQ(0u, stats.timeouts);
+    ASSERT_EQ(2u, seqs.size());
+    EXPECT_EQ((vector<uint32_t>{ 0, 1, 2 }), seqs["127.0.0.1:5014"]);
+    EXPECT_EQ((vector<uint32_t>{ 0, 1, 2 }), seqs["127.0.0.1:5015"]);
+    close(sock);
+    for (int i = 0; i < 2; i++)
+    {
+        close(group_socks[i]);
+        close(reply_socks[i]);
+    }
+}
+
+// TX timestamps are matched to their send by OPT_ID: those of earlier sends left on the queue are dropped, and one
+// that never comes times out rather than being mistaken for a later send's.
+TEST(EventLoopTest, TxTimestampMatchesItsSend)
+{
+    EventLoop loop;
+    int rx = bound_socket(5017);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    const int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+        SOF_TIMESTAMPING_OPT_TSONLY;
+    ASSERT_EQ(0, setsockopt(tx, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)));
+    sockaddr_storage dest;
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5017, &dest);
+    char buf[64] = {};
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_TRUE(try_sendpacket(&dest, tx, buf, sizeof(buf)));
+    }
+
+    uint64_t stale = thread_counters().get(M_TX_STAMP_STALE);
+    uint64_t timeouts = thread_counters().get(M_ERRQUEUE_TIMEOUT);
+    auto collect = [&](uint32_t key) -> Task<void>
+    {
+        // Software stamps only, so 0 either way; what counts is which ones were consumed.
+        EXPECT_EQ(0, co_await loop.tx_timestamp(tx, key, loop.now_ns() + 100 * MS));
+    };
+    loop.spawn(collect(2));
+    loop.run();
+    EXPECT_EQ(stale + 2, thread_counters().get(M_TX_STAMP_STALE));
+    EXPECT_EQ(timeouts, thread_counters().get(M_ERRQUEUE_TIMEOUT));
+    loop.spawn(collect(3));
+    loop.run();
+    EXPECT_EQ(timeouts + 1, thread_counters().get(M_ERRQUEUE_TIMEOUT));
+    close(tx);
+    close(rx);
+}
+
+// Replies and timestamp reports from anybody but the reflector are ignored, even for the probe in flight.
+TEST(EventLoopTest, ProbeSessionIgnoresForeignSources)
+{
+    EventLoop loop;
+    int reflector = bound_socket(5019);
+    loop.spawn(reflect_session(loop, reflector, 3));
+    int sock = bound_socket(5020);
+    int intruder = socket(AF_INET, SOCK_DGRAM, 0);
+
+    sockaddr_storage victim;
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5020, &victim);
+    char buf[256];
+    ReflectorPacket reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = FROM_REFLECTOR;
+    reply.t2 = 12345;
+    size_t len = serialize_reflector_packet(reply, buf, sizeof(buf));
+    ASSERT_TRUE(try_sendpacket(&victim, intruder, buf, len));
+    TimestampReportEntry entry = { 0, 0, 12345, 23456 };
+    len = serialize_timestamp_report(&entry, 1, buf, sizeof(buf));
+    ASSERT_TRUE(try_sendpacket(&victim, intruder, buf, len));
+
+    ProbeSessionConfig config;
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5019, &config.reflector);
+    config.count = 3;
+    config.interval_ns = MS;
+    config.probe_len = 64;
+    config.reply_timeout_ns = 100 * MS;
+    config.tx_timestamps = false;
+    config.timestamp_reports = true;
+    ProbeSessionStats stats;
+    vector<ProbeRecord> records;
+    loop.spawn(probe_session(loop, sock, config, [&records](const ProbeRecord& rec) { records.push_back(rec); },
+                             &stats));
+    loop.run();
+
+    EXPECT_EQ(2u, stats.foreign);
+    EXPECT_EQ(0u, stats.reports);
+    EXPECT_EQ(3u, stats.replies);
+    ASSERT_EQ(3u, records.size());
+    for (const ProbeRecord& rec : records)
+    {
+        EXPECT_EQ(0, rec.t2);
+        EXPECT_EQ(0, rec.t3);
+    }
+    close(intruder);
+    close(sock);
+    close(reflector);
+}
+
+// A datagram too long for the receive buffers is dropped and counted, on both ends, and the sessions carry on.
+TEST(EventLoopTest, OversizedDatagramsAreDropped)
+{
+    EventLoop loop;
+    int reflector = bound_socket(5024);
+    loop.spawn(reflect_session(loop, reflector, 3));
+    int sock = bound_socket(5025);
+    int intruder = socket(AF_INET, SOCK_DGRAM, 0);
+
+    uint64_t truncated = thread_counters().get(M_RX_TRUNCATED);
+    vector<char> big(MAX_SESSION_PROBE_LEN + 1000);
+    sockaddr_storage target;
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5025, &target);
+    ASSERT_TRUE(try_sendpacket(&target, intruder, big.data(), big.size()));
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5024, &target);
+    ASSERT_TRUE(try_sendpacket(&target, intruder, big.data(), big.size()));
+
+    ProbeSessionConfig config;
+    config.reflector = target;
+    config.count = 3;
+    config.interval_ns = MS;
+    config.probe_len = 64;
+    config.reply_timeout_ns = 1000 * MS;
+    config.tx_timestamps = false;
+    ProbeSessionStats stats;
+    loop.spawn(probe_session(loop, sock, config, [](const ProbeRecord&) {}, &stats));
+    loop.run();
+
+    EXPECT_EQ(3u, stats.replies);
+    EXPECT_EQ(0u, stats.timeouts);
+    EXPECT_EQ(truncated + 2, thread_counters().get(M_RX_TRUNCATED));
+    close(intruder);
+    close(sock);
+    close(reflector);
+}
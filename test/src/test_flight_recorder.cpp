@@ -0,0 +1,109 @@
+#include <string>
+#include <thread>
+
+#include <cstdio>
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "gtest/gtest.h"
+
+#include "flight_recorder.h"
+#include "packet.h"
+#include "pcap_format.h"
+#include "pcap_reader.h"
+#include "util.h"
+
+using std::string;
+
+using namespace Netrounds;
+
+TEST(LatencyDetectorTest, ThresholdAndCusum)
+{
+    LatencyDetector threshold(50000, 0, 0, 0.01, 3);
+    EXPECT_FALSE(threshold.update(10000));
+    EXPECT_FALSE(threshold.update(20000));
+    EXPECT_TRUE(threshold.update(60000));
+    // Holdoff swallows the next three samples.
+    EXPECT_FALSE(threshold.update(60000));
+    EXPECT_FALSE(threshold.update(60000));
+    EXPECT_FALSE(threshold.update(60000));
+    EXPECT_TRUE(threshold.update(60000));
+
+    // A step of 10 us over a 100 us baseline stays below any fixed threshold but accumulates in the CUSUM.
+    LatencyDetector cusum(0, 2000, 30000, 0.001, 0);
+    for (int i = 0; i < 100; i++)
+    {
+        EXPECT_FALSE(cusum.update(100000));
+    }
+    EXPECT_FALSE(cusum.update(110000));
+    EXPECT_FALSE(cusum.update(110000));
+    EXPECT_FALSE(cusum.update(110000));
+    EXPECT_TRUE(cusum.update(110000));
+}
+
+TEST(FlightRecorderTest, DumpIsReadablePcapng)
+{
+    sockaddr_storage src, dst;
+    create_sockaddr_storage(AF_INET, "10.0.0.1", 40000, &src);
+    create_sockaddr_storage(AF_INET, "10.0.0.2", 5000, &dst);
+
+    FlightRecorder recorder(2, "/tmp/test_flight_recorder");
+    char buf[64];
+    for (uint32_t seq = 0; seq < 3; seq++)
+    {
+        prepare_packet(buf, sizeof(buf), seq);
+        FlightInfo info = { 1700000000000000000LL + seq, FLIGHT_OUTBOUND, &src, &dst, seq, { 0 }, { 0 } };
+        recorder.record(info, buf, sizeof(buf));
+    }
+    string path = recorder.dump();
+
+    // Only the last two probes fit the ring.
+    PcapReader reader(path);
+    CapturedPacket pkt;
+    UdpDatagram udp;
+    for (uint32_t seq = 1; seq < 3; seq++)
+    {
+        ASSERT_TRUE(reader.next(&pkt));
+        EXPECT_EQ(pkt.linktype, Pcap::LINKTYPE_RAW);
+        EXPECT_EQ(pkt.ts_ns, 1700000000000000000LL + seq);
+        ASSERT_TRUE(extract_udp(pkt, &udp));
+        EXPECT_EQ(ntohs(reinterpret_cast<sockaddr_in *>(&udp.dst)->sin_port), 5000);
+        EXPECT_EQ(udp.len, sizeof(buf));
+        PacketType type;
+        ASSERT_TRUE(peek_packet_type(reinterpret_cast<const char *>(udp.payload), udp.len, &type));
+        EXPECT_EQ(type, FROM_SENDER);
+    }
+    EXPECT_FALSE(reader.next(&pkt));
+    remove(path.c_str());
+}
+
+// SIGUSR1 asks for a dump without cutting short the blocking receive the sender and receiver loops sit in.
+TEST(FlightRecorderTest, DumpSignalDoesNotInterruptReceive)
+{
+    FlightRecorder::install_signal_handler();
+    int rx = setup_socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_storage ss;
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5018, &ss);
+    do_bind(rx, &ss);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+
+    pthread_t receiving = pthread_self();
+    std::thread signaller([&]()
+    {
+        usleep(50000);
+        pthread_kill(receiving, SIGUSR1);
+        usleep(50000);
+        char buf[16] = {};
+        sendto(tx, buf, sizeof(buf), 0, reinterpret_cast<sockaddr *>(&ss), sizeof(sockaddr_in));
+    });
+    int len = std::get<1>(recvpacket(rx, 0));
+    signaller.join();
+    EXPECT_EQ(16, len);
+    EXPECT_TRUE(FlightRecorder::dump_requested());
+    close(tx);
+    close(rx);
+}
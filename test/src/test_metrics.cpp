@@ -0,0 +1,65 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "histogram.h"
+#include "metrics.h"
+
+using std::string;
+
+using namespace Netrounds;
+
+TEST(HistogramTest, BucketIndex)
+{
+    EXPECT_EQ(Log2Histogram::bucket_index(0), 0);
+    EXPECT_EQ(Log2Histogram::bucket_index(63), 0);
+    EXPECT_EQ(Log2Histogram::bucket_index(64), 1);
+    EXPECT_EQ(Log2Histogram::bucket_index(127), 1);
+    EXPECT_EQ(Log2Histogram::bucket_index(128), 2);
+    EXPECT_EQ(Log2Histogram::bucket_index(~0ULL), Log2Histogram::NR_BUCKETS - 1);
+
+    // Every value must be below the upper bound of its bucket.
+    for (uint64_t ns = 1; ns < (1ULL << 40); ns *= 3)
+    {
+        int idx = Log2Histogram::bucket_index(ns);
+        uint64_t upper = Log2Histogram::bucket_upper_ns(idx);
+        EXPECT_TRUE(upper == 0 || ns < upper);
+    }
+}
+
+TEST(HistogramTest, RecordCountSum)
+{
+    Log2Histogram h;
+    h.record(10);
+    h.record(1000);
+    h.record(1000000);
+    EXPECT_EQ(h.count(), 3u);
+    EXPECT_EQ(h.sum(), 1001010u);
+}
+
+TEST(MetricsTest, FormatSessionCounters)
+{
+    CounterBlock *session = session_counters("10.0.0.1:5000");
+    EXPECT_EQ(session, session_counters("10.0.0.1:5000"));
+    session->inc(M_PKTS_REFLECTED, 3);
+    session->latency.record(2000);
+    count(M_SEND_EAGAIN);
+
+    string text = format_metrics();
+    EXPECT_NE(text.find("netrounds_packets_reflected_total{session=\"10.0.0.1:5000\"} 3\n"), string::npos);
+    EXPECT_NE(text.find("netrounds_send_eagain_total 1\n"), string::npos);
+    EXPECT_NE(text.find("netrounds_latency_seconds_count{session=\"10.0.0.1:5000\"} 1\n"), string::npos);
+    EXPECT_NE(text.find("le=\"+Inf\"} 1\n"), string::npos);
+}
+
+// A released session leaves the exposition, and comes back from zero if its peer does.
+TEST(MetricsTest, ReleaseSessionCounters)
+{
+    session_counters("10.0.0.2:5000")->inc(M_PKTS_REFLECTED, 5);
+    EXPECT_NE(format_metrics().find("{session=\"10.0.0.2:5000\"} 5\n"), string::npos);
+    release_session_counters("10.0.0.2:5000");
+    EXPECT_EQ(format_metrics().find("session=\"10.0.0.2:5000\""), string::npos);
+    EXPECT_EQ(0u, session_counters("10.0.0.2:5000")->get(M_PKTS_REFLECTED));
+    release_session_counters("10.0.0.2:5000");
+    release_session_counters("10.0.0.2:5000");
+}
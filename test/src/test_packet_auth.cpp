@@ -0,0 +1,189 @@
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "engine.h"
+#include "packet.h"
+#include "packet_auth.h"
+#include "transport.h"
+
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+const uint8_t RFC4493_KEY[16] =
+{
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+
+const uint8_t RFC4493_MSG[64] =
+{
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+
+vector<AuthKernel> supported_kernels()
+{
+    vector<AuthKernel> kernels;
+    for (int k = AUTH_PORTABLE; k <= best_auth_kernel(); k++)
+    {
+        kernels.push_back(static_cast<AuthKernel>(k));
+    }
+    return kernels;
+}
+
+void flip(char *buf, size_t offset)
+{
+    buf[offset] ^= 0x01;
+}
+}
+
+// The four examples of RFC 4493, section 4, on every kernel, one at a time and as a batch.
+TEST(PacketAuthTest, Rfc4493Vectors)
+{
+    const size_t lens[4] = { 0, 16, 40, 64 };
+    const uint8_t tags[4][16] =
+    {
+        { 0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28, 0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46 },
+        { 0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44, 0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c },
+        { 0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27 },
+        { 0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92, 0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe }
+    };
+    for (AuthKernel kernel : supported_kernels())
+    {
+        AesCmac cmac(RFC4493_KEY, kernel);
+        for (int i = 0; i < 4; i++)
+        {
+            uint8_t tag[16];
+            cmac.mac(RFC4493_MSG, lens[i], tag);
+            EXPECT_EQ(memcmp(tag, tags[i], 16), 0) << auth_kernel_name(kernel) << ", " << lens[i] << " bytes";
+
+            const AesCmac *keys[3] = { &cmac, &cmac, &cmac };
+            const uint8_t *msgs[3] = { RFC4493_MSG, RFC4493_MSG, RFC4493_MSG };
+            uint8_t batch_tags[3][16];
+            AesCmac::mac_batch(keys, msgs, lens[i], batch_tags, 3);
+            for (int l = 0; l < 3; l++)
+            {
+                EXPECT_EQ(memcmp(batch_tags[l], tags[i], 16), 0) << auth_kernel_name(kernel) << " batch";
+            }
+        }
+    }
+}
+
+// Any change to the sequence numbers or timestamps, another session's trailer or another master key fails; t3, which
+// one-step timestamping writes after signing, does not. A batch gives what verifying one by one does.
+TEST(PacketAuthTest, TamperingIsRejected)
+{
+    uint8_t master[AUTH_KEY_LEN] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    uint8_t other[AUTH_KEY_LEN] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 17 };
+    for (AuthKernel kernel : supported_kernels())
+    {
+        PacketAuth auth(master, kernel);
+        PacketAuth wrong_key(other, kernel);
+
+        vector<char> probe(100, 0);
+        prepare_packet(probe.data(), probe.size(), 7);
+        ASSERT_TRUE(auth.sign(probe.data(), probe.size(), 1234));
+        uint32_t session_id = 0;
+        EXPECT_TRUE(auth.verify(probe.data(), probe.size(), &session_id));
+        EXPECT_EQ(session_id, 1234u);
+        EXPECT_FALSE(wrong_key.verify(probe.data(), probe.size(), nullptr));
+        // Padding is not covered.
+        flip(probe.data(), 50);
+        EXPECT_TRUE(auth.verify(probe.data(), probe.size(), nullptr));
+
+        vector<char> reply(100, 0);
+        ReflectorPacket pkt;
+        memset(&pkt, 0, sizeof(pkt));
+        pkt.type = FROM_REFLECTOR;
+        pkt.sender_seq = 7;
+        pkt.t2 = 1000;
+        pkt.t3 = 2000;
+        serialize_reflector_packet(pkt, reply.data(), reply.size());
+        ASSERT_TRUE(auth.sign(reply.data(), reply.size(), 1234));
+        EXPECT_TRUE(auth.verify(reply.data(), reply.size(), nullptr));
+        flip(reply.data(), offsetof(ReflectorPacket, t3));
+        EXPECT_TRUE(auth.verify(reply.data(), reply.size(), nullptr));
+
+        vector<vector<char>> bufs;
+        for (size_t offset : { offsetof(SenderPacket, sender_seq) + 3, reply.size() - AUTH_TRAILER_LEN,
+                               reply.size() - 1 })
+        {
+            bufs.push_back(reply);
+            flip(bufs.back().data(), offset);
+        }
+        bufs.push_back(probe);
+        bufs.push_back(reply);
+        vector<char> tampered_t2 = reply;
+        flip(tampered_t2.data(), offsetof(ReflectorPacket, t2) + 7);
+        bufs.push_back(tampered_t2);
+        bufs.push_back(vector<char>(reply.begin(), reply.begin() + 40));
+        vector<char> other_session = probe;
+        auth.sign(other_session.data(), other_session.size(), 99);
+        bufs.push_back(other_session);
+        bufs.push_back(reply);
+
+        vector<const char *> ptrs;
+        vector<size_t> lens;
+        for (const vector<char>& b : bufs)
+        {
+            ptrs.push_back(b.data());
+            lens.push_back(b.size());
+        }
+        bool ok[9];
+        uint32_t ids[9];
+        const bool want[9] = { false, false, false, true, true, false, false, true, true };
+        EXPECT_EQ(auth.verify_batch(ptrs.data(), lens.data(), ptrs.size(), ok, ids), 4u);
+        for (size_t i = 0; i < 9; i++)
+        {
+            EXPECT_EQ(ok[i], want[i]) << auth_kernel_name(kernel) << ", datagram " << i;
+            EXPECT_EQ(auth.verify(ptrs[i], lens[i], nullptr), want[i]);
+        }
+        EXPECT_EQ(ids[7], 99u);
+        EXPECT_EQ(ids[8], 1234u);
+    }
+}
+
+// An authenticating reflector drops unsigned probes and signs its replies, with t3 stamped in after signing.
+TEST(PacketAuthTest, ReflectorSignsReplies)
+{
+    uint8_t master[AUTH_KEY_LEN] = { 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 1, 2, 3, 4, 5, 6 };
+    PacketAuth auth(master);
+    SimLinkConfig link;
+    link.delay_ns = 1000;
+    SimNetwork net(link, link, 1);
+    ReflectorEngine reflector(net.b());
+    reflector.set_auth(&auth);
+
+    const size_t PROBE_LEN = 100;    // within what SimNetwork carries
+    char probe[PROBE_LEN] = {};
+    prepare_packet(probe, PROBE_LEN, 1);
+    net.a().send(net.b().address(), probe, PROBE_LEN, Transport::NO_TX_STAMP);
+    prepare_packet(probe, PROBE_LEN, 2);
+    auth.sign(probe, PROBE_LEN, 55);
+    net.a().send(net.b().address(), probe, PROBE_LEN, Transport::NO_TX_STAMP);
+    net.advance_to(net.next_delivery_ns());
+    while (reflector.poll())
+    {
+    }
+    EXPECT_EQ(reflector.rejected(), 1u);
+    EXPECT_EQ(reflector.reflected(), 1u);
+
+    net.advance_to(net.next_delivery_ns());
+    char rx[PROBE_LEN];
+    RxInfo info;
+    ASSERT_TRUE(net.a().receive(rx, sizeof(rx), &info));
+    ReflectorPacket reply;
+    ASSERT_TRUE(decode_reflector_packet(rx, info.len, &reply));
+    EXPECT_EQ(reply.sender_seq, 2u);
+    EXPECT_NE(reply.t3, 0u);
+    uint32_t session_id;
+    EXPECT_TRUE(auth.verify(rx, info.len, &session_id));
+    EXPECT_EQ(session_id, 55u);
+    EXPECT_FALSE(net.a().receive(rx, sizeof(rx), &info));
+}
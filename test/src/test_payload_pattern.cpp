@@ -0,0 +1,104 @@
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "gtest/gtest.h"
+
+#include "engine.h"
+#include "packet.h"
+#include "payload_pattern.h"
+#include "rx_path.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+vector<PatternKernel> supported_kernels()
+{
+    vector<PatternKernel> kernels;
+    for (int k = PATTERN_SCALAR; k <= best_pattern_kernel(); k++)
+    {
+        kernels.push_back(static_cast<PatternKernel>(k));
+    }
+    return kernels;
+}
+}
+
+// The vector kernels write exactly what the scalar one does, tails included, and leave the header alone.
+TEST(PayloadPatternTest, KernelsAgree)
+{
+    for (size_t len : { 0, 47, 48, 49, 63, 64, 65, 100, 1472, 1473, 9000 })
+    {
+        vector<char> want(len + 1, 'x');
+        fill_pattern(want.data(), len, 42, PATTERN_SCALAR);
+        for (PatternKernel kernel : supported_kernels())
+        {
+            vector<char> got(len + 1, 'x');
+            fill_pattern(got.data(), len, 42, kernel);
+            EXPECT_EQ(want, got) << pattern_kernel_name(kernel) << " at " << len;
+            EXPECT_EQ(0u, verify_pattern(got.data(), len, 42, nullptr, 0, kernel));
+        }
+        for (size_t i = 0; i < std::min(len, PATTERN_OFFSET); i++)
+        {
+            ASSERT_EQ('x', want[i]);
+        }
+        ASSERT_EQ('x', want[len]);
+    }
+}
+
+TEST(PayloadPatternTest, VerifyReportsCorruptedOffsets)
+{
+    const size_t LEN = 1472;
+    const uint32_t BAD[] = { PATTERN_OFFSET, 100, 101, 1000, LEN - 1 };
+    vector<char> buf(LEN);
+    fill_pattern(buf.data(), LEN, 7);
+    for (uint32_t offset : BAD)
+    {
+        buf[offset] ^= 0x10;
+    }
+
+    for (PatternKernel kernel : supported_kernels())
+    {
+        uint32_t bad[3];
+        EXPECT_EQ(5u, verify_pattern(buf.data(), LEN, 7, bad, 3, kernel)) << pattern_kernel_name(kernel);
+        EXPECT_EQ(PATTERN_OFFSET, bad[0]);
+        EXPECT_EQ(100u, bad[1]);
+        EXPECT_EQ(101u, bad[2]);
+        // Another probe's pattern, as a reply mixed up on the way would have, matches hardly anywhere.
+        EXPECT_GT(verify_pattern(buf.data(), LEN, 8, nullptr, 0, kernel), (LEN - PATTERN_OFFSET) * 9 / 10);
+    }
+}
+
+// ReflectorEngine replies echo the probe's payload past the reply header.
+TEST(PayloadPatternTest, ReflectorEchoesPattern)
+{
+    const size_t PROBE_LEN = 1000;
+    sockaddr_storage addr;
+    int refl = setup_socket(AF_INET, SOCK_DGRAM, 0);
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5091, &addr);
+    do_bind(refl, &addr);
+    std::unique_ptr<Transport> transport = make_rx_path_transport(refl, TS_NONE, AF_INET);
+    ReflectorEngine engine(*transport);
+
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    vector<char> probe(PROBE_LEN);
+    prepare_packet(probe.data(), PROBE_LEN, 3);
+    fill_pattern(probe.data(), PROBE_LEN, 3);
+    sendto(tx, probe.data(), PROBE_LEN, 0, reinterpret_cast<sockaddr *>(&addr), sizeof(sockaddr_in));
+    for (int tries = 0; tries < 1000 && !engine.poll(); tries++)
+    {
+        usleep(100);
+    }
+
+    vector<char> reply(PROBE_LEN + 1);
+    ASSERT_EQ(static_cast<ssize_t>(PROBE_LEN), recv(tx, reply.data(), reply.size(), 0));
+    EXPECT_EQ(0u, verify_pattern(reply.data(), PROBE_LEN, 3, nullptr, 0));
+    close(refl);
+    close(tx);
+}
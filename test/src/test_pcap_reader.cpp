@@ -0,0 +1,269 @@
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include "gtest/gtest.h"
+
+#include "capture_stream.h"
+#include "packet.h"
+#include "pcap_format.h"
+#include "pcap_reader.h"
+#include "probe_matcher.h"
+#include "result_store.h"
+
+using std::string;
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+// Ethernet + IPv4 + UDP frame around a probe payload. Checksums are not checked by the reader.
+vector<uint8_t> make_frame(const char *payload, size_t len, uint16_t sport, uint16_t dport)
+{
+    vector<uint8_t> frame(14 + 20 + 8 + len, 0);
+    frame[12] = 0x08;
+    uint8_t *ip = &frame[14];
+    ip[0] = 0x45;
+    uint16_t ip_len = htons(20 + 8 + len);
+    memcpy(ip + 2, &ip_len, 2);
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    uint32_t src = htonl(0x0a000001), dst = htonl(0x0a000002);
+    memcpy(ip + 12, &src, 4);
+    memcpy(ip + 16, &dst, 4);
+    uint8_t *udp = ip + 20;
+    uint16_t v = htons(sport);
+    memcpy(udp, &v, 2);
+    v = htons(dport);
+    memcpy(udp + 2, &v, 2);
+    v = htons(8 + len);
+    memcpy(udp + 4, &v, 2);
+    memcpy(udp + 8, payload, len);
+    return frame;
+}
+
+vector<uint8_t> sender_probe(uint32_t seq)
+{
+    char buf[64];
+    prepare_packet(buf, sizeof(buf), seq);
+    return make_frame(buf, sizeof(buf), 40000, 5000);
+}
+
+// The reflector's reply to probe seq, with its t2 and t3 in it.
+vector<uint8_t> reflector_reply(uint32_t seq, int64_t t2, int64_t t3)
+{
+    ReflectorPacket reply = {};
+    reply.type = FROM_REFLECTOR;
+    reply.sender_seq = seq;
+    reply.refl_seq = seq;
+    reply.t2 = t2;
+    reply.t3 = t3;
+    char buf[sizeof(ReflectorPacket)];
+    size_t len = serialize_reflector_packet(reply, buf, sizeof(buf));
+    return make_frame(buf, len, 5000, 40000);
+}
+
+void write_pcap(const string& path, const vector<vector<uint8_t> >& frames, const vector<int64_t>& ts)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    ASSERT_TRUE(f);
+    Pcap::FileHeader fh = { Pcap::MAGIC_NSEC, 2, 4, 0, 0, 65535, Pcap::LINKTYPE_ETHERNET };
+    fwrite(&fh, sizeof(fh), 1, f);
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        Pcap::RecordHeader rh = { static_cast<uint32_t>(ts[i] / 1000000000), static_cast<uint32_t>(ts[i] % 1000000000),
+                                  static_cast<uint32_t>(frames[i].size()), static_cast<uint32_t>(frames[i].size()) };
+        fwrite(&rh, sizeof(rh), 1, f);
+        fwrite(frames[i].data(), frames[i].size(), 1, f);
+    }
+    fclose(f);
+}
+
+void write_block(FILE *f, uint32_t type, const vector<uint8_t>& body)
+{
+    uint32_t total = sizeof(Pcap::BlockHeader) + Pcap::pad4(body.size()) + sizeof(uint32_t);
+    fwrite(&type, 4, 1, f);
+    fwrite(&total, 4, 1, f);
+    fwrite(body.data(), body.size(), 1, f);
+    uint32_t zero = 0;
+    fwrite(&zero, Pcap::pad4(body.size()) - body.size(), 1, f);
+    fwrite(&total, 4, 1, f);
+}
+
+template<class T> void append(vector<uint8_t>& v, const T& val)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&val);
+    v.insert(v.end(), p, p + sizeof(val));
+}
+}
+
+TEST(PcapReaderTest, ClassicNanosecond)
+{
+    const string path = "/tmp/test_pcap_reader.pcap";
+    vector<vector<uint8_t> > frames;
+    vector<int64_t> ts;
+    for (uint32_t seq = 0; seq < 3; seq++)
+    {
+        frames.push_back(sender_probe(seq));
+        ts.push_back(1700000000123456789LL + seq);
+    }
+    write_pcap(path, frames, ts);
+
+    PcapReader reader(path);
+    CapturedPacket pkt;
+    UdpDatagram udp;
+    for (uint32_t seq = 0; seq < 3; seq++)
+    {
+        ASSERT_TRUE(reader.next(&pkt));
+        EXPECT_EQ(pkt.ts_ns, ts[seq]);
+        ASSERT_TRUE(extract_udp(pkt, &udp));
+        EXPECT_EQ(ntohs(reinterpret_cast<sockaddr_in *>(&udp.dst)->sin_port), 5000);
+        PacketType type;
+        ASSERT_TRUE(peek_packet_type(reinterpret_cast<const char *>(udp.payload), udp.len, &type));
+        EXPECT_EQ(type, FROM_SENDER);
+    }
+    EXPECT_FALSE(reader.next(&pkt));
+    remove(path.c_str());
+}
+
+TEST(PcapReaderTest, PcapngTsresol)
+{
+    const string path = "/tmp/test_pcap_reader.pcapng";
+    FILE *f = fopen(path.c_str(), "wb");
+    ASSERT_TRUE(f);
+
+    vector<uint8_t> shb;
+    Pcap::SectionHeader sh = { Pcap::BYTE_ORDER_MAGIC, 1, 0, -1 };
+    append(shb, sh);
+    write_block(f, Pcap::BLOCK_SHB, shb);
+
+    vector<uint8_t> idb;
+    Pcap::InterfaceDescription id = { Pcap::LINKTYPE_ETHERNET, 0, 65535 };
+    append(idb, id);
+    Pcap::OptionHeader tsresol = { Pcap::OPT_IF_TSRESOL, 1 };
+    append(idb, tsresol);
+    idb.push_back(9);
+    idb.resize(Pcap::pad4(idb.size()), 0);
+    Pcap::OptionHeader end = { Pcap::OPT_ENDOFOPT, 0 };
+    append(idb, end);
+    write_block(f, Pcap::BLOCK_IDB, idb);
+
+    const int64_t ts = 1700000000987654321LL;
+    vector<uint8_t> frame = sender_probe(7);
+    vector<uint8_t> epb;
+    Pcap::EnhancedPacket ep = { 0, static_cast<uint32_t>(ts >> 32), static_cast<uint32_t>(ts),
+                                static_cast<uint32_t>(frame.size()), static_cast<uint32_t>(frame.size()) };
+    append(epb, ep);
+    epb.insert(epb.end(), frame.begin(), frame.end());
+    write_block(f, Pcap::BLOCK_EPB, epb);
+    fclose(f);
+
+    PcapReader reader(path);
+    CapturedPacket pkt;
+    UdpDatagram udp;
+    ASSERT_TRUE(reader.next(&pkt));
+    EXPECT_EQ(pkt.ts_ns, ts);
+    EXPECT_EQ(pkt.linktype, Pcap::LINKTYPE_ETHERNET);
+    ASSERT_TRUE(extract_udp(pkt, &udp));
+    EXPECT_EQ(udp.len, 64u);
+    EXPECT_FALSE(reader.next(&pkt));
+    remove(path.c_str());
+}
+
+// A capture of the sender side only: t1 and t4 are the capture times of probe and reply, t2 and t3 come from the
+// replies. Timestamp reports and other ports are not probes.
+TEST(PcapReaderTest, SenderSideCaptureTakesReflectorTimestampsFromReplies)
+{
+    const string path = "/tmp/test_pcap_reader_sender.pcap";
+    const int64_t T0 = 1700000000000000000LL;
+    const int64_t OFFSET = 5000000;   // reflector clock ahead
+    vector<vector<uint8_t> > frames;
+    vector<int64_t> ts;
+    for (uint32_t seq = 0; seq < 3; seq++)
+    {
+        int64_t t1 = T0 + seq * 1000000;
+        frames.push_back(sender_probe(seq));
+        ts.push_back(t1);
+        if (seq == 1)
+        {
+            continue;   // lost
+        }
+        frames.push_back(reflector_reply(seq, t1 + 20000 + OFFSET, t1 + 25000 + OFFSET));
+        ts.push_back(t1 + 45000);
+    }
+    TimestampReportEntry entry = { 0, 0, 1, 2 };
+    char report[64];
+    size_t report_len = serialize_timestamp_report(&entry, 1, report, sizeof(report));
+    frames.push_back(make_frame(report, report_len, 5000, 40000));
+    ts.push_back(T0 + 3000000);
+    char other[64];
+    prepare_packet(other, sizeof(other), 9);
+    frames.push_back(make_frame(other, sizeof(other), 40000, 6000));
+    ts.push_back(T0 + 4000000);
+    write_pcap(path, frames, ts);
+
+    vector<ProbeRecord> out;
+    ProbeMatcher matcher(16, [&](const ProbeRecord& rec) { out.push_back(rec); });
+    CaptureStream sender_side(path, true, 5000);
+    match_captures(sender_side, nullptr, &matcher);
+    matcher.flush();
+    remove(path.c_str());
+
+    ASSERT_EQ(out.size(), 3u);
+    for (const ProbeRecord& rec : out)
+    {
+        int64_t t1 = T0 + rec.seq * 1000000;
+        EXPECT_EQ(rec.t1, t1);
+        if (rec.seq == 1)
+        {
+            EXPECT_EQ(rec.flags, RESULT_HAS_T1);
+            continue;
+        }
+        ASSERT_EQ(rec.flags, RESULT_COMPLETE);
+        EXPECT_EQ(rec.t2, t1 + 20000 + OFFSET);
+        EXPECT_EQ(rec.t3, t1 + 25000 + OFFSET);
+        EXPECT_EQ(rec.t4, t1 + 45000);
+        // The reflector's residence time drops out of the RTT.
+        EXPECT_EQ((rec.t4 - rec.t1) - (rec.t3 - rec.t2), 40000);
+    }
+}
+
+TEST(ProbeMatcherTest, PairsAcrossStreamsWithBoundedWindow)
+{
+    vector<ProbeRecord> out;
+    ProbeMatcher matcher(4, [&](const ProbeRecord& rec) { out.push_back(rec); });
+
+    // Probe 0 complete, probe 1 lost on the way back, probe 2 complete.
+    for (uint32_t seq = 0; seq < 3; seq++)
+    {
+        int64_t base = seq * 1000000;
+        matcher.add(seq, PROBE_T1, base);
+        matcher.add(seq, PROBE_T2, base + 100);
+        if (seq != 1)
+        {
+            matcher.add(seq, PROBE_T3, base + 150);
+            matcher.add(seq, PROBE_T4, base + 250);
+        }
+    }
+    ASSERT_EQ(out.size(), 2u);
+    EXPECT_EQ(out[0].seq, 0u);
+    EXPECT_EQ(out[0].flags, RESULT_COMPLETE);
+    EXPECT_EQ(out[1].seq, 2u);
+
+    // seq 5 reuses the slot of seq 1, which gets emitted incomplete.
+    matcher.add(5, PROBE_T1, 5000000);
+    ASSERT_EQ(out.size(), 3u);
+    EXPECT_EQ(out[2].seq, 1u);
+    EXPECT_EQ(out[2].flags, RESULT_HAS_T1 | RESULT_HAS_T2);
+
+    matcher.add(5, PROBE_T1, 5000001);
+    EXPECT_EQ(matcher.duplicates(), 1u);
+    matcher.flush();
+    ASSERT_EQ(out.size(), 4u);
+    EXPECT_EQ(out[3].t1, 5000000);
+}
@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "perf_counters.h"
+
+using std::string;
+
+using namespace Netrounds;
+
+namespace
+{
+volatile uint64_t sink;
+
+void spin(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        sink = sink + i;
+    }
+}
+}
+
+// The software events are what is left without a PMU, so they have to work everywhere the hardware ones may not.
+TEST(PerfCountersTest, SoftwareFallbackCountsThisThread)
+{
+    PerfCounters counters(false);
+    EXPECT_EQ(PERF_SOFTWARE, counters.event_set());
+    EXPECT_STREQ("task-clock-ns", counters.name(0));
+
+    PerfReading before = counters.read();
+    spin(10000000);
+    PerfReading after = counters.read();
+    EXPECT_GT(after.value[0], before.value[0]);
+    for (int i = 0; i < PERF_NR_COUNTERS; i++)
+    {
+        EXPECT_GE(after.value[i], before.value[i]);
+    }
+}
+
+// One line per interval of packets, whichever event set was opened.
+TEST(PerfCountersTest, ProfileReportsEveryInterval)
+{
+    PerfCounters counters;
+    std::ostringstream os;
+    PerfProfile profile(counters, 1000, os);
+
+    for (uint64_t packets = 1; packets <= 3500; packets++)
+    {
+        spin(100);
+        profile.sample(packets);
+    }
+    string report = os.str();
+    EXPECT_EQ(3, std::count(report.begin(), report.end(), '\n'));
+    EXPECT_EQ(0u, report.find("1000 packets at "));
+    EXPECT_NE(string::npos, report.find(counters.name(PERF_NR_COUNTERS - 1)));
+}
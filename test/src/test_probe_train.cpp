@@ -0,0 +1,101 @@
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+
+#include "gtest/gtest.h"
+
+#include "metrics.h"
+#include "probe_train.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+
+using namespace Netrounds;
+
+TEST(ProbeTrainTest, SegmentLimits)
+{
+    EXPECT_EQ(64u, train_segments(100, 1000));
+    EXPECT_EQ(44u, train_segments(1472, 64));
+    EXPECT_EQ(10u, train_segments(1472, 10));
+    EXPECT_THROW(train_segments(2, 10), std::runtime_error);
+}
+
+// Two GSO sends of 20 probes over loopback come back split into the same 40 probes, with one TX timestamp per send.
+TEST(ProbeTrainTest, GsoTrainThroughGroSink)
+{
+    const size_t PROBE_LEN = 1000;
+    const size_t TRAIN = 20;
+    sockaddr_storage addr;
+    int rx = setup_socket(AF_INET, SOCK_DGRAM, SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE);
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5051, &addr);
+    do_bind(rx, &addr);
+    TrainSink sink(rx);
+
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_EQ(0, setsockopt(tx, SOL_SOCKET, SO_TIMESTAMPING, &TRAIN_TX_TIMESTAMPING, sizeof(TRAIN_TX_TIMESTAMPING)));
+    vector<char> buf(TRAIN * PROBE_LEN);
+    for (uint32_t first = 0; first < 2 * TRAIN; first += TRAIN)
+    {
+        build_train(buf.data(), PROBE_LEN, first, TRAIN);
+        ASSERT_TRUE(send_train(tx, &addr, buf.data(), PROBE_LEN, TRAIN));
+    }
+
+    for (int i = 0; i < 100 && sink.stats().probes < 2 * TRAIN; i++)
+    {
+        sink.poll();
+        usleep(1000);
+    }
+    EXPECT_EQ(2 * TRAIN, sink.stats().probes);
+    EXPECT_EQ(0u, sink.seq().lost);
+    EXPECT_EQ(0u, sink.seq().reordered);
+    EXPECT_EQ(2 * TRAIN - 1, sink.seq().prev);
+    EXPECT_LE(sink.stats().reads, 2 * TRAIN);
+    // RX timestamping is turned on asynchronously for the first socket that asks, so early reads may lack one.
+    EXPECT_LE(sink.stats().stamped_reads, sink.stats().reads);
+
+    uint32_t last_key = 0;
+    EXPECT_EQ(2u, drain_train_tx_timestamps(tx, &last_key));
+    EXPECT_EQ(1u, last_key);
+
+    close(rx);
+    close(tx);
+}
+
+// A read longer than the buffer is dropped and counted, and the next one comes through.
+TEST(ProbeTrainTest, OversizedReadsAreDropped)
+{
+    sockaddr_storage addr;
+    int rx = setup_socket(AF_INET, SOCK_DGRAM, 0);
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5026, &addr);
+    do_bind(rx, &addr);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+
+    uint64_t truncated = thread_counters().get(M_RX_TRUNCATED);
+    vector<char> big(2000);
+    vector<char> small(100);
+    ASSERT_TRUE(try_sendpacket(&addr, tx, big.data(), big.size()));
+    ASSERT_TRUE(try_sendpacket(&addr, tx, small.data(), small.size()));
+
+    char buf[1000];
+    size_t segment_len;
+    int64_t sw_ns;
+    ssize_t len = -1;
+    for (int i = 0; i < 100 && len < 0; i++)
+    {
+        len = receive_train(rx, buf, sizeof(buf), &segment_len, &sw_ns);
+        if (len < 0)
+        {
+            usleep(1000);
+        }
+    }
+    EXPECT_EQ(100, len);
+    EXPECT_EQ(100u, segment_len);
+    EXPECT_EQ(truncated + 1, thread_counters().get(M_RX_TRUNCATED));
+
+    close(rx);
+    close(tx);
+}
@@ -0,0 +1,110 @@
+#include <string>
+#include <thread>
+
+#include <cstring>
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "result_sink.h"
+
+using std::string;
+
+using namespace Netrounds;
+
+namespace
+{
+string read_all(int fd)
+{
+    string out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        out.append(buf, n);
+    }
+    return out;
+}
+
+WindowSummary make_summary()
+{
+    WindowSummary w;
+    memset(&w, 0, sizeof(w));
+    w.records = 2;
+    w.rtt.count = 2;
+    w.rtt.min = 100;
+    w.rtt.max = 300;
+    w.rtt.sum = 400;
+    w.rtt.abs_sum = 400;
+    return w;
+}
+}
+
+TEST(ResultSinkTest, CsvAndJsonLines)
+{
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    {
+        ResultSink sink(fds[1], make_record_format("csv"), OVERFLOW_BLOCK);
+        sink.push(ProbeRecord{ 7, 1000, 1100, 1200, 1400, 15 });
+        sink.push(make_summary());
+        sink.close();
+        EXPECT_EQ(2u, sink.written());
+        EXPECT_EQ(0u, sink.dropped());
+    }
+    string csv = read_all(fds[0]);
+    close(fds[0]);
+    EXPECT_EQ(0u, csv.find("type,seq,"));
+    EXPECT_NE(string::npos, csv.find("\nprobe,7,1000,1100,1200,1400,15,,,,,,,,\n"));
+    EXPECT_NE(string::npos, csv.find("\nwindow,,,,,,,2,2,100,200,300,,,\n"));
+
+    ASSERT_EQ(0, pipe(fds));
+    {
+        ResultSink sink(fds[1], make_record_format("jsonl"), OVERFLOW_BLOCK);
+        sink.push(ProbeRecord{ 7, 1000, 1100, 1200, 1400, 15 });
+        sink.push(make_summary());
+    }
+    string jsonl = read_all(fds[0]);
+    close(fds[0]);
+    EXPECT_EQ("{\"type\":\"probe\",\"seq\":7,\"t1\":1000,\"t2\":1100,\"t3\":1200,\"t4\":1400,\"flags\":15}\n"
+              "{\"type\":\"window\",\"records\":2,\"rtt\":{\"count\":2,\"min\":100,\"mean\":200,\"max\":300,"
+              "\"abs_mean\":200},\"ipdv\":{\"count\":0},\"forward\":{\"count\":0},\"reverse\":{\"count\":0}}\n",
+              jsonl);
+    EXPECT_THROW(make_record_format("xml"), std::runtime_error);
+}
+
+// Binary records have a fixed size, and a stalled writer makes the drop policy shed records instead of waiting.
+TEST(ResultSinkTest, BinaryAndDropWhenFull)
+{
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    const int NR_RECORDS = 100000;
+    uint64_t dropped;
+    {
+        ResultSink sink(fds[1], make_record_format("binary"), OVERFLOW_DROP, 16);
+        // Nobody reads the pipe yet, so the writer stalls once the pipe is full.
+        for (int i = 0; i < NR_RECORDS; i++)
+        {
+            sink.push(ProbeRecord{ static_cast<uint32_t>(i), i, i, i, i, 15 });
+        }
+        dropped = sink.dropped();
+        EXPECT_GT(dropped, 0u);
+        EXPECT_EQ(0u, sink.blocked());
+
+        string data;
+        std::thread reader([&data, &fds]() { data = read_all(fds[0]); });
+        sink.close();
+        reader.join();
+        EXPECT_EQ(NR_RECORDS - dropped, sink.written());
+
+        const size_t PROBE_BYTES = 1 + 4 + 4 * 8 + 1;
+        ASSERT_EQ(5 + sink.written() * PROBE_BYTES, data.size());
+        EXPECT_EQ(0, memcmp(data.data(), "NRRS\1", 5));
+        EXPECT_EQ(OutputRecord::PROBE, data[5]);
+        uint32_t seq;
+        memcpy(&seq, data.data() + 6, sizeof(seq));
+        EXPECT_EQ(0u, seq);
+    }
+    close(fds[0]);
+}
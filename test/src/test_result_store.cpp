@@ -0,0 +1,107 @@
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "result_store.h"
+
+using std::vector;
+
+using namespace Netrounds;
+
+class ResultStoreTest : public testing::Test
+{
+protected:
+    // Odd size so the SIMD kernels also exercise their scalar tails.
+    static const size_t NR_RECORDS = 1003;
+
+    ResultStoreTest() : store(NR_RECORDS)
+    {
+    }
+
+    virtual void SetUp()
+    {
+        std::mt19937_64 rng(42);
+        std::uniform_int_distribution<int64_t> jitter(-5000, 5000);
+        int64_t t1 = 1000000000000LL;
+        for (size_t i = 0; i < NR_RECORDS; i++)
+        {
+            int64_t t2 = t1 + 40000 + jitter(rng);
+            int64_t t3 = t2 + 3000;
+            int64_t t4 = t3 + 40000 + jitter(rng);
+            uint8_t flags = RESULT_COMPLETE;
+            if (i % 17 == 0)
+            {
+                flags &= ~RESULT_HAS_T4;
+            }
+            if (i % 29 == 0)
+            {
+                flags &= ~RESULT_HAS_T2;
+            }
+            store.append(i, t1, t2, t3, t4, flags);
+            t1 += 1000000;
+        }
+    }
+
+    ResultStore store;
+};
+
+TEST_F(ResultStoreTest, RttMatchesDefinition)
+{
+    vector<int64_t> rtt(store.size());
+    compute_rtt(store, rtt.data(), SIMD_SCALAR);
+
+    for (size_t i = 0; i < store.size(); i++)
+    {
+        if (store.flags()[i] == RESULT_COMPLETE)
+        {
+            EXPECT_EQ(rtt[i], (store.t4()[i] - store.t1()[i]) - (store.t3()[i] - store.t2()[i]));
+        }
+        else
+        {
+            EXPECT_EQ(rtt[i], NO_DELAY);
+        }
+    }
+}
+
+TEST_F(ResultStoreTest, SimdMatchesScalar)
+{
+    if (simd_level() == SIMD_SCALAR)
+    {
+        return;
+    }
+    size_t n = store.size();
+    vector<int64_t> a(n), b(n), fwd_a(n), fwd_b(n), rev_a(n), rev_b(n), ipdv_a(n - 1), ipdv_b(n - 1);
+
+    compute_rtt(store, a.data(), SIMD_SCALAR);
+    compute_rtt(store, b.data(), SIMD_AVX2);
+    EXPECT_EQ(a, b);
+
+    compute_one_way(store, fwd_a.data(), rev_a.data(), SIMD_SCALAR);
+    compute_one_way(store, fwd_b.data(), rev_b.data(), SIMD_AVX2);
+    EXPECT_EQ(fwd_a, fwd_b);
+    EXPECT_EQ(rev_a, rev_b);
+
+    compute_ipdv(a.data(), n, ipdv_a.data(), SIMD_SCALAR);
+    compute_ipdv(a.data(), n, ipdv_b.data(), SIMD_AVX2);
+    EXPECT_EQ(ipdv_a, ipdv_b);
+
+    DelayStats sa = compute_stats(ipdv_a.data(), n - 1, SIMD_SCALAR);
+    DelayStats sb = compute_stats(ipdv_a.data(), n - 1, SIMD_AVX2);
+    EXPECT_EQ(sa.count, sb.count);
+    EXPECT_EQ(sa.min, sb.min);
+    EXPECT_EQ(sa.max, sb.max);
+    EXPECT_EQ(sa.sum, sb.sum);
+    EXPECT_EQ(sa.abs_sum, sb.abs_sum);
+}
+
+TEST_F(ResultStoreTest, StatsSkipMissing)
+{
+    int64_t delays[] = { 5, NO_DELAY, -3, 10, NO_DELAY, 2 };
+    DelayStats stats = compute_stats(delays, sizeof(delays) / sizeof(delays[0]));
+    EXPECT_EQ(stats.count, 4u);
+    EXPECT_EQ(stats.min, -3);
+    EXPECT_EQ(stats.max, 10);
+    EXPECT_EQ(stats.sum, 14);
+    EXPECT_EQ(stats.abs_sum, 20);
+}
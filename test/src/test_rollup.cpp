@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <vector>
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+#include "rollup.h"
+
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+const int64_t SECOND = 1000000000LL;
+const int64_t START = 1700000040 * SECOND; // on a minute boundary
+
+vector<RollupLevel> small_levels()
+{
+    vector<RollupLevel> levels;
+    levels.push_back({ SECOND, 10 });
+    levels.push_back({ 10 * SECOND, 4 });
+    levels.push_back({ 60 * SECOND, 2 });
+    return levels;
+}
+}
+
+// Ten probes a second for 2 minutes, one in 50 lost; every level must agree with a direct count over the raw probes.
+TEST(RollupTest, CascadeMatchesRawData)
+{
+    Rollup rollup(small_levels());
+    uint64_t sent = 0;
+    uint64_t lost = 0;
+    int64_t min = INT64_MAX;
+    int64_t max = 0;
+    for (int i = 0; i < 1200; i++)
+    {
+        int64_t delay = 10000 + (i % 7) * 1000;
+        if (i % 50 == 49)
+        {
+            delay = -1;
+            lost++;
+        }
+        else
+        {
+            min = std::min(min, delay);
+            max = std::max(max, delay);
+        }
+        rollup.add(START + i * (SECOND / 10), delay);
+        sent++;
+    }
+    rollup.advance(START + 120 * SECOND);
+
+    // Rings keep only the newest intervals, the coarsest one still covers everything.
+    ASSERT_EQ(10u, rollup.size(0));
+    ASSERT_EQ(4u, rollup.size(1));
+    ASSERT_EQ(2u, rollup.size(2));
+    RollupBucket all = rollup.query(2, 0, INT64_MAX);
+    EXPECT_EQ(sent, all.sent);
+    EXPECT_EQ(lost, all.lost);
+    EXPECT_EQ(min, all.min);
+    EXPECT_EQ(max, all.max);
+    EXPECT_EQ(START, all.start_ns);
+    EXPECT_EQ(16384u, all.quantile_upper_ns(0.99));
+
+    RollupBucket second = rollup.closed(0, 0);
+    EXPECT_EQ(START + 119 * SECOND, second.start_ns);
+    EXPECT_EQ(10u, second.sent);
+
+    // The last 40 s from the 10 s level equal the 40 s of seconds, but the 1 s ring only holds the last 10.
+    RollupBucket tens = rollup.query(1, START + 80 * SECOND, START + 120 * SECOND);
+    EXPECT_EQ(400u, tens.sent);
+    EXPECT_EQ(8u, tens.lost);
+    RollupBucket seconds = rollup.query(0, START + 110 * SECOND, START + 120 * SECOND);
+    EXPECT_EQ(100u, seconds.sent);
+    EXPECT_EQ(2u, seconds.lost);
+    EXPECT_EQ(START + 110 * SECOND, seconds.start_ns);
+}
+
+// Jitter is the mean |IPDV| between answered probes, with losses skipped rather than breaking the chain.
+TEST(RollupTest, JitterSkipsLoss)
+{
+    Rollup rollup(small_levels());
+    rollup.add(START, 10000);
+    rollup.add(START + 1, -1);
+    rollup.add(START + 2, 14000);
+    rollup.add(START + 3, 12000);
+
+    RollupBucket b = rollup.query(0, START, START + SECOND);
+    EXPECT_EQ(4u, b.sent);
+    EXPECT_EQ(1u, b.lost);
+    EXPECT_EQ(2u, b.ipdv_count);
+    EXPECT_EQ(6000u, b.ipdv_abs_sum);
+    EXPECT_EQ(36000, b.sum);
+}
+
+// Empty intervals take no slot and memory is what the levels ask for, however long the session runs.
+TEST(RollupTest, FixedMemory)
+{
+    Rollup rollup(small_levels());
+    size_t bytes = rollup.memory_bytes();
+    EXPECT_EQ((11u + 5u + 3u) * sizeof(RollupBucket), bytes);
+
+    for (int64_t t = 0; t < 24 * 3600; t += 37)
+    {
+        rollup.add(START + t * SECOND, 20000);
+    }
+    EXPECT_EQ(bytes, rollup.memory_bytes());
+    EXPECT_EQ(10u, rollup.size(0));
+    EXPECT_EQ(START + (24 * 3600 / 37 - 1) * 37 * SECOND, rollup.closed(0, 0).start_ns);
+
+    EXPECT_THROW(Rollup(vector<RollupLevel>{ { SECOND, 1 }, { SECOND + 1, 1 } }), std::runtime_error);
+}
@@ -0,0 +1,90 @@
+#include <string>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "gtest/gtest.h"
+
+#include "rx_path.h"
+#include "util.h"
+
+using std::string;
+
+using namespace Netrounds;
+
+// A software timestamping socket read through the transport picked at runtime: the kernel RX timestamp and the
+// peer come back, and the reply goes to that peer.
+TEST(RxPathTest, SoftwareTimestampsThroughDispatch)
+{
+    sockaddr_storage addr;
+    int rx = setup_socket(AF_INET, SOCK_DGRAM, rx_path_so_flags(TS_SOFTWARE));
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5021, &addr);
+    do_bind(rx, &addr);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+
+    std::unique_ptr<Transport> transport = make_rx_path_transport(rx, TS_SOFTWARE, AF_INET);
+    char buf[64] = "probe";
+    RxInfo info;
+    EXPECT_FALSE(transport->receive(buf, sizeof(buf), &info));
+
+    // The kernel turns RX timestamping on asynchronously when the first socket asks for it, so the very first
+    // datagrams may come unstamped.
+    int64_t before;
+    for (int i = 0; i < 100; i++)
+    {
+        before = TscClock::instance().realtime_ns();
+        sendto(tx, buf, 16, 0, reinterpret_cast<sockaddr *>(&addr), sizeof(sockaddr_in));
+        ASSERT_TRUE(transport->receive(buf, sizeof(buf), &info));
+        if (info.sw_ns)
+        {
+            break;
+        }
+        usleep(1000);
+    }
+    EXPECT_EQ(16u, info.len);
+    EXPECT_EQ(0, info.hw_ns);
+    EXPECT_GT(info.sw_ns, before - 1000000);
+    EXPECT_LT(info.sw_ns, before + 1000000000);
+    EXPECT_EQ(AF_INET, info.peer.ss_family);
+
+    transport->send(info.peer, "reply", 6, Transport::NO_TX_STAMP);
+    char reply[16];
+    EXPECT_EQ(6, recv(tx, reply, sizeof(reply), 0));
+
+    close(rx);
+    close(tx);
+}
+
+// A datagram too long for the buffer is counted and skipped, not an error; the next one comes through.
+TEST(RxPathTest, TruncatedDatagramsAreDropped)
+{
+    sockaddr_storage addr;
+    int rx = setup_socket(AF_INET, SOCK_DGRAM, rx_path_so_flags(TS_NONE));
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5022, &addr);
+    do_bind(rx, &addr);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+
+    std::unique_ptr<Transport> transport = make_rx_path_transport(rx, TS_NONE, AF_INET);
+    char big[200] = {};
+    sendto(tx, big, sizeof(big), 0, reinterpret_cast<sockaddr *>(&addr), sizeof(sockaddr_in));
+    sendto(tx, big, 16, 0, reinterpret_cast<sockaddr *>(&addr), sizeof(sockaddr_in));
+    uint64_t truncated = thread_counters().get(M_RX_TRUNCATED);
+    char buf[64];
+    RxInfo info;
+    ASSERT_TRUE(transport->receive(buf, sizeof(buf), &info));
+    EXPECT_EQ(16u, info.len);
+    EXPECT_EQ(truncated + 1, thread_counters().get(M_RX_TRUNCATED));
+    EXPECT_FALSE(transport->receive(buf, sizeof(buf), &info));
+
+    close(rx);
+    close(tx);
+}
+
+TEST(RxPathTest, ControlBufferFitsMode)
+{
+    EXPECT_LT((RxPath<TS_NONE, AF_INET6>::CONTROL_LEN), (RxPath<TS_NONE, AF_INET>::CONTROL_LEN));
+    EXPECT_LT((RxPath<TS_NONE, AF_INET>::CONTROL_LEN), (RxPath<TS_BOTH, AF_INET>::CONTROL_LEN));
+    EXPECT_EQ(0, rx_path_so_flags(TS_NONE));
+    EXPECT_EQ((RxPath<TS_HARDWARE, AF_INET6>::SO_FLAGS), rx_path_so_flags(TS_HARDWARE));
+    EXPECT_THROW(parse_timestamp_mode("ptp"), std::runtime_error);
+}
@@ -0,0 +1,33 @@
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+#include "snmp.h"
+
+using namespace Netrounds;
+
+TEST(SnmpTest, ParsesUdpAndUdp6)
+{
+    std::istringstream snmp(
+        "Ip: Forwarding DefaultTTL\n"
+        "Ip: 1 64\n"
+        "Udp: InDatagrams NoPorts InErrors OutDatagrams RcvbufErrors SndbufErrors InCsumErrors IgnoredMulti\n"
+        "Udp: 1000 2 7 900 5 3 0 0\n"
+        "UdpLite: InDatagrams NoPorts InErrors OutDatagrams RcvbufErrors SndbufErrors InCsumErrors IgnoredMulti\n"
+        "UdpLite: 0 0 0 0 100 100 0 0\n");
+    std::istringstream snmp6(
+        "Udp6InDatagrams                 	40\n"
+        "Udp6RcvbufErrors                	11\n"
+        "Udp6SndbufErrors                	1\n");
+
+    UdpSnmp stats = { 0, 0 };
+    EXPECT_TRUE(parse_snmp(snmp, &stats));
+    EXPECT_EQ(stats.rcvbuf_errors, 5u);
+    EXPECT_EQ(stats.sndbuf_errors, 3u);
+    EXPECT_TRUE(parse_snmp6(snmp6, &stats));
+    EXPECT_EQ(stats.rcvbuf_errors, 16u);
+    EXPECT_EQ(stats.sndbuf_errors, 4u);
+
+    std::istringstream none("Ip: Forwarding\nIp: 1\n");
+    EXPECT_FALSE(parse_snmp(none, &stats));
+}
@@ -0,0 +1,64 @@
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "metrics.h"
+#include "stage_timer.h"
+
+using std::string;
+
+using namespace Netrounds;
+
+// Each checkpoint goes to its stage's histogram with the time since the previous one, and the stages are exported
+// under their names. The timer registers its histograms for good, so like STAGE_TIMER's it is static.
+TEST(StageTimerTest, CheckpointsAccumulatePerStage)
+{
+    static StageTimer timer;
+    for (int i = 0; i < 3; i++)
+    {
+        timer.start();
+        timer.checkpoint(STAGE_RECVMSG);
+        usleep(2000);
+        timer.checkpoint(STAGE_DECODE);
+    }
+    EXPECT_EQ(3u, timer.histogram(STAGE_RECVMSG).count());
+    EXPECT_EQ(3u, timer.histogram(STAGE_DECODE).count());
+    EXPECT_GE(timer.histogram(STAGE_DECODE).sum(), 3 * 2000000u);
+    EXPECT_EQ(0u, timer.histogram(STAGE_SENDTO).count());
+
+    std::ostringstream report;
+    timer.report(report);
+    EXPECT_NE(string::npos, report.str().find("stage decode: n 3 mean_ns "));
+    EXPECT_NE(string::npos, report.str().find("stage sendto: n 0 mean_ns 0"));
+    EXPECT_NE(string::npos, format_metrics().find("stage=\"tx_timestamp\""));
+}
+
+#ifdef STAGE_TIMING
+// Built with -DSTAGE_TIMING, the macros are the timer's calls.
+TEST(StageTimerTest, MacrosTimeStages)
+{
+    STAGE_TIMER(timer);
+    uint64_t before = timer.histogram(STAGE_SERIALIZE).count();
+    STAGE_START(timer);
+    STAGE_CHECKPOINT(timer, STAGE_SERIALIZE);
+    EXPECT_EQ(before + 1, timer.histogram(STAGE_SERIALIZE).count());
+    std::ostringstream report;
+    STAGE_REPORT(timer, report);
+    EXPECT_NE(string::npos, report.str().find("stage serialize: n "));
+}
+#else
+// Without STAGE_TIMING the macros are gone: no timer is declared, so uses of it compile, and their arguments are
+// never evaluated.
+TEST(StageTimerTest, MacrosCompileOut)
+{
+    int evaluated = 0;
+    STAGE_TIMER(no_such_timer);
+    STAGE_START(no_such_timer);
+    STAGE_CHECKPOINT(no_such_timer, (evaluated++, STAGE_SERIALIZE));
+    STAGE_REPORT(no_such_timer, (evaluated++, std::cout));
+    EXPECT_EQ(0, evaluated);
+}
+#endif
@@ -0,0 +1,203 @@
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <cstring>
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "metrics.h"
+#include "stats_page.h"
+
+using std::string;
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+string page_name(const char *test)
+{
+    return "netrounds-test-" + string(test) + "-" + std::to_string(getpid());
+}
+
+MetricsSnapshot snapshot(const string& session, uint64_t value)
+{
+    MetricsSnapshot snap;
+    snap.session = session;
+    for (int c = 0; c < NR_METRIC_COUNTERS; c++)
+    {
+        snap.counters[c] = value;
+    }
+    for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+    {
+        snap.buckets[i] = value;
+    }
+    snap.latency_sum_ns = value;
+    return snap;
+}
+}
+
+// Records are handed out in the order sessions first show up and keep their place; sessions beyond the last record
+// are only counted. The page goes away with the writer.
+TEST(StatsPageTest, PublishAndRead)
+{
+    string name = page_name("publish");
+    {
+        StatsPageWriter writer(name, 0, 3);
+        StatsPageReader reader(name);
+        EXPECT_EQ(STATS_PAGE_VERSION, reader.page().version);
+        EXPECT_EQ(static_cast<uint32_t>(getpid()), static_cast<uint32_t>(reader.page().pid));
+        EXPECT_EQ(0u, reader.size());
+
+        writer.publish({ snapshot("", 5), snapshot("10.0.0.2:5000", 7) }, 1000);
+        ASSERT_EQ(2u, reader.size());
+        StatsSnapshot snap;
+        ASSERT_TRUE(reader.read(1, &snap));
+        EXPECT_EQ("10.0.0.2:5000", snap.name);
+        EXPECT_EQ(1000, snap.published_ns);
+        EXPECT_EQ(7u, snap.counters[M_PKTS_SENT]);
+        EXPECT_EQ(7u, snap.buckets[Log2Histogram::NR_BUCKETS - 1]);
+        EXPECT_FALSE(reader.read(2, &snap));
+
+        writer.publish({ snapshot("", 6), snapshot("10.0.0.1:5000", 8), snapshot("10.0.0.2:5000", 9),
+                         snapshot("10.0.0.3:5000", 1) }, 2000);
+        EXPECT_EQ(3u, reader.size());
+        EXPECT_EQ(1u, reader.page().dropped.load());
+        EXPECT_EQ(2000, reader.page().updated_ns.load());
+        ASSERT_TRUE(reader.read(0, &snap));
+        EXPECT_EQ("", snap.name);
+        EXPECT_EQ(6u, snap.counters[M_AUTH_FAILED]);
+        ASSERT_TRUE(reader.read(1, &snap));
+        EXPECT_EQ(9u, snap.latency_sum_ns);
+        ASSERT_TRUE(reader.read(2, &snap));
+        EXPECT_EQ("10.0.0.1:5000", snap.name);
+        EXPECT_EQ(8u, snap.counters[M_PKTS_RECEIVED]);
+    }
+    EXPECT_THROW(StatsPageReader reader(name), std::system_error);
+}
+
+// A reader polling while the writer publishes as fast as it can never sees a record half updated: every field of a
+// copy is from the same publication.
+TEST(StatsPageTest, SnapshotsAreConsistent)
+{
+    string name = page_name("consistent");
+    StatsPageWriter writer(name, 0, 2);
+    std::atomic<bool> done(false);
+    std::thread publisher([&]()
+                          {
+                              vector<MetricsSnapshot> snaps = { snapshot("", 0), snapshot("s", 0) };
+                              for (uint64_t v = 1; v <= 200000; v++)
+                              {
+                                  snaps[0] = snapshot("", v);
+                                  snaps[1] = snapshot("s", v);
+                                  writer.publish(snaps, v);
+                              }
+                              done = true;
+                          });
+
+    StatsPageReader reader(name);
+    StatsSnapshot snap;
+    uint64_t reads = 0;
+    uint64_t last = 0;
+    while (!done || !reads)
+    {
+        if (!reader.read(reader.size() - 1, &snap))
+        {
+            continue;
+        }
+        reads++;
+        uint64_t v = snap.counters[0];
+        ASSERT_GE(v, last);
+        last = v;
+        ASSERT_EQ(static_cast<int64_t>(v), snap.published_ns);
+        for (int c = 0; c < NR_METRIC_COUNTERS; c++)
+        {
+            ASSERT_EQ(v, snap.counters[c]);
+        }
+        for (int i = 0; i < Log2Histogram::NR_BUCKETS; i++)
+        {
+            ASSERT_EQ(v, snap.buckets[i]);
+        }
+        ASSERT_EQ(v, snap.latency_sum_ns);
+    }
+    publisher.join();
+    EXPECT_GT(reads, 0u);
+}
+
+// Released sessions give their records back: many more sessions than records come and go, a few at a time, and
+// none of them goes without a record. A freed record reads back cleared until a new session takes it.
+TEST(StatsPageTest, ReleasedRecordsAreReused)
+{
+    string name = page_name("reuse");
+    StatsPageWriter writer(name, 0);
+    StatsPageReader reader(name);
+    const size_t LIVE = 4;
+    const size_t SESSIONS = 3 * StatsPageWriter::DEFAULT_RECORDS;
+    StatsSnapshot snap;
+    for (size_t first = 0; first + LIVE <= SESSIONS; first++)
+    {
+        vector<MetricsSnapshot> snaps = { snapshot("", first + 1) };
+        for (size_t s = first; s < first + LIVE; s++)
+        {
+            snaps.push_back(snapshot("session-" + std::to_string(s), s + 1));
+        }
+        writer.publish(snaps, first + 1);
+        ASSERT_EQ(0u, reader.page().dropped.load());
+        ASSERT_LE(reader.size(), 1 + LIVE + 1);
+        size_t live = 0;
+        for (size_t i = 1; i < reader.size(); i++)
+        {
+            ASSERT_TRUE(reader.read(i, &snap));
+            if (!snap.published_ns)
+            {
+                EXPECT_EQ("", snap.name);
+                EXPECT_EQ(0u, snap.counters[M_PKTS_SENT]);
+                EXPECT_EQ(0u, snap.latency_sum_ns);
+                continue;
+            }
+            live++;
+            EXPECT_EQ(static_cast<int64_t>(first + 1), snap.published_ns);
+            ASSERT_EQ(0u, snap.name.find("session-"));
+            size_t s = std::stoul(snap.name.substr(8));
+            EXPECT_GE(s, first);
+            EXPECT_LT(s, first + LIVE);
+            EXPECT_EQ(s + 1, snap.counters[M_PKTS_SENT]);
+        }
+        EXPECT_EQ(LIVE, live);
+    }
+
+    // The process totals stay where they are, and a session that is released leaves a cleared record behind.
+    writer.publish({ snapshot("", 1) }, SESSIONS + 1);
+    ASSERT_TRUE(reader.read(0, &snap));
+    EXPECT_EQ("", snap.name);
+    EXPECT_EQ(static_cast<int64_t>(SESSIONS + 1), snap.published_ns);
+    for (size_t i = 1; i < reader.size(); i++)
+    {
+        ASSERT_TRUE(reader.read(i, &snap));
+        EXPECT_EQ("", snap.name);
+        EXPECT_EQ(0, snap.published_ns);
+    }
+}
+
+// A page that is not one, or of another layout version, is refused.
+TEST(StatsPageTest, RejectsUnknownLayouts)
+{
+    EXPECT_THROW(StatsPageReader reader(page_name("missing")), std::system_error);
+
+    string name = page_name("version");
+    StatsPageWriter writer(name, 0);
+    string path = "/dev/shm/" + name;
+    FILE *f = fopen(path.c_str(), "r+");
+    ASSERT_NE(nullptr, f);
+    uint32_t version = STATS_PAGE_VERSION + 1;
+    fseek(f, offsetof(StatsPageHeader, version), SEEK_SET);
+    fwrite(&version, sizeof(version), 1, f);
+    fclose(f);
+    EXPECT_THROW(StatsPageReader reader(name), std::runtime_error);
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <cstring>
+
+#include <arpa/inet.h>
+
+#include "gtest/gtest.h"
+
+#include "engine.h"
+#include "packet.h"
+#include "probe_matcher.h"
+#include "result_store.h"
+#include "timestamp_report.h"
+#include "transport.h"
+
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+TimestampReportEntry entry(uint32_t seq)
+{
+    TimestampReportEntry e = { seq, 1000 + seq, 5000000000ULL + seq * 1000, 5000000000ULL + seq * 1000 + 300 };
+    return e;
+}
+}
+
+// A batch is due when full or when its oldest entry has waited long enough, and its report decodes to the entries.
+TEST(TimestampReportTest, BatchBoundsAndWireFormat)
+{
+    TimestampBatch batch(4, 1000000);
+    EXPECT_TRUE(batch.empty());
+    EXPECT_EQ(INT64_MAX, batch.deadline_ns());
+    EXPECT_FALSE(batch.add(entry(0), 7000000));
+    EXPECT_EQ(8000000, batch.deadline_ns());
+    EXPECT_FALSE(batch.add(entry(1), 7500000));
+    EXPECT_FALSE(batch.add(entry(2), 7600000));
+    EXPECT_EQ(8000000, batch.deadline_ns());
+    EXPECT_TRUE(batch.add(entry(3), 7700000));
+
+    char buf[sizeof(TimestampReportHeader) + MAX_REPORT_ENTRIES * sizeof(TimestampReportEntry)];
+    size_t len = batch.take(buf, sizeof(buf));
+    EXPECT_EQ(sizeof(TimestampReportHeader) + 4 * sizeof(TimestampReportEntry), len);
+    EXPECT_TRUE(batch.empty());
+    EXPECT_EQ(1u, batch.reports());
+
+    PacketType type;
+    ASSERT_TRUE(peek_packet_type(buf, len, &type));
+    EXPECT_EQ(FROM_REFLECTOR_ONLY_TIMESTAMPS, type);
+    TimestampReportEntry entries[MAX_REPORT_ENTRIES];
+    size_t n;
+    ASSERT_TRUE(decode_timestamp_report(buf, len, entries, &n));
+    ASSERT_EQ(4u, n);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        EXPECT_EQ(i, entries[i].sender_seq);
+        EXPECT_EQ(1000 + i, entries[i].refl_seq);
+        EXPECT_EQ(entry(i).t2, entries[i].t2);
+        EXPECT_EQ(entry(i).t3, entries[i].t3);
+    }
+    // Cut short, or not a report at all.
+    EXPECT_FALSE(decode_timestamp_report(buf, len - 1, entries, &n));
+    char probe[64] = {};
+    prepare_packet(probe, sizeof(probe), 1);
+    EXPECT_FALSE(decode_timestamp_report(probe, sizeof(probe), entries, &n));
+
+    EXPECT_LE(sizeof(buf) + 48, 1280u);
+    EXPECT_THROW(TimestampBatch(0), std::runtime_error);
+    EXPECT_THROW(TimestampBatch(MAX_REPORT_ENTRIES + 1), std::runtime_error);
+}
+
+// Replies without t3 and a report with it, over the simulated link: the sender's records come out complete.
+TEST(TimestampReportTest, SenderEngineMergesReports)
+{
+    SimLinkConfig link;
+    link.delay_ns = 40000;
+    SimNetwork net(link, link, 1);
+    vector<ProbeRecord> records;
+    const uint64_t COUNT = 20;
+    SenderEngine sender(net.a(), net.b().address(), COUNT, 10000, 64, 1024,
+                        [&](const ProbeRecord& rec) { records.push_back(rec); });
+
+    // By hand rather than with ReflectorEngine, which would put t3 in the reply itself. Reports of 5 probes fit
+    // within what SimNetwork carries.
+    TimestampBatch batch(5, 1000000000);
+    char buf[ReflectorEngine::BUF_LEN];
+    uint32_t refl_seq = 0;
+    while (!sender.done() || net.next_delivery_ns() != INT64_MAX)
+    {
+        bool busy = sender.poll();
+        RxInfo info;
+        if (net.b().receive(buf, sizeof(buf), &info))
+        {
+            busy = true;
+            ReflectorPacket reply;
+            memset(&reply, 0, sizeof(reply));
+            reply.type = FROM_REFLECTOR;
+            memcpy(&reply.sender_seq, buf + offsetof(SenderPacket, sender_seq), sizeof(reply.sender_seq));
+            reply.sender_seq = ntohl(reply.sender_seq);
+            reply.refl_seq = refl_seq++;
+            reply.t2 = info.hw_ns;
+            size_t len = serialize_reflector_packet(reply, buf, sizeof(buf));
+            int64_t t3 = net.b().send(info.peer, buf, len, Transport::NO_TX_STAMP);
+            TimestampReportEntry e = { reply.sender_seq, reply.refl_seq, reply.t2, static_cast<timestamp_t>(t3) };
+            if (batch.add(e, net.now_ns()))
+            {
+                len = batch.take(buf, sizeof(buf));
+                net.b().send(info.peer, buf, len, Transport::NO_TX_STAMP);
+            }
+        }
+        if (!busy)
+        {
+            net.advance_to(std::min(sender.next_send_ns(), net.next_delivery_ns()));
+        }
+    }
+    sender.flush();
+
+    EXPECT_EQ(COUNT / 5, sender.reports());
+    EXPECT_EQ(COUNT, sender.replies());
+    ASSERT_EQ(COUNT, records.size());
+    for (const ProbeRecord& rec : records)
+    {
+        ASSERT_EQ(RESULT_COMPLETE, rec.flags);
+        EXPECT_EQ(40000, rec.t2 - rec.t1);
+        EXPECT_EQ(40000, rec.t4 - rec.t3);
+    }
+}
+
+// Entries without t3 are left out, and a report is only ever about t3.
+TEST(TimestampReportTest, MergeTakesT3Only)
+{
+    vector<ProbeRecord> records;
+    ProbeMatcher matcher(64, [&](const ProbeRecord& rec) { records.push_back(rec); });
+    for (uint32_t seq = 0; seq < 3; seq++)
+    {
+        matcher.add(seq, PROBE_T1, 100 + seq);
+        matcher.add(seq, PROBE_T2, 200 + seq);
+        matcher.add(seq, PROBE_T4, 400 + seq);
+    }
+    TimestampReportEntry entries[3] = { entry(0), entry(1), entry(2) };
+    entries[1].t3 = 0;
+    char buf[256];
+    size_t len = serialize_timestamp_report(entries, 3, buf, sizeof(buf));
+    EXPECT_EQ(2u, merge_timestamp_report(buf, len, &matcher));
+    ASSERT_EQ(2u, records.size());
+    EXPECT_EQ(0u, records[0].seq);
+    EXPECT_EQ(200, records[0].t2);
+    EXPECT_EQ(static_cast<int64_t>(entry(0).t3), records[0].t3);
+    EXPECT_EQ(2u, records[1].seq);
+    EXPECT_EQ(0u, merge_timestamp_report(buf, len - 1, &matcher));
+    EXPECT_EQ(0u, matcher.duplicates());
+}
+
+// Records go straight through until a report shows up; after that those without t3 wait for theirs, and entries of
+// probes already handed on are ignored.
+TEST(TimestampReportTest, ReportMergerWaitsOnceReportsCome)
+{
+    vector<ProbeRecord> records;
+    ReportMerger merger(64, [&](const ProbeRecord& rec) { records.push_back(rec); });
+    auto add = [&](uint32_t seq)
+    {
+        ProbeRecord rec = { seq, 100 + seq, 200 + seq, 0, 400 + seq,
+                            RESULT_HAS_T1 | RESULT_HAS_T2 | RESULT_HAS_T4 };
+        merger.add(rec);
+    };
+    add(0);
+    add(1);
+    ASSERT_EQ(2u, records.size());
+    EXPECT_EQ(0, records[1].t3);
+
+    TimestampReportEntry entries[3] = { entry(0), entry(1), entry(2) };
+    char buf[256];
+    size_t len = serialize_timestamp_report(entries, 2, buf, sizeof(buf));
+    EXPECT_TRUE(merger.merge(buf, len));
+    EXPECT_EQ(1u, merger.reports());
+    EXPECT_EQ(2u, records.size());
+
+    add(2);
+    add(3);
+    EXPECT_EQ(2u, records.size());
+    len = serialize_timestamp_report(entries + 2, 1, buf, sizeof(buf));
+    EXPECT_TRUE(merger.merge(buf, len));
+    ASSERT_EQ(3u, records.size());
+    EXPECT_EQ(2u, records[2].seq);
+    EXPECT_EQ(RESULT_COMPLETE, records[2].flags);
+    EXPECT_EQ(static_cast<int64_t>(entry(2).t3), records[2].t3);
+
+    // Not a report: left to the caller as a reply.
+    char probe[64] = {};
+    prepare_packet(probe, sizeof(probe), 4);
+    EXPECT_FALSE(merger.merge(probe, sizeof(probe)));
+    merger.flush();
+    ASSERT_EQ(4u, records.size());
+    EXPECT_EQ(3u, records[3].seq);
+    EXPECT_EQ(0, records[3].t3);
+}
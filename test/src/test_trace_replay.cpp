@@ -0,0 +1,92 @@
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "gtest/gtest.h"
+
+#include "event_loop.h"
+#include "probe_session.h"
+#include "trace_replay.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+
+using namespace Netrounds;
+
+namespace
+{
+const int64_t MS = 1000000;
+}
+
+// Offsets that go backwards come back clamped to the one before.
+TEST(TraceReplayTest, BinaryTraceRoundTrip)
+{
+    const string path = "/tmp/test_trace_replay.trace";
+    save_trace(path, { { 0, 64 }, { 5 * MS, 1500 }, { 3 * MS, 200 }, { 9 * MS, 9000 } });
+
+    vector<TraceEntry> trace = load_trace(path);
+    ASSERT_EQ(4u, trace.size());
+    EXPECT_EQ(0, trace[0].offset_ns);
+    EXPECT_EQ(5 * MS, trace[1].offset_ns);
+    EXPECT_EQ(5 * MS, trace[2].offset_ns);
+    EXPECT_EQ(200u, trace[2].len);
+    EXPECT_EQ(9 * MS, trace[3].offset_ns);
+    EXPECT_EQ(9000u, trace[3].len);
+    unlink(path.c_str());
+}
+
+// Bursts go out back to back without waiting for replies, the gaps between them are kept at the given scale, and
+// every probe's record comes out in order.
+TEST(TraceReplayTest, ReplaysBurstsOnSchedule)
+{
+    const int BURSTS = 3;
+    const int BURST_LEN = 10;
+    vector<TraceEntry> trace;
+    for (int b = 0; b < BURSTS; b++)
+    {
+        for (int i = 0; i < BURST_LEN; i++)
+        {
+            trace.push_back(TraceEntry{ b * 20 * MS, static_cast<uint32_t>(100 + 100 * i) });
+        }
+    }
+    trace[0].len = 10;
+
+    EventLoop loop;
+    sockaddr_storage addr;
+    int reflector = socket(AF_INET, SOCK_DGRAM, 0);
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5081, &addr);
+    do_bind(reflector, &addr);
+    loop.spawn(reflect_session(loop, reflector, trace.size()));
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    ReplayConfig config;
+    config.reflector = addr;
+    config.time_scale = 0.5;
+    config.max_len = 1500;
+    config.reply_timeout_ns = 1000 * MS;
+    config.window = 16;
+    config.tx_timestamps = false;
+    ReplayStats stats;
+    vector<uint32_t> seqs;
+    loop.spawn(replay_session(loop, sock, config, trace, [&seqs](const ProbeRecord& rec) { seqs.push_back(rec.seq); },
+                              &stats));
+    loop.run();
+
+    EXPECT_EQ(trace.size(), stats.sent);
+    EXPECT_EQ(trace.size(), stats.replies);
+    EXPECT_EQ(0u, stats.timeouts);
+    EXPECT_EQ(1u, stats.resized);
+    EXPECT_EQ(trace.size(), stats.late.count());
+    EXPECT_GE(stats.duration_ns, 20 * MS);
+    EXPECT_LT(stats.duration_ns, 200 * MS);
+    ASSERT_EQ(trace.size(), seqs.size());
+    for (size_t i = 0; i < seqs.size(); i++)
+    {
+        EXPECT_EQ(i, seqs[i]);
+    }
+    close(sock);
+    close(reflector);
+}
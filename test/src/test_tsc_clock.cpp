@@ -0,0 +1,64 @@
+#include <ctime>
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "tsc_clock.h"
+
+using Netrounds::TscClock;
+
+namespace
+{
+uint64_t clock_ns(clockid_t clk)
+{
+    timespec ts;
+    clock_gettime(clk, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+int64_t abs_diff(uint64_t a, uint64_t b)
+{
+    return a > b ? a - b : b - a;
+}
+}
+
+TEST(TscClockTest, TracksSystemClocks)
+{
+    // Loose bounds, this also runs on VMs where clock_gettime() itself can take microseconds.
+    const int64_t MAX_ERROR_NS = 100000;
+    TscClock& clock = TscClock::instance();
+
+    EXPECT_LT(abs_diff(clock.monotonic_ns(), clock_ns(CLOCK_MONOTONIC_RAW)), MAX_ERROR_NS);
+    EXPECT_LT(abs_diff(clock.realtime_ns(), clock_ns(CLOCK_REALTIME)), MAX_ERROR_NS);
+}
+
+TEST(TscClockTest, MonotonicAcrossRecalibration)
+{
+    TscClock& clock = TscClock::instance();
+    uint64_t prev = clock.monotonic_ns();
+    for (int i = 0; i < 100000; i++)
+    {
+        if (i % 10000 == 0)
+        {
+            clock.recalibrate();
+        }
+        uint64_t now = clock.monotonic_ns();
+        ASSERT_GE(now, prev);
+        prev = now;
+    }
+}
+
+// Recalibration is lazy, so after an idle stretch the baseline is longer than the 2^32 ns that fit the fixed point
+// arithmetic once shifted. The clock must still run at the right rate afterwards.
+TEST(TscClockTest, RateAfterLongIdle)
+{
+    const int64_t MAX_ERROR_NS = 100000;
+    TscClock& clock = TscClock::instance();
+    clock.monotonic_ns();
+    usleep(4500000);
+    clock.monotonic_ns();
+    usleep(200000);
+    EXPECT_LT(abs_diff(clock.monotonic_ns(), clock_ns(CLOCK_MONOTONIC_RAW)), MAX_ERROR_NS);
+    EXPECT_LT(abs_diff(clock.realtime_ns(), clock_ns(CLOCK_REALTIME)), MAX_ERROR_NS);
+}
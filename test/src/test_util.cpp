@@ -2,8 +2,10 @@
 #include <string>
 #include <system_error>
 
+#include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <linux/net_tstamp.h>
 #include <bsd/string.h>
 
 #include "gtest/gtest.h"
@@ -127,3 +129,69 @@ TEST_F(UtilTest, RecvPacketRealUdp)
     string received_buf(data.get());
     EXPECT_EQ(received_buf, string(buf));
 }
+
+TEST_F(UtilTest, RxqOverflowCounted)
+{
+    int domain = AF_INET;
+    int listen_port = 5001;
+    string addr("127.0.0.1");
+    sockaddr_storage listen_addr;
+    SocketBuffers buffers;
+    buffers.rcvbuf = 4096;
+
+    // Smallest receive buffer the kernel allows, then overflow it before reading anything.
+    int sock = setup_socket(domain, SOCK_DGRAM, 0, buffers);
+    create_sockaddr_storage(domain, addr, listen_port, &listen_addr);
+    do_bind(sock, &listen_addr);
+
+    int sock2 = socket(domain, SOCK_DGRAM, 0);
+    ASSERT_NE(sock2, -1);
+    char buf[1024] = "overflow";
+    for (int i = 0; i < 100; i++)
+    {
+        sendto(sock2, buf, sizeof(buf), 0, reinterpret_cast<sockaddr *>(&listen_addr), sizeof(listen_addr));
+    }
+    // The count travels with datagrams queued after the drops, so drain the queue and send one more.
+    while (recv(sock, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+    {
+    }
+    sendto(sock2, buf, sizeof(buf), 0, reinterpret_cast<sockaddr *>(&listen_addr), sizeof(listen_addr));
+
+    std::shared_ptr<char> data;
+    int datalen;
+    sockaddr_storage ss;
+    timespec hwts;
+    uint32_t dropped = 0;
+    tie(data, datalen, ss, hwts) = recvpacket(sock, 0, &dropped);
+    EXPECT_EQ(datalen, static_cast<int>(sizeof(buf)));
+    EXPECT_GT(dropped, 0u);
+
+    RxqDrops drops;
+    EXPECT_EQ(drops.update(dropped), dropped);
+    EXPECT_EQ(drops.update(dropped), 0u);
+
+    close(sock);
+    close(sock2);
+}
+
+// A datagram sent untimestamped leaves nothing in the error queue of a socket that timestamps its sends.
+TEST_F(UtilTest, SendUntimestamped)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    const int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+        SOF_TIMESTAMPING_OPT_TSONLY;
+    ASSERT_EQ(0, setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)));
+    sockaddr_storage dest;
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5023, &dest);
+    char buf[32] = {};
+    uint32_t key;
+    int64_t hw_ns;
+
+    ASSERT_TRUE(try_send_untimestamped(&dest, sock, buf, sizeof(buf)));
+    usleep(10000);
+    EXPECT_FALSE(try_read_tx_timestamp(sock, &key, &hw_ns));
+    ASSERT_TRUE(try_sendpacket(&dest, sock, buf, sizeof(buf)));
+    usleep(10000);
+    EXPECT_TRUE(try_read_tx_timestamp(sock, &key, &hw_ns));
+    close(sock);
+}
@@ -0,0 +1,96 @@
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "gtest/gtest.h"
+
+#include "engine.h"
+#include "packet.h"
+#include "rx_path.h"
+#include "util.h"
+#include "zerocopy.h"
+
+using std::string;
+using std::vector;
+
+using namespace Netrounds;
+
+// Buffers stay out of the pool until the kernel reports their sends complete on the error queue.
+TEST(ZerocopyTest, PoolReturnsBuffersOnCompletion)
+{
+    const size_t NR_BUFFERS = 4;
+    sockaddr_storage addr;
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5061, &addr);
+    do_bind(rx, &addr);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    enable_zerocopy(tx);
+
+    ZerocopyPool pool(NR_BUFFERS, 2000);
+    for (size_t i = 0; i < NR_BUFFERS; i++)
+    {
+        char *buf = pool.acquire();
+        ASSERT_TRUE(buf);
+        EXPECT_TRUE(pool.owns(buf));
+        prepare_packet(buf, 2000, i);
+        ASSERT_TRUE(pool.send(tx, &addr, buf, 2000));
+    }
+    EXPECT_FALSE(pool.acquire());
+
+    int64_t sw_ns;
+    int64_t hw_ns;
+    uint32_t key;
+    for (int i = 0; i < 1000 && pool.in_flight(); i++)
+    {
+        if (read_errqueue(tx, &pool, &sw_ns, &hw_ns, &key) == ERRQUEUE_EMPTY)
+        {
+            usleep(1000);
+        }
+    }
+    EXPECT_EQ(0u, pool.in_flight());
+    EXPECT_EQ(NR_BUFFERS, pool.zerocopy_sends());
+    EXPECT_TRUE(pool.acquire());
+
+    char buf[2000];
+    EXPECT_EQ(2000, recv(rx, buf, sizeof(buf), 0));
+    close(rx);
+    close(tx);
+}
+
+// Jumbo probes reflected through ReflectorEngine come back full length, each reply sent from its own pool buffer.
+TEST(ZerocopyTest, EngineRepliesFromPool)
+{
+    const int NR_PROBES = 10;
+    const size_t PROBE_LEN = 8000;
+    sockaddr_storage addr;
+    int refl = setup_socket(AF_INET, SOCK_DGRAM, 0);
+    create_sockaddr_storage(AF_INET, string("127.0.0.1"), 5062, &addr);
+    do_bind(refl, &addr);
+    std::unique_ptr<Transport> inner = make_rx_path_transport(refl, TS_NONE, AF_INET);
+    ZerocopyTransport transport(refl, *inner, 4, ReflectorEngine::BUF_LEN);
+    ReflectorEngine engine(transport);
+
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    vector<char> probe(PROBE_LEN);
+    vector<char> reply(PROBE_LEN + 1);
+    for (int i = 0; i < NR_PROBES; i++)
+    {
+        prepare_packet(probe.data(), PROBE_LEN, i);
+        sendto(tx, probe.data(), PROBE_LEN, 0, reinterpret_cast<sockaddr *>(&addr), sizeof(sockaddr_in));
+        for (int tries = 0; tries < 1000 && !engine.poll(); tries++)
+        {
+            usleep(100);
+        }
+        ASSERT_EQ(static_cast<ssize_t>(PROBE_LEN), recv(tx, reply.data(), reply.size(), 0));
+        PacketType type;
+        ASSERT_TRUE(peek_packet_type(reply.data(), PROBE_LEN, &type));
+        EXPECT_EQ(FROM_REFLECTOR, type);
+    }
+    EXPECT_EQ(static_cast<uint64_t>(NR_PROBES), engine.reflected());
+    EXPECT_EQ(static_cast<uint64_t>(NR_PROBES), transport.pool().zerocopy_sends());
+    EXPECT_EQ(0u, transport.pool_exhausted());
+    close(refl);
+    close(tx);
+}